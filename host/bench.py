@@ -0,0 +1,77 @@
+#!/usr/bin/env python3
+"""Runs the host build's benchmarks against the local stand-in server.
+
+Generates a certificate for localhost, starts ganymede_stand_in with it and
+any extra arguments given after --, registers the device and runs `bench`,
+then stops the server and prints its report. Exits with the runner's status.
+"""
+
+import argparse
+import os
+import shutil
+import subprocess
+import sys
+
+
+def make_certificate(work_dir):
+    cert = os.path.join(work_dir, 'stand-in.crt')
+    key = os.path.join(work_dir, 'stand-in.key')
+
+    if not os.path.exists(cert):
+        subprocess.run(['openssl', 'req', '-x509', '-newkey', 'rsa:2048', '-nodes', '-days', '30',
+                        '-subj', '/CN=localhost', '-addext', 'subjectAltName=DNS:localhost',
+                        '-keyout', key, '-out', cert],
+                       check=True, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+
+    return cert, key
+
+
+def start_stand_in(path, cert, key, port, args):
+    server = subprocess.Popen([path, '--cert', cert, '--key', key, '--port', str(port), '--report', '0'] + args,
+                              stdout=subprocess.PIPE, text=True)
+
+    # The first line says it is listening, or the server is gone
+    line = server.stdout.readline()
+
+    if 'listening' not in line:
+        server.wait()
+        sys.exit('stand-in failed to start')
+
+    return server
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('--stand-in', required=True)
+    parser.add_argument('--runner', required=True)
+    parser.add_argument('--work-dir', required=True)
+    parser.add_argument('--port', type=int, default=8443)
+    parser.add_argument('stand_in_args', nargs='*')
+    args = parser.parse_args()
+
+    os.makedirs(args.work_dir, exist_ok=True)
+    cert, key = make_certificate(args.work_dir)
+
+    # A fresh device every run
+    flash_dir = os.path.join(args.work_dir, 'flash')
+    shutil.rmtree(flash_dir, ignore_errors=True)
+    os.makedirs(flash_dir)
+
+    env = dict(os.environ)
+    env['SSL_CERT_FILE'] = cert
+    env['GANYMEDE_NVS_PATH'] = os.path.join(flash_dir, 'nvs')
+    env['GANYMEDE_FLASH_DIR'] = flash_dir
+
+    server = start_stand_in(args.stand_in, cert, key, args.port, args.stand_in_args)
+
+    try:
+        rc = subprocess.run([args.runner, 'register', 'bench'], env=env).returncode
+    finally:
+        server.terminate()
+        sys.stdout.write(server.communicate()[0])
+
+    sys.exit(rc)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,308 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sdkconfig.h>
+
+#include <api/ganymede/v2/encode.h>
+#include <ganymede/v2/measurements.pb-c.h>
+
+// Checks the encoders of api/ganymede/v2/encode.c against protobuf-c, byte for
+// byte, so floats are compared bitwise. Exits non-zero if any output differs.
+
+enum {
+    CHECK_DEVICE_ID_LEN = 37,
+};
+
+// Sample `index` of a case, in the AM2320's units
+typedef void (*check_sample_t)(size_t index, time_t* timestamp, int16_t* humidity, int16_t* temperature);
+
+struct check_case {
+    const char* name;
+    size_t count;
+    check_sample_t sample;
+    const char* device_id;
+    const char* batch_id;
+};
+
+static size_t check_failures_ = 0;
+
+// Samples as the app stores them, and as protobuf-c messages
+struct check_batch {
+    time_t* timestamps;
+    int16_t* humidities;
+    int16_t* temperatures;
+
+    Ganymede__V2__Measurement* measurements;
+    Ganymede__V2__Measurement** measurement_ptrs;
+    Google__Protobuf__Timestamp* stamps;
+    Ganymede__V2__AtmosphericMeasurements* atmospheres;
+
+    int64_t* timestamp_deltas;
+    int32_t* relative_humidities;
+    int32_t* temperature_columns;
+};
+
+static void check_bucket_sample_(size_t index, time_t* timestamp, int16_t* humidity, int16_t* temperature)
+{
+    *timestamp = (time_t) (1700000000 + index * CONFIG_MEASUREMENTS_ACQUISITION_INTERVAL);
+    *humidity = (int16_t) (400 + (index % 200));
+    *temperature = (int16_t) (200 + (index % 10));
+}
+
+// Every field at its default value, so left out
+static void check_zero_sample_(size_t index, time_t* timestamp, int16_t* humidity, int16_t* temperature)
+{
+    (void) index;
+
+    *timestamp = 0;
+    *humidity = 0;
+    *temperature = 0;
+}
+
+// Negative values throughout, with timestamps going back in time
+static void check_negative_sample_(size_t index, time_t* timestamp, int16_t* humidity, int16_t* temperature)
+{
+    static const int16_t values[] = { -1, -10, -400, -1000, INT16_MIN };
+
+    *timestamp = (time_t) (-1 - (int64_t) index * 3600);
+    *humidity = values[index % 5];
+    *temperature = values[(index + 2) % 5];
+}
+
+// Extremes of each type, and deltas jumping both ways
+static void check_extreme_sample_(size_t index, time_t* timestamp, int16_t* humidity, int16_t* temperature)
+{
+    *timestamp = (index % 2 == 0) ? (time_t) INT32_MAX : (time_t) INT32_MIN;
+    *humidity = (index % 2 == 0) ? INT16_MAX : INT16_MIN;
+    *temperature = (index % 3 == 0) ? INT16_MIN : INT16_MAX;
+}
+
+// A deterministic spread of plausible readings, with a few gaps
+static void check_random_sample_(size_t index, time_t* timestamp, int16_t* humidity, int16_t* temperature)
+{
+    uint32_t state = (uint32_t) index * 2654435761U + 1;
+
+    state ^= state >> 15;
+    state *= 2246822519U;
+    state ^= state >> 13;
+
+    *timestamp = (time_t) (1700000000 + index * CONFIG_MEASUREMENTS_ACQUISITION_INTERVAL + (state % 7 == 0 ? 86400 : 0));
+    *humidity = (int16_t) (state % 1001);
+    *temperature = (int16_t) ((int32_t) ((state >> 10) % 1200) - 400);
+}
+
+static const struct check_case check_cases_[] = {
+    { "bucket", CONFIG_MEASUREMENTS_BUCKET_SIZE, check_bucket_sample_, "00000000-0000-4000-8000-000000000000", "0123456789abcdef0123456789abcdef" },
+    { "zero", 4, check_zero_sample_, "00000000-0000-4000-8000-000000000000", NULL },
+    { "negative", 25, check_negative_sample_, "00000000-0000-4000-8000-000000000000", "b" },
+    { "extreme", 6, check_extreme_sample_, "", NULL },
+    { "empty", 0, check_bucket_sample_, "00000000-0000-4000-8000-000000000000", NULL },
+    { "empty without device", 0, check_bucket_sample_, "", "" },
+    { "one", 1, check_random_sample_, "00000000-0000-4000-8000-000000000000", "0123456789abcdef0123456789abcdef" },
+    { "push max", CONFIG_MEASUREMENTS_PUSH_MAX_LEN, check_random_sample_, "00000000-0000-4000-8000-000000000000", "0123456789abcdef0123456789abcdef" },
+};
+
+static void check_compare_(const struct check_case* check, const char* what, const ProtobufCMessage* expected, size_t (*encode)(const void* arg, uint8_t* buffer), const void* arg)
+{
+    size_t expected_len = protobuf_c_message_get_packed_size(expected);
+    size_t sized_len = encode(arg, NULL);
+
+    // One more byte, so an encoder writing past its length shows
+    uint8_t* expected_buffer = calloc(1, expected_len + 1);
+    uint8_t* actual_buffer = calloc(1, (sized_len > expected_len ? sized_len : expected_len) + 1);
+
+    if (expected_buffer == NULL || actual_buffer == NULL) {
+        printf("FAIL %s %s: out of memory\n", check->name, what);
+        check_failures_++;
+        goto exit;
+    }
+
+    protobuf_c_message_pack(expected, expected_buffer);
+    size_t actual_len = encode(arg, actual_buffer);
+
+    if (sized_len != expected_len || actual_len != expected_len) {
+        printf("FAIL %s %s: %zu bytes, sized as %zu, protobuf-c packs %zu\n", check->name, what, actual_len, sized_len, expected_len);
+        check_failures_++;
+        goto exit;
+    }
+
+    for (size_t i = 0; i <= expected_len; i++) {
+        if (actual_buffer[i] != expected_buffer[i]) {
+            printf("FAIL %s %s: byte %zu is %02x, protobuf-c packs %02x\n", check->name, what, i, actual_buffer[i], expected_buffer[i]);
+            check_failures_++;
+            goto exit;
+        }
+    }
+
+exit:
+    free(expected_buffer);
+    free(actual_buffer);
+}
+
+struct check_measurement {
+    const struct ganymede_api_v2_atmosphere_samples* samples;
+    size_t index;
+};
+
+static size_t check_encode_measurement_(const void* arg, uint8_t* buffer)
+{
+    const struct check_measurement* measurement = (const struct check_measurement*) arg;
+    return ganymede_api_v2_encode_atmosphere_measurement(measurement->samples, measurement->index, buffer);
+}
+
+struct check_request {
+    const struct ganymede_api_v2_atmosphere_samples* samples;
+    const char* batch_id;
+};
+
+static size_t check_encode_push_request_(const void* arg, uint8_t* buffer)
+{
+    const struct check_request* request = (const struct check_request*) arg;
+    return ganymede_api_v2_encode_push_atmosphere_request(request->samples, request->batch_id, buffer);
+}
+
+static size_t check_encode_atmosphere_batch_(const void* arg, uint8_t* buffer)
+{
+    const struct check_request* request = (const struct check_request*) arg;
+    return ganymede_api_v2_encode_atmosphere_batch(request->samples, request->batch_id, buffer);
+}
+
+static void check_free_batch_(struct check_batch* batch)
+{
+    free(batch->timestamps);
+    free(batch->humidities);
+    free(batch->temperatures);
+    free(batch->measurements);
+    free(batch->measurement_ptrs);
+    free(batch->stamps);
+    free(batch->atmospheres);
+    free(batch->timestamp_deltas);
+    free(batch->relative_humidities);
+    free(batch->temperature_columns);
+}
+
+static bool check_alloc_batch_(struct check_batch* batch, size_t count)
+{
+    // calloc(0) may return NULL
+    size_t n = count > 0 ? count : 1;
+
+    batch->timestamps = calloc(n, sizeof(*batch->timestamps));
+    batch->humidities = calloc(n, sizeof(*batch->humidities));
+    batch->temperatures = calloc(n, sizeof(*batch->temperatures));
+    batch->measurements = calloc(n, sizeof(*batch->measurements));
+    batch->measurement_ptrs = calloc(n, sizeof(*batch->measurement_ptrs));
+    batch->stamps = calloc(n, sizeof(*batch->stamps));
+    batch->atmospheres = calloc(n, sizeof(*batch->atmospheres));
+    batch->timestamp_deltas = calloc(n, sizeof(*batch->timestamp_deltas));
+    batch->relative_humidities = calloc(n, sizeof(*batch->relative_humidities));
+    batch->temperature_columns = calloc(n, sizeof(*batch->temperature_columns));
+
+    return batch->timestamps != NULL && batch->humidities != NULL && batch->temperatures != NULL && batch->measurements != NULL && batch->measurement_ptrs != NULL && batch->stamps != NULL && batch->atmospheres != NULL && batch->timestamp_deltas != NULL && batch->relative_humidities != NULL && batch->temperature_columns != NULL;
+}
+
+static void check_run_(const struct check_case* check)
+{
+    struct check_batch batch = { 0 };
+    char device_id[CHECK_DEVICE_ID_LEN] = { 0 };
+    char batch_id[CHECK_DEVICE_ID_LEN] = { 0 };
+
+    strncpy(device_id, check->device_id, sizeof(device_id) - 1);
+
+    if (check->batch_id != NULL) {
+        strncpy(batch_id, check->batch_id, sizeof(batch_id) - 1);
+    }
+
+    if (!check_alloc_batch_(&batch, check->count)) {
+        printf("FAIL %s: out of memory\n", check->name);
+        check_failures_++;
+        goto exit;
+    }
+
+    for (size_t i = 0; i < check->count; i++) {
+        check->sample(i, &batch.timestamps[i], &batch.humidities[i], &batch.temperatures[i]);
+
+        ganymede__v2__measurement__init(&batch.measurements[i]);
+        google__protobuf__timestamp__init(&batch.stamps[i]);
+        ganymede__v2__atmospheric_measurements__init(&batch.atmospheres[i]);
+
+        // Converted as am2320_readf does
+        batch.stamps[i].seconds = (int64_t) batch.timestamps[i];
+        batch.atmospheres[i].relative_humidity = ((float) batch.humidities[i]) / 1000.0F;
+        batch.atmospheres[i].temperature = ((float) batch.temperatures[i]) / 10.0F;
+
+        batch.measurements[i].device_id = device_id;
+        batch.measurements[i].timestamp = &batch.stamps[i];
+        batch.measurements[i].atmosphere = &batch.atmospheres[i];
+        batch.measurement_ptrs[i] = &batch.measurements[i];
+
+        batch.timestamp_deltas[i] = (int64_t) batch.timestamps[i] - (int64_t) batch.timestamps[i > 0 ? i - 1 : 0];
+        batch.relative_humidities[i] = batch.humidities[i];
+        batch.temperature_columns[i] = batch.temperatures[i];
+    }
+
+    struct ganymede_api_v2_atmosphere_samples samples = {
+        .device_id = device_id,
+        .timestamps = batch.timestamps,
+        .humidities = batch.humidities,
+        .temperatures = batch.temperatures,
+        .count = check->count,
+    };
+
+    for (size_t i = 0; i < check->count; i++) {
+        struct check_measurement measurement = { .samples = &samples, .index = i };
+        char what[40];
+
+        snprintf(what, sizeof(what), "measurement %zu", i);
+        check_compare_(check, what, (const ProtobufCMessage*) &batch.measurements[i], check_encode_measurement_, &measurement);
+    }
+
+    struct check_request request = {
+        .samples = &samples,
+        .batch_id = check->batch_id != NULL ? batch_id : NULL,
+    };
+
+    Ganymede__V2__PushMeasurementsRequest push;
+    ganymede__v2__push_measurements_request__init(&push);
+    push.measurements = batch.measurement_ptrs;
+    push.n_measurements = check->count;
+    push.batch_id = batch_id;
+
+    check_compare_(check, "PushMeasurementsRequest", (const ProtobufCMessage*) &push, check_encode_push_request_, &request);
+
+    Ganymede__V2__PushAtmosphereBatchRequest columns;
+    ganymede__v2__push_atmosphere_batch_request__init(&columns);
+    columns.device_id = device_id;
+    columns.batch_id = batch_id;
+    columns.base_timestamp = check->count > 0 ? (int64_t) batch.timestamps[0] : 0;
+    columns.n_timestamp_deltas = check->count;
+    columns.timestamp_deltas = batch.timestamp_deltas;
+    columns.n_relative_humidities = check->count;
+    columns.relative_humidities = batch.relative_humidities;
+    columns.n_temperatures = check->count;
+    columns.temperatures = batch.temperature_columns;
+
+    check_compare_(check, "PushAtmosphereBatchRequest", (const ProtobufCMessage*) &columns, check_encode_atmosphere_batch_, &request);
+
+exit:
+    check_free_batch_(&batch);
+}
+
+int main(void)
+{
+    for (size_t i = 0; i < sizeof(check_cases_) / sizeof(check_cases_[0]); i++) {
+        check_run_(&check_cases_[i]);
+    }
+
+    if (check_failures_ > 0) {
+        printf("%zu encodings differ from protobuf-c\n", check_failures_);
+        return EXIT_FAILURE;
+    }
+
+    printf("All encodings match protobuf-c\n");
+    return EXIT_SUCCESS;
+}
\ No newline at end of file
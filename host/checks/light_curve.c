@@ -0,0 +1,151 @@
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <app/light_curve.h>
+
+// Checks the duty curves of app/light_curve.c. Exits non-zero if any value
+// differs from the expected one.
+
+static size_t check_failures_ = 0;
+
+static void check_equal_(const char* what, uint32_t actual, uint32_t expected)
+{
+    if (actual != expected) {
+        printf("FAIL %s: %" PRIu32 ", expected %" PRIu32 "\n", what, actual, expected);
+        check_failures_++;
+    }
+}
+
+// 22:00 to 02:00, ramping over half an hour on each side of midnight
+static void check_wrap_past_midnight_(void)
+{
+    struct light_curve_period period = { .start = 22 * 3600, .stop = 2 * 3600, .ramp = 1800, .intensity = 200 };
+    uint32_t breakpoints[LIGHT_CURVE_BREAKPOINTS_LEN];
+
+    check_equal_("wrap: before start", light_curve_intensity(&period, 22 * 3600 - 1), 0);
+    check_equal_("wrap: at start", light_curve_intensity(&period, 22 * 3600), 0);
+    check_equal_("wrap: halfway up", light_curve_intensity(&period, 22 * 3600 + 900), 100);
+    check_equal_("wrap: up", light_curve_intensity(&period, 22 * 3600 + 1800), 200);
+    check_equal_("wrap: last second of day", light_curve_intensity(&period, LIGHT_CURVE_SECONDS_PER_DAY - 1), 200);
+    check_equal_("wrap: midnight", light_curve_intensity(&period, 0), 200);
+    check_equal_("wrap: at stop", light_curve_intensity(&period, 2 * 3600), 200);
+    check_equal_("wrap: halfway down", light_curve_intensity(&period, 2 * 3600 + 900), 100);
+    check_equal_("wrap: down", light_curve_intensity(&period, 2 * 3600 + 1800), 0);
+    check_equal_("wrap: noon", light_curve_intensity(&period, 12 * 3600), 0);
+
+    check_equal_("wrap: breakpoint count", light_curve_breakpoints(&period, breakpoints), 4);
+    check_equal_("wrap: breakpoint start", breakpoints[0], 22 * 3600);
+    check_equal_("wrap: breakpoint stop", breakpoints[1], 2 * 3600);
+    check_equal_("wrap: breakpoint up", breakpoints[2], 22 * 3600 + 1800);
+    check_equal_("wrap: breakpoint down", breakpoints[3], 2 * 3600 + 1800);
+
+    // The ramp in crosses midnight too
+    period.start = LIGHT_CURVE_SECONDS_PER_DAY - 600;
+    check_equal_("wrap: ramp across midnight", light_curve_intensity(&period, 300), 100);
+    check_equal_("wrap: ramp across midnight breakpoints", light_curve_breakpoints(&period, breakpoints), 4);
+    check_equal_("wrap: ramp across midnight breakpoint up", breakpoints[2], 1200);
+}
+
+// Ramps are cut to the period, and to the gap before it comes around again
+static void check_long_ramp_(void)
+{
+    struct light_curve_period period = { .start = 3600, .stop = 5400, .ramp = 7200, .intensity = 255 };
+    uint32_t breakpoints[LIGHT_CURVE_BREAKPOINTS_LEN];
+
+    check_equal_("long ramp: at start", light_curve_intensity(&period, 3600), 0);
+    check_equal_("long ramp: halfway up", light_curve_intensity(&period, 3600 + 900), 127);
+    check_equal_("long ramp: at stop", light_curve_intensity(&period, 5400), 255);
+    check_equal_("long ramp: halfway down", light_curve_intensity(&period, 5400 + 900), 127);
+    check_equal_("long ramp: down", light_curve_intensity(&period, 7200), 0);
+    check_equal_("long ramp: past the ramp", light_curve_intensity(&period, 7200 + 3600), 0);
+
+    check_equal_("long ramp: breakpoint count", light_curve_breakpoints(&period, breakpoints), 4);
+    check_equal_("long ramp: breakpoint up", breakpoints[2], 5400);
+    check_equal_("long ramp: breakpoint down", breakpoints[3], 7200);
+
+    // Off for only 400 seconds a day
+    period = (struct light_curve_period) { .start = 0, .stop = LIGHT_CURVE_SECONDS_PER_DAY - 400, .ramp = 1000, .intensity = 200 };
+
+    check_equal_("short gap: halfway up", light_curve_intensity(&period, 200), 100);
+    check_equal_("short gap: up", light_curve_intensity(&period, 400), 200);
+    check_equal_("short gap: halfway down", light_curve_intensity(&period, LIGHT_CURVE_SECONDS_PER_DAY - 200), 100);
+
+    // Starting and stopping together, the period is empty
+    period = (struct light_curve_period) { .start = 3600, .stop = 3600, .ramp = 600, .intensity = 200 };
+
+    check_equal_("empty: at start", light_curve_intensity(&period, 3600), 0);
+    check_equal_("empty: after start", light_curve_intensity(&period, 3900), 0);
+    check_equal_("empty: breakpoint count", light_curve_breakpoints(&period, breakpoints), 0);
+}
+
+static void check_duty_(void)
+{
+    check_equal_("duty: off", light_curve_duty(0), 0);
+    check_equal_("duty: half", light_curve_duty(128), 4112);
+    check_equal_("duty: full", light_curve_duty(255), LIGHT_CURVE_DUTY_MAX);
+
+    check_equal_("duty up: start", light_curve_duty_at(0, LIGHT_CURVE_DUTY_MAX, 0, 1000), 0);
+    check_equal_("duty up: halfway", light_curve_duty_at(0, LIGHT_CURVE_DUTY_MAX, 500, 1000), 4095);
+    check_equal_("duty up: end", light_curve_duty_at(0, LIGHT_CURVE_DUTY_MAX, 1000, 1000), LIGHT_CURVE_DUTY_MAX);
+    check_equal_("duty up: past the end", light_curve_duty_at(0, LIGHT_CURVE_DUTY_MAX, 2000, 1000), LIGHT_CURVE_DUTY_MAX);
+
+    check_equal_("duty down: start", light_curve_duty_at(LIGHT_CURVE_DUTY_MAX, 0, 0, 1000), LIGHT_CURVE_DUTY_MAX);
+    check_equal_("duty down: halfway", light_curve_duty_at(LIGHT_CURVE_DUTY_MAX, 0, 500, 1000), 4096);
+    check_equal_("duty down: end", light_curve_duty_at(LIGHT_CURVE_DUTY_MAX, 0, 1000, 1000), 0);
+    check_equal_("duty down: past the end", light_curve_duty_at(LIGHT_CURVE_DUTY_MAX, 0, 2000, 1000), 0);
+
+    check_equal_("duty: no duration", light_curve_duty_at(100, 200, 0, 0), 200);
+    check_equal_("duty: flat", light_curve_duty_at(300, 300, 500, 1000), 300);
+
+    // Fades a day long don't overflow, and stay between their ends
+    uint32_t day = LIGHT_CURVE_SECONDS_PER_DAY * 1000U;
+    uint32_t up = 0;
+    uint32_t down = LIGHT_CURVE_DUTY_MAX;
+
+    for (uint32_t elapsed = 0; elapsed <= day; elapsed += day / 1000) {
+        uint32_t next_up = light_curve_duty_at(0, LIGHT_CURVE_DUTY_MAX, elapsed, day);
+        uint32_t next_down = light_curve_duty_at(LIGHT_CURVE_DUTY_MAX, 0, elapsed, day);
+
+        if (next_up < up || next_up > LIGHT_CURVE_DUTY_MAX || next_down > down) {
+            printf("FAIL duty: not monotonic at %" PRIu32 "ms\n", elapsed);
+            check_failures_++;
+            break;
+        }
+
+        up = next_up;
+        down = next_down;
+    }
+
+    check_equal_("duty: day long fade up", up, LIGHT_CURVE_DUTY_MAX);
+    check_equal_("duty: day long fade down", down, 0);
+}
+
+static void check_max_fade_time_(void)
+{
+    check_equal_("fade time: full range", light_curve_max_fade_time(0, LIGHT_CURVE_DUTY_MAX, 1000), 8379393);
+    check_equal_("fade time: either direction", light_curve_max_fade_time(LIGHT_CURVE_DUTY_MAX, 0, 1000), 8379393);
+    check_equal_("fade time: highest frequency", light_curve_max_fade_time(0, LIGHT_CURVE_DUTY_MAX, 9765), 858104);
+    check_equal_("fade time: few steps", light_curve_max_fade_time(100, 200, 1000), 102300);
+    check_equal_("fade time: no steps", light_curve_max_fade_time(200, 200, 1000), 0);
+
+    // Longer than a uint32_t of milliseconds
+    check_equal_("fade time: clamped", light_curve_max_fade_time(0, LIGHT_CURVE_DUTY_MAX, 1), UINT32_MAX);
+}
+
+int main(void)
+{
+    check_wrap_past_midnight_();
+    check_long_ramp_();
+    check_duty_();
+    check_max_fade_time_();
+
+    if (check_failures_ > 0) {
+        printf("%zu light curve checks failed\n", check_failures_);
+        return EXIT_FAILURE;
+    }
+
+    printf("All light curve checks passed\n");
+    return EXIT_SUCCESS;
+}
\ No newline at end of file
@@ -0,0 +1,155 @@
+#!/usr/bin/env python3
+"""Simulates a fleet of devices booting together against the stand-in server.
+
+Each device is a ganymede_host process running the firmware's auth, poll and
+measurement tasks under its own MAC, NVS, flash and clock drift. Devices are
+registered first. Then the server's stats are cleared and every device boots
+within --boot-spread seconds, as after a site-wide power cut, and runs for
+--duration seconds. Prints the fleet's request rate over time, its burst peaks
+and how long requests queued at the server.
+
+Runs are in real time. Build with GANYMEDE_HOST_SDKCONFIG=host/sdkconfig.fleet
+for auth refreshes and pushes to happen within minutes rather than hours.
+"""
+
+import argparse
+import json
+import os
+import random
+import shutil
+import signal
+import subprocess
+import sys
+import time
+
+from bench import make_certificate, start_stand_in
+
+# Registrations run at once, before the measured boot
+REGISTER_BATCH = 32
+
+
+def device_env(work_dir, cert, device, drift):
+    device_dir = os.path.join(work_dir, 'devices', str(device))
+    os.makedirs(device_dir, exist_ok=True)
+
+    env = dict(os.environ)
+    env['SSL_CERT_FILE'] = cert
+    env['GANYMEDE_NVS_PATH'] = os.path.join(device_dir, 'nvs')
+    env['GANYMEDE_FLASH_DIR'] = device_dir
+    env['GANYMEDE_CLOCK_DRIFT'] = str(drift)
+
+    # Locally administered, unicast, as app/fleet.c numbers virtual devices
+    env['GANYMEDE_MAC'] = '02:00:00:{:02x}:{:02x}:{:02x}'.format((device >> 16) & 0xFF, (device >> 8) & 0xFF, device & 0xFF)
+
+    return env, os.path.join(device_dir, 'log.txt')
+
+
+def spawn(runner, args, env, log_path):
+    with open(log_path, 'a') as log:
+        return subprocess.Popen([runner] + args, env=env, stdout=log, stderr=subprocess.STDOUT)
+
+
+def register(runner, envs):
+    failed = 0
+
+    for start in range(0, len(envs), REGISTER_BATCH):
+        batch = [spawn(runner, ['register'], env, log) for env, log in envs[start:start + REGISTER_BATCH]]
+        failed += sum(1 for process in batch if process.wait() != 0)
+
+    return failed
+
+
+def boot(runner, envs, offsets, duration):
+    processes = []
+    started = time.monotonic()
+
+    for (env, log), offset in sorted(zip(envs, offsets), key=lambda pair: pair[1]):
+        delay = started + offset - time.monotonic()
+
+        if delay > 0:
+            time.sleep(delay)
+
+        processes.append(spawn(runner, ['run', str(duration)], env, log))
+
+    return sum(1 for process in processes if process.wait() != 0)
+
+
+def percent(part, total):
+    return 100.0 * part / total if total > 0 else 0.0
+
+
+def report(stats, devices, bucket):
+    arrivals = stats['arrivals']
+    seconds = len(arrivals)
+    total = sum(arrivals)
+    peak = max(range(seconds), key=lambda i: arrivals[i]) if seconds > 0 else 0
+
+    print('Fleet: {} devices, {} requests in {}s (Mean {:.2f}/s)'.format(devices, total, seconds, total / seconds if seconds > 0 else 0.0))
+    print('Fleet requests: Poll {} Push {} Token {} Errors {} ({:.1f}%) Measurements {}'.format(
+        stats['poll'], stats['push'], stats['token'], stats['errors'], percent(stats['errors'], stats['requests']), stats['measurements']))
+    print('Fleet connections: {} ({} handshakes, {} resumed)'.format(stats['connections'], stats['handshakes'], stats['resumed_handshakes']))
+
+    if seconds > 0:
+        print('Fleet peak: {} requests in 1s at t+{}s'.format(arrivals[peak], peak))
+
+    print('Fleet backend: Max queue {} Wait p50 {}us p99 {}us Max {}us'.format(
+        stats['max_queue'], stats['queue_wait_p50'], stats['queue_wait_p99'], stats['queue_wait_max']))
+
+    for start in range(0, seconds, bucket):
+        span = arrivals[start:start + bucket]
+        print('  t+{:5d}s: {:5d} requests (Peak {}/s)'.format(start, sum(span), max(span)))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--stand-in', required=True)
+    parser.add_argument('--runner', required=True)
+    parser.add_argument('--work-dir', required=True)
+    parser.add_argument('--port', type=int, default=8443)
+    parser.add_argument('--devices', type=int, default=20)
+    parser.add_argument('--duration', type=int, default=300, help='seconds each device runs after booting')
+    parser.add_argument('--boot-spread', type=float, default=5.0, help='seconds over which devices boot')
+    parser.add_argument('--drift', type=int, default=20, help='largest clock drift (parts per million)')
+    parser.add_argument('--bucket', type=int, default=30, help='seconds per timeline line')
+    parser.add_argument('--seed', type=int, default=1)
+    parser.add_argument('stand_in_args', nargs='*')
+    args = parser.parse_args()
+
+    # A fresh fleet every run
+    shutil.rmtree(os.path.join(args.work_dir, 'devices'), ignore_errors=True)
+    os.makedirs(args.work_dir, exist_ok=True)
+
+    cert, key = make_certificate(args.work_dir)
+    stats_path = os.path.join(args.work_dir, 'stats.json')
+
+    # Deterministic, so runs can be compared
+    rng = random.Random(args.seed)
+    drifts = [rng.randint(-args.drift, args.drift) for _ in range(args.devices)]
+    offsets = [rng.uniform(0, args.boot_spread) for _ in range(args.devices)]
+    envs = [device_env(args.work_dir, cert, device, drifts[device]) for device in range(args.devices)]
+
+    server = start_stand_in(args.stand_in, cert, key, args.port, ['--stats', stats_path] + args.stand_in_args)
+
+    try:
+        print('Fleet: registering {} devices'.format(args.devices), flush=True)
+
+        if register(args.runner, envs) > 0:
+            sys.exit('registration failed, see {}/devices/*/log.txt'.format(args.work_dir))
+
+        server.send_signal(signal.SIGHUP)
+        print('Fleet: booting {} devices over {}s, running {}s'.format(args.devices, args.boot_spread, args.duration), flush=True)
+
+        failed = boot(args.runner, envs, offsets, args.duration)
+    finally:
+        server.terminate()
+        server.communicate()
+
+    with open(stats_path) as f:
+        report(json.load(f), args.devices, args.bucket)
+
+    if failed > 0:
+        sys.exit('{} devices exited with an error'.format(failed))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,7 @@
+#ifndef HOST__ESP_COMPILER_H_
+#define HOST__ESP_COMPILER_H_
+
+#define likely(x)   __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+
+#endif // HOST__ESP_COMPILER_H_
\ No newline at end of file
@@ -0,0 +1,9 @@
+#ifndef HOST__ESP_CRT_BUNDLE_H_
+#define HOST__ESP_CRT_BUNDLE_H_
+
+#include <esp_err.h>
+
+// Installs a verify callback that keeps OpenSSL's verdict, see esp_tls.h
+esp_err_t esp_crt_bundle_attach(void* conf);
+
+#endif // HOST__ESP_CRT_BUNDLE_H_
\ No newline at end of file
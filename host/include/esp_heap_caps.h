@@ -0,0 +1,21 @@
+#ifndef HOST__ESP_HEAP_CAPS_H_
+#define HOST__ESP_HEAP_CAPS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <esp_bit_defs.h>
+
+#define MALLOC_CAP_8BIT     BIT(2)
+#define MALLOC_CAP_INTERNAL BIT(11)
+#define MALLOC_CAP_DEFAULT  BIT(12)
+
+// Figures for a heap the size of the device's, less what the firmware's own
+// code has allocated. Memory allocated inside OpenSSL, nghttp2 or protobuf-c
+// is not seen, see host/heap.h.
+size_t heap_caps_get_free_size(uint32_t caps);
+size_t heap_caps_get_total_size(uint32_t caps);
+size_t heap_caps_get_largest_free_block(uint32_t caps);
+size_t heap_caps_get_minimum_free_size(uint32_t caps);
+
+#endif // HOST__ESP_HEAP_CAPS_H_
\ No newline at end of file
@@ -0,0 +1,39 @@
+#ifndef HOST__ESP_LOG_H_
+#define HOST__ESP_LOG_H_
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdint.h>
+
+#include <sdkconfig.h>
+
+typedef enum {
+    ESP_LOG_NONE,
+    ESP_LOG_ERROR,
+    ESP_LOG_WARN,
+    ESP_LOG_INFO,
+    ESP_LOG_DEBUG,
+    ESP_LOG_VERBOSE,
+} esp_log_level_t;
+
+// Only the "*" tag is supported: the level applies to every tag
+void esp_log_level_set(const char* tag, esp_log_level_t level);
+esp_log_level_t esp_log_level_get(const char* tag);
+
+uint32_t esp_log_timestamp(void);
+void esp_log_write(esp_log_level_t level, const char* tag, const char* format, ...) __attribute__((format(printf, 3, 4)));
+
+#define ESP_LOG_LEVEL_(level, letter, tag, format, ...)                                                                   \
+    do {                                                                                                                 \
+        if ((level) <= CONFIG_LOG_MAXIMUM_LEVEL) {                                                                       \
+            esp_log_write((level), (tag), letter " (%" PRIu32 ") %s: " format "\n", esp_log_timestamp(), (tag), ##__VA_ARGS__); \
+        }                                                                                                                \
+    } while (0)
+
+#define ESP_LOGE(tag, format, ...) ESP_LOG_LEVEL_(ESP_LOG_ERROR, "E", tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) ESP_LOG_LEVEL_(ESP_LOG_WARN, "W", tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) ESP_LOG_LEVEL_(ESP_LOG_INFO, "I", tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) ESP_LOG_LEVEL_(ESP_LOG_DEBUG, "D", tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) ESP_LOG_LEVEL_(ESP_LOG_VERBOSE, "V", tag, format, ##__VA_ARGS__)
+
+#endif // HOST__ESP_LOG_H_
\ No newline at end of file
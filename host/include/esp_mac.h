@@ -0,0 +1,19 @@
+#ifndef HOST__ESP_MAC_H_
+#define HOST__ESP_MAC_H_
+
+#include <stdint.h>
+
+#include <esp_err.h>
+
+typedef enum {
+    ESP_MAC_WIFI_STA,
+    ESP_MAC_WIFI_SOFTAP,
+    ESP_MAC_BT,
+    ESP_MAC_ETH,
+} esp_mac_type_t;
+
+// The station MAC comes from GANYMEDE_MAC ("aa:bb:cc:dd:ee:ff") when set, and
+// is otherwise derived from the host name so that it is stable across runs
+esp_err_t esp_read_mac(uint8_t* mac, esp_mac_type_t type);
+
+#endif // HOST__ESP_MAC_H_
\ No newline at end of file
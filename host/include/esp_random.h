@@ -0,0 +1,10 @@
+#ifndef HOST__ESP_RANDOM_H_
+#define HOST__ESP_RANDOM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+uint32_t esp_random(void);
+void esp_fill_random(void* buf, size_t len);
+
+#endif // HOST__ESP_RANDOM_H_
\ No newline at end of file
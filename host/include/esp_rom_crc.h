@@ -0,0 +1,9 @@
+#ifndef HOST__ESP_ROM_CRC_H_
+#define HOST__ESP_ROM_CRC_H_
+
+#include <stdint.h>
+
+// Same polynomial and conditioning as the ROM's, and zlib's
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t* buf, uint32_t len);
+
+#endif // HOST__ESP_ROM_CRC_H_
\ No newline at end of file
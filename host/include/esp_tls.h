@@ -0,0 +1,58 @@
+#ifndef HOST__ESP_TLS_H_
+#define HOST__ESP_TLS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include <esp_err.h>
+
+#include <mbedtls/ssl.h>
+
+#define ESP_TLS_ERR_SSL_WANT_READ  MBEDTLS_ERR_SSL_WANT_READ
+#define ESP_TLS_ERR_SSL_WANT_WRITE MBEDTLS_ERR_SSL_WANT_WRITE
+
+typedef enum {
+    ESP_TLS_INIT = 0,
+    ESP_TLS_CONNECTING,
+    ESP_TLS_HANDSHAKE,
+    ESP_TLS_FAIL,
+    ESP_TLS_DONE,
+} esp_tls_conn_state_t;
+
+typedef struct esp_tls esp_tls_t;
+
+typedef struct esp_tls_client_session {
+    mbedtls_ssl_session saved_session;
+} esp_tls_client_session_t;
+
+// Servers are verified against OpenSSL's default store, which SSL_CERT_FILE
+// and SSL_CERT_DIR override, instead of the certificate bundle. TLS 1.3 is
+// disabled, as it is in the device's mbedtls.
+typedef struct esp_tls_cfg {
+    const char** alpn_protos;
+    bool non_block;
+    int timeout_ms;
+    const char* common_name;
+    bool skip_common_name;
+    esp_err_t (*crt_bundle_attach)(void* conf);
+    esp_tls_client_session_t* client_session;
+} esp_tls_cfg_t;
+
+esp_tls_t* esp_tls_init(void);
+int esp_tls_conn_destroy(esp_tls_t* tls);
+
+// Returns 0 while connecting, 1 once the handshake is done and -1 on failure
+int esp_tls_conn_new_async(const char* hostname, int hostlen, int port, const esp_tls_cfg_t* cfg, esp_tls_t* tls);
+
+ssize_t esp_tls_conn_write(esp_tls_t* tls, const void* data, size_t datalen);
+ssize_t esp_tls_conn_read(esp_tls_t* tls, void* data, size_t datalen);
+ssize_t esp_tls_get_bytes_avail(esp_tls_t* tls);
+
+esp_err_t esp_tls_get_conn_state(esp_tls_t* tls, esp_tls_conn_state_t* conn_state);
+esp_err_t esp_tls_get_conn_sockfd(esp_tls_t* tls, int* sockfd);
+
+esp_tls_client_session_t* esp_tls_get_client_session(esp_tls_t* tls);
+void esp_tls_free_client_session(esp_tls_client_session_t* client_session);
+
+#endif // HOST__ESP_TLS_H_
\ No newline at end of file
@@ -0,0 +1,19 @@
+#ifndef HOST__ESP_VFS_EVENTFD_H_
+#define HOST__ESP_VFS_EVENTFD_H_
+
+#include <stddef.h>
+#include <sys/eventfd.h>
+
+#include <esp_err.h>
+
+typedef struct {
+    size_t max_fds;
+} esp_vfs_eventfd_config_t;
+
+#define ESP_VFS_EVENTD_CONFIG_DEFAULT() \
+    (esp_vfs_eventfd_config_t) { .max_fds = 5, }
+
+// Linux has eventfd already, there is nothing to register
+esp_err_t esp_vfs_eventfd_register(const esp_vfs_eventfd_config_t* config);
+
+#endif // HOST__ESP_VFS_EVENTFD_H_
\ No newline at end of file
@@ -0,0 +1,27 @@
+#ifndef HOST__ESP_WIFI_H_
+#define HOST__ESP_WIFI_H_
+
+#include <esp_event.h>
+
+// The host has no radio. Its network is up from the start, and only the
+// events remain so that the tasks waiting on them build; the runner posts
+// IP_EVENT_STA_GOT_IP itself.
+
+ESP_EVENT_DECLARE_BASE(WIFI_EVENT);
+ESP_EVENT_DECLARE_BASE(IP_EVENT);
+
+typedef enum {
+    WIFI_EVENT_WIFI_READY = 0,
+    WIFI_EVENT_SCAN_DONE,
+    WIFI_EVENT_STA_START,
+    WIFI_EVENT_STA_STOP,
+    WIFI_EVENT_STA_CONNECTED,
+    WIFI_EVENT_STA_DISCONNECTED,
+} wifi_event_t;
+
+typedef enum {
+    IP_EVENT_STA_GOT_IP = 0,
+    IP_EVENT_STA_LOST_IP,
+} ip_event_t;
+
+#endif // HOST__ESP_WIFI_H_
\ No newline at end of file
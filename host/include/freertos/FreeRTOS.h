@@ -0,0 +1,60 @@
+#ifndef HOST__FREERTOS__FREERTOS_H_
+#define HOST__FREERTOS__FREERTOS_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <esp_bit_defs.h>
+#include <esp_err.h>
+#include <sdkconfig.h>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+// Handles are declared here so the headers below can be included in any order
+typedef struct tskTaskControlBlock* TaskHandle_t;
+typedef struct QueueDefinition* QueueHandle_t;
+typedef QueueHandle_t SemaphoreHandle_t;
+typedef struct EventGroupDef_t* EventGroupHandle_t;
+typedef TickType_t EventBits_t;
+
+#define pdFALSE ((BaseType_t) 0)
+#define pdTRUE  ((BaseType_t) 1)
+#define pdPASS  (pdTRUE)
+#define pdFAIL  (pdFALSE)
+
+#define errQUEUE_EMPTY ((BaseType_t) 0)
+#define errQUEUE_FULL  ((BaseType_t) 0)
+
+#define configTICK_RATE_HZ      CONFIG_FREERTOS_HZ
+#define configMAX_TASK_NAME_LEN 16
+
+#define portMAX_DELAY      ((TickType_t) 0xffffffffUL)
+#define portTICK_PERIOD_MS ((TickType_t) 1000 / configTICK_RATE_HZ)
+
+#define pdMS_TO_TICKS(ms) ((TickType_t) (((uint64_t) (ms) * (uint64_t) configTICK_RATE_HZ) / 1000U))
+#define pdTICKS_TO_MS(ticks) ((uint32_t) (((uint64_t) (ticks) * 1000U) / (uint64_t) configTICK_RATE_HZ))
+
+// A single core and no ISRs: critical sections only have to exclude the other
+// tasks, a recursive mutex does it
+typedef struct {
+    pthread_mutex_t mutex;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED { .mutex = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP }
+
+#define portENTER_CRITICAL(mux) pthread_mutex_lock(&(mux)->mutex)
+#define portEXIT_CRITICAL(mux)  pthread_mutex_unlock(&(mux)->mutex)
+#define taskENTER_CRITICAL(mux) portENTER_CRITICAL(mux)
+#define taskEXIT_CRITICAL(mux)  portEXIT_CRITICAL(mux)
+
+// As with ESP-IDF's additions, the rest of the API comes along
+#include <freertos/event_groups.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#endif // HOST__FREERTOS__FREERTOS_H_
\ No newline at end of file
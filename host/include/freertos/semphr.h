@@ -0,0 +1,22 @@
+#ifndef HOST__FREERTOS__SEMPHR_H_
+#define HOST__FREERTOS__SEMPHR_H_
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+// As in FreeRTOS, a semaphore is a queue of empty items
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count);
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex(void);
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks_to_wait);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore);
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t mutex, TickType_t ticks_to_wait);
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t mutex);
+
+UBaseType_t uxSemaphoreGetCount(SemaphoreHandle_t semaphore);
+
+#define vSemaphoreDelete(semaphore) vQueueDelete((QueueHandle_t) (semaphore))
+
+#endif // HOST__FREERTOS__SEMPHR_H_
\ No newline at end of file
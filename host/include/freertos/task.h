@@ -0,0 +1,42 @@
+#ifndef HOST__FREERTOS__TASK_H_
+#define HOST__FREERTOS__TASK_H_
+
+#include <stdint.h>
+
+#include <freertos/FreeRTOS.h>
+
+typedef void (*TaskFunction_t)(void*);
+
+typedef enum {
+    eNoAction = 0,
+    eSetBits,
+    eIncrement,
+    eSetValueWithOverwrite,
+    eSetValueWithoutOverwrite,
+} eNotifyAction;
+
+// Tasks are threads. Priorities are ignored, and stacks are the host's default
+// size: frames are larger than on Xtensa and OpenSSL needs more than mbedtls.
+BaseType_t xTaskCreate(TaskFunction_t code, const char* name, uint32_t stack_depth, void* parameters, UBaseType_t priority, TaskHandle_t* created_task);
+
+// Only a task may delete itself
+void vTaskDelete(TaskHandle_t task);
+
+// Sleep until a later tick boundary, as the tick interrupt would wake the task
+void vTaskDelay(TickType_t ticks);
+BaseType_t xTaskDelayUntil(TickType_t* previous_wake_time, TickType_t increment);
+
+#define vTaskDelayUntil(previous_wake_time, increment) ((void) xTaskDelayUntil((previous_wake_time), (increment)))
+
+TickType_t xTaskGetTickCount(void);
+
+// Threads not started by xTaskCreate get a handle on first use
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+char* pcTaskGetName(TaskHandle_t task);
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action);
+BaseType_t xTaskNotifyWait(uint32_t bits_to_clear_on_entry, uint32_t bits_to_clear_on_exit, uint32_t* notification_value, TickType_t ticks_to_wait);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clear_count_on_exit, TickType_t ticks_to_wait);
+
+#endif // HOST__FREERTOS__TASK_H_
\ No newline at end of file
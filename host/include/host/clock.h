@@ -0,0 +1,15 @@
+#ifndef HOST__HOST__CLOCK_H_
+#define HOST__HOST__CLOCK_H_
+
+#include <stdint.h>
+#include <time.h>
+
+// The runner's clock counts from process start, like the device's from boot,
+// and runs GANYMEDE_CLOCK_DRIFT parts per million fast (or slow, if negative)
+// like a crystal off its nominal frequency. esp_timer_get_time reads it.
+
+// CLOCK_MONOTONIC time at which esp_timer_get_time reaches `uptime`
+// (microseconds)
+struct timespec host_clock_to_monotonic(int64_t uptime);
+
+#endif // HOST__HOST__CLOCK_H_
\ No newline at end of file
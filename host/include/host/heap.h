@@ -0,0 +1,20 @@
+#ifndef HOST__HOST__HEAP_H_
+#define HOST__HOST__HEAP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Allocations made by the firmware's own code. The linker routes malloc,
+// calloc, realloc and free through counting wrappers (--wrap); allocations
+// made inside shared libraries are not counted.
+struct host_heap_stats {
+    uint64_t allocations;
+    uint64_t frees;
+
+    size_t in_use;
+    size_t peak;
+};
+
+void host_heap_get_stats(struct host_heap_stats* dest);
+
+#endif // HOST__HOST__HEAP_H_
\ No newline at end of file
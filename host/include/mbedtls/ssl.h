@@ -0,0 +1,38 @@
+#ifndef HOST__MBEDTLS__SSL_H_
+#define HOST__MBEDTLS__SSL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The host's esp_tls runs on OpenSSL. This is only what the firmware touches
+// of mbedtls, implemented on top of it: the session is an SSL_SESSION, and the
+// verify callback of the configuration is called from OpenSSL's.
+
+#define MBEDTLS_PRIVATE(member) private_##member
+
+#define MBEDTLS_ERR_SSL_BAD_INPUT_DATA    -0x7100
+#define MBEDTLS_ERR_SSL_BUFFER_TOO_SMALL  -0x6A00
+#define MBEDTLS_ERR_SSL_WANT_READ         -0x6900
+#define MBEDTLS_ERR_SSL_WANT_WRITE        -0x6880
+#define MBEDTLS_X509_BADCERT_NOT_TRUSTED  0x08
+
+// Never dereferenced, verify callbacks get NULL
+typedef struct mbedtls_x509_crt mbedtls_x509_crt;
+
+typedef struct mbedtls_ssl_session {
+    void* MBEDTLS_PRIVATE(handle);
+} mbedtls_ssl_session;
+
+typedef struct mbedtls_ssl_config {
+    int (*MBEDTLS_PRIVATE(f_vrfy))(void*, mbedtls_x509_crt*, int, uint32_t*);
+    void* MBEDTLS_PRIVATE(p_vrfy);
+} mbedtls_ssl_config;
+
+void mbedtls_ssl_session_init(mbedtls_ssl_session* session);
+void mbedtls_ssl_session_free(mbedtls_ssl_session* session);
+int mbedtls_ssl_session_save(const mbedtls_ssl_session* session, unsigned char* buf, size_t buf_len, size_t* olen);
+int mbedtls_ssl_session_load(mbedtls_ssl_session* session, const unsigned char* buf, size_t len);
+
+void mbedtls_ssl_conf_verify(mbedtls_ssl_config* conf, int (*f_vrfy)(void*, mbedtls_x509_crt*, int, uint32_t*), void* p_vrfy);
+
+#endif // HOST__MBEDTLS__SSL_H_
\ No newline at end of file
@@ -0,0 +1,13 @@
+#ifndef HOST__NVS_FLASH_H_
+#define HOST__NVS_FLASH_H_
+
+#include <esp_err.h>
+#include <nvs.h>
+
+// Entries live in memory. When GANYMEDE_NVS_PATH names a file, they are loaded
+// from it here and written back on every change, as NVS writes through to
+// flash, so that the identity and tokens survive restarts like on the device.
+esp_err_t nvs_flash_init(void);
+esp_err_t nvs_flash_erase(void);
+
+#endif // HOST__NVS_FLASH_H_
\ No newline at end of file
@@ -0,0 +1,8 @@
+#ifndef HOST__ROM__ETS_SYS_H_
+#define HOST__ROM__ETS_SYS_H_
+
+#include <stdint.h>
+
+void ets_delay_us(uint32_t us);
+
+#endif // HOST__ROM__ETS_SYS_H_
\ No newline at end of file
@@ -0,0 +1,15 @@
+#ifndef HOST__SOC__GPIO_REG_H_
+#define HOST__SOC__GPIO_REG_H_
+
+#include <soc/soc.h>
+
+// ESP32-S2 addresses
+#define DR_REG_GPIO_BASE   0x3f404000
+#define GPIO_OUT_REG       (DR_REG_GPIO_BASE + 0x4)
+#define GPIO_OUT_W1TS_REG  (DR_REG_GPIO_BASE + 0x8)
+#define GPIO_OUT_W1TC_REG  (DR_REG_GPIO_BASE + 0xc)
+#define GPIO_OUT1_REG      (DR_REG_GPIO_BASE + 0x10)
+#define GPIO_OUT1_W1TS_REG (DR_REG_GPIO_BASE + 0x14)
+#define GPIO_OUT1_W1TC_REG (DR_REG_GPIO_BASE + 0x18)
+
+#endif // HOST__SOC__GPIO_REG_H_
\ No newline at end of file
@@ -0,0 +1,14 @@
+#ifndef HOST__SOC__SOC_H_
+#define HOST__SOC__SOC_H_
+
+#include <stdint.h>
+
+// Peripheral registers are plain memory on the host. Writes to the GPIO set
+// and clear registers update the output levels gpio_get_level reports.
+void host_reg_write(uint32_t address, uint32_t value);
+uint32_t host_reg_read(uint32_t address);
+
+#define REG_WRITE(reg, val) host_reg_write((uint32_t) (reg), (uint32_t) (val))
+#define REG_READ(reg)       host_reg_read((uint32_t) (reg))
+
+#endif // HOST__SOC__SOC_H_
\ No newline at end of file
@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+"""Writes sdkconfig.h for the host build, as ESP-IDF's confgen would.
+
+Values are taken, lowest precedence first, from the defaults of the Kconfig
+files, then from each sdkconfig file in the order given.
+"""
+
+import argparse
+import re
+
+CONFIG_LINE = re.compile(r'^(CONFIG_[A-Za-z0-9_]+)=(.*)$')
+NOT_SET_LINE = re.compile(r'^# (CONFIG_[A-Za-z0-9_]+) is not set$')
+
+
+def read_kconfig(path, values):
+    name = None
+    kind = None
+    in_help = False
+    help_indent = 0
+
+    with open(path) as f:
+        for line in f:
+            stripped = line.strip()
+            indent = len(line) - len(line.lstrip())
+
+            if in_help:
+                if stripped == '' or indent > help_indent:
+                    continue
+                in_help = False
+
+            words = stripped.split(None, 1)
+
+            if not words:
+                continue
+
+            if words[0] == 'config':
+                name = 'CONFIG_' + words[1]
+                kind = None
+            elif words[0] in ('bool', 'int', 'hex', 'string'):
+                kind = words[0]
+            elif words[0] == 'default' and name is not None and name not in values:
+                default = words[1]
+
+                if kind == 'bool':
+                    default = 'y' if default == 'y' else None
+
+                values[name] = default
+            elif words[0] == 'help':
+                in_help = True
+                help_indent = indent
+
+
+def read_sdkconfig(path, values):
+    with open(path) as f:
+        for line in f:
+            line = line.strip()
+            match = CONFIG_LINE.match(line)
+
+            if match:
+                values[match.group(1)] = match.group(2)
+                continue
+
+            match = NOT_SET_LINE.match(line)
+
+            if match:
+                values[match.group(1)] = None
+
+
+def write_header(path, values):
+    lines = ['/*', ' * Automatically generated file. DO NOT EDIT.', ' */', '#pragma once']
+
+    for name, value in sorted(values.items()):
+        if value is None or value == 'n':
+            continue
+
+        if value == 'y':
+            value = '1'
+
+        lines.append('#define {} {}'.format(name, value))
+
+    content = '\n'.join(lines) + '\n'
+
+    try:
+        with open(path) as f:
+            if f.read() == content:
+                return
+    except FileNotFoundError:
+        pass
+
+    with open(path, 'w') as f:
+        f.write(content)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('--kconfig', action='append', default=[])
+    parser.add_argument('--sdkconfig', action='append', default=[])
+    parser.add_argument('--output', required=True)
+    args = parser.parse_args()
+
+    values = {}
+
+    for path in args.sdkconfig:
+        read_sdkconfig(path, values)
+
+    # Kconfig defaults only fill in what no sdkconfig file sets
+    for path in args.kconfig:
+        read_kconfig(path, values)
+
+    write_header(args.output, values)
+
+
+if __name__ == '__main__':
+    main()
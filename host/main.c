@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_event.h>
+#include <esp_log.h>
+#include <esp_wifi.h>
+
+#include <nvs_flash.h>
+
+#include <api/error.h>
+#include <api/ganymede/v2/api.h>
+#include <app/bench.h>
+#include <app/config.h>
+#include <app/fleet.h>
+#include <app/identity.h>
+#include <app/lights.h>
+#include <app/measurements.h>
+#include <app/poll.h>
+#include <app/schedule.h>
+#include <net/auth/auth.h>
+#include <net/http2/http2.h>
+
+enum {
+    // How long `register` waits for the device flow to complete (milliseconds)
+    MAIN_REGISTER_TIMEOUT = 60 * 1000,
+    MAIN_REGISTER_POLL_INTERVAL = 1000,
+};
+
+static const char* TAG = "main";
+
+static esp_err_t main_register_(void)
+{
+    char token[CONFIG_AUTH_ACCESS_TOKEN_LEN];
+
+    ERROR_CHECK(auth_request_register());
+
+    for (int waited = 0; waited < MAIN_REGISTER_TIMEOUT; waited += MAIN_REGISTER_POLL_INTERVAL) {
+        size_t length = sizeof(token);
+
+        if (auth_get_token(token, &length) == ESP_OK) {
+            return ESP_OK;
+        }
+
+        vTaskDelay(pdMS_TO_TICKS(MAIN_REGISTER_POLL_INTERVAL));
+    }
+
+    ESP_LOGE(TAG, "registration timed out");
+    return ESP_ERR_TIMEOUT;
+}
+
+// Leaves the app's tasks to poll, acquire and push on their own schedule
+static esp_err_t main_run_(unsigned long seconds)
+{
+    for (unsigned long elapsed = 0; elapsed < seconds; elapsed++) {
+        vTaskDelay(pdMS_TO_TICKS(1000));
+    }
+
+    return ESP_OK;
+}
+
+// Boots the firmware as app_main does, minus Wi-Fi and SNTP: the host is
+// already online and its clock set. Then runs each command given, `bench` if
+// none is.
+//
+//   ganymede_host [register] [bench] [run SECONDS] [fleet N]
+int main(int argc, char** argv)
+{
+    ERROR_CHECK(esp_event_loop_create_default());
+    ERROR_CHECK(nvs_flash_init());
+
+    ERROR_CHECK(http2_init());
+    ERROR_CHECK(auth_init());
+    ERROR_CHECK(ganymede_api_v2_init());
+    ERROR_CHECK(app_identity_init());
+    ERROR_CHECK(app_schedule_init());
+    ERROR_CHECK(app_config_init());
+    ERROR_CHECK(app_poll_init());
+    ERROR_CHECK(app_lights_init());
+    ERROR_CHECK(app_measurements_init());
+
+    // What the Wi-Fi driver posts once the station has an address
+    ERROR_CHECK(esp_event_post(IP_EVENT, IP_EVENT_STA_GOT_IP, NULL, 0, portMAX_DELAY));
+
+    if (argc < 2) {
+        return app_bench_run() == ESP_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        esp_err_t rc = ESP_ERR_INVALID_ARG;
+
+        if (strcmp(argv[i], "register") == 0) {
+            rc = main_register_();
+        } else if (strcmp(argv[i], "bench") == 0) {
+            rc = app_bench_run();
+        } else if (strcmp(argv[i], "run") == 0 && i + 1 < argc) {
+            rc = main_run_(strtoul(argv[++i], NULL, 10));
+        } else if (strcmp(argv[i], "fleet") == 0 && i + 1 < argc) {
+            rc = app_fleet_simulate(strtoul(argv[++i], NULL, 10));
+        } else {
+            fprintf(stderr, "usage: %s [register] [bench] [run SECONDS] [fleet N]\n", argv[0]);
+        }
+
+        if (rc != ESP_OK) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
\ No newline at end of file
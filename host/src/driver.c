@@ -0,0 +1,366 @@
+#include <driver/gpio.h>
+#include <driver/i2c_master.h>
+#include <driver/ledc.h>
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <soc/gpio_reg.h>
+
+enum {
+    // AM2320 on the host's I2C buses
+    DRIVER_AM2320_ADDRESS = 0x5C,
+    DRIVER_AM2320_READ = 0x03,
+    DRIVER_AM2320_REGISTERS = 4,
+
+    // 55.0 %RH and 21.5 °C, in tenths
+    DRIVER_AM2320_HUMIDITY = 550,
+    DRIVER_AM2320_TEMPERATURE = 215,
+};
+
+struct i2c_master_bus_t {
+    i2c_port_num_t port;
+};
+
+struct i2c_master_dev_t {
+    uint16_t address;
+
+    // Registers requested by the last read command
+    uint8_t start;
+    uint8_t count;
+};
+
+static pthread_mutex_t driver_lock_ = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t driver_gpio_outputs_ = 0;
+static uint64_t driver_gpio_levels_ = 0;
+
+static uint32_t driver_ledc_duties_[LEDC_CHANNEL_MAX] = { 0 };
+
+esp_err_t gpio_config(const gpio_config_t* config)
+{
+    if (config == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    for (int pin = 0; pin < GPIO_NUM_MAX; pin++) {
+        if ((config->pin_bit_mask & (1ULL << pin)) == 0) {
+            continue;
+        }
+
+        if (!GPIO_IS_VALID_GPIO(pin) || ((config->mode & GPIO_MODE_OUTPUT) && !GPIO_IS_VALID_OUTPUT_GPIO(pin))) {
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+
+    pthread_mutex_lock(&driver_lock_);
+
+    if (config->mode & GPIO_MODE_OUTPUT) {
+        driver_gpio_outputs_ |= config->pin_bit_mask;
+    } else {
+        driver_gpio_outputs_ &= ~config->pin_bit_mask;
+    }
+
+    pthread_mutex_unlock(&driver_lock_);
+    return ESP_OK;
+}
+
+esp_err_t gpio_reset_pin(gpio_num_t gpio_num)
+{
+    if (!GPIO_IS_VALID_GPIO(gpio_num)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    pthread_mutex_lock(&driver_lock_);
+    driver_gpio_outputs_ &= ~(1ULL << gpio_num);
+    driver_gpio_levels_ &= ~(1ULL << gpio_num);
+    pthread_mutex_unlock(&driver_lock_);
+
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level)
+{
+    if (!GPIO_IS_VALID_OUTPUT_GPIO(gpio_num)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    pthread_mutex_lock(&driver_lock_);
+
+    if (level) {
+        driver_gpio_levels_ |= 1ULL << gpio_num;
+    } else {
+        driver_gpio_levels_ &= ~(1ULL << gpio_num);
+    }
+
+    pthread_mutex_unlock(&driver_lock_);
+    return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio_num)
+{
+    if (!GPIO_IS_VALID_GPIO(gpio_num)) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&driver_lock_);
+    int level = (driver_gpio_outputs_ & driver_gpio_levels_ & (1ULL << gpio_num)) != 0;
+    pthread_mutex_unlock(&driver_lock_);
+
+    return level;
+}
+
+void host_reg_write(uint32_t address, uint32_t value)
+{
+    pthread_mutex_lock(&driver_lock_);
+
+    switch (address) {
+    case GPIO_OUT_REG:
+        driver_gpio_levels_ = (driver_gpio_levels_ & ~0xFFFFFFFFULL) | value;
+        break;
+
+    case GPIO_OUT_W1TS_REG:
+        driver_gpio_levels_ |= value;
+        break;
+
+    case GPIO_OUT_W1TC_REG:
+        driver_gpio_levels_ &= ~(uint64_t) value;
+        break;
+
+    case GPIO_OUT1_REG:
+        driver_gpio_levels_ = (driver_gpio_levels_ & 0xFFFFFFFFULL) | ((uint64_t) value << 32);
+        break;
+
+    case GPIO_OUT1_W1TS_REG:
+        driver_gpio_levels_ |= (uint64_t) value << 32;
+        break;
+
+    case GPIO_OUT1_W1TC_REG:
+        driver_gpio_levels_ &= ~((uint64_t) value << 32);
+        break;
+
+    default:
+        break;
+    }
+
+    pthread_mutex_unlock(&driver_lock_);
+}
+
+uint32_t host_reg_read(uint32_t address)
+{
+    uint32_t value = 0;
+
+    pthread_mutex_lock(&driver_lock_);
+
+    if (address == GPIO_OUT_REG) {
+        value = (uint32_t) driver_gpio_levels_;
+    } else if (address == GPIO_OUT1_REG) {
+        value = (uint32_t) (driver_gpio_levels_ >> 32);
+    }
+
+    pthread_mutex_unlock(&driver_lock_);
+    return value;
+}
+
+esp_err_t i2c_new_master_bus(const i2c_master_bus_config_t* bus_config, i2c_master_bus_handle_t* ret_bus_handle)
+{
+    if (bus_config == NULL || ret_bus_handle == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    i2c_master_bus_handle_t bus = calloc(1, sizeof(struct i2c_master_bus_t));
+
+    if (bus == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    bus->port = bus_config->i2c_port;
+
+    *ret_bus_handle = bus;
+    return ESP_OK;
+}
+
+esp_err_t i2c_master_bus_add_device(i2c_master_bus_handle_t bus_handle, const i2c_device_config_t* dev_config, i2c_master_dev_handle_t* ret_handle)
+{
+    if (bus_handle == NULL || dev_config == NULL || ret_handle == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    i2c_master_dev_handle_t device = calloc(1, sizeof(struct i2c_master_dev_t));
+
+    if (device == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    device->address = dev_config->device_address;
+
+    *ret_handle = device;
+    return ESP_OK;
+}
+
+esp_err_t i2c_master_transmit(i2c_master_dev_handle_t i2c_dev, const uint8_t* write_buffer, size_t write_size, int xfer_timeout_ms)
+{
+    (void) xfer_timeout_ms;
+
+    if (i2c_dev == NULL || (write_buffer == NULL && write_size > 0)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (i2c_dev->address != DRIVER_AM2320_ADDRESS) {
+        return ESP_FAIL;
+    }
+
+    // A wake-up write, or a read command
+    if (write_size == 3 && write_buffer[0] == DRIVER_AM2320_READ) {
+        i2c_dev->start = write_buffer[1];
+        i2c_dev->count = write_buffer[2];
+    }
+
+    return ESP_OK;
+}
+
+// Modbus CRC, as the AM2320 appends it
+static uint16_t driver_am2320_crc_(const uint8_t* data, size_t length)
+{
+    uint16_t crc = 0xFFFF;
+
+    for (size_t i = 0; i < length; i++) {
+        crc ^= data[i];
+
+        for (size_t j = 0; j < 8; j++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+        }
+    }
+
+    return crc;
+}
+
+esp_err_t i2c_master_receive(i2c_master_dev_handle_t i2c_dev, uint8_t* read_buffer, size_t read_size, int xfer_timeout_ms)
+{
+    (void) xfer_timeout_ms;
+
+    if (i2c_dev == NULL || read_buffer == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (i2c_dev->address != DRIVER_AM2320_ADDRESS || i2c_dev->count == 0) {
+        return ESP_FAIL;
+    }
+
+    uint8_t registers[DRIVER_AM2320_REGISTERS] = {
+        DRIVER_AM2320_HUMIDITY >> 8,
+        DRIVER_AM2320_HUMIDITY & 0xFF,
+        DRIVER_AM2320_TEMPERATURE >> 8,
+        DRIVER_AM2320_TEMPERATURE & 0xFF,
+    };
+
+    uint8_t response[2 + DRIVER_AM2320_REGISTERS + 2];
+    size_t count = i2c_dev->count;
+
+    if (i2c_dev->start + count > DRIVER_AM2320_REGISTERS) {
+        return ESP_FAIL;
+    }
+
+    response[0] = DRIVER_AM2320_READ;
+    response[1] = (uint8_t) count;
+    memcpy(&response[2], &registers[i2c_dev->start], count);
+
+    uint16_t crc = driver_am2320_crc_(response, 2 + count);
+    response[2 + count] = (uint8_t) (crc & 0xFF);
+    response[3 + count] = (uint8_t) (crc >> 8);
+
+    memset(read_buffer, 0, read_size);
+    memcpy(read_buffer, response, read_size < 4 + count ? read_size : 4 + count);
+
+    i2c_dev->count = 0;
+    return ESP_OK;
+}
+
+static bool driver_ledc_valid_(ledc_mode_t speed_mode, ledc_channel_t channel)
+{
+    return speed_mode < LEDC_SPEED_MODE_MAX && channel < LEDC_CHANNEL_MAX;
+}
+
+esp_err_t ledc_timer_config(const ledc_timer_config_t* timer_conf)
+{
+    if (timer_conf == NULL || timer_conf->timer_num >= LEDC_TIMER_MAX || timer_conf->duty_resolution >= LEDC_TIMER_BIT_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t ledc_channel_config(const ledc_channel_config_t* ledc_conf)
+{
+    if (ledc_conf == NULL || !driver_ledc_valid_(ledc_conf->speed_mode, ledc_conf->channel) || !GPIO_IS_VALID_OUTPUT_GPIO(ledc_conf->gpio_num)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    pthread_mutex_lock(&driver_lock_);
+    driver_ledc_duties_[ledc_conf->channel] = ledc_conf->duty;
+    pthread_mutex_unlock(&driver_lock_);
+
+    return ESP_OK;
+}
+
+esp_err_t ledc_set_duty(ledc_mode_t speed_mode, ledc_channel_t channel, uint32_t duty)
+{
+    if (!driver_ledc_valid_(speed_mode, channel)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    pthread_mutex_lock(&driver_lock_);
+    driver_ledc_duties_[channel] = duty;
+    pthread_mutex_unlock(&driver_lock_);
+
+    return ESP_OK;
+}
+
+esp_err_t ledc_update_duty(ledc_mode_t speed_mode, ledc_channel_t channel)
+{
+    return driver_ledc_valid_(speed_mode, channel) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+uint32_t ledc_get_duty(ledc_mode_t speed_mode, ledc_channel_t channel)
+{
+    if (!driver_ledc_valid_(speed_mode, channel)) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&driver_lock_);
+    uint32_t duty = driver_ledc_duties_[channel];
+    pthread_mutex_unlock(&driver_lock_);
+
+    return duty;
+}
+
+esp_err_t ledc_stop(ledc_mode_t speed_mode, ledc_channel_t channel, uint32_t idle_level)
+{
+    (void) idle_level;
+    return ledc_set_duty(speed_mode, channel, 0);
+}
+
+esp_err_t ledc_fade_func_install(int intr_alloc_flags)
+{
+    (void) intr_alloc_flags;
+    return ESP_OK;
+}
+
+// Fades complete at once
+esp_err_t ledc_set_fade_with_time(ledc_mode_t speed_mode, ledc_channel_t channel, uint32_t target_duty, int max_fade_time_ms)
+{
+    (void) max_fade_time_ms;
+    return ledc_set_duty(speed_mode, channel, target_duty);
+}
+
+esp_err_t ledc_fade_start(ledc_mode_t speed_mode, ledc_channel_t channel, ledc_fade_mode_t fade_mode)
+{
+    (void) fade_mode;
+    return ledc_update_duty(speed_mode, channel);
+}
+
+esp_err_t ledc_fade_stop(ledc_mode_t speed_mode, ledc_channel_t channel)
+{
+    return ledc_update_duty(speed_mode, channel);
+}
\ No newline at end of file
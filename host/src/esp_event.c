@@ -0,0 +1,205 @@
+#include <esp_event.h>
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_log.h>
+#include <esp_wifi.h>
+
+#include <freertos/FreeRTOS.h>
+
+enum {
+    ESP_EVENT_TASK_STACK_DEPTH = 1024 * 3,
+
+    // Events posted but not dispatched yet
+    ESP_EVENT_QUEUE_LEN = 32,
+};
+
+static const char* TAG = "esp_event";
+
+ESP_EVENT_DEFINE_BASE(WIFI_EVENT);
+ESP_EVENT_DEFINE_BASE(IP_EVENT);
+
+struct esp_event_handler {
+    esp_event_base_t base;
+    int32_t id;
+    esp_event_handler_t handler;
+    void* arg;
+
+    struct esp_event_handler* next;
+};
+
+struct esp_event {
+    esp_event_base_t base;
+    int32_t id;
+    void* data;
+};
+
+// Recursive, so that handlers may register or post from the loop's task
+static pthread_mutex_t esp_event_lock_ = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+static struct esp_event_handler* esp_event_handlers_ = NULL;
+static QueueHandle_t esp_event_queue_ = NULL;
+
+static bool esp_event_matches_(const struct esp_event_handler* handler, esp_event_base_t base, int32_t id)
+{
+    return (handler->base == ESP_EVENT_ANY_BASE || handler->base == base) && (handler->id == ESP_EVENT_ANY_ID || handler->id == id);
+}
+
+static void esp_event_task_(void* args)
+{
+    (void) args;
+
+    while (true) {
+        struct esp_event event;
+
+        if (xQueueReceive(esp_event_queue_, &event, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+
+        pthread_mutex_lock(&esp_event_lock_);
+
+        for (struct esp_event_handler* handler = esp_event_handlers_; handler != NULL; handler = handler->next) {
+            if (esp_event_matches_(handler, event.base, event.id)) {
+                handler->handler(handler->arg, event.base, event.id, event.data);
+            }
+        }
+
+        pthread_mutex_unlock(&esp_event_lock_);
+        free(event.data);
+    }
+}
+
+esp_err_t esp_event_loop_create_default(void)
+{
+    if (esp_event_queue_ != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    esp_event_queue_ = xQueueCreate(ESP_EVENT_QUEUE_LEN, sizeof(struct esp_event));
+
+    if (esp_event_queue_ == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (xTaskCreate(esp_event_task_, "sys_evt", ESP_EVENT_TASK_STACK_DEPTH, NULL, 20, NULL) != pdPASS) {
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t esp_event_handler_instance_register(esp_event_base_t event_base, int32_t event_id, esp_event_handler_t event_handler, void* event_handler_arg, esp_event_handler_instance_t* instance)
+{
+    if (esp_event_queue_ == NULL) {
+        ESP_LOGE(TAG, "the default event loop was not created");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (event_handler == NULL || (event_base == ESP_EVENT_ANY_BASE && event_id != ESP_EVENT_ANY_ID)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    struct esp_event_handler* handler = calloc(1, sizeof(struct esp_event_handler));
+
+    if (handler == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    handler->base = event_base;
+    handler->id = event_id;
+    handler->handler = event_handler;
+    handler->arg = event_handler_arg;
+
+    pthread_mutex_lock(&esp_event_lock_);
+
+    struct esp_event_handler** cursor = &esp_event_handlers_;
+
+    while (*cursor != NULL) {
+        cursor = &(*cursor)->next;
+    }
+
+    *cursor = handler;
+    pthread_mutex_unlock(&esp_event_lock_);
+
+    if (instance != NULL) {
+        *instance = handler;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t esp_event_handler_register(esp_event_base_t event_base, int32_t event_id, esp_event_handler_t event_handler, void* event_handler_arg)
+{
+    return esp_event_handler_instance_register(event_base, event_id, event_handler, event_handler_arg, NULL);
+}
+
+static esp_err_t esp_event_unregister_(esp_event_base_t event_base, int32_t event_id, esp_event_handler_t event_handler, esp_event_handler_instance_t instance)
+{
+    esp_err_t rc = ESP_ERR_NOT_FOUND;
+
+    pthread_mutex_lock(&esp_event_lock_);
+
+    for (struct esp_event_handler** cursor = &esp_event_handlers_; *cursor != NULL; cursor = &(*cursor)->next) {
+        struct esp_event_handler* handler = *cursor;
+
+        if (handler->base != event_base || handler->id != event_id) {
+            continue;
+        }
+
+        if ((instance != NULL && handler == instance) || (instance == NULL && handler->handler == event_handler)) {
+            *cursor = handler->next;
+            free(handler);
+            rc = ESP_OK;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&esp_event_lock_);
+    return rc;
+}
+
+esp_err_t esp_event_handler_unregister(esp_event_base_t event_base, int32_t event_id, esp_event_handler_t event_handler)
+{
+    return esp_event_unregister_(event_base, event_id, event_handler, NULL);
+}
+
+esp_err_t esp_event_handler_instance_unregister(esp_event_base_t event_base, int32_t event_id, esp_event_handler_instance_t instance)
+{
+    if (instance == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    return esp_event_unregister_(event_base, event_id, NULL, instance);
+}
+
+esp_err_t esp_event_post(esp_event_base_t event_base, int32_t event_id, const void* event_data, size_t event_data_size, TickType_t ticks_to_wait)
+{
+    if (esp_event_queue_ == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    struct esp_event event = {
+        .base = event_base,
+        .id = event_id,
+        .data = NULL,
+    };
+
+    // Handlers get a copy, the poster's data may be gone by the time they run
+    if (event_data != NULL && event_data_size > 0) {
+        event.data = malloc(event_data_size);
+
+        if (event.data == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+
+        memcpy(event.data, event_data, event_data_size);
+    }
+
+    if (xQueueSend(esp_event_queue_, &event, ticks_to_wait) != pdTRUE) {
+        free(event.data);
+        return ESP_ERR_TIMEOUT;
+    }
+
+    return ESP_OK;
+}
\ No newline at end of file
@@ -0,0 +1,285 @@
+#include <esp_partition.h>
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <esp_log.h>
+
+enum {
+    // Partitions read from the table
+    PARTITION_MAX = 16,
+
+    // Where the table leaves the first partition, and how it aligns the next
+    PARTITION_FIRST_OFFSET = 0x9000,
+    PARTITION_DATA_ALIGN = 0x1000,
+    PARTITION_APP_ALIGN = 0x10000,
+};
+
+static const char* TAG = "esp_partition";
+
+struct partition {
+    esp_partition_t info;
+    uint8_t* contents;
+};
+
+static pthread_once_t partition_once_ = PTHREAD_ONCE_INIT;
+static pthread_mutex_t partition_lock_ = PTHREAD_MUTEX_INITIALIZER;
+static struct partition partitions_[PARTITION_MAX];
+static size_t partition_count_ = 0;
+
+static char* partition_trim_(char* field)
+{
+    while (isspace((unsigned char) *field)) {
+        field++;
+    }
+
+    char* end = field + strlen(field);
+
+    while (end > field && isspace((unsigned char) end[-1])) {
+        *--end = '\0';
+    }
+
+    return field;
+}
+
+// Sizes and offsets as gen_esp32part.py reads them: hex, decimal, or with a K
+// or M suffix
+static uint32_t partition_parse_size_(const char* field)
+{
+    char* end = NULL;
+    unsigned long value = strtoul(field, &end, 0);
+
+    if (*end == 'K' || *end == 'k') {
+        value *= 1024;
+    } else if (*end == 'M' || *end == 'm') {
+        value *= 1024 * 1024;
+    }
+
+    return (uint32_t) value;
+}
+
+static int partition_parse_subtype_(const char* field)
+{
+    static const struct {
+        const char* name;
+        int subtype;
+    } names[] = {
+        { "factory", ESP_PARTITION_SUBTYPE_APP_FACTORY },
+        { "phy", ESP_PARTITION_SUBTYPE_DATA_PHY },
+        { "nvs", ESP_PARTITION_SUBTYPE_DATA_NVS },
+    };
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strcmp(field, names[i].name) == 0) {
+            return names[i].subtype;
+        }
+    }
+
+    return (int) strtol(field, NULL, 0);
+}
+
+// Maps `<label>.bin` under GANYMEDE_FLASH_DIR, so that contents survive the
+// process. Erased flash reads 0xFF, as does a new file once filled. Contents
+// are mapped rather than allocated, to stay out of the heap figures.
+static uint8_t* partition_map_(const esp_partition_t* info)
+{
+    const char* directory = getenv("GANYMEDE_FLASH_DIR");
+
+    if (directory == NULL) {
+        uint8_t* contents = mmap(NULL, info->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (contents == MAP_FAILED) {
+            return NULL;
+        }
+
+        memset(contents, 0xFF, info->size);
+        return contents;
+    }
+
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s.bin", directory, info->label);
+
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+
+    if (fd < 0) {
+        ESP_LOGE(TAG, "failed to open %s", path);
+        return NULL;
+    }
+
+    off_t length = lseek(fd, 0, SEEK_END);
+
+    if (length < (off_t) info->size && ftruncate(fd, info->size) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    uint8_t* contents = mmap(NULL, info->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (contents == MAP_FAILED) {
+        return NULL;
+    }
+
+    if (length < (off_t) info->size) {
+        memset(&contents[length], 0xFF, info->size - (size_t) length);
+    }
+
+    return contents;
+}
+
+static void partition_load_table_(void)
+{
+    FILE* file = fopen(HOST_PARTITION_TABLE, "r");
+
+    if (file == NULL) {
+        ESP_LOGE(TAG, "failed to open %s", HOST_PARTITION_TABLE);
+        return;
+    }
+
+    char line[256];
+    uint32_t offset = PARTITION_FIRST_OFFSET;
+
+    while (fgets(line, sizeof(line), file) != NULL && partition_count_ < PARTITION_MAX) {
+        char* fields[5] = { 0 };
+        char* cursor = line;
+        size_t count = 0;
+
+        if (line[0] == '#') {
+            continue;
+        }
+
+        while (count < 5 && cursor != NULL) {
+            fields[count++] = partition_trim_(strsep(&cursor, ","));
+        }
+
+        if (count < 5 || fields[0][0] == '\0') {
+            continue;
+        }
+
+        esp_partition_t* info = &partitions_[partition_count_].info;
+        bool app = strcmp(fields[1], "app") == 0;
+
+        strncpy(info->label, fields[0], sizeof(info->label) - 1);
+        info->type = app ? ESP_PARTITION_TYPE_APP : ESP_PARTITION_TYPE_DATA;
+        info->subtype = (esp_partition_subtype_t) partition_parse_subtype_(fields[2]);
+        info->size = partition_parse_size_(fields[4]);
+        info->erase_size = SPI_FLASH_SEC_SIZE;
+
+        if (fields[3][0] != '\0') {
+            offset = partition_parse_size_(fields[3]);
+        } else {
+            uint32_t align = app ? PARTITION_APP_ALIGN : PARTITION_DATA_ALIGN;
+            offset = (offset + align - 1) & ~(align - 1);
+        }
+
+        info->address = offset;
+        offset += info->size;
+        partition_count_++;
+    }
+
+    fclose(file);
+}
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char* label)
+{
+    pthread_once(&partition_once_, partition_load_table_);
+
+    for (size_t i = 0; i < partition_count_; i++) {
+        struct partition* partition = &partitions_[i];
+
+        if (type != ESP_PARTITION_TYPE_ANY && partition->info.type != type) {
+            continue;
+        }
+
+        if (subtype != ESP_PARTITION_SUBTYPE_ANY && partition->info.subtype != subtype) {
+            continue;
+        }
+
+        if (label != NULL && strcmp(partition->info.label, label) != 0) {
+            continue;
+        }
+
+        pthread_mutex_lock(&partition_lock_);
+
+        if (partition->contents == NULL) {
+            partition->contents = partition_map_(&partition->info);
+        }
+
+        pthread_mutex_unlock(&partition_lock_);
+
+        return partition->contents != NULL ? &partition->info : NULL;
+    }
+
+    return NULL;
+}
+
+// esp_partition_t is the first member of its partition
+static uint8_t* partition_contents_(const esp_partition_t* info, size_t offset, size_t size)
+{
+    if (info == NULL || offset > info->size || size > info->size - offset) {
+        return NULL;
+    }
+
+    return &((const struct partition*) info)->contents[offset];
+}
+
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t src_offset, void* dst, size_t size)
+{
+    uint8_t* contents = partition_contents_(partition, src_offset, size);
+
+    if (contents == NULL) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    pthread_mutex_lock(&partition_lock_);
+    memcpy(dst, contents, size);
+    pthread_mutex_unlock(&partition_lock_);
+
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t* partition, size_t dst_offset, const void* src, size_t size)
+{
+    uint8_t* contents = partition_contents_(partition, dst_offset, size);
+
+    if (contents == NULL) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    const uint8_t* bytes = (const uint8_t*) src;
+
+    // Programming can only clear bits
+    pthread_mutex_lock(&partition_lock_);
+
+    for (size_t i = 0; i < size; i++) {
+        contents[i] &= bytes[i];
+    }
+
+    pthread_mutex_unlock(&partition_lock_);
+
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t* partition, size_t offset, size_t size)
+{
+    uint8_t* contents = partition_contents_(partition, offset, size);
+
+    if (contents == NULL) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    if (offset % partition->erase_size != 0 || size % partition->erase_size != 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    pthread_mutex_lock(&partition_lock_);
+    memset(contents, 0xFF, size);
+    pthread_mutex_unlock(&partition_lock_);
+
+    return ESP_OK;
+}
\ No newline at end of file
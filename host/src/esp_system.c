@@ -0,0 +1,191 @@
+#include <esp_err.h>
+#include <esp_log.h>
+#include <esp_mac.h>
+#include <esp_random.h>
+#include <esp_rom_crc.h>
+#include <esp_timer.h>
+#include <esp_vfs_eventfd.h>
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <rom/ets_sys.h>
+
+static pthread_mutex_t log_lock_ = PTHREAD_MUTEX_INITIALIZER;
+static esp_log_level_t log_level_ = (esp_log_level_t) CONFIG_LOG_DEFAULT_LEVEL;
+
+const char* esp_err_to_name(esp_err_t code)
+{
+    static const struct {
+        esp_err_t code;
+        const char* name;
+    } names[] = {
+        { ESP_OK, "ESP_OK" },
+        { ESP_FAIL, "ESP_FAIL" },
+        { ESP_ERR_NO_MEM, "ESP_ERR_NO_MEM" },
+        { ESP_ERR_INVALID_ARG, "ESP_ERR_INVALID_ARG" },
+        { ESP_ERR_INVALID_STATE, "ESP_ERR_INVALID_STATE" },
+        { ESP_ERR_INVALID_SIZE, "ESP_ERR_INVALID_SIZE" },
+        { ESP_ERR_NOT_FOUND, "ESP_ERR_NOT_FOUND" },
+        { ESP_ERR_NOT_SUPPORTED, "ESP_ERR_NOT_SUPPORTED" },
+        { ESP_ERR_TIMEOUT, "ESP_ERR_TIMEOUT" },
+        { ESP_ERR_INVALID_RESPONSE, "ESP_ERR_INVALID_RESPONSE" },
+        { ESP_ERR_INVALID_CRC, "ESP_ERR_INVALID_CRC" },
+        { ESP_ERR_INVALID_VERSION, "ESP_ERR_INVALID_VERSION" },
+        { ESP_ERR_INVALID_MAC, "ESP_ERR_INVALID_MAC" },
+        { ESP_ERR_NOT_FINISHED, "ESP_ERR_NOT_FINISHED" },
+        { ESP_ERR_NVS_NOT_INITIALIZED, "ESP_ERR_NVS_NOT_INITIALIZED" },
+        { ESP_ERR_NVS_NOT_FOUND, "ESP_ERR_NVS_NOT_FOUND" },
+        { ESP_ERR_NVS_TYPE_MISMATCH, "ESP_ERR_NVS_TYPE_MISMATCH" },
+        { ESP_ERR_NVS_READ_ONLY, "ESP_ERR_NVS_READ_ONLY" },
+        { ESP_ERR_NVS_NOT_ENOUGH_SPACE, "ESP_ERR_NVS_NOT_ENOUGH_SPACE" },
+        { ESP_ERR_NVS_INVALID_NAME, "ESP_ERR_NVS_INVALID_NAME" },
+        { ESP_ERR_NVS_INVALID_HANDLE, "ESP_ERR_NVS_INVALID_HANDLE" },
+        { ESP_ERR_NVS_KEY_TOO_LONG, "ESP_ERR_NVS_KEY_TOO_LONG" },
+        { ESP_ERR_NVS_INVALID_LENGTH, "ESP_ERR_NVS_INVALID_LENGTH" },
+        { ESP_ERR_NVS_NO_FREE_PAGES, "ESP_ERR_NVS_NO_FREE_PAGES" },
+        { ESP_ERR_NVS_NEW_VERSION_FOUND, "ESP_ERR_NVS_NEW_VERSION_FOUND" },
+    };
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (names[i].code == code) {
+            return names[i].name;
+        }
+    }
+
+    return "UNKNOWN ERROR";
+}
+
+void esp_error_check_failed_(esp_err_t rc, const char* file, int line, const char* function, const char* expression)
+{
+    fprintf(stderr, "ESP_ERROR_CHECK failed: esp_err_t 0x%x (%s) at %s:%d\nfunc: %s\nexpression: %s\n", rc, esp_err_to_name(rc), file, line, function, expression);
+    abort();
+}
+
+void esp_log_level_set(const char* tag, esp_log_level_t level)
+{
+    (void) tag;
+    log_level_ = level;
+}
+
+esp_log_level_t esp_log_level_get(const char* tag)
+{
+    (void) tag;
+    return log_level_;
+}
+
+uint32_t esp_log_timestamp(void)
+{
+    return (uint32_t) (esp_timer_get_time() / 1000);
+}
+
+void esp_log_write(esp_log_level_t level, const char* tag, const char* format, ...)
+{
+    (void) tag;
+
+    if (level > log_level_) {
+        return;
+    }
+
+    va_list args;
+    va_start(args, format);
+
+    // On stdout, as the device's console interleaves logs with printf
+    pthread_mutex_lock(&log_lock_);
+    vfprintf(stdout, format, args);
+    fflush(stdout);
+    pthread_mutex_unlock(&log_lock_);
+
+    va_end(args);
+}
+
+uint32_t esp_random(void)
+{
+    uint32_t value;
+    esp_fill_random(&value, sizeof(value));
+    return value;
+}
+
+void esp_fill_random(void* buf, size_t len)
+{
+    uint8_t* bytes = (uint8_t*) buf;
+
+    while (len > 0) {
+        ssize_t rc = getrandom(bytes, len, 0);
+
+        if (rc > 0) {
+            bytes += rc;
+            len -= (size_t) rc;
+        }
+    }
+}
+
+esp_err_t esp_read_mac(uint8_t* mac, esp_mac_type_t type)
+{
+    const char* configured = getenv("GANYMEDE_MAC");
+    unsigned int octets[6];
+
+    if (mac == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (configured != NULL && sscanf(configured, "%x:%x:%x:%x:%x:%x", &octets[0], &octets[1], &octets[2], &octets[3], &octets[4], &octets[5]) == 6) {
+        for (size_t i = 0; i < 6; i++) {
+            mac[i] = (uint8_t) octets[i];
+        }
+    } else {
+        char hostname[64] = { 0 };
+        gethostname(hostname, sizeof(hostname) - 1);
+
+        uint32_t hash = esp_rom_crc32_le(0, (const uint8_t*) hostname, (uint32_t) strlen(hostname));
+
+        // Locally administered, unicast
+        mac[0] = 0x02;
+        mac[1] = 0x00;
+        mac[2] = (uint8_t) (hash >> 24);
+        mac[3] = (uint8_t) (hash >> 16);
+        mac[4] = (uint8_t) (hash >> 8);
+        mac[5] = (uint8_t) hash;
+    }
+
+    // The other interfaces follow the station's, as in the eFuse derived ones
+    mac[5] += (uint8_t) type;
+    return ESP_OK;
+}
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t* buf, uint32_t len)
+{
+    crc = ~crc;
+
+    for (uint32_t i = 0; i < len; i++) {
+        crc ^= buf[i];
+
+        for (size_t j = 0; j < 8; j++) {
+            crc = (crc >> 1) ^ (0xEDB88320U & (0U - (crc & 1U)));
+        }
+    }
+
+    return ~crc;
+}
+
+void ets_delay_us(uint32_t us)
+{
+    struct timespec delay = {
+        .tv_sec = us / 1000000,
+        .tv_nsec = (long) (us % 1000000) * 1000,
+    };
+
+    nanosleep(&delay, NULL);
+}
+
+esp_err_t esp_vfs_eventfd_register(const esp_vfs_eventfd_config_t* config)
+{
+    (void) config;
+    return ESP_OK;
+}
\ No newline at end of file
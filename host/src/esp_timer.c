@@ -0,0 +1,275 @@
+#include <esp_timer.h>
+
+#include <host/clock.h>
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <esp_log.h>
+
+#include <freertos/FreeRTOS.h>
+
+enum {
+    ESP_TIMER_TASK_STACK_DEPTH = 1024 * 4,
+};
+
+static const char* TAG = "esp_timer";
+
+struct esp_timer {
+    esp_timer_cb_t callback;
+    void* arg;
+    const char* name;
+
+    // Absolute time of the next alarm, in esp_timer_get_time's microseconds
+    int64_t alarm;
+    uint64_t period;
+    bool armed;
+
+    // Armed timers, soonest first
+    struct esp_timer* next;
+};
+
+static pthread_once_t esp_timer_once_ = PTHREAD_ONCE_INIT;
+static pthread_mutex_t esp_timer_lock_ = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t esp_timer_cond_;
+static struct esp_timer* esp_timer_armed_ = NULL;
+
+static struct timespec esp_timer_boot_;
+static int64_t esp_timer_drift_ = 0;
+
+// Taken before main, so uptimes start near zero like the device's
+__attribute__((constructor)) static void esp_timer_init_boot_(void)
+{
+    clock_gettime(CLOCK_MONOTONIC, &esp_timer_boot_);
+
+    const char* drift = getenv("GANYMEDE_CLOCK_DRIFT");
+
+    if (drift != NULL) {
+        esp_timer_drift_ = strtoll(drift, NULL, 10);
+    }
+}
+
+int64_t esp_timer_get_time(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    int64_t elapsed = (int64_t) (now.tv_sec - esp_timer_boot_.tv_sec) * 1000000 + (now.tv_nsec - esp_timer_boot_.tv_nsec) / 1000;
+    // Split so that neither product overflows
+    return elapsed + (elapsed / 1000000) * esp_timer_drift_ + ((elapsed % 1000000) * esp_timer_drift_) / 1000000;
+}
+
+struct timespec host_clock_to_monotonic(int64_t uptime)
+{
+    int64_t rate = 1000000 + esp_timer_drift_;
+    int64_t elapsed = uptime - (uptime / rate) * esp_timer_drift_ - ((uptime % rate) * esp_timer_drift_) / rate;
+    int64_t ns = (int64_t) esp_timer_boot_.tv_nsec + elapsed * 1000;
+
+    struct timespec result = {
+        .tv_sec = esp_timer_boot_.tv_sec + ns / 1000000000,
+        .tv_nsec = ns % 1000000000,
+    };
+
+    if (result.tv_nsec < 0) {
+        result.tv_sec--;
+        result.tv_nsec += 1000000000;
+    }
+
+    return result;
+}
+
+static void esp_timer_insert_(struct esp_timer* timer)
+{
+    struct esp_timer** cursor = &esp_timer_armed_;
+
+    while (*cursor != NULL && (*cursor)->alarm <= timer->alarm) {
+        cursor = &(*cursor)->next;
+    }
+
+    timer->next = *cursor;
+    *cursor = timer;
+    timer->armed = true;
+}
+
+static void esp_timer_remove_(struct esp_timer* timer)
+{
+    for (struct esp_timer** cursor = &esp_timer_armed_; *cursor != NULL; cursor = &(*cursor)->next) {
+        if (*cursor == timer) {
+            *cursor = timer->next;
+            break;
+        }
+    }
+
+    timer->next = NULL;
+    timer->armed = false;
+}
+
+// Callbacks run one after the other on this task, without the lock held, so
+// they may re-arm their own timer
+static void esp_timer_task_(void* args)
+{
+    (void) args;
+
+    pthread_mutex_lock(&esp_timer_lock_);
+
+    while (true) {
+        struct esp_timer* timer = esp_timer_armed_;
+
+        if (timer == NULL) {
+            pthread_cond_wait(&esp_timer_cond_, &esp_timer_lock_);
+            continue;
+        }
+
+        if (timer->alarm > esp_timer_get_time()) {
+            struct timespec deadline = host_clock_to_monotonic(timer->alarm);
+
+            pthread_cond_timedwait(&esp_timer_cond_, &esp_timer_lock_, &deadline);
+            continue;
+        }
+
+        esp_timer_remove_(timer);
+
+        if (timer->period > 0) {
+            timer->alarm += (int64_t) timer->period;
+            esp_timer_insert_(timer);
+        }
+
+        esp_timer_cb_t callback = timer->callback;
+        void* arg = timer->arg;
+
+        pthread_mutex_unlock(&esp_timer_lock_);
+        callback(arg);
+        pthread_mutex_lock(&esp_timer_lock_);
+    }
+}
+
+static void esp_timer_start_task_(void)
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&esp_timer_cond_, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if (xTaskCreate(esp_timer_task_, "esp_timer", ESP_TIMER_TASK_STACK_DEPTH, NULL, 22, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "failed to start the esp_timer task");
+        abort();
+    }
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* create_args, esp_timer_handle_t* out_handle)
+{
+    if (create_args == NULL || create_args->callback == NULL || out_handle == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    pthread_once(&esp_timer_once_, esp_timer_start_task_);
+
+    struct esp_timer* timer = calloc(1, sizeof(struct esp_timer));
+
+    if (timer == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    timer->callback = create_args->callback;
+    timer->arg = create_args->arg;
+    timer->name = create_args->name;
+
+    *out_handle = timer;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+    if (timer == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    pthread_mutex_lock(&esp_timer_lock_);
+    bool armed = timer->armed;
+    pthread_mutex_unlock(&esp_timer_lock_);
+
+    if (armed) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    free(timer);
+    return ESP_OK;
+}
+
+static esp_err_t esp_timer_arm_(esp_timer_handle_t timer, uint64_t timeout_us, uint64_t period, bool restart)
+{
+    esp_err_t rc = ESP_OK;
+
+    if (timer == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    pthread_mutex_lock(&esp_timer_lock_);
+
+    if (timer->armed != restart) {
+        rc = ESP_ERR_INVALID_STATE;
+        goto exit;
+    }
+
+    if (restart) {
+        esp_timer_remove_(timer);
+        period = timer->period > 0 ? timeout_us : 0;
+    }
+
+    timer->alarm = esp_timer_get_time() + (int64_t) timeout_us;
+    timer->period = period;
+    esp_timer_insert_(timer);
+
+    pthread_cond_signal(&esp_timer_cond_);
+
+exit:
+    pthread_mutex_unlock(&esp_timer_lock_);
+    return rc;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    return esp_timer_arm_(timer, timeout_us, 0, false);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period)
+{
+    return esp_timer_arm_(timer, period, period, false);
+}
+
+esp_err_t esp_timer_restart(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    return esp_timer_arm_(timer, timeout_us, 0, true);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    esp_err_t rc = ESP_OK;
+
+    if (timer == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    pthread_mutex_lock(&esp_timer_lock_);
+
+    if (!timer->armed) {
+        rc = ESP_ERR_INVALID_STATE;
+    } else {
+        esp_timer_remove_(timer);
+    }
+
+    pthread_mutex_unlock(&esp_timer_lock_);
+    return rc;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t timer)
+{
+    pthread_mutex_lock(&esp_timer_lock_);
+    bool armed = timer->armed;
+    pthread_mutex_unlock(&esp_timer_lock_);
+
+    return armed;
+}
\ No newline at end of file
@@ -0,0 +1,451 @@
+#include <esp_tls.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+
+#include <esp_crt_bundle.h>
+#include <esp_log.h>
+
+enum {
+    // Longest ALPN list in wire format
+    ESP_TLS_ALPN_MAX_LEN = 64,
+};
+
+static const char* TAG = "esp-tls";
+
+struct esp_tls {
+    esp_tls_conn_state_t state;
+    int sockfd;
+    SSL* ssl;
+
+    // What crt_bundle_attach installs its verify callback into
+    mbedtls_ssl_config conf;
+};
+
+static pthread_once_t esp_tls_once_ = PTHREAD_ONCE_INIT;
+static SSL_CTX* esp_tls_ctx_ = NULL;
+static int esp_tls_index_ = -1;
+
+static int esp_tls_verify_(int preverify_ok, X509_STORE_CTX* store)
+{
+    SSL* ssl = X509_STORE_CTX_get_ex_data(store, SSL_get_ex_data_X509_STORE_CTX_idx());
+    esp_tls_t* tls = SSL_get_ex_data(ssl, esp_tls_index_);
+
+    if (tls == NULL || tls->conf.MBEDTLS_PRIVATE(f_vrfy) == NULL) {
+        return preverify_ok;
+    }
+
+    uint32_t flags = preverify_ok ? 0 : MBEDTLS_X509_BADCERT_NOT_TRUSTED;
+    int rc = tls->conf.MBEDTLS_PRIVATE(f_vrfy)(tls->conf.MBEDTLS_PRIVATE(p_vrfy), NULL, X509_STORE_CTX_get_error_depth(store), &flags);
+
+    return rc == 0 && flags == 0;
+}
+
+static void esp_tls_init_ctx_(void)
+{
+    esp_tls_ctx_ = SSL_CTX_new(TLS_client_method());
+
+    if (esp_tls_ctx_ == NULL) {
+        return;
+    }
+
+    SSL_CTX_set_max_proto_version(esp_tls_ctx_, TLS1_2_VERSION);
+    SSL_CTX_set_default_verify_paths(esp_tls_ctx_);
+    SSL_CTX_set_verify(esp_tls_ctx_, SSL_VERIFY_PEER, esp_tls_verify_);
+    SSL_CTX_set_mode(esp_tls_ctx_, SSL_MODE_ENABLE_PARTIAL_WRITE);
+
+    esp_tls_index_ = SSL_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+}
+
+esp_tls_t* esp_tls_init(void)
+{
+    esp_tls_t* tls = calloc(1, sizeof(esp_tls_t));
+
+    if (tls == NULL) {
+        return NULL;
+    }
+
+    tls->state = ESP_TLS_INIT;
+    tls->sockfd = -1;
+
+    return tls;
+}
+
+int esp_tls_conn_destroy(esp_tls_t* tls)
+{
+    if (tls == NULL) {
+        return -1;
+    }
+
+    if (tls->ssl != NULL) {
+        SSL_free(tls->ssl);
+    }
+
+    if (tls->sockfd >= 0) {
+        close(tls->sockfd);
+    }
+
+    free(tls);
+    return 0;
+}
+
+static int esp_tls_tcp_connect_(esp_tls_t* tls, const char* hostname, int hostlen, int port)
+{
+    char host[256];
+    char service[8];
+    struct addrinfo* addresses = NULL;
+
+    struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM,
+    };
+
+    if (hostlen <= 0 || (size_t) hostlen >= sizeof(host)) {
+        return -1;
+    }
+
+    memcpy(host, hostname, (size_t) hostlen);
+    host[hostlen] = '\0';
+    snprintf(service, sizeof(service), "%d", port);
+
+    if (getaddrinfo(host, service, &hints, &addresses) != 0 || addresses == NULL) {
+        ESP_LOGE(TAG, "couldn't resolve %s", host);
+        return -1;
+    }
+
+    tls->sockfd = socket(addresses->ai_family, addresses->ai_socktype, addresses->ai_protocol);
+
+    if (tls->sockfd < 0) {
+        freeaddrinfo(addresses);
+        return -1;
+    }
+
+    fcntl(tls->sockfd, F_SETFL, fcntl(tls->sockfd, F_GETFL, 0) | O_NONBLOCK);
+
+    int rc = connect(tls->sockfd, addresses->ai_addr, addresses->ai_addrlen);
+    freeaddrinfo(addresses);
+
+    if (rc != 0 && errno != EINPROGRESS) {
+        ESP_LOGE(TAG, "failed to connect to %s:%d: %s", host, port, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+static int esp_tls_create_ssl_(esp_tls_t* tls, const char* hostname, int hostlen, const esp_tls_cfg_t* cfg)
+{
+    unsigned char alpn[ESP_TLS_ALPN_MAX_LEN];
+    size_t alpn_length = 0;
+    char name[256];
+
+    pthread_once(&esp_tls_once_, esp_tls_init_ctx_);
+
+    if (esp_tls_ctx_ == NULL) {
+        return -1;
+    }
+
+    tls->ssl = SSL_new(esp_tls_ctx_);
+
+    if (tls->ssl == NULL || !SSL_set_fd(tls->ssl, tls->sockfd)) {
+        return -1;
+    }
+
+    SSL_set_ex_data(tls->ssl, esp_tls_index_, tls);
+    SSL_set_connect_state(tls->ssl);
+
+    for (const char** proto = cfg->alpn_protos; proto != NULL && *proto != NULL; proto++) {
+        size_t length = strlen(*proto);
+
+        if (length == 0 || length > UINT8_MAX || alpn_length + 1 + length > sizeof(alpn)) {
+            return -1;
+        }
+
+        alpn[alpn_length++] = (unsigned char) length;
+        memcpy(&alpn[alpn_length], *proto, length);
+        alpn_length += length;
+    }
+
+    if (alpn_length > 0 && SSL_set_alpn_protos(tls->ssl, alpn, (unsigned int) alpn_length) != 0) {
+        return -1;
+    }
+
+    if (cfg->common_name != NULL) {
+        snprintf(name, sizeof(name), "%s", cfg->common_name);
+    } else if (hostlen > 0 && (size_t) hostlen < sizeof(name)) {
+        memcpy(name, hostname, (size_t) hostlen);
+        name[hostlen] = '\0';
+    } else {
+        return -1;
+    }
+
+    SSL_set_tlsext_host_name(tls->ssl, name);
+
+    if (!cfg->skip_common_name && !SSL_set1_host(tls->ssl, name)) {
+        return -1;
+    }
+
+    if (cfg->crt_bundle_attach != NULL && cfg->crt_bundle_attach(&tls->conf) != ESP_OK) {
+        return -1;
+    }
+
+    if (cfg->client_session != NULL && cfg->client_session->saved_session.MBEDTLS_PRIVATE(handle) != NULL) {
+        SSL_set_session(tls->ssl, cfg->client_session->saved_session.MBEDTLS_PRIVATE(handle));
+    }
+
+    return 0;
+}
+
+// Steps through the connection one state at a time; the caller waits on the
+// socket in between, as it does on the device.
+int esp_tls_conn_new_async(const char* hostname, int hostlen, int port, const esp_tls_cfg_t* cfg, esp_tls_t* tls)
+{
+    if (tls == NULL || cfg == NULL) {
+        return -1;
+    }
+
+    switch (tls->state) {
+    case ESP_TLS_INIT:
+        if (esp_tls_tcp_connect_(tls, hostname, hostlen, port) != 0) {
+            tls->state = ESP_TLS_FAIL;
+            return -1;
+        }
+
+        tls->state = ESP_TLS_CONNECTING;
+        return 0;
+
+    case ESP_TLS_CONNECTING: {
+        int error = 0;
+        socklen_t length = sizeof(error);
+
+        if (getsockopt(tls->sockfd, SOL_SOCKET, SO_ERROR, &error, &length) != 0 || error != 0) {
+            ESP_LOGE(TAG, "failed to connect: %s", strerror(error));
+            tls->state = ESP_TLS_FAIL;
+            return -1;
+        }
+
+        // Still in progress unless the peer is known
+        struct sockaddr_storage peer;
+        socklen_t peer_length = sizeof(peer);
+
+        if (getpeername(tls->sockfd, (struct sockaddr*) &peer, &peer_length) != 0) {
+            return 0;
+        }
+
+        if (esp_tls_create_ssl_(tls, hostname, hostlen, cfg) != 0) {
+            tls->state = ESP_TLS_FAIL;
+            return -1;
+        }
+
+        tls->state = ESP_TLS_HANDSHAKE;
+    }
+        // fall through
+
+    case ESP_TLS_HANDSHAKE: {
+        int rc = SSL_do_handshake(tls->ssl);
+
+        if (rc == 1) {
+            tls->state = ESP_TLS_DONE;
+            return 1;
+        }
+
+        int error = SSL_get_error(tls->ssl, rc);
+
+        if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE) {
+            return 0;
+        }
+
+        ESP_LOGE(TAG, "handshake failed: %s", ERR_reason_error_string(ERR_get_error()));
+        tls->state = ESP_TLS_FAIL;
+        return -1;
+    }
+
+    case ESP_TLS_DONE:
+        return 1;
+
+    case ESP_TLS_FAIL:
+    default:
+        return -1;
+    }
+}
+
+static ssize_t esp_tls_result_(esp_tls_t* tls, int rc)
+{
+    if (rc > 0) {
+        return rc;
+    }
+
+    switch (SSL_get_error(tls->ssl, rc)) {
+    case SSL_ERROR_WANT_READ:
+        return ESP_TLS_ERR_SSL_WANT_READ;
+
+    case SSL_ERROR_WANT_WRITE:
+        return ESP_TLS_ERR_SSL_WANT_WRITE;
+
+    case SSL_ERROR_ZERO_RETURN:
+        return 0;
+
+    default:
+        ERR_clear_error();
+        return -1;
+    }
+}
+
+ssize_t esp_tls_conn_write(esp_tls_t* tls, const void* data, size_t datalen)
+{
+    if (tls == NULL || tls->ssl == NULL) {
+        return -1;
+    }
+
+    return esp_tls_result_(tls, SSL_write(tls->ssl, data, (int) datalen));
+}
+
+ssize_t esp_tls_conn_read(esp_tls_t* tls, void* data, size_t datalen)
+{
+    if (tls == NULL || tls->ssl == NULL) {
+        return -1;
+    }
+
+    return esp_tls_result_(tls, SSL_read(tls->ssl, data, (int) datalen));
+}
+
+ssize_t esp_tls_get_bytes_avail(esp_tls_t* tls)
+{
+    if (tls == NULL || tls->ssl == NULL) {
+        return -1;
+    }
+
+    return SSL_pending(tls->ssl);
+}
+
+esp_err_t esp_tls_get_conn_state(esp_tls_t* tls, esp_tls_conn_state_t* conn_state)
+{
+    if (tls == NULL || conn_state == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    *conn_state = tls->state;
+    return ESP_OK;
+}
+
+esp_err_t esp_tls_get_conn_sockfd(esp_tls_t* tls, int* sockfd)
+{
+    if (tls == NULL || sockfd == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    *sockfd = tls->sockfd;
+    return ESP_OK;
+}
+
+esp_tls_client_session_t* esp_tls_get_client_session(esp_tls_t* tls)
+{
+    if (tls == NULL || tls->ssl == NULL) {
+        return NULL;
+    }
+
+    SSL_SESSION* handle = SSL_get1_session(tls->ssl);
+
+    if (handle == NULL) {
+        return NULL;
+    }
+
+    esp_tls_client_session_t* session = calloc(1, sizeof(esp_tls_client_session_t));
+
+    if (session == NULL) {
+        SSL_SESSION_free(handle);
+        return NULL;
+    }
+
+    session->saved_session.MBEDTLS_PRIVATE(handle) = handle;
+    return session;
+}
+
+void esp_tls_free_client_session(esp_tls_client_session_t* client_session)
+{
+    if (client_session == NULL) {
+        return;
+    }
+
+    mbedtls_ssl_session_free(&client_session->saved_session);
+    free(client_session);
+}
+
+void mbedtls_ssl_session_init(mbedtls_ssl_session* session)
+{
+    session->MBEDTLS_PRIVATE(handle) = NULL;
+}
+
+void mbedtls_ssl_session_free(mbedtls_ssl_session* session)
+{
+    if (session->MBEDTLS_PRIVATE(handle) != NULL) {
+        SSL_SESSION_free(session->MBEDTLS_PRIVATE(handle));
+        session->MBEDTLS_PRIVATE(handle) = NULL;
+    }
+}
+
+int mbedtls_ssl_session_save(const mbedtls_ssl_session* session, unsigned char* buf, size_t buf_len, size_t* olen)
+{
+    SSL_SESSION* handle = session->MBEDTLS_PRIVATE(handle);
+    int length = handle != NULL ? i2d_SSL_SESSION(handle, NULL) : 0;
+
+    if (length <= 0) {
+        return MBEDTLS_ERR_SSL_BAD_INPUT_DATA;
+    }
+
+    *olen = (size_t) length;
+
+    if (buf == NULL || buf_len < (size_t) length) {
+        return MBEDTLS_ERR_SSL_BUFFER_TOO_SMALL;
+    }
+
+    i2d_SSL_SESSION(handle, &buf);
+    return 0;
+}
+
+int mbedtls_ssl_session_load(mbedtls_ssl_session* session, const unsigned char* buf, size_t len)
+{
+    SSL_SESSION* handle = d2i_SSL_SESSION(NULL, &buf, (long) len);
+
+    if (handle == NULL) {
+        return MBEDTLS_ERR_SSL_BAD_INPUT_DATA;
+    }
+
+    mbedtls_ssl_session_free(session);
+    session->MBEDTLS_PRIVATE(handle) = handle;
+
+    return 0;
+}
+
+void mbedtls_ssl_conf_verify(mbedtls_ssl_config* conf, int (*f_vrfy)(void*, mbedtls_x509_crt*, int, uint32_t*), void* p_vrfy)
+{
+    conf->MBEDTLS_PRIVATE(f_vrfy) = f_vrfy;
+    conf->MBEDTLS_PRIVATE(p_vrfy) = p_vrfy;
+}
+
+// OpenSSL has already checked the chain against its store
+static int esp_crt_bundle_verify_(void* ctx, mbedtls_x509_crt* crt, int depth, uint32_t* flags)
+{
+    (void) ctx;
+    (void) crt;
+    (void) depth;
+    (void) flags;
+
+    return 0;
+}
+
+esp_err_t esp_crt_bundle_attach(void* conf)
+{
+    mbedtls_ssl_conf_verify((mbedtls_ssl_config*) conf, esp_crt_bundle_verify_, NULL);
+    return ESP_OK;
+}
\ No newline at end of file
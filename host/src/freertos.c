@@ -0,0 +1,685 @@
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include <freertos/FreeRTOS.h>
+
+#include <host/clock.h>
+
+static const char* TAG = "freertos";
+
+// Tasks live until the end of the process. vTaskDelete only ends the thread,
+// the control block stays so that late notifications are harmless.
+struct tskTaskControlBlock {
+    pthread_t thread;
+    char name[configMAX_TASK_NAME_LEN];
+
+    TaskFunction_t code;
+    void* parameters;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    uint32_t notified_value;
+    bool notification_pending;
+};
+
+struct QueueDefinition {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+
+    uint8_t* storage;
+    UBaseType_t item_size;
+    UBaseType_t length;
+    UBaseType_t count;
+    UBaseType_t head;
+
+    // Mutexes only
+    bool is_mutex;
+    TaskHandle_t holder;
+    UBaseType_t recursion;
+};
+
+struct EventGroupDef_t {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    EventBits_t bits;
+};
+
+static __thread TaskHandle_t current_task_ = NULL;
+
+static void freertos_cond_init_(pthread_cond_t* cond)
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+// Time of a tick boundary on CLOCK_MONOTONIC. Ticks count from the same origin
+// and at the same rate as esp_timer_get_time.
+static struct timespec freertos_tick_to_timespec_(uint64_t tick)
+{
+    return host_clock_to_monotonic((int64_t) ((tick * 1000000ULL) / configTICK_RATE_HZ));
+}
+
+static struct timespec freertos_deadline_(TickType_t ticks_to_wait)
+{
+    return host_clock_to_monotonic(esp_timer_get_time() + (int64_t) (((uint64_t) ticks_to_wait * 1000000ULL) / configTICK_RATE_HZ));
+}
+
+// Wait on `cond` until signalled or the deadline passes. Returns false once
+// the deadline passed.
+static bool freertos_wait_(pthread_cond_t* cond, pthread_mutex_t* mutex, TickType_t ticks_to_wait, const struct timespec* deadline)
+{
+    if (ticks_to_wait == 0) {
+        return false;
+    }
+
+    if (ticks_to_wait == portMAX_DELAY) {
+        pthread_cond_wait(cond, mutex);
+        return true;
+    }
+
+    return pthread_cond_timedwait(cond, mutex, deadline) != ETIMEDOUT;
+}
+
+static TaskHandle_t freertos_task_new_(const char* name)
+{
+    TaskHandle_t task = calloc(1, sizeof(struct tskTaskControlBlock));
+
+    if (task == NULL) {
+        return NULL;
+    }
+
+    strncpy(task->name, name, sizeof(task->name) - 1);
+    pthread_mutex_init(&task->mutex, NULL);
+    freertos_cond_init_(&task->cond);
+
+    return task;
+}
+
+static void* freertos_task_entry_(void* arg)
+{
+    TaskHandle_t task = (TaskHandle_t) arg;
+
+    current_task_ = task;
+    task->code(task->parameters);
+
+    // FreeRTOS tasks must not return
+    ESP_LOGE(TAG, "task %s returned", task->name);
+    abort();
+}
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char* name, uint32_t stack_depth, void* parameters, UBaseType_t priority, TaskHandle_t* created_task)
+{
+    (void) stack_depth;
+    (void) priority;
+
+    TaskHandle_t task = freertos_task_new_(name);
+
+    if (task == NULL) {
+        return pdFAIL;
+    }
+
+    task->code = code;
+    task->parameters = parameters;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    int rc = pthread_create(&task->thread, &attr, freertos_task_entry_, task);
+    pthread_attr_destroy(&attr);
+
+    if (rc != 0) {
+        ESP_LOGE(TAG, "failed to start task %s: %d", name, rc);
+        free(task);
+        return pdFAIL;
+    }
+
+    // Names are limited to 15 characters on Linux
+    char thread_name[16] = { 0 };
+    strncpy(thread_name, name, sizeof(thread_name) - 1);
+    pthread_setname_np(task->thread, thread_name);
+
+    if (created_task != NULL) {
+        *created_task = task;
+    }
+
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    if (task != NULL && task != xTaskGetCurrentTaskHandle()) {
+        ESP_LOGE(TAG, "only a task may delete itself");
+        abort();
+    }
+
+    pthread_exit(NULL);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t) (((uint64_t) esp_timer_get_time() * configTICK_RATE_HZ) / 1000000ULL);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    if (ticks == 0) {
+        sched_yield();
+        return;
+    }
+
+    // The tick count is truncated, the next boundary is one tick away at most
+    uint64_t now = ((uint64_t) esp_timer_get_time() * configTICK_RATE_HZ) / 1000000ULL;
+    struct timespec wake = freertos_tick_to_timespec_(now + ticks);
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL) == EINTR) {
+    }
+}
+
+BaseType_t xTaskDelayUntil(TickType_t* previous_wake_time, TickType_t increment)
+{
+    TickType_t target = *previous_wake_time + increment;
+    TickType_t now = xTaskGetTickCount();
+
+    *previous_wake_time = target;
+
+    if ((int32_t) (target - now) <= 0) {
+        return pdFALSE;
+    }
+
+    // Ticks are only 32 bits, rebuild the full count of the target
+    uint64_t full_now = ((uint64_t) esp_timer_get_time() * configTICK_RATE_HZ) / 1000000ULL;
+    struct timespec wake = freertos_tick_to_timespec_(full_now + (TickType_t) (target - now));
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL) == EINTR) {
+    }
+
+    return pdTRUE;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    if (current_task_ == NULL) {
+        char name[16] = { 0 };
+        pthread_getname_np(pthread_self(), name, sizeof(name));
+
+        current_task_ = freertos_task_new_(name);
+
+        if (current_task_ == NULL) {
+            abort();
+        }
+
+        current_task_->thread = pthread_self();
+    }
+
+    return current_task_;
+}
+
+char* pcTaskGetName(TaskHandle_t task)
+{
+    if (task == NULL) {
+        task = xTaskGetCurrentTaskHandle();
+    }
+
+    return task->name;
+}
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action)
+{
+    BaseType_t rc = pdPASS;
+
+    pthread_mutex_lock(&task->mutex);
+
+    switch (action) {
+    case eNoAction:
+        break;
+    case eSetBits:
+        task->notified_value |= value;
+        break;
+    case eIncrement:
+        task->notified_value++;
+        break;
+    case eSetValueWithOverwrite:
+        task->notified_value = value;
+        break;
+    case eSetValueWithoutOverwrite:
+        if (task->notification_pending) {
+            rc = pdFAIL;
+        } else {
+            task->notified_value = value;
+        }
+        break;
+    }
+
+    if (rc == pdPASS) {
+        task->notification_pending = true;
+        pthread_cond_broadcast(&task->cond);
+    }
+
+    pthread_mutex_unlock(&task->mutex);
+    return rc;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    return xTaskNotify(task, 0, eIncrement);
+}
+
+BaseType_t xTaskNotifyWait(uint32_t bits_to_clear_on_entry, uint32_t bits_to_clear_on_exit, uint32_t* notification_value, TickType_t ticks_to_wait)
+{
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    struct timespec deadline = freertos_deadline_(ticks_to_wait);
+    BaseType_t rc = pdTRUE;
+
+    pthread_mutex_lock(&task->mutex);
+
+    if (!task->notification_pending) {
+        task->notified_value &= ~bits_to_clear_on_entry;
+    }
+
+    while (!task->notification_pending) {
+        if (!freertos_wait_(&task->cond, &task->mutex, ticks_to_wait, &deadline)) {
+            break;
+        }
+    }
+
+    if (notification_value != NULL) {
+        *notification_value = task->notified_value;
+    }
+
+    if (task->notification_pending) {
+        task->notified_value &= ~bits_to_clear_on_exit;
+        task->notification_pending = false;
+    } else {
+        rc = pdFALSE;
+    }
+
+    pthread_mutex_unlock(&task->mutex);
+    return rc;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_count_on_exit, TickType_t ticks_to_wait)
+{
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    struct timespec deadline = freertos_deadline_(ticks_to_wait);
+
+    pthread_mutex_lock(&task->mutex);
+
+    while (task->notified_value == 0) {
+        if (!freertos_wait_(&task->cond, &task->mutex, ticks_to_wait, &deadline)) {
+            break;
+        }
+    }
+
+    uint32_t value = task->notified_value;
+
+    if (value != 0) {
+        task->notified_value = clear_count_on_exit ? 0 : value - 1;
+    }
+
+    task->notification_pending = false;
+    pthread_mutex_unlock(&task->mutex);
+
+    return value;
+}
+
+static QueueHandle_t freertos_queue_new_(UBaseType_t length, UBaseType_t item_size)
+{
+    QueueHandle_t queue = calloc(1, sizeof(struct QueueDefinition));
+
+    if (queue == NULL) {
+        return NULL;
+    }
+
+    if (item_size > 0) {
+        queue->storage = calloc(length, item_size);
+
+        if (queue->storage == NULL) {
+            free(queue);
+            return NULL;
+        }
+    }
+
+    queue->length = length;
+    queue->item_size = item_size;
+
+    pthread_mutex_init(&queue->mutex, NULL);
+    freertos_cond_init_(&queue->cond);
+
+    return queue;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    if (length == 0) {
+        return NULL;
+    }
+
+    return freertos_queue_new_(length, item_size);
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    if (queue == NULL) {
+        return;
+    }
+
+    pthread_mutex_destroy(&queue->mutex);
+    pthread_cond_destroy(&queue->cond);
+    free(queue->storage);
+    free(queue);
+}
+
+static BaseType_t freertos_queue_send_(QueueHandle_t queue, const void* item, TickType_t ticks_to_wait, bool to_front)
+{
+    struct timespec deadline = freertos_deadline_(ticks_to_wait);
+    BaseType_t rc = pdTRUE;
+
+    pthread_mutex_lock(&queue->mutex);
+
+    while (queue->count == queue->length) {
+        if (!freertos_wait_(&queue->cond, &queue->mutex, ticks_to_wait, &deadline)) {
+            rc = errQUEUE_FULL;
+            goto exit;
+        }
+    }
+
+    UBaseType_t index;
+
+    if (to_front) {
+        queue->head = (queue->head + queue->length - 1) % queue->length;
+        index = queue->head;
+    } else {
+        index = (queue->head + queue->count) % queue->length;
+    }
+
+    if (queue->item_size > 0) {
+        memcpy(&queue->storage[index * queue->item_size], item, queue->item_size);
+    }
+
+    queue->count++;
+    pthread_cond_broadcast(&queue->cond);
+
+exit:
+    pthread_mutex_unlock(&queue->mutex);
+    return rc;
+}
+
+static BaseType_t freertos_queue_receive_(QueueHandle_t queue, void* buffer, TickType_t ticks_to_wait, bool peek)
+{
+    struct timespec deadline = freertos_deadline_(ticks_to_wait);
+    BaseType_t rc = pdTRUE;
+
+    pthread_mutex_lock(&queue->mutex);
+
+    while (queue->count == 0) {
+        if (!freertos_wait_(&queue->cond, &queue->mutex, ticks_to_wait, &deadline)) {
+            rc = errQUEUE_EMPTY;
+            goto exit;
+        }
+    }
+
+    if (queue->item_size > 0) {
+        memcpy(buffer, &queue->storage[queue->head * queue->item_size], queue->item_size);
+    }
+
+    if (!peek) {
+        queue->head = (queue->head + 1) % queue->length;
+        queue->count--;
+
+        if (queue->is_mutex) {
+            queue->holder = xTaskGetCurrentTaskHandle();
+        }
+
+        pthread_cond_broadcast(&queue->cond);
+    }
+
+exit:
+    pthread_mutex_unlock(&queue->mutex);
+    return rc;
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void* item, TickType_t ticks_to_wait)
+{
+    return freertos_queue_send_(queue, item, ticks_to_wait, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void* item, TickType_t ticks_to_wait)
+{
+    return freertos_queue_send_(queue, item, ticks_to_wait, true);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void* buffer, TickType_t ticks_to_wait)
+{
+    return freertos_queue_receive_(queue, buffer, ticks_to_wait, false);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void* buffer, TickType_t ticks_to_wait)
+{
+    return freertos_queue_receive_(queue, buffer, ticks_to_wait, true);
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue)
+{
+    pthread_mutex_lock(&queue->mutex);
+    queue->count = 0;
+    queue->head = 0;
+    pthread_cond_broadcast(&queue->cond);
+    pthread_mutex_unlock(&queue->mutex);
+
+    return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    pthread_mutex_lock(&queue->mutex);
+    UBaseType_t count = queue->count;
+    pthread_mutex_unlock(&queue->mutex);
+
+    return count;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue)
+{
+    pthread_mutex_lock(&queue->mutex);
+    UBaseType_t spaces = queue->length - queue->count;
+    pthread_mutex_unlock(&queue->mutex);
+
+    return spaces;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return freertos_queue_new_(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count)
+{
+    if (max_count == 0 || initial_count > max_count) {
+        return NULL;
+    }
+
+    SemaphoreHandle_t semaphore = freertos_queue_new_(max_count, 0);
+
+    if (semaphore != NULL) {
+        semaphore->count = initial_count;
+    }
+
+    return semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    SemaphoreHandle_t mutex = freertos_queue_new_(1, 0);
+
+    if (mutex != NULL) {
+        mutex->is_mutex = true;
+        mutex->count = 1;
+    }
+
+    return mutex;
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex(void)
+{
+    return xSemaphoreCreateMutex();
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks_to_wait)
+{
+    return freertos_queue_receive_(semaphore, NULL, ticks_to_wait, false);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    if (semaphore->is_mutex) {
+        pthread_mutex_lock(&semaphore->mutex);
+
+        // Only the holder may give a mutex back
+        if (semaphore->holder != xTaskGetCurrentTaskHandle()) {
+            pthread_mutex_unlock(&semaphore->mutex);
+            return pdFAIL;
+        }
+
+        semaphore->holder = NULL;
+        pthread_mutex_unlock(&semaphore->mutex);
+    }
+
+    return freertos_queue_send_(semaphore, NULL, 0, false);
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t mutex, TickType_t ticks_to_wait)
+{
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+
+    pthread_mutex_lock(&mutex->mutex);
+
+    if (mutex->holder == task) {
+        mutex->recursion++;
+        pthread_mutex_unlock(&mutex->mutex);
+        return pdTRUE;
+    }
+
+    pthread_mutex_unlock(&mutex->mutex);
+
+    if (xSemaphoreTake(mutex, ticks_to_wait) != pdTRUE) {
+        return pdFALSE;
+    }
+
+    // Only the holder touches the count from here
+    mutex->recursion = 1;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t mutex)
+{
+    pthread_mutex_lock(&mutex->mutex);
+
+    if (mutex->holder != xTaskGetCurrentTaskHandle()) {
+        pthread_mutex_unlock(&mutex->mutex);
+        return pdFAIL;
+    }
+
+    bool released = --mutex->recursion == 0;
+    pthread_mutex_unlock(&mutex->mutex);
+
+    return released ? xSemaphoreGive(mutex) : pdTRUE;
+}
+
+UBaseType_t uxSemaphoreGetCount(SemaphoreHandle_t semaphore)
+{
+    return uxQueueMessagesWaiting(semaphore);
+}
+
+EventGroupHandle_t xEventGroupCreate(void)
+{
+    EventGroupHandle_t event_group = calloc(1, sizeof(struct EventGroupDef_t));
+
+    if (event_group == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_init(&event_group->mutex, NULL);
+    freertos_cond_init_(&event_group->cond);
+
+    return event_group;
+}
+
+void vEventGroupDelete(EventGroupHandle_t event_group)
+{
+    pthread_mutex_destroy(&event_group->mutex);
+    pthread_cond_destroy(&event_group->cond);
+    free(event_group);
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t event_group, EventBits_t bits_to_set)
+{
+    pthread_mutex_lock(&event_group->mutex);
+    event_group->bits |= bits_to_set;
+    EventBits_t bits = event_group->bits;
+    pthread_cond_broadcast(&event_group->cond);
+    pthread_mutex_unlock(&event_group->mutex);
+
+    return bits;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t event_group, EventBits_t bits_to_clear)
+{
+    pthread_mutex_lock(&event_group->mutex);
+    EventBits_t bits = event_group->bits;
+    event_group->bits &= ~bits_to_clear;
+    pthread_mutex_unlock(&event_group->mutex);
+
+    return bits;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t event_group)
+{
+    pthread_mutex_lock(&event_group->mutex);
+    EventBits_t bits = event_group->bits;
+    pthread_mutex_unlock(&event_group->mutex);
+
+    return bits;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t event_group, EventBits_t bits_to_wait_for, BaseType_t clear_on_exit, BaseType_t wait_for_all_bits, TickType_t ticks_to_wait)
+{
+    struct timespec deadline = freertos_deadline_(ticks_to_wait);
+
+    pthread_mutex_lock(&event_group->mutex);
+
+    while (true) {
+        EventBits_t set = event_group->bits & bits_to_wait_for;
+
+        if (wait_for_all_bits ? set == bits_to_wait_for : set != 0) {
+            break;
+        }
+
+        if (!freertos_wait_(&event_group->cond, &event_group->mutex, ticks_to_wait, &deadline)) {
+            EventBits_t bits = event_group->bits;
+            pthread_mutex_unlock(&event_group->mutex);
+            return bits;
+        }
+    }
+
+    EventBits_t bits = event_group->bits;
+
+    if (clear_on_exit) {
+        event_group->bits &= ~bits_to_wait_for;
+    }
+
+    pthread_mutex_unlock(&event_group->mutex);
+    return bits;
+}
\ No newline at end of file
@@ -0,0 +1,124 @@
+#include <host/heap.h>
+
+#include <esp_heap_caps.h>
+
+#include <malloc.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+enum {
+    // What the firmware has of the ESP32-S2's internal RAM once running
+    HEAP_TOTAL_SIZE = 256 * 1024,
+};
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+void __real_free(void* ptr);
+
+static atomic_uint_fast64_t heap_allocations_ = 0;
+static atomic_uint_fast64_t heap_frees_ = 0;
+static atomic_size_t heap_in_use_ = 0;
+static atomic_size_t heap_peak_ = 0;
+
+static void heap_count_allocation_(void* ptr)
+{
+    if (ptr == NULL) {
+        return;
+    }
+
+    size_t in_use = atomic_fetch_add(&heap_in_use_, malloc_usable_size(ptr)) + malloc_usable_size(ptr);
+    size_t peak = atomic_load(&heap_peak_);
+
+    while (in_use > peak && !atomic_compare_exchange_weak(&heap_peak_, &peak, in_use)) {
+    }
+
+    atomic_fetch_add(&heap_allocations_, 1);
+}
+
+static void heap_count_free_(void* ptr)
+{
+    if (ptr == NULL) {
+        return;
+    }
+
+    atomic_fetch_sub(&heap_in_use_, malloc_usable_size(ptr));
+    atomic_fetch_add(&heap_frees_, 1);
+}
+
+void* __wrap_malloc(size_t size)
+{
+    void* ptr = __real_malloc(size);
+    heap_count_allocation_(ptr);
+
+    return ptr;
+}
+
+void* __wrap_calloc(size_t count, size_t size)
+{
+    void* ptr = __real_calloc(count, size);
+    heap_count_allocation_(ptr);
+
+    return ptr;
+}
+
+// Counted as a free and an allocation when the block moves or grows
+void* __wrap_realloc(void* ptr, size_t size)
+{
+    size_t old_size = ptr != NULL ? malloc_usable_size(ptr) : 0;
+    void* new_ptr = __real_realloc(ptr, size);
+
+    if (new_ptr == NULL) {
+        return NULL;
+    }
+
+    if (ptr != NULL) {
+        atomic_fetch_sub(&heap_in_use_, old_size);
+        atomic_fetch_add(&heap_frees_, 1);
+    }
+
+    heap_count_allocation_(new_ptr);
+    return new_ptr;
+}
+
+void __wrap_free(void* ptr)
+{
+    heap_count_free_(ptr);
+    __real_free(ptr);
+}
+
+void host_heap_get_stats(struct host_heap_stats* dest)
+{
+    dest->allocations = atomic_load(&heap_allocations_);
+    dest->frees = atomic_load(&heap_frees_);
+    dest->in_use = atomic_load(&heap_in_use_);
+    dest->peak = atomic_load(&heap_peak_);
+}
+
+static size_t heap_remaining_(size_t used)
+{
+    return used < HEAP_TOTAL_SIZE ? HEAP_TOTAL_SIZE - used : 0;
+}
+
+size_t heap_caps_get_free_size(uint32_t caps)
+{
+    (void) caps;
+    return heap_remaining_(atomic_load(&heap_in_use_));
+}
+
+size_t heap_caps_get_total_size(uint32_t caps)
+{
+    (void) caps;
+    return HEAP_TOTAL_SIZE;
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps)
+{
+    return heap_caps_get_free_size(caps);
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps)
+{
+    (void) caps;
+    return heap_remaining_(atomic_load(&heap_peak_));
+}
\ No newline at end of file
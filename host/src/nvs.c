@@ -0,0 +1,456 @@
+#include <nvs.h>
+#include <nvs_flash.h>
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_log.h>
+
+enum {
+    // Handles open at once, as many as the firmware's tasks could hold
+    NVS_HANDLES = 16,
+
+    // Longest namespace name, as with keys
+    NVS_NAMESPACE_MAX_SIZE = NVS_KEY_NAME_MAX_SIZE,
+};
+
+// Entry types, as NVS keeps them. A value is only found under its own type.
+enum nvs_type {
+    NVS_TYPE_U32 = 0x04,
+    NVS_TYPE_U64 = 0x08,
+    NVS_TYPE_STR = 0x21,
+    NVS_TYPE_BLOB = 0x42,
+};
+
+static const char* TAG = "nvs";
+
+struct nvs_entry {
+    char namespace_name[NVS_NAMESPACE_MAX_SIZE];
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    uint8_t type;
+
+    uint8_t* value;
+    size_t length;
+
+    struct nvs_entry* next;
+};
+
+struct nvs_handle {
+    bool in_use;
+    bool read_only;
+    char namespace_name[NVS_NAMESPACE_MAX_SIZE];
+};
+
+static pthread_mutex_t nvs_lock_ = PTHREAD_MUTEX_INITIALIZER;
+static bool nvs_initialized_ = false;
+static struct nvs_entry* nvs_entries_ = NULL;
+static struct nvs_handle nvs_handles_[NVS_HANDLES] = { 0 };
+
+static void nvs_clear_(void)
+{
+    while (nvs_entries_ != NULL) {
+        struct nvs_entry* entry = nvs_entries_;
+        nvs_entries_ = entry->next;
+
+        free(entry->value);
+        free(entry);
+    }
+}
+
+static struct nvs_entry* nvs_find_(const char* namespace_name, const char* key)
+{
+    for (struct nvs_entry* entry = nvs_entries_; entry != NULL; entry = entry->next) {
+        if (strcmp(entry->namespace_name, namespace_name) == 0 && strcmp(entry->key, key) == 0) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+static esp_err_t nvs_put_(const char* namespace_name, const char* key, uint8_t type, const void* value, size_t length)
+{
+    struct nvs_entry* entry = nvs_find_(namespace_name, key);
+
+    if (entry == NULL) {
+        entry = calloc(1, sizeof(struct nvs_entry));
+
+        if (entry == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+
+        strcpy(entry->namespace_name, namespace_name);
+        strcpy(entry->key, key);
+
+        entry->next = nvs_entries_;
+        nvs_entries_ = entry;
+    }
+
+    uint8_t* copy = malloc(length > 0 ? length : 1);
+
+    if (copy == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    memcpy(copy, value, length);
+    free(entry->value);
+
+    entry->type = type;
+    entry->value = copy;
+    entry->length = length;
+
+    return ESP_OK;
+}
+
+// The file holds the entries back to back: namespace and key NULL terminated,
+// then the type, the length as 4 little endian bytes, and the value
+static void nvs_load_(const char* path)
+{
+    FILE* file = fopen(path, "rb");
+
+    if (file == NULL) {
+        return;
+    }
+
+    while (true) {
+        char namespace_name[NVS_NAMESPACE_MAX_SIZE] = { 0 };
+        char key[NVS_KEY_NAME_MAX_SIZE] = { 0 };
+        uint8_t header[5];
+
+        size_t i = 0;
+        int c;
+
+        while ((c = fgetc(file)) > 0 && i < sizeof(namespace_name) - 1) {
+            namespace_name[i++] = (char) c;
+        }
+
+        if (c != 0) {
+            break;
+        }
+
+        i = 0;
+        while ((c = fgetc(file)) > 0 && i < sizeof(key) - 1) {
+            key[i++] = (char) c;
+        }
+
+        if (c != 0 || fread(header, 1, sizeof(header), file) != sizeof(header)) {
+            break;
+        }
+
+        size_t length = (size_t) header[1] | ((size_t) header[2] << 8) | ((size_t) header[3] << 16) | ((size_t) header[4] << 24);
+        uint8_t* value = malloc(length > 0 ? length : 1);
+
+        if (value == NULL || fread(value, 1, length, file) != length) {
+            free(value);
+            break;
+        }
+
+        nvs_put_(namespace_name, key, header[0], value, length);
+        free(value);
+    }
+
+    fclose(file);
+}
+
+static void nvs_store_(void)
+{
+    const char* path = getenv("GANYMEDE_NVS_PATH");
+
+    if (path == NULL) {
+        return;
+    }
+
+    FILE* file = fopen(path, "wb");
+
+    if (file == NULL) {
+        ESP_LOGW(TAG, "failed to write %s", path);
+        return;
+    }
+
+    for (struct nvs_entry* entry = nvs_entries_; entry != NULL; entry = entry->next) {
+        uint8_t header[5] = {
+            entry->type,
+            (uint8_t) entry->length,
+            (uint8_t) (entry->length >> 8),
+            (uint8_t) (entry->length >> 16),
+            (uint8_t) (entry->length >> 24),
+        };
+
+        fwrite(entry->namespace_name, 1, strlen(entry->namespace_name) + 1, file);
+        fwrite(entry->key, 1, strlen(entry->key) + 1, file);
+        fwrite(header, 1, sizeof(header), file);
+        fwrite(entry->value, 1, entry->length, file);
+    }
+
+    fclose(file);
+}
+
+esp_err_t nvs_flash_init(void)
+{
+    pthread_mutex_lock(&nvs_lock_);
+
+    if (!nvs_initialized_) {
+        const char* path = getenv("GANYMEDE_NVS_PATH");
+
+        if (path != NULL) {
+            nvs_load_(path);
+        }
+
+        nvs_initialized_ = true;
+    }
+
+    pthread_mutex_unlock(&nvs_lock_);
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+    pthread_mutex_lock(&nvs_lock_);
+    nvs_clear_();
+    nvs_store_();
+    nvs_initialized_ = false;
+    pthread_mutex_unlock(&nvs_lock_);
+
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char* namespace_name, nvs_open_mode_t open_mode, nvs_handle_t* out_handle)
+{
+    esp_err_t rc = ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+
+    if (strlen(namespace_name) >= NVS_NAMESPACE_MAX_SIZE) {
+        return ESP_ERR_NVS_INVALID_NAME;
+    }
+
+    pthread_mutex_lock(&nvs_lock_);
+
+    if (!nvs_initialized_) {
+        rc = ESP_ERR_NVS_NOT_INITIALIZED;
+        goto exit;
+    }
+
+    // Handle 0 is never given out, like on the device
+    for (size_t i = 1; i < NVS_HANDLES; i++) {
+        if (!nvs_handles_[i].in_use) {
+            nvs_handles_[i].in_use = true;
+            nvs_handles_[i].read_only = open_mode == NVS_READONLY;
+            strcpy(nvs_handles_[i].namespace_name, namespace_name);
+
+            *out_handle = (nvs_handle_t) i;
+            rc = ESP_OK;
+            break;
+        }
+    }
+
+exit:
+    pthread_mutex_unlock(&nvs_lock_);
+    return rc;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+    pthread_mutex_lock(&nvs_lock_);
+
+    if (handle < NVS_HANDLES) {
+        nvs_handles_[handle].in_use = false;
+    }
+
+    pthread_mutex_unlock(&nvs_lock_);
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    esp_err_t rc = ESP_OK;
+
+    pthread_mutex_lock(&nvs_lock_);
+
+    // Changes were written through already
+    if (handle >= NVS_HANDLES || !nvs_handles_[handle].in_use) {
+        rc = ESP_ERR_NVS_INVALID_HANDLE;
+    }
+
+    pthread_mutex_unlock(&nvs_lock_);
+    return rc;
+}
+
+// Called with the lock held
+static esp_err_t nvs_check_(nvs_handle_t handle, const char* key, bool write)
+{
+    if (handle >= NVS_HANDLES || !nvs_handles_[handle].in_use) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+
+    if (write && nvs_handles_[handle].read_only) {
+        return ESP_ERR_NVS_READ_ONLY;
+    }
+
+    if (key == NULL) {
+        return ESP_ERR_NVS_INVALID_NAME;
+    }
+
+    if (strlen(key) >= NVS_KEY_NAME_MAX_SIZE) {
+        return ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t nvs_set_(nvs_handle_t handle, const char* key, uint8_t type, const void* value, size_t length)
+{
+    pthread_mutex_lock(&nvs_lock_);
+
+    esp_err_t rc = nvs_check_(handle, key, true);
+
+    if (rc == ESP_OK) {
+        rc = nvs_put_(nvs_handles_[handle].namespace_name, key, type, value, length);
+    }
+
+    if (rc == ESP_OK) {
+        nvs_store_();
+    }
+
+    pthread_mutex_unlock(&nvs_lock_);
+    return rc;
+}
+
+// With `out_value` NULL, only reports the length. Fixed size values pass their
+// own size as `length`.
+static esp_err_t nvs_get_(nvs_handle_t handle, const char* key, uint8_t type, void* out_value, size_t* length)
+{
+    pthread_mutex_lock(&nvs_lock_);
+
+    esp_err_t rc = nvs_check_(handle, key, false);
+
+    if (rc != ESP_OK) {
+        goto exit;
+    }
+
+    struct nvs_entry* entry = nvs_find_(nvs_handles_[handle].namespace_name, key);
+
+    if (entry == NULL || entry->type != type) {
+        rc = ESP_ERR_NVS_NOT_FOUND;
+        goto exit;
+    }
+
+    if (out_value == NULL) {
+        *length = entry->length;
+        goto exit;
+    }
+
+    if (*length < entry->length) {
+        rc = ESP_ERR_NVS_INVALID_LENGTH;
+        goto exit;
+    }
+
+    memcpy(out_value, entry->value, entry->length);
+    *length = entry->length;
+
+exit:
+    pthread_mutex_unlock(&nvs_lock_);
+    return rc;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char* key)
+{
+    pthread_mutex_lock(&nvs_lock_);
+
+    esp_err_t rc = nvs_check_(handle, key, true);
+
+    if (rc != ESP_OK) {
+        goto exit;
+    }
+
+    rc = ESP_ERR_NVS_NOT_FOUND;
+
+    for (struct nvs_entry** cursor = &nvs_entries_; *cursor != NULL; cursor = &(*cursor)->next) {
+        struct nvs_entry* entry = *cursor;
+
+        if (strcmp(entry->namespace_name, nvs_handles_[handle].namespace_name) == 0 && strcmp(entry->key, key) == 0) {
+            *cursor = entry->next;
+            free(entry->value);
+            free(entry);
+            nvs_store_();
+            rc = ESP_OK;
+            break;
+        }
+    }
+
+exit:
+    pthread_mutex_unlock(&nvs_lock_);
+    return rc;
+}
+
+esp_err_t nvs_erase_all(nvs_handle_t handle)
+{
+    pthread_mutex_lock(&nvs_lock_);
+
+    esp_err_t rc = nvs_check_(handle, "", true);
+
+    if (rc != ESP_OK) {
+        goto exit;
+    }
+
+    struct nvs_entry** cursor = &nvs_entries_;
+
+    while (*cursor != NULL) {
+        struct nvs_entry* entry = *cursor;
+
+        if (strcmp(entry->namespace_name, nvs_handles_[handle].namespace_name) == 0) {
+            *cursor = entry->next;
+            free(entry->value);
+            free(entry);
+        } else {
+            cursor = &entry->next;
+        }
+    }
+
+    nvs_store_();
+
+exit:
+    pthread_mutex_unlock(&nvs_lock_);
+    return rc;
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char* key, uint32_t* out_value)
+{
+    size_t length = sizeof(uint32_t);
+    return nvs_get_(handle, key, NVS_TYPE_U32, out_value, &length);
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char* key, uint32_t value)
+{
+    return nvs_set_(handle, key, NVS_TYPE_U32, &value, sizeof(value));
+}
+
+esp_err_t nvs_get_u64(nvs_handle_t handle, const char* key, uint64_t* out_value)
+{
+    size_t length = sizeof(uint64_t);
+    return nvs_get_(handle, key, NVS_TYPE_U64, out_value, &length);
+}
+
+esp_err_t nvs_set_u64(nvs_handle_t handle, const char* key, uint64_t value)
+{
+    return nvs_set_(handle, key, NVS_TYPE_U64, &value, sizeof(value));
+}
+
+esp_err_t nvs_get_str(nvs_handle_t handle, const char* key, char* out_value, size_t* length)
+{
+    return nvs_get_(handle, key, NVS_TYPE_STR, out_value, length);
+}
+
+esp_err_t nvs_set_str(nvs_handle_t handle, const char* key, const char* value)
+{
+    return nvs_set_(handle, key, NVS_TYPE_STR, value, strlen(value) + 1);
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char* key, void* out_value, size_t* length)
+{
+    return nvs_get_(handle, key, NVS_TYPE_BLOB, out_value, length);
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char* key, const void* value, size_t length)
+{
+    return nvs_set_(handle, key, NVS_TYPE_BLOB, value, length);
+}
\ No newline at end of file
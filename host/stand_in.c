@@ -0,0 +1,1304 @@
+// Local stand-in for the Ganymede backend and Auth0, for benchmarks and the
+// fleet simulator. Serves, over TLS with ALPN h2:
+//
+//  - /ganymede.v2.DeviceService/Poll
+//  - /ganymede.v2.MeasurementsService/PushMeasurements and PushAtmosphereBatch
+//  - /grpc.health.v1.Health/Check
+//  - /oauth/device/code and /oauth/token, approving every device at once
+//  - GET /stand-in/stats, and POST /stand-in/reset to clear them
+//
+// Requests are served by a fixed number of workers, each taking the configured
+// latency, so that bursts queue up the way they would in front of a real
+// backend. SIGHUP clears the stats, and --stats writes them to a file on exit.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <nghttp2/nghttp2.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+enum {
+    // Connections served at once, the listening socket aside
+    STAND_IN_MAX_CONNS = 4096,
+
+    // Largest request body accepted
+    STAND_IN_MAX_BODY_LEN = 1024 * 1024,
+
+    // Largest padding added to PollResponses
+    STAND_IN_MAX_RESPONSE_LEN = 64 * 1024,
+
+    // Arrivals are counted per second, for this long after a reset
+    STAND_IN_ARRIVAL_SECONDS = 3600,
+
+    // Queue waits kept for percentiles
+    STAND_IN_WAIT_SAMPLES = 65536,
+
+    // gRPC message prefix: compression flag and big endian length
+    STAND_IN_GRPC_PREFIX_LEN = 5,
+
+    // gRPC status codes
+    STAND_IN_GRPC_OK = 0,
+    STAND_IN_GRPC_UNIMPLEMENTED = 12,
+    STAND_IN_GRPC_UNAVAILABLE = 14,
+};
+
+struct stand_in_options {
+    uint16_t port;
+    const char* cert;
+    const char* key;
+
+    // Service time of each request, and how many are served at once (0 for
+    // as many as arrive)
+    int64_t latency;
+    size_t workers;
+
+    // Bytes of padding in PollResponses
+    size_t response_size;
+
+    // Share of gRPC calls failed with `error_code`, in percent
+    unsigned int error_rate;
+    unsigned int error_code;
+
+    // What PollResponses tell devices (seconds)
+    int64_t poll_period;
+    int64_t poll_spread;
+
+    // Seconds between reports on stdout, 0 for none
+    int64_t report_interval;
+
+    // Written with the stats on exit, if set
+    const char* stats_path;
+};
+
+enum stand_in_endpoint {
+    STAND_IN_ENDPOINT_UNKNOWN,
+    STAND_IN_ENDPOINT_POLL,
+    STAND_IN_ENDPOINT_PUSH_MEASUREMENTS,
+    STAND_IN_ENDPOINT_PUSH_ATMOSPHERE_BATCH,
+    STAND_IN_ENDPOINT_HEALTH_CHECK,
+    STAND_IN_ENDPOINT_DEVICE_CODE,
+    STAND_IN_ENDPOINT_TOKEN,
+    STAND_IN_ENDPOINT_STATS,
+    STAND_IN_ENDPOINT_RESET,
+    STAND_IN_ENDPOINT_COUNT,
+};
+
+static const char* STAND_IN_ENDPOINT_PATHS[STAND_IN_ENDPOINT_COUNT] = {
+    [STAND_IN_ENDPOINT_UNKNOWN] = "",
+    [STAND_IN_ENDPOINT_POLL] = "/ganymede.v2.DeviceService/Poll",
+    [STAND_IN_ENDPOINT_PUSH_MEASUREMENTS] = "/ganymede.v2.MeasurementsService/PushMeasurements",
+    [STAND_IN_ENDPOINT_PUSH_ATMOSPHERE_BATCH] = "/ganymede.v2.MeasurementsService/PushAtmosphereBatch",
+    [STAND_IN_ENDPOINT_HEALTH_CHECK] = "/grpc.health.v1.Health/Check",
+    [STAND_IN_ENDPOINT_DEVICE_CODE] = "/oauth/device/code",
+    [STAND_IN_ENDPOINT_TOKEN] = "/oauth/token",
+    [STAND_IN_ENDPOINT_STATS] = "/stand-in/stats",
+    [STAND_IN_ENDPOINT_RESET] = "/stand-in/reset",
+};
+
+struct stand_in_conn;
+
+struct stand_in_stream {
+    struct stand_in_conn* conn;
+    int32_t id;
+
+    enum stand_in_endpoint endpoint;
+    uint8_t* body;
+    size_t body_length;
+
+    uint8_t* response;
+    size_t response_length;
+    size_t response_cursor;
+    unsigned int grpc_status;
+    bool grpc;
+
+    // Arrival, and when its worker is done with it
+    int64_t arrived;
+    int64_t ready_at;
+
+    // Waiting for a worker, or being served
+    bool queued;
+    bool in_service;
+    struct stand_in_stream* next;
+};
+
+struct stand_in_conn {
+    int fd;
+    SSL* ssl;
+    nghttp2_session* ng;
+    bool handshaken;
+
+    // Frames not taken by SSL_write yet
+    uint8_t* out;
+    size_t out_length;
+    size_t out_capacity;
+};
+
+struct stand_in_stats {
+    int64_t reset_at;
+
+    uint64_t requests[STAND_IN_ENDPOINT_COUNT];
+    uint64_t errors;
+    uint64_t measurements;
+    uint64_t connections;
+    uint64_t handshakes;
+    uint64_t resumed_handshakes;
+
+    size_t queue_length;
+    size_t max_queue_length;
+    size_t in_service;
+
+    uint32_t arrivals[STAND_IN_ARRIVAL_SECONDS];
+    int64_t waits[STAND_IN_WAIT_SAMPLES];
+    size_t wait_count;
+    int64_t max_wait;
+};
+
+static struct stand_in_options options_ = {
+    .port = 8443,
+    .latency = 0,
+    .workers = 0,
+    .response_size = 0,
+    .error_rate = 0,
+    .error_code = STAND_IN_GRPC_UNAVAILABLE,
+    .poll_period = 60,
+    .poll_spread = 0,
+    .report_interval = 10,
+};
+
+static struct stand_in_stats stats_;
+static struct pollfd pollfds_[STAND_IN_MAX_CONNS + 1];
+static struct stand_in_conn* conns_[STAND_IN_MAX_CONNS + 1];
+static size_t conn_count_ = 0;
+
+// Requests waiting for a worker, oldest first, and those being served
+static struct stand_in_stream* queue_head_ = NULL;
+static struct stand_in_stream* queue_tail_ = NULL;
+static struct stand_in_stream* serving_ = NULL;
+
+static volatile sig_atomic_t stopping_ = 0;
+static volatile sig_atomic_t resetting_ = 0;
+static unsigned int token_counter_ = 0;
+
+static int64_t stand_in_now_(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// Protobuf encoding, only as much as the responses need
+
+static size_t stand_in_pb_varint_(uint8_t* buf, uint64_t value)
+{
+    size_t length = 0;
+
+    do {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        buf[length++] = byte | (value != 0 ? 0x80 : 0);
+    } while (value != 0);
+
+    return length;
+}
+
+static size_t stand_in_pb_tag_(uint8_t* buf, uint32_t number, uint8_t wire_type)
+{
+    return stand_in_pb_varint_(buf, ((uint64_t) number << 3) | wire_type);
+}
+
+static size_t stand_in_pb_bytes_(uint8_t* buf, uint32_t number, const void* data, size_t length)
+{
+    size_t cursor = stand_in_pb_tag_(buf, number, 2);
+    cursor += stand_in_pb_varint_(&buf[cursor], length);
+    memcpy(&buf[cursor], data, length);
+
+    return cursor + length;
+}
+
+// A google.protobuf.Duration of whole seconds
+static size_t stand_in_pb_duration_(uint8_t* buf, uint32_t number, int64_t seconds)
+{
+    uint8_t duration[16];
+    size_t length = 0;
+
+    if (seconds != 0) {
+        length += stand_in_pb_tag_(duration, 1, 0);
+        length += stand_in_pb_varint_(&duration[length], (uint64_t) seconds);
+    }
+
+    return stand_in_pb_bytes_(buf, number, duration, length);
+}
+
+static bool stand_in_pb_read_varint_(const uint8_t* buf, size_t length, size_t* cursor, uint64_t* value)
+{
+    *value = 0;
+
+    for (size_t shift = 0; shift < 64 && *cursor < length; shift += 7) {
+        uint8_t byte = buf[(*cursor)++];
+        *value |= (uint64_t) (byte & 0x7F) << shift;
+
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Counts the measurements of a PushMeasurementsRequest (each a field 1), or the
+// samples of a PushAtmosphereBatchRequest (varints of the packed field 4)
+static size_t stand_in_pb_count_measurements_(const uint8_t* message, size_t length, bool batch)
+{
+    size_t count = 0;
+    size_t cursor = 0;
+
+    while (cursor < length) {
+        uint64_t key;
+        uint64_t value;
+
+        if (!stand_in_pb_read_varint_(message, length, &cursor, &key)) {
+            break;
+        }
+
+        switch (key & 0x07) {
+        case 0:
+            if (!stand_in_pb_read_varint_(message, length, &cursor, &value)) {
+                return count;
+            }
+            break;
+
+        case 1:
+            cursor += 8;
+            break;
+
+        case 5:
+            cursor += 4;
+            break;
+
+        case 2:
+            if (!stand_in_pb_read_varint_(message, length, &cursor, &value) || value > length - cursor) {
+                return count;
+            }
+
+            if (!batch && (key >> 3) == 1) {
+                count++;
+            } else if (batch && (key >> 3) == 4) {
+                size_t end = cursor + value;
+                uint64_t delta;
+
+                for (size_t packed = cursor; packed < end && stand_in_pb_read_varint_(message, end, &packed, &delta);) {
+                    count++;
+                }
+            }
+
+            cursor += value;
+            break;
+
+        default:
+            return count;
+        }
+    }
+
+    return count;
+}
+
+// Responses
+
+static bool stand_in_stream_set_response_(struct stand_in_stream* stream, const void* data, size_t length)
+{
+    stream->response = malloc(length > 0 ? length : 1);
+
+    if (stream->response == NULL) {
+        return false;
+    }
+
+    memcpy(stream->response, data, length);
+    stream->response_length = length;
+    return true;
+}
+
+static bool stand_in_stream_set_grpc_response_(struct stand_in_stream* stream, const uint8_t* message, size_t length)
+{
+    stream->response = malloc(STAND_IN_GRPC_PREFIX_LEN + length);
+
+    if (stream->response == NULL) {
+        return false;
+    }
+
+    stream->response[0] = 0;
+    stream->response[1] = (uint8_t) (length >> 24);
+    stream->response[2] = (uint8_t) (length >> 16);
+    stream->response[3] = (uint8_t) (length >> 8);
+    stream->response[4] = (uint8_t) length;
+    memcpy(&stream->response[STAND_IN_GRPC_PREFIX_LEN], message, length);
+
+    stream->response_length = STAND_IN_GRPC_PREFIX_LEN + length;
+    return true;
+}
+
+static bool stand_in_build_poll_response_(struct stand_in_stream* stream)
+{
+    static uint8_t message[STAND_IN_MAX_RESPONSE_LEN + 256];
+    static char padding[STAND_IN_MAX_RESPONSE_LEN];
+
+    static const char device_uid[] = "00000000-0000-4000-8000-000000000000";
+    static const char config_uid[] = "00000000-0000-4000-8000-000000000001";
+
+    size_t length = 0;
+
+    length += stand_in_pb_bytes_(&message[length], 1, device_uid, strlen(device_uid));
+    length += stand_in_pb_bytes_(&message[length], 11, config_uid, strlen(config_uid));
+
+    if (options_.response_size > 0) {
+        memset(padding, 'x', options_.response_size);
+        length += stand_in_pb_bytes_(&message[length], 12, padding, options_.response_size);
+    }
+
+    length += stand_in_pb_duration_(&message[length], 21, options_.poll_period);
+
+    if (options_.poll_spread > 0) {
+        length += stand_in_pb_duration_(&message[length], 22, options_.poll_spread);
+    }
+
+    // atmosphere_batch_supported
+    length += stand_in_pb_tag_(&message[length], 23, 0);
+    length += stand_in_pb_varint_(&message[length], 1);
+
+    return stand_in_stream_set_grpc_response_(stream, message, length);
+}
+
+static void stand_in_count_pushed_(struct stand_in_stream* stream)
+{
+    size_t cursor = 0;
+
+    // The body may hold several messages
+    while (stream->body_length - cursor >= STAND_IN_GRPC_PREFIX_LEN) {
+        const uint8_t* prefix = &stream->body[cursor];
+        size_t length = ((size_t) prefix[1] << 24) | ((size_t) prefix[2] << 16) | ((size_t) prefix[3] << 8) | prefix[4];
+
+        cursor += STAND_IN_GRPC_PREFIX_LEN;
+
+        if (length > stream->body_length - cursor) {
+            break;
+        }
+
+        stats_.measurements += stand_in_pb_count_measurements_(&stream->body[cursor], length, stream->endpoint == STAND_IN_ENDPOINT_PUSH_ATMOSPHERE_BATCH);
+        cursor += length;
+    }
+}
+
+static int stand_in_compare_waits_(const void* a, const void* b)
+{
+    int64_t lhs = *(const int64_t*) a;
+    int64_t rhs = *(const int64_t*) b;
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+static int64_t stand_in_wait_percentile_(const int64_t* sorted, size_t count, size_t percent)
+{
+    return count > 0 ? sorted[((count - 1) * percent) / 100] : 0;
+}
+
+// The stats as JSON, in static storage
+static size_t stand_in_format_stats_(const char** dest)
+{
+    static int64_t sorted[STAND_IN_WAIT_SAMPLES];
+    static char json[STAND_IN_ARRIVAL_SECONDS * 12 + 1024];
+
+    size_t count = stats_.wait_count < STAND_IN_WAIT_SAMPLES ? stats_.wait_count : STAND_IN_WAIT_SAMPLES;
+    memcpy(sorted, stats_.waits, count * sizeof(int64_t));
+    qsort(sorted, count, sizeof(int64_t), stand_in_compare_waits_);
+
+    int64_t elapsed = (stand_in_now_() - stats_.reset_at) / 1000000;
+    size_t seconds = elapsed < STAND_IN_ARRIVAL_SECONDS ? (size_t) elapsed + 1 : STAND_IN_ARRIVAL_SECONDS;
+
+    uint64_t requests = 0;
+
+    for (size_t i = 0; i < STAND_IN_ENDPOINT_COUNT; i++) {
+        requests += stats_.requests[i];
+    }
+
+    int length = snprintf(json, sizeof(json),
+        "{\"requests\":%" PRIu64 ",\"poll\":%" PRIu64 ",\"push\":%" PRIu64 ",\"token\":%" PRIu64 ",\"errors\":%" PRIu64 ",\"measurements\":%" PRIu64 ","
+        "\"connections\":%" PRIu64 ",\"handshakes\":%" PRIu64 ",\"resumed_handshakes\":%" PRIu64 ","
+        "\"max_queue\":%zu,\"queue_wait_p50\":%" PRId64 ",\"queue_wait_p99\":%" PRId64 ",\"queue_wait_max\":%" PRId64 ",\"arrivals\":[",
+        requests, stats_.requests[STAND_IN_ENDPOINT_POLL], stats_.requests[STAND_IN_ENDPOINT_PUSH_MEASUREMENTS] + stats_.requests[STAND_IN_ENDPOINT_PUSH_ATMOSPHERE_BATCH],
+        stats_.requests[STAND_IN_ENDPOINT_DEVICE_CODE] + stats_.requests[STAND_IN_ENDPOINT_TOKEN], stats_.errors, stats_.measurements,
+        stats_.connections, stats_.handshakes, stats_.resumed_handshakes,
+        stats_.max_queue_length, stand_in_wait_percentile_(sorted, count, 50), stand_in_wait_percentile_(sorted, count, 99), stats_.max_wait);
+
+    for (size_t i = 0; i < seconds; i++) {
+        length += snprintf(&json[length], sizeof(json) - (size_t) length, "%s%" PRIu32, i > 0 ? "," : "", stats_.arrivals[i]);
+    }
+
+    length += snprintf(&json[length], sizeof(json) - (size_t) length, "]}\n");
+
+    *dest = json;
+    return (size_t) length;
+}
+
+static bool stand_in_build_stats_response_(struct stand_in_stream* stream)
+{
+    const char* json;
+    size_t length = stand_in_format_stats_(&json);
+
+    return stand_in_stream_set_response_(stream, json, length);
+}
+
+static void stand_in_write_stats_(void)
+{
+    const char* json;
+    size_t length = stand_in_format_stats_(&json);
+    FILE* file = fopen(options_.stats_path, "w");
+
+    if (file == NULL || fwrite(json, 1, length, file) != length) {
+        fprintf(stderr, "stand-in: failed to write %s\n", options_.stats_path);
+    }
+
+    if (file != NULL) {
+        fclose(file);
+    }
+}
+
+static void stand_in_reset_stats_(void)
+{
+    size_t queue_length = stats_.queue_length;
+    size_t in_service = stats_.in_service;
+
+    memset(&stats_, 0, sizeof(stats_));
+    stats_.reset_at = stand_in_now_();
+    stats_.queue_length = queue_length;
+    stats_.in_service = in_service;
+}
+
+// Fills in the response once a worker is done with the request
+static bool stand_in_build_response_(struct stand_in_stream* stream)
+{
+    char json[256];
+    uint8_t message[16];
+
+    if (stream->grpc && options_.error_rate > 0 && (unsigned int) (rand() % 100) < options_.error_rate) {
+        stats_.errors++;
+        stream->grpc_status = options_.error_code;
+        return stand_in_stream_set_response_(stream, NULL, 0);
+    }
+
+    switch (stream->endpoint) {
+    case STAND_IN_ENDPOINT_POLL:
+        return stand_in_build_poll_response_(stream);
+
+    case STAND_IN_ENDPOINT_PUSH_MEASUREMENTS:
+    case STAND_IN_ENDPOINT_PUSH_ATMOSPHERE_BATCH:
+        stand_in_count_pushed_(stream);
+
+        // google.protobuf.Empty
+        return stand_in_stream_set_grpc_response_(stream, NULL, 0);
+
+    case STAND_IN_ENDPOINT_HEALTH_CHECK: {
+        // SERVING
+        size_t length = stand_in_pb_tag_(message, 1, 0);
+        length += stand_in_pb_varint_(&message[length], 1);
+
+        return stand_in_stream_set_grpc_response_(stream, message, length);
+    }
+
+    case STAND_IN_ENDPOINT_DEVICE_CODE: {
+        int length = snprintf(json, sizeof(json), "{\"device_code\":\"device-%u\",\"user_code\":\"STAND-IN\",\"verification_uri\":\"https://localhost/activate\",\"interval\":1,\"expires_in\":300}", token_counter_++);
+        return stand_in_stream_set_response_(stream, json, (size_t) length);
+    }
+
+    case STAND_IN_ENDPOINT_TOKEN: {
+        int length = snprintf(json, sizeof(json), "{\"access_token\":\"access-%u\",\"refresh_token\":\"refresh-%u\",\"token_type\":\"Bearer\",\"expires_in\":86400}", token_counter_, token_counter_);
+        token_counter_++;
+
+        return stand_in_stream_set_response_(stream, json, (size_t) length);
+    }
+
+    case STAND_IN_ENDPOINT_STATS:
+        return stand_in_build_stats_response_(stream);
+
+    case STAND_IN_ENDPOINT_RESET:
+        stand_in_reset_stats_();
+        return stand_in_stream_set_response_(stream, NULL, 0);
+
+    case STAND_IN_ENDPOINT_UNKNOWN:
+    default:
+        stream->grpc_status = STAND_IN_GRPC_UNIMPLEMENTED;
+        return stand_in_stream_set_response_(stream, NULL, 0);
+    }
+}
+
+static ssize_t stand_in_read_response_(nghttp2_session* session, int32_t stream_id, uint8_t* buf, size_t length, uint32_t* data_flags, nghttp2_data_source* source, void* user_data)
+{
+    struct stand_in_stream* stream = (struct stand_in_stream*) source->ptr;
+    size_t remaining = stream->response_length - stream->response_cursor;
+
+    if (length > remaining) {
+        length = remaining;
+    }
+
+    memcpy(buf, &stream->response[stream->response_cursor], length);
+    stream->response_cursor += length;
+
+    if (stream->response_cursor == stream->response_length) {
+        *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+
+        if (stream->grpc) {
+            char status[16];
+            snprintf(status, sizeof(status), "%u", stream->grpc_status);
+
+            nghttp2_nv trailers[] = {
+                { (uint8_t*) "grpc-status", (uint8_t*) status, strlen("grpc-status"), strlen(status), NGHTTP2_NV_FLAG_NONE },
+            };
+
+            *data_flags |= NGHTTP2_DATA_FLAG_NO_END_STREAM;
+            nghttp2_submit_trailer(session, stream_id, trailers, sizeof(trailers) / sizeof(trailers[0]));
+        }
+    }
+
+    return (ssize_t) length;
+}
+
+static void stand_in_respond_(struct stand_in_stream* stream)
+{
+    if (!stand_in_build_response_(stream)) {
+        nghttp2_submit_rst_stream(stream->conn->ng, NGHTTP2_FLAG_NONE, stream->id, NGHTTP2_INTERNAL_ERROR);
+        return;
+    }
+
+    bool not_found = stream->endpoint == STAND_IN_ENDPOINT_UNKNOWN && !stream->grpc;
+    const char* content_type = stream->grpc ? "application/grpc" : "application/json";
+
+    nghttp2_nv headers[] = {
+        { (uint8_t*) ":status", (uint8_t*) (not_found ? "404" : "200"), strlen(":status"), 3, NGHTTP2_NV_FLAG_NONE },
+        { (uint8_t*) "content-type", (uint8_t*) content_type, strlen("content-type"), strlen(content_type), NGHTTP2_NV_FLAG_NONE },
+    };
+
+    nghttp2_data_provider provider = {
+        .source.ptr = stream,
+        .read_callback = stand_in_read_response_,
+    };
+
+    nghttp2_submit_response(stream->conn->ng, stream->id, headers, sizeof(headers) / sizeof(headers[0]), &provider);
+}
+
+// Workers
+
+static void stand_in_start_service_(struct stand_in_stream* stream, int64_t now)
+{
+    int64_t wait = now - stream->arrived;
+
+    stats_.waits[stats_.wait_count % STAND_IN_WAIT_SAMPLES] = wait;
+    stats_.wait_count++;
+    stats_.max_wait = wait > stats_.max_wait ? wait : stats_.max_wait;
+    stats_.in_service++;
+
+    stream->in_service = true;
+    stream->ready_at = now + options_.latency;
+    stream->next = serving_;
+    serving_ = stream;
+}
+
+static void stand_in_enqueue_(struct stand_in_stream* stream)
+{
+    int64_t now = stand_in_now_();
+    int64_t second = (now - stats_.reset_at) / 1000000;
+
+    stats_.requests[stream->endpoint]++;
+
+    if (second < STAND_IN_ARRIVAL_SECONDS) {
+        stats_.arrivals[second]++;
+    }
+
+    stream->arrived = now;
+
+    if (options_.workers == 0 || stats_.in_service < options_.workers) {
+        stand_in_start_service_(stream, now);
+        return;
+    }
+
+    stream->queued = true;
+    stream->next = NULL;
+
+    if (queue_tail_ != NULL) {
+        queue_tail_->next = stream;
+    } else {
+        queue_head_ = stream;
+    }
+
+    queue_tail_ = stream;
+    stats_.queue_length++;
+
+    if (stats_.queue_length > stats_.max_queue_length) {
+        stats_.max_queue_length = stats_.queue_length;
+    }
+}
+
+static void stand_in_unlink_(struct stand_in_stream* stream)
+{
+    if (stream->queued) {
+        struct stand_in_stream* previous = NULL;
+
+        for (struct stand_in_stream* cursor = queue_head_; cursor != NULL; previous = cursor, cursor = cursor->next) {
+            if (cursor == stream) {
+                if (previous != NULL) {
+                    previous->next = cursor->next;
+                } else {
+                    queue_head_ = cursor->next;
+                }
+
+                if (queue_tail_ == cursor) {
+                    queue_tail_ = previous;
+                }
+
+                break;
+            }
+        }
+
+        stream->queued = false;
+        stats_.queue_length--;
+    } else if (stream->in_service) {
+        for (struct stand_in_stream** cursor = &serving_; *cursor != NULL; cursor = &(*cursor)->next) {
+            if (*cursor == stream) {
+                *cursor = stream->next;
+                break;
+            }
+        }
+
+        stream->in_service = false;
+        stats_.in_service--;
+    }
+}
+
+// Responds to the requests whose service time is up, and hands their workers
+// the next ones in line. Returns how long until the next one is (ms), or -1.
+static int stand_in_run_workers_(void)
+{
+    int64_t now = stand_in_now_();
+    int64_t next = INT64_MAX;
+
+    for (struct stand_in_stream** cursor = &serving_; *cursor != NULL;) {
+        struct stand_in_stream* stream = *cursor;
+
+        if (stream->ready_at > now) {
+            next = stream->ready_at < next ? stream->ready_at : next;
+            cursor = &stream->next;
+            continue;
+        }
+
+        *cursor = stream->next;
+        stream->in_service = false;
+        stats_.in_service--;
+
+        stand_in_respond_(stream);
+
+        if (queue_head_ != NULL) {
+            struct stand_in_stream* waiting = queue_head_;
+
+            queue_head_ = waiting->next;
+            queue_tail_ = queue_head_ != NULL ? queue_tail_ : NULL;
+            waiting->queued = false;
+            stats_.queue_length--;
+
+            stand_in_start_service_(waiting, now);
+            next = waiting->ready_at < next ? waiting->ready_at : next;
+
+            // Served in this same pass when there is no latency
+            cursor = &serving_;
+        }
+    }
+
+    if (next == INT64_MAX) {
+        return -1;
+    }
+
+    return (int) ((next - now + 999) / 1000);
+}
+
+// HTTP/2 callbacks
+
+static int stand_in_on_begin_headers_(nghttp2_session* session, const nghttp2_frame* frame, void* user_data)
+{
+    if (frame->hd.type != NGHTTP2_HEADERS || frame->headers.cat != NGHTTP2_HCAT_REQUEST) {
+        return 0;
+    }
+
+    struct stand_in_stream* stream = calloc(1, sizeof(struct stand_in_stream));
+
+    if (stream == NULL) {
+        return NGHTTP2_ERR_CALLBACK_FAILURE;
+    }
+
+    stream->conn = (struct stand_in_conn*) user_data;
+    stream->id = frame->hd.stream_id;
+
+    nghttp2_session_set_stream_user_data(session, frame->hd.stream_id, stream);
+    return 0;
+}
+
+static int stand_in_on_header_(nghttp2_session* session, const nghttp2_frame* frame, const uint8_t* name, size_t namelen, const uint8_t* value, size_t valuelen, uint8_t flags, void* user_data)
+{
+    struct stand_in_stream* stream = nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+
+    if (stream == NULL) {
+        return 0;
+    }
+
+    if (namelen == strlen(":path") && memcmp(name, ":path", namelen) == 0) {
+        for (size_t i = 1; i < STAND_IN_ENDPOINT_COUNT; i++) {
+            if (valuelen == strlen(STAND_IN_ENDPOINT_PATHS[i]) && memcmp(value, STAND_IN_ENDPOINT_PATHS[i], valuelen) == 0) {
+                stream->endpoint = (enum stand_in_endpoint) i;
+                break;
+            }
+        }
+    } else if (namelen == strlen("content-type") && memcmp(name, "content-type", namelen) == 0) {
+        stream->grpc = valuelen >= strlen("application/grpc") && memcmp(value, "application/grpc", strlen("application/grpc")) == 0;
+    }
+
+    return 0;
+}
+
+static int stand_in_on_data_chunk_(nghttp2_session* session, uint8_t flags, int32_t stream_id, const uint8_t* data, size_t len, void* user_data)
+{
+    struct stand_in_stream* stream = nghttp2_session_get_stream_user_data(session, stream_id);
+
+    if (stream == NULL) {
+        return 0;
+    }
+
+    if (stream->body_length + len > STAND_IN_MAX_BODY_LEN) {
+        return nghttp2_submit_rst_stream(session, NGHTTP2_FLAG_NONE, stream_id, NGHTTP2_REFUSED_STREAM);
+    }
+
+    uint8_t* body = realloc(stream->body, stream->body_length + len);
+
+    if (body == NULL) {
+        return NGHTTP2_ERR_CALLBACK_FAILURE;
+    }
+
+    memcpy(&body[stream->body_length], data, len);
+    stream->body = body;
+    stream->body_length += len;
+
+    return 0;
+}
+
+static int stand_in_on_frame_recv_(nghttp2_session* session, const nghttp2_frame* frame, void* user_data)
+{
+    if ((frame->hd.type != NGHTTP2_HEADERS && frame->hd.type != NGHTTP2_DATA) || (frame->hd.flags & NGHTTP2_FLAG_END_STREAM) == 0) {
+        return 0;
+    }
+
+    struct stand_in_stream* stream = nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+
+    if (stream != NULL) {
+        stand_in_enqueue_(stream);
+    }
+
+    return 0;
+}
+
+static int stand_in_on_stream_close_(nghttp2_session* session, int32_t stream_id, uint32_t error_code, void* user_data)
+{
+    struct stand_in_stream* stream = nghttp2_session_get_stream_user_data(session, stream_id);
+
+    if (stream == NULL) {
+        return 0;
+    }
+
+    stand_in_unlink_(stream);
+
+    free(stream->body);
+    free(stream->response);
+    free(stream);
+
+    return 0;
+}
+
+// Connections
+
+static void stand_in_conn_close_(size_t index)
+{
+    struct stand_in_conn* conn = conns_[index];
+
+    // Closing the session closes its streams, which unlinks them
+    nghttp2_session_del(conn->ng);
+    SSL_free(conn->ssl);
+    close(conn->fd);
+    free(conn->out);
+    free(conn);
+
+    conn_count_--;
+    conns_[index] = conns_[conn_count_ + 1];
+    pollfds_[index] = pollfds_[conn_count_ + 1];
+}
+
+// Hands nghttp2's pending frames to TLS. Returns false once the connection is
+// done.
+static bool stand_in_conn_flush_(struct stand_in_conn* conn, short* events)
+{
+    while (true) {
+        if (conn->out_length == 0) {
+            const uint8_t* data = NULL;
+            ssize_t length = nghttp2_session_mem_send(conn->ng, &data);
+
+            if (length < 0) {
+                return false;
+            }
+
+            if (length == 0) {
+                break;
+            }
+
+            if ((size_t) length > conn->out_capacity) {
+                uint8_t* out = realloc(conn->out, (size_t) length);
+
+                if (out == NULL) {
+                    return false;
+                }
+
+                conn->out = out;
+                conn->out_capacity = (size_t) length;
+            }
+
+            memcpy(conn->out, data, (size_t) length);
+            conn->out_length = (size_t) length;
+        }
+
+        int written = SSL_write(conn->ssl, conn->out, (int) conn->out_length);
+
+        if (written <= 0) {
+            int error = SSL_get_error(conn->ssl, written);
+
+            if (error == SSL_ERROR_WANT_WRITE || error == SSL_ERROR_WANT_READ) {
+                *events |= error == SSL_ERROR_WANT_WRITE ? POLLOUT : POLLIN;
+                return true;
+            }
+
+            return false;
+        }
+
+        conn->out_length -= (size_t) written;
+        memmove(conn->out, &conn->out[written], conn->out_length);
+    }
+
+    return nghttp2_session_want_read(conn->ng) || nghttp2_session_want_write(conn->ng);
+}
+
+static bool stand_in_conn_handshake_(struct stand_in_conn* conn, short* events)
+{
+    int rc = SSL_do_handshake(conn->ssl);
+
+    if (rc != 1) {
+        int error = SSL_get_error(conn->ssl, rc);
+
+        if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE) {
+            *events = error == SSL_ERROR_WANT_WRITE ? POLLOUT : POLLIN;
+            return true;
+        }
+
+        ERR_clear_error();
+        return false;
+    }
+
+    const unsigned char* alpn = NULL;
+    unsigned int alpn_length = 0;
+    SSL_get0_alpn_selected(conn->ssl, &alpn, &alpn_length);
+
+    if (alpn_length != 2 || memcmp(alpn, "h2", 2) != 0) {
+        return false;
+    }
+
+    conn->handshaken = true;
+    stats_.handshakes++;
+
+    if (SSL_session_reused(conn->ssl)) {
+        stats_.resumed_handshakes++;
+    }
+
+    nghttp2_settings_entry settings[] = {
+        { NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS, 100 },
+    };
+
+    return nghttp2_submit_settings(conn->ng, NGHTTP2_FLAG_NONE, settings, sizeof(settings) / sizeof(settings[0])) == 0;
+}
+
+// Reads what TLS has, and writes what nghttp2 has. Returns false once the
+// connection is done.
+static bool stand_in_conn_service_(struct stand_in_conn* conn, short* events)
+{
+    uint8_t buf[16 * 1024];
+
+    *events = POLLIN;
+
+    if (!conn->handshaken) {
+        if (!stand_in_conn_handshake_(conn, events)) {
+            return false;
+        }
+
+        if (!conn->handshaken) {
+            return true;
+        }
+    }
+
+    while (true) {
+        int received = SSL_read(conn->ssl, buf, sizeof(buf));
+
+        if (received <= 0) {
+            int error = SSL_get_error(conn->ssl, received);
+
+            if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE) {
+                break;
+            }
+
+            ERR_clear_error();
+            return false;
+        }
+
+        if (nghttp2_session_mem_recv(conn->ng, buf, (size_t) received) < 0) {
+            return false;
+        }
+    }
+
+    return stand_in_conn_flush_(conn, events);
+}
+
+static void stand_in_accept_(int listener, SSL_CTX* ctx, nghttp2_session_callbacks* callbacks)
+{
+    while (conn_count_ < STAND_IN_MAX_CONNS) {
+        int fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if (fd < 0) {
+            return;
+        }
+
+        int nodelay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+        struct stand_in_conn* conn = calloc(1, sizeof(struct stand_in_conn));
+
+        if (conn == NULL) {
+            close(fd);
+            return;
+        }
+
+        conn->fd = fd;
+        conn->ssl = SSL_new(ctx);
+
+        if (conn->ssl == NULL || !SSL_set_fd(conn->ssl, fd) || nghttp2_session_server_new(&conn->ng, callbacks, conn) != 0) {
+            SSL_free(conn->ssl);
+            close(fd);
+            free(conn);
+            return;
+        }
+
+        SSL_set_accept_state(conn->ssl);
+        stats_.connections++;
+
+        conn_count_++;
+        conns_[conn_count_] = conn;
+        pollfds_[conn_count_] = (struct pollfd) { .fd = fd, .events = POLLIN };
+    }
+}
+
+static int stand_in_select_alpn_(SSL* ssl, const unsigned char** out, unsigned char* outlen, const unsigned char* in, unsigned int inlen, void* arg)
+{
+    static const unsigned char h2[] = { 2, 'h', '2' };
+
+    if (SSL_select_next_proto((unsigned char**) out, outlen, h2, sizeof(h2), in, inlen) != OPENSSL_NPN_NEGOTIATED) {
+        return SSL_TLSEXT_ERR_ALERT_FATAL;
+    }
+
+    return SSL_TLSEXT_ERR_OK;
+}
+
+static SSL_CTX* stand_in_create_ssl_ctx_(void)
+{
+    SSL_CTX* ctx = SSL_CTX_new(TLS_server_method());
+
+    if (ctx == NULL) {
+        return NULL;
+    }
+
+    if (SSL_CTX_use_certificate_chain_file(ctx, options_.cert) != 1 || SSL_CTX_use_PrivateKey_file(ctx, options_.key, SSL_FILETYPE_PEM) != 1) {
+        fprintf(stderr, "stand-in: failed to load %s and %s\n", options_.cert, options_.key);
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+
+    // As the device negotiates it
+    SSL_CTX_set_max_proto_version(ctx, TLS1_2_VERSION);
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_set_alpn_select_cb(ctx, stand_in_select_alpn_, NULL);
+
+    return ctx;
+}
+
+static int stand_in_listen_(void)
+{
+    int fd = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int yes = 1;
+    int no = 0;
+
+    if (fd < 0) {
+        return -1;
+    }
+
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &no, sizeof(no));
+
+    struct sockaddr_in6 address = {
+        .sin6_family = AF_INET6,
+        .sin6_port = htons(options_.port),
+        .sin6_addr = in6addr_any,
+    };
+
+    if (bind(fd, (struct sockaddr*) &address, sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        fprintf(stderr, "stand-in: failed to listen on port %u: %s\n", options_.port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static void stand_in_report_(int64_t now, int64_t* last_report, uint64_t* last_requests)
+{
+    uint64_t requests = 0;
+
+    for (size_t i = 0; i < STAND_IN_ENDPOINT_COUNT; i++) {
+        requests += stats_.requests[i];
+    }
+
+    int64_t elapsed = now - *last_report;
+
+    printf("stand-in: %" PRIu64 " requests (%" PRIu64 "/s) Connections %zu Serving %zu Queued %zu (Max %zu, Max wait %" PRId64 "us) Errors %" PRIu64 " Measurements %" PRIu64 "\n",
+        requests, (requests - *last_requests) * 1000000 / (uint64_t) (elapsed > 0 ? elapsed : 1), conn_count_, stats_.in_service, stats_.queue_length, stats_.max_queue_length, stats_.max_wait, stats_.errors, stats_.measurements);
+    fflush(stdout);
+
+    *last_report = now;
+    *last_requests = requests;
+}
+
+static void stand_in_on_signal_(int signal)
+{
+    if (signal == SIGHUP) {
+        resetting_ = 1;
+    } else {
+        stopping_ = 1;
+    }
+}
+
+static void stand_in_usage_(const char* name)
+{
+    fprintf(stderr,
+        "usage: %s --cert FILE --key FILE [options]\n"
+        "  --port N            port to listen on (8443)\n"
+        "  --latency MS        service time of each request (0)\n"
+        "  --workers N         requests served at once, 0 for no limit (0)\n"
+        "  --response-size N   bytes of padding in PollResponses (0)\n"
+        "  --error-rate P      percent of gRPC calls that fail (0)\n"
+        "  --error-code C      gRPC status of failed calls (14, UNAVAILABLE)\n"
+        "  --poll-period S     poll_period sent to devices (60)\n"
+        "  --poll-spread S     poll_spread sent to devices (0)\n"
+        "  --report S          seconds between reports, 0 for none (10)\n"
+        "  --stats FILE        write the stats to FILE as JSON on exit\n",
+        name);
+}
+
+static bool stand_in_parse_options_(int argc, char** argv)
+{
+    static const struct option long_options[] = {
+        { "cert", required_argument, NULL, 'c' },
+        { "key", required_argument, NULL, 'k' },
+        { "port", required_argument, NULL, 'p' },
+        { "latency", required_argument, NULL, 'l' },
+        { "workers", required_argument, NULL, 'w' },
+        { "response-size", required_argument, NULL, 's' },
+        { "error-rate", required_argument, NULL, 'e' },
+        { "error-code", required_argument, NULL, 'E' },
+        { "poll-period", required_argument, NULL, 'P' },
+        { "poll-spread", required_argument, NULL, 'S' },
+        { "report", required_argument, NULL, 'r' },
+        { "stats", required_argument, NULL, 'o' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    int option;
+
+    while ((option = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (option) {
+        case 'c':
+            options_.cert = optarg;
+            break;
+        case 'k':
+            options_.key = optarg;
+            break;
+        case 'p':
+            options_.port = (uint16_t) strtoul(optarg, NULL, 10);
+            break;
+        case 'l':
+            options_.latency = strtoll(optarg, NULL, 10) * 1000;
+            break;
+        case 'w':
+            options_.workers = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            options_.response_size = strtoul(optarg, NULL, 10);
+            break;
+        case 'e':
+            options_.error_rate = (unsigned int) strtoul(optarg, NULL, 10);
+            break;
+        case 'E':
+            options_.error_code = (unsigned int) strtoul(optarg, NULL, 10);
+            break;
+        case 'P':
+            options_.poll_period = strtoll(optarg, NULL, 10);
+            break;
+        case 'S':
+            options_.poll_spread = strtoll(optarg, NULL, 10);
+            break;
+        case 'r':
+            options_.report_interval = strtoll(optarg, NULL, 10);
+            break;
+        case 'o':
+            options_.stats_path = optarg;
+            break;
+        default:
+            return false;
+        }
+    }
+
+    if (options_.response_size > STAND_IN_MAX_RESPONSE_LEN) {
+        options_.response_size = STAND_IN_MAX_RESPONSE_LEN;
+    }
+
+    return options_.cert != NULL && options_.key != NULL;
+}
+
+int main(int argc, char** argv)
+{
+    int rc = EXIT_FAILURE;
+    SSL_CTX* ctx = NULL;
+    nghttp2_session_callbacks* callbacks = NULL;
+    int listener = -1;
+
+    if (!stand_in_parse_options_(argc, argv)) {
+        stand_in_usage_(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, stand_in_on_signal_);
+    signal(SIGTERM, stand_in_on_signal_);
+    signal(SIGHUP, stand_in_on_signal_);
+
+    ctx = stand_in_create_ssl_ctx_();
+    listener = stand_in_listen_();
+
+    if (ctx == NULL || listener < 0 || nghttp2_session_callbacks_new(&callbacks) != 0) {
+        goto exit;
+    }
+
+    nghttp2_session_callbacks_set_on_begin_headers_callback(callbacks, stand_in_on_begin_headers_);
+    nghttp2_session_callbacks_set_on_header_callback(callbacks, stand_in_on_header_);
+    nghttp2_session_callbacks_set_on_data_chunk_recv_callback(callbacks, stand_in_on_data_chunk_);
+    nghttp2_session_callbacks_set_on_frame_recv_callback(callbacks, stand_in_on_frame_recv_);
+    nghttp2_session_callbacks_set_on_stream_close_callback(callbacks, stand_in_on_stream_close_);
+
+    stand_in_reset_stats_();
+    pollfds_[0] = (struct pollfd) { .fd = listener, .events = POLLIN };
+
+    printf("stand-in: listening on port %u\n", options_.port);
+    fflush(stdout);
+
+    int64_t last_report = stand_in_now_();
+    uint64_t last_requests = 0;
+
+    while (!stopping_) {
+        if (resetting_) {
+            resetting_ = 0;
+            stand_in_reset_stats_();
+            last_requests = 0;
+        }
+
+        int timeout = stand_in_run_workers_();
+
+        // Responses submitted by the workers go out now
+        for (size_t i = 1; i <= conn_count_; i++) {
+            if (conns_[i]->handshaken && !stand_in_conn_flush_(conns_[i], &pollfds_[i].events)) {
+                stand_in_conn_close_(i--);
+            }
+        }
+
+        if (options_.report_interval > 0) {
+            int64_t until_report = last_report + options_.report_interval * 1000000 - stand_in_now_();
+            int report_timeout = until_report > 0 ? (int) ((until_report + 999) / 1000) : 0;
+
+            timeout = timeout < 0 || report_timeout < timeout ? report_timeout : timeout;
+        }
+
+        if (poll(pollfds_, conn_count_ + 1, timeout) < 0 && errno != EINTR) {
+            break;
+        }
+
+        if (pollfds_[0].revents & POLLIN) {
+            stand_in_accept_(listener, ctx, callbacks);
+        }
+
+        for (size_t i = 1; i <= conn_count_; i++) {
+            if (pollfds_[i].revents == 0) {
+                continue;
+            }
+
+            if ((pollfds_[i].revents & (POLLERR | POLLHUP)) != 0 || !stand_in_conn_service_(conns_[i], &pollfds_[i].events)) {
+                stand_in_conn_close_(i--);
+            }
+        }
+
+        int64_t now = stand_in_now_();
+
+        if (options_.report_interval > 0 && now - last_report >= options_.report_interval * 1000000) {
+            stand_in_report_(now, &last_report, &last_requests);
+        }
+    }
+
+    stand_in_report_(stand_in_now_(), &last_report, &last_requests);
+
+    if (options_.stats_path != NULL) {
+        stand_in_write_stats_();
+    }
+
+    rc = EXIT_SUCCESS;
+
+exit:
+    while (conn_count_ > 0) {
+        stand_in_conn_close_(conn_count_);
+    }
+
+    if (listener >= 0) {
+        close(listener);
+    }
+
+    nghttp2_session_callbacks_del(callbacks);
+    SSL_CTX_free(ctx);
+
+    return rc;
+}
\ No newline at end of file
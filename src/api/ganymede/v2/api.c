@@ -1,28 +1,179 @@
 #include "api.h"
 
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
 
 #include <esp_log.h>
+#include <esp_random.h>
+#include <esp_timer.h>
 
 #include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
 #include <freertos/task.h>
 
 #include <net/auth/auth.h>
 #include <net/http2/http2.h>
 
+// The arena holds a PollResponse both packed and unpacked
+#if CONFIG_GANYMEDE_POLL_RESPONSE_ARENA_SIZE < 4 * CONFIG_GANYMEDE_POLL_RESPONSE_MAX_SIZE
+#error "GANYMEDE_POLL_RESPONSE_ARENA_SIZE must be at least four times GANYMEDE_POLL_RESPONSE_MAX_SIZE"
+#endif
+
 static char* TAG = "api";
 
-static char token_[CONFIG_AUTH_ACCESS_TOKEN_LEN + 7] = { 0 };
-static uint8_t payload_buffer_[CONFIG_GRPC_PAYLOAD_BUFFER_LEN] = { 0 };
-static uint8_t response_buffer_[CONFIG_GRPC_RESPONSE_BUFFER_LEN] = { 0 };
+enum {
+    // gRPC messages are prefixed by a compressed flag and their length as a
+    // 32 bit big endian integer.
+    GRPC_MESSAGE_PREFIX_LEN = 5,
+
+    // Tag and length of an embedded message, both varints of up to 32 bits
+    PROTOBUF_FIELD_HEADER_MAX_LEN = 10,
+
+    // Wire type of embedded messages
+    PROTOBUF_WIRE_TYPE_LENGTH_DELIMITED = 2,
+
+    // Room for the fields of a streamed request other than the streamed one
+    GRPC_STREAM_TAIL_MAX_LEN = 64,
+
+    // Longest response message accepted. PollResponse is the largest the
+    // server sends.
+    GRPC_RESPONSE_MAX_LEN = CONFIG_GANYMEDE_POLL_RESPONSE_MAX_SIZE,
+
+    // Value of a call's pushback until the server sends one
+    GRPC_PUSHBACK_NONE = INT32_MIN,
+
+    // Retry budget, in thousandths of a token. Each retryable failure costs a
+    // token and each success earns back a tenth of one. Retries stop while
+    // half the budget or less remains.
+    GRPC_RETRY_BUDGET_MAX = CONFIG_GANYMEDE_API_RETRY_BUDGET * 1000,
+    GRPC_RETRY_BUDGET_FAILURE_COST = 1000,
+    GRPC_RETRY_BUDGET_SUCCESS_REFUND = 100,
+};
+
+// Packs a whole request to `buffer`, or only sizes it when `buffer` is NULL.
+// Returns its packed length.
+typedef size_t (*ganymede_api_v2_request_encoder_t)(const void* request, uint8_t* buffer);
+
+// Packs element `index` of a streamed field to `buffer`, or only sizes it when
+// `buffer` is NULL. Returns its packed length.
+typedef size_t (*ganymede_api_v2_element_encoder_t)(const void* elements, size_t index, uint8_t* buffer);
+
+// Loads element `index` for the encoder, when elements are read in order from
+// storage rather than held in memory. Called before each element is sized or
+// packed, with indices counting up from 0 again on every attempt.
+typedef esp_err_t (*ganymede_api_v2_element_seeker_t)(const void* elements, size_t index);
 
-static const struct http_perform_options http_perform_options_ = {
-    .authorization = token_,
-    .content_type = "application/grpc+proto",
-    .use_grpc_status = true
+// A repeated message field, serialized one element at a time as the request is
+// sent rather than packed whole up front
+struct ganymede_api_v2_streamed_field {
+    uint32_t number;
+    ganymede_api_v2_element_encoder_t encode;
+    ganymede_api_v2_element_seeker_t seek;
+    const void* elements;
+    size_t count;
+
+    // The request's other fields, packed after the streamed one, as protobuf-c
+    // would. Must not set the streamed field, nor fields numbered before it.
+    const ProtobufCMessage* rest;
+};
+
+// PushAtmosphereBatch request, encoded straight from the samples
+struct ganymede_api_v2_atmosphere_batch {
+    const struct ganymede_api_v2_atmosphere_samples* samples;
+    const char* batch_id;
+};
+
+// A reader's samples as the elements of a streamed field, the one loaded last
+// staged as a single sample
+struct ganymede_api_v2_atmosphere_stream {
+    const struct ganymede_api_v2_atmosphere_reader* reader;
+    struct ganymede_api_v2_atmosphere_samples sample;
+
+    // Index of the sample loaded, SIZE_MAX if none is
+    size_t loaded;
+    time_t timestamp;
+    int16_t humidity;
+    int16_t temperature;
 };
 
+// Progress of a streamed request. The element being sent is staged in the
+// call's payload buffer.
+struct ganymede_api_v2_request_stream {
+    struct ganymede_api_v2_streamed_field field;
+    size_t next;
+
+    uint8_t tail[GRPC_STREAM_TAIL_MAX_LEN];
+    size_t tail_length;
+    uint32_t message_length;
+
+    size_t pending_length;
+    size_t pending_cursor;
+};
+
+enum ganymede_api_v2_call_state {
+    GANYMEDE_API_V2_CALL_IDLE,
+    GANYMEDE_API_V2_CALL_IN_FLIGHT,
+
+    // Waiting on the retry timer
+    GANYMEDE_API_V2_CALL_BACKOFF,
+};
+
+// Reassembles the response message from the body chunks as they arrive, in
+// bytes reserved at the end of the call's arena
+struct ganymede_api_v2_deframer {
+    uint8_t prefix[GRPC_MESSAGE_PREFIX_LEN];
+    size_t prefix_cursor;
+
+    uint8_t* message;
+    uint32_t message_length;
+    uint32_t message_cursor;
+};
+
+// Buffers for a single call. Calls from different tasks run concurrently on
+// the same HTTP2 session, so each needs its own.
+struct ganymede_api_v2_call {
+    char token[CONFIG_AUTH_ACCESS_TOKEN_LEN + 7];
+    uint8_t payload_buffer[CONFIG_GRPC_PAYLOAD_BUFFER_LEN];
+    struct ganymede_api_v2_deframer deframer;
+    struct ganymede_api_v2_request_stream request_stream;
+
+    http2_session_t* session;
+    const char* rpc;
+    size_t payload_length;
+    bool streamed;
+    const ProtobufCMessageDescriptor* response_descriptor;
+    struct pb_arena* arena;
+    int64_t timeout_ms;
+    ganymede_api_v2_callback_t callback;
+    void* arg;
+
+    // Retries. `state`, `cancelled`, `attempts` and `request_id` are shared
+    // with ganymede_api_v2_cancel, under calls_lock_.
+    enum ganymede_api_v2_call_state state;
+    bool cancelled;
+    ganymede_api_v2_call_id_t call_id;
+    http2_request_id_t request_id;
+    uint32_t attempts;
+    int32_t pushback_ms;
+    esp_timer_handle_t retry_timer;
+};
+
+// State of a blocking call, waiting on its async counterpart
+struct ganymede_api_v2_sync_call {
+    TaskHandle_t requestor;
+    ProtobufCMessage* response;
+};
+
+static struct ganymede_api_v2_call calls_[CONFIG_GANYMEDE_API_MAX_CONCURRENT_CALLS] = { 0 };
+static QueueHandle_t free_calls_ = NULL;
+static portMUX_TYPE calls_lock_ = portMUX_INITIALIZER_UNLOCKED;
+static atomic_uint_fast32_t next_call_id_ = 1;
+
+static int32_t retry_budget_ = GRPC_RETRY_BUDGET_MAX;
+
 static void ganymede_api_v2_copy_32bit_bigendian_(uint32_t* pdest, const uint32_t* psource)
 {
     const unsigned char* source = (const unsigned char*) psource;
@@ -33,72 +184,576 @@ static void ganymede_api_v2_copy_32bit_bigendian_(uint32_t* pdest, const uint32_
     dest[3] = source[0];
 }
 
-static size_t ganymede_api_v2_pack_protobuf_(const ProtobufCMessage* request, uint8_t* buffer)
+static size_t ganymede_api_v2_pack_message_(const void* request, uint8_t* buffer)
+{
+    if (buffer == NULL) {
+        return protobuf_c_message_get_packed_size((const ProtobufCMessage*) request);
+    }
+
+    return protobuf_c_message_pack((const ProtobufCMessage*) request, buffer);
+}
+
+static size_t ganymede_api_v2_encode_atmosphere_batch_(const void* request, uint8_t* buffer)
+{
+    const struct ganymede_api_v2_atmosphere_batch* batch = (const struct ganymede_api_v2_atmosphere_batch*) request;
+    return ganymede_api_v2_encode_atmosphere_batch(batch->samples, batch->batch_id, buffer);
+}
+
+static size_t ganymede_api_v2_pack_request_(ganymede_api_v2_request_encoder_t encode, const void* request, uint8_t* buffer)
 {
-    uint32_t length = protobuf_c_message_get_packed_size(request);
+    uint32_t length = encode(request, NULL);
+
+    if (length > CONFIG_GRPC_PAYLOAD_BUFFER_LEN - GRPC_MESSAGE_PREFIX_LEN) {
+        ESP_LOGE(TAG, "request too large (%" PRIu32 " bytes)", length);
+        return 0;
+    }
 
     buffer[0] = 0;
     ganymede_api_v2_copy_32bit_bigendian_((uint32_t*) &buffer[1], &length);
-    protobuf_c_message_pack(request, &buffer[5]);
+    encode(request, &buffer[GRPC_MESSAGE_PREFIX_LEN]);
 
-    return length + 5;
+    return length + GRPC_MESSAGE_PREFIX_LEN;
 }
 
-grpc_status_t ganymede_api_v2_perform_(const char* rpc, const ProtobufCMessage* request, const ProtobufCMessageDescriptor* response_descriptor, ProtobufCMessage** response_dest)
+static size_t ganymede_api_v2_encode_varint_(uint32_t value, uint8_t* buffer)
 {
-    grpc_status_t rc = GRPC_STATUS_LOCAL_ERROR;
+    size_t length = 0;
+
+    while (value >= 0x80) {
+        buffer[length++] = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+
+    buffer[length++] = (uint8_t) value;
+    return length;
+}
+
+// Stage the next element of the streamed field, with its tag and length, in
+// the payload buffer. The packed tail follows the last element.
+static esp_err_t ganymede_api_v2_stage_element_(struct ganymede_api_v2_call* call)
+{
+    struct ganymede_api_v2_request_stream* stream = &call->request_stream;
+    size_t index = stream->next++;
+
+    if (index == stream->field.count) {
+        memcpy(call->payload_buffer, stream->tail, stream->tail_length);
+        stream->pending_length = stream->tail_length;
+        stream->pending_cursor = 0;
+        return ESP_OK;
+    }
+
+    if (stream->field.seek != NULL && stream->field.seek(stream->field.elements, index) != ESP_OK) {
+        ESP_LOGE(TAG, "failed to read request element %zu", index);
+        return ESP_FAIL;
+    }
+
+    uint32_t element_length = stream->field.encode(stream->field.elements, index, NULL);
+
+    if (element_length > sizeof(call->payload_buffer) - PROTOBUF_FIELD_HEADER_MAX_LEN) {
+        ESP_LOGE(TAG, "request element too large (%" PRIu32 " bytes)", element_length);
+        return ESP_FAIL;
+    }
+
+    size_t length = ganymede_api_v2_encode_varint_((stream->field.number << 3) | PROTOBUF_WIRE_TYPE_LENGTH_DELIMITED, call->payload_buffer);
+    length += ganymede_api_v2_encode_varint_(element_length, &call->payload_buffer[length]);
+    length += stream->field.encode(stream->field.elements, index, &call->payload_buffer[length]);
+
+    stream->pending_length = length;
+    stream->pending_cursor = 0;
+    return ESP_OK;
+}
+
+// Request source, runs in the http2 task. Only one element is serialized at a
+// time, so the request may be many times the size of the payload buffer.
+static ssize_t ganymede_api_v2_request_source_(uint8_t* buf, size_t length, void* arg)
+{
+    struct ganymede_api_v2_call* call = (struct ganymede_api_v2_call*) arg;
+    struct ganymede_api_v2_request_stream* stream = &call->request_stream;
+    size_t written = 0;
+
+    while (written < length) {
+        if (stream->pending_cursor == stream->pending_length) {
+            if (stream->next > stream->field.count) {
+                break;
+            }
+
+            if (ganymede_api_v2_stage_element_(call) != ESP_OK) {
+                return -1;
+            }
+        }
+
+        size_t left = stream->pending_length - stream->pending_cursor;
+        size_t copied = length - written < left ? length - written : left;
+        memcpy(&buf[written], &call->payload_buffer[stream->pending_cursor], copied);
+        stream->pending_cursor += copied;
+        written += copied;
+    }
+
+    // Ran out of elements before the length announced in the prefix
+    if (written == 0) {
+        ESP_LOGE(TAG, "request stream ended early");
+        return -1;
+    }
+
+    return (ssize_t) written;
+}
+
+static size_t ganymede_api_v2_varint_len_(uint32_t value)
+{
+    size_t length = 1;
+
+    while (value >= 0x80) {
+        value >>= 7;
+        length++;
+    }
+
+    return length;
+}
+
+// Pack the fields that are not streamed and size the whole message. Returns the
+// length of the body, or 0 if something does not fit the call's buffers.
+static size_t ganymede_api_v2_start_stream_(struct ganymede_api_v2_call* call, const struct ganymede_api_v2_streamed_field* field)
+{
+    struct ganymede_api_v2_request_stream* stream = &call->request_stream;
+    uint32_t tag_length = ganymede_api_v2_varint_len_((field->number << 3) | PROTOBUF_WIRE_TYPE_LENGTH_DELIMITED);
+
+    *stream = (struct ganymede_api_v2_request_stream) {
+        .field = *field,
+    };
+
+    if (field->rest != NULL) {
+        if (protobuf_c_message_get_packed_size(field->rest) > sizeof(stream->tail)) {
+            ESP_LOGE(TAG, "request tail too large");
+            return 0;
+        }
+
+        stream->tail_length = protobuf_c_message_pack(field->rest, stream->tail);
+    }
+
+    stream->message_length = stream->tail_length;
+
+    for (size_t i = 0; i < field->count; i++) {
+        if (field->seek != NULL && field->seek(field->elements, i) != ESP_OK) {
+            ESP_LOGE(TAG, "failed to read request element %zu", i);
+            return 0;
+        }
+
+        uint32_t element_length = field->encode(field->elements, i, NULL);
+
+        if (element_length > sizeof(call->payload_buffer) - PROTOBUF_FIELD_HEADER_MAX_LEN) {
+            ESP_LOGE(TAG, "request element too large (%" PRIu32 " bytes)", element_length);
+            return 0;
+        }
+
+        stream->message_length += tag_length + ganymede_api_v2_varint_len_(element_length) + element_length;
+    }
+
+    return stream->message_length + GRPC_MESSAGE_PREFIX_LEN;
+}
+
+// Stage the gRPC prefix, to send the request from the start. Done before every
+// attempt.
+static void ganymede_api_v2_rewind_stream_(struct ganymede_api_v2_call* call)
+{
+    struct ganymede_api_v2_request_stream* stream = &call->request_stream;
+
+    call->payload_buffer[0] = 0;
+    ganymede_api_v2_copy_32bit_bigendian_((uint32_t*) &call->payload_buffer[1], &stream->message_length);
+
+    stream->next = 0;
+    stream->pending_length = GRPC_MESSAGE_PREFIX_LEN;
+    stream->pending_cursor = 0;
+}
+
+// Response sink, runs in the http2 task. Unary calls get a single message,
+// which is buffered until complete as protobuf-c can only unpack whole
+// messages.
+static esp_err_t ganymede_api_v2_on_response_data_(const uint8_t* data, size_t length, void* arg)
+{
+    struct ganymede_api_v2_call* call = (struct ganymede_api_v2_call*) arg;
+    struct ganymede_api_v2_deframer* deframer = &call->deframer;
+
+    // No response expected, nothing to keep
+    if (call->response_descriptor == NULL) {
+        return ESP_OK;
+    }
+
+    while (length > 0) {
+        if (deframer->prefix_cursor < GRPC_MESSAGE_PREFIX_LEN) {
+            deframer->prefix[deframer->prefix_cursor++] = *data++;
+            length--;
+
+            if (deframer->prefix_cursor < GRPC_MESSAGE_PREFIX_LEN) {
+                continue;
+            }
+
+            if (deframer->prefix[0] != 0) {
+                ESP_LOGE(TAG, "compressed responses are not supported");
+                return ESP_FAIL;
+            }
+
+            ganymede_api_v2_copy_32bit_bigendian_(&deframer->message_length, (uint32_t*) &deframer->prefix[1]);
+
+            if (deframer->message_length > GRPC_RESPONSE_MAX_LEN) {
+                ESP_LOGE(TAG, "response too large (%" PRIu32 " bytes)", deframer->message_length);
+                return ESP_FAIL;
+            }
+
+            // The unpacked message goes in front of it
+            deframer->message = pb_arena_reserve(call->arena, deframer->message_length);
+
+            if (deframer->message == NULL) {
+                return ESP_FAIL;
+            }
+
+            continue;
+        }
+
+        size_t left = deframer->message_length - deframer->message_cursor;
+
+        if (left == 0) {
+            ESP_LOGE(TAG, "unexpected data after response message");
+            return ESP_FAIL;
+        }
+
+        size_t copied = length < left ? length : left;
+        memcpy(&deframer->message[deframer->message_cursor], data, copied);
+        deframer->message_cursor += copied;
+        data += copied;
+        length -= copied;
+    }
+
+    return ESP_OK;
+}
+
+static void ganymede_api_v2_deframer_reset_(struct ganymede_api_v2_deframer* deframer)
+{
+    memset(deframer, 0, sizeof(struct ganymede_api_v2_deframer));
+}
+
+static grpc_status_t ganymede_api_v2_status_from_http2_(int32_t status)
+{
+    switch (status) {
+    case HTTP2_STATUS_DEADLINE_EXCEEDED:
+        return GRPC_STATUS_DEADLINE_EXCEEDED;
+    case HTTP2_STATUS_CANCELLED:
+        return GRPC_STATUS_CANCELLED;
+    default:
+        return (grpc_status_t) status;
+    }
+}
+
+static bool ganymede_api_v2_is_retryable_(grpc_status_t status)
+{
+    switch (status) {
+    case GRPC_STATUS_DEADLINE_EXCEEDED:
+    case GRPC_STATUS_RESOURCE_EXHAUSTED:
+    case GRPC_STATUS_UNAVAILABLE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Spend or earn back retry budget, shared by every call. Returns whether
+// retries are still allowed.
+static bool ganymede_api_v2_update_retry_budget_(bool success)
+{
+    portENTER_CRITICAL(&calls_lock_);
+
+    if (success) {
+        retry_budget_ += GRPC_RETRY_BUDGET_SUCCESS_REFUND;
+        retry_budget_ = retry_budget_ > GRPC_RETRY_BUDGET_MAX ? GRPC_RETRY_BUDGET_MAX : retry_budget_;
+    } else {
+        retry_budget_ -= GRPC_RETRY_BUDGET_FAILURE_COST;
+        retry_budget_ = retry_budget_ < 0 ? 0 : retry_budget_;
+    }
+
+    bool allowed = retry_budget_ > GRPC_RETRY_BUDGET_MAX / 2;
+    portEXIT_CRITICAL(&calls_lock_);
+
+    return allowed;
+}
+
+// Delay before the next attempt (milliseconds). The server's pushback wins,
+// otherwise the backoff doubles with each attempt up to the maximum, and only
+// its upper half is used so calls that failed together retry apart.
+static uint32_t ganymede_api_v2_backoff_(const struct ganymede_api_v2_call* call)
+{
+    if (call->pushback_ms >= 0) {
+        return (uint32_t) call->pushback_ms;
+    }
+
+    uint32_t backoff = CONFIG_GANYMEDE_API_RETRY_INITIAL_BACKOFF;
+
+    for (uint32_t i = 1; i < call->attempts && backoff < CONFIG_GANYMEDE_API_RETRY_MAX_BACKOFF; i++) {
+        backoff *= 2;
+    }
+
+    if (backoff > CONFIG_GANYMEDE_API_RETRY_MAX_BACKOFF) {
+        backoff = CONFIG_GANYMEDE_API_RETRY_MAX_BACKOFF;
+    }
+
+    return backoff / 2 + esp_random() % (backoff / 2 + 1);
+}
+
+static void ganymede_api_v2_finish_(struct ganymede_api_v2_call* call, grpc_status_t rc, ProtobufCMessage* response)
+{
+    ganymede_api_v2_deframer_reset_(&call->deframer);
+
+    ganymede_api_v2_callback_t callback = call->callback;
+    void* callback_arg = call->arg;
+
+    portENTER_CRITICAL(&calls_lock_);
+    call->state = GANYMEDE_API_V2_CALL_IDLE;
+    portEXIT_CRITICAL(&calls_lock_);
+
+    // Give the slot back first, the callback may start another call
+    http2_session_release(call->session);
+    xQueueSend(free_calls_, &call, 0);
+
+    callback(rc, response, callback_arg);
+}
+
+// Runs in the http2 task
+static void ganymede_api_v2_on_complete_(int32_t http2_status, void* arg)
+{
+    struct ganymede_api_v2_call* call = (struct ganymede_api_v2_call*) arg;
+    struct ganymede_api_v2_deframer* deframer = &call->deframer;
+    grpc_status_t rc = ganymede_api_v2_status_from_http2_(http2_status);
+    ProtobufCMessage* response = NULL;
+
+    if (rc != GRPC_STATUS_OK) {
+        ESP_LOGE(TAG, "status=%d %s", rc, grpc_status_to_str(rc));
+    } else if (call->response_descriptor != NULL) {
+        if (deframer->message != NULL && deframer->message_cursor == deframer->message_length) {
+            response = pb_arena_unpack_reserved(call->arena, call->response_descriptor);
+        }
+
+        if (response == NULL) {
+            ESP_LOGE(TAG, "incomplete or invalid response");
+            rc = GRPC_STATUS_LOCAL_ERROR;
+        }
+    }
+
+    if (rc == GRPC_STATUS_OK || ganymede_api_v2_is_retryable_(rc)) {
+        bool budget_left = ganymede_api_v2_update_retry_budget_(rc == GRPC_STATUS_OK);
+
+        if (rc != GRPC_STATUS_OK && budget_left && call->attempts < CONFIG_GANYMEDE_API_RETRY_MAX_ATTEMPTS && call->pushback_ms != -1) {
+            uint32_t delay = ganymede_api_v2_backoff_(call);
+
+            portENTER_CRITICAL(&calls_lock_);
+            bool retry = !call->cancelled;
+
+            if (retry) {
+                call->state = GANYMEDE_API_V2_CALL_BACKOFF;
+            }
+            portEXIT_CRITICAL(&calls_lock_);
+
+            if (retry) {
+                ESP_LOGW(TAG, "retrying %s in %" PRIu32 "ms (attempt %" PRIu32 "/%d)", call->rpc, delay, call->attempts + 1, CONFIG_GANYMEDE_API_RETRY_MAX_ATTEMPTS);
+                ganymede_api_v2_deframer_reset_(deframer);
+                esp_timer_start_once(call->retry_timer, (uint64_t) delay * 1000ULL);
+                return;
+            }
+        }
+    }
+
+    ganymede_api_v2_finish_(call, rc, response);
+}
+
+// Send the request once more. Each attempt gets the full timeout. With
+// `no_wait`, fails rather than wait for room in the http2 task's queue.
+static esp_err_t ganymede_api_v2_attempt_(struct ganymede_api_v2_call* call, bool no_wait)
+{
+    const char* payload = (const char*) call->payload_buffer;
+
+    struct http_perform_options options = {
+        .authorization = call->token,
+        .content_type = "application/grpc+proto",
+        .use_grpc_status = true,
+        .deadline = esp_timer_get_time() + call->timeout_ms * 1000LL,
+        .sink = ganymede_api_v2_on_response_data_,
+        .sink_arg = call,
+        .retry_pushback = &call->pushback_ms,
+        .no_wait = no_wait,
+    };
+
+    if (call->streamed) {
+        ganymede_api_v2_rewind_stream_(call);
+        options.source = ganymede_api_v2_request_source_;
+        options.source_arg = call;
+        payload = NULL;
+    }
+
+    call->pushback_ms = GRPC_PUSHBACK_NONE;
 
+    portENTER_CRITICAL(&calls_lock_);
+    ganymede_api_v2_call_id_t call_id = call->call_id;
+    uint32_t attempt = ++call->attempts;
+    call->request_id = 0;
+    portEXIT_CRITICAL(&calls_lock_);
+
+    http2_request_id_t request_id = 0;
+    esp_err_t rc = http2_perform_async(call->session, "POST", CONFIG_GANYMEDE_AUTHORITY, call->rpc, payload, call->payload_length, NULL, 0, options, ganymede_api_v2_on_complete_, call, &request_id);
+
+    if (rc != ESP_OK) {
+        return rc;
+    }
+
+    // The attempt may already be over, and the call retrying or reused. Its id
+    // is only of use while it is still the call's current attempt.
+    portENTER_CRITICAL(&calls_lock_);
+    bool current = call->state == GANYMEDE_API_V2_CALL_IN_FLIGHT && call->call_id == call_id && call->attempts == attempt;
+
+    if (current) {
+        call->request_id = request_id;
+    }
+
+    // Cancelled before the id was known, ganymede_api_v2_cancel left it to us
+    bool cancel = current && call->cancelled;
+    portEXIT_CRITICAL(&calls_lock_);
+
+    if (cancel) {
+        http2_cancel(request_id, no_wait);
+    }
+
+    return ESP_OK;
+}
+
+// Runs in the esp_timer task, which must never block, so the retry fails
+// rather than wait for the http2 task. A call cancelled while backing off is
+// finished here too, so its callback doesn't run on the cancelling task.
+static void ganymede_api_v2_retry_timer_callback_(void* arg)
+{
+    struct ganymede_api_v2_call* call = (struct ganymede_api_v2_call*) arg;
+
+    portENTER_CRITICAL(&calls_lock_);
+    bool due = call->state == GANYMEDE_API_V2_CALL_BACKOFF;
+    bool cancelled = call->cancelled;
+
+    if (due) {
+        call->state = GANYMEDE_API_V2_CALL_IN_FLIGHT;
+    }
+    portEXIT_CRITICAL(&calls_lock_);
+
+    if (due && cancelled) {
+        ganymede_api_v2_finish_(call, GRPC_STATUS_CANCELLED, NULL);
+    } else if (due && ganymede_api_v2_attempt_(call, true) != ESP_OK) {
+        ESP_LOGE(TAG, "failed to queue retry of %s", call->rpc);
+        ganymede_api_v2_finish_(call, GRPC_STATUS_LOCAL_ERROR, NULL);
+    }
+}
+
+static grpc_status_t ganymede_api_v2_perform_async_(const char* rpc, ganymede_api_v2_request_encoder_t encode, const void* request, const struct ganymede_api_v2_streamed_field* streamed, const ProtobufCMessageDescriptor* response_descriptor, struct pb_arena* arena, int64_t timeout_ms, ganymede_api_v2_callback_t callback, void* arg, ganymede_api_v2_call_id_t* call_id, TickType_t ticks_to_wait)
+{
     http2_session_t* session = NULL;
-    uint32_t payload_len = 0;
-    size_t token_len = sizeof(token_) - 7;
+    struct ganymede_api_v2_call* call = NULL;
+    size_t payload_len = 0;
+
+    if (xQueueReceive(free_calls_, &call, ticks_to_wait) != pdTRUE) {
+        ESP_LOGE(TAG, "too many calls in flight");
+        return GRPC_STATUS_LOCAL_ERROR;
+    }
+
+    size_t token_len = sizeof(call->token) - 7;
 
     // Prepare HTTP2 session
     {
-        // FIXME: Temporarily using the HTTP2 mutex as our mutex too
-        session = http2_session_acquire(portMAX_DELAY);
+        session = http2_session_acquire(CONFIG_GANYMEDE_HOST, CONFIG_GANYMEDE_PORT, CONFIG_GANYMEDE_AUTHORITY, portMAX_DELAY);
 
         if (session == NULL) {
-            ESP_LOGE(TAG, "http2 session acquisition failed");
-            goto cleanup;
-        }
-
-        if (http2_session_connect(session, CONFIG_GANYMEDE_HOST, 443, CONFIG_GANYMEDE_AUTHORITY) != ESP_OK) {
-            ESP_LOGE(TAG, "failed to connect to %s:443", CONFIG_GANYMEDE_HOST);
+            ESP_LOGE(TAG, "failed to acquire session to %s:%d", CONFIG_GANYMEDE_HOST, CONFIG_GANYMEDE_PORT);
             goto cleanup;
         }
     }
 
     // Prepare HTTP2/GRPC request
     {
-        strncpy(token_, "Bearer ", 7);
-        if (auth_get_token(&token_[7], &token_len) != ESP_OK) {
+        strncpy(call->token, "Bearer ", 7);
+        if (auth_get_token(&call->token[7], &token_len) != ESP_OK) {
             ESP_LOGE(TAG, "auth token retrieval failed");
             goto cleanup;
         }
 
-        payload_len = ganymede_api_v2_pack_protobuf_((ProtobufCMessage*) request, payload_buffer_);
-    }
-
-    // Perform HTTP2 operation
-    {
-        rc = (grpc_status_t) http2_perform(session, "POST", CONFIG_GANYMEDE_AUTHORITY, rpc, (const char*) payload_buffer_, payload_len, (char*) response_buffer_, sizeof(response_buffer_), http_perform_options_);
+        if (streamed != NULL) {
+            payload_len = ganymede_api_v2_start_stream_(call, streamed);
+        } else {
+            payload_len = ganymede_api_v2_pack_request_(encode, request, call->payload_buffer);
+        }
 
-        if (rc != GRPC_STATUS_OK) {
-            ESP_LOGE(TAG, "Poll: status=%d %s", rc, grpc_status_to_str(rc));
+        if (payload_len == 0) {
             goto cleanup;
         }
     }
 
-    // Handle response if needed
-    {
-        if (response_descriptor != NULL) {
-            ganymede_api_v2_copy_32bit_bigendian_(&payload_len, (uint32_t*) &response_buffer_[1]);
-            *response_dest = protobuf_c_message_unpack(response_descriptor, NULL, payload_len, &response_buffer_[5]);
-        }
+    call->session = session;
+    call->rpc = rpc;
+    call->payload_length = payload_len;
+    call->streamed = streamed != NULL;
+    call->response_descriptor = response_descriptor;
+    call->arena = arena;
+    call->timeout_ms = timeout_ms;
+    call->callback = callback;
+    call->arg = arg;
+
+    portENTER_CRITICAL(&calls_lock_);
+    call->attempts = 0;
+    call->state = GANYMEDE_API_V2_CALL_IN_FLIGHT;
+    call->cancelled = false;
+    call->call_id = atomic_fetch_add(&next_call_id_, 1);
+    call->request_id = 0;
+    portEXIT_CRITICAL(&calls_lock_);
+
+    // Set before the request is queued, it may complete before this returns
+    if (call_id != NULL) {
+        *call_id = call->call_id;
+    }
+
+    // Queue HTTP2 operation, the call is finished in ganymede_api_v2_on_complete_
+    if (ganymede_api_v2_attempt_(call, false) == ESP_OK) {
+        return GRPC_STATUS_OK;
     }
 
+    portENTER_CRITICAL(&calls_lock_);
+    call->state = GANYMEDE_API_V2_CALL_IDLE;
+    portEXIT_CRITICAL(&calls_lock_);
+
 cleanup:
     http2_session_release(session);
+    xQueueSend(free_calls_, &call, portMAX_DELAY);
+    return GRPC_STATUS_LOCAL_ERROR;
+}
+
+static void ganymede_api_v2_sync_complete_(grpc_status_t status, ProtobufCMessage* response, void* arg)
+{
+    struct ganymede_api_v2_sync_call* sync = (struct ganymede_api_v2_sync_call*) arg;
+
+    sync->response = response;
+    xTaskNotify(sync->requestor, (uint32_t) status, eSetValueWithOverwrite);
+}
+
+static grpc_status_t ganymede_api_v2_perform_(const char* rpc, ganymede_api_v2_request_encoder_t encode, const void* request, const struct ganymede_api_v2_streamed_field* streamed, const ProtobufCMessageDescriptor* response_descriptor, struct pb_arena* arena, int64_t timeout_ms, ProtobufCMessage** response_dest)
+{
+    grpc_status_t rc = GRPC_STATUS_LOCAL_ERROR;
+
+    struct ganymede_api_v2_sync_call sync = {
+        .requestor = xTaskGetCurrentTaskHandle(),
+        .response = NULL,
+    };
+
+    rc = ganymede_api_v2_perform_async_(rpc, encode, request, streamed, response_descriptor, arena, timeout_ms, ganymede_api_v2_sync_complete_, &sync, NULL, portMAX_DELAY);
+
+    if (rc != GRPC_STATUS_OK) {
+        return rc;
+    }
+
+    xTaskNotifyWait(0xFFFFFFFF, 0xFFFFFFFF, (uint32_t*) &rc, portMAX_DELAY);
+
+    if (response_dest != NULL) {
+        *response_dest = sync.response;
+    }
+
     return rc;
 }
 
@@ -133,15 +788,267 @@ const char* grpc_status_to_str(grpc_status_t status)
 
 esp_err_t ganymede_api_v2_init(void)
 {
+    free_calls_ = xQueueCreate(CONFIG_GANYMEDE_API_MAX_CONCURRENT_CALLS, sizeof(struct ganymede_api_v2_call*));
+
+    if (free_calls_ == NULL) {
+        ESP_LOGE(TAG, "Call queue initialization failed");
+        return ESP_FAIL;
+    }
+
+    for (size_t i = 0; i < CONFIG_GANYMEDE_API_MAX_CONCURRENT_CALLS; i++) {
+        struct ganymede_api_v2_call* call = &calls_[i];
+
+        esp_timer_create_args_t args = {
+            .dispatch_method = ESP_TIMER_TASK,
+            .callback = ganymede_api_v2_retry_timer_callback_,
+            .arg = call,
+            .name = "api_retry",
+        };
+
+        if (esp_timer_create(&args, &call->retry_timer) != ESP_OK) {
+            ESP_LOGE(TAG, "Retry timer initialization failed");
+            return ESP_FAIL;
+        }
+
+        xQueueSend(free_calls_, &call, 0);
+    }
+
     return ESP_OK;
 }
 
-grpc_status_t ganymede_api_v2_poll_device(const Ganymede__V2__PollRequest* request, Ganymede__V2__PollResponse** response)
+grpc_status_t ganymede_api_v2_poll_device(const Ganymede__V2__PollRequest* request, Ganymede__V2__PollResponse** response, struct pb_arena* arena)
 {
-    return ganymede_api_v2_perform_("/ganymede.v2.DeviceService/Poll", (const ProtobufCMessage*) request, &ganymede__v2__poll_response__descriptor, (ProtobufCMessage**) response);
+    return ganymede_api_v2_perform_("/ganymede.v2.DeviceService/Poll", ganymede_api_v2_pack_message_, request, NULL, &ganymede__v2__poll_response__descriptor, arena, CONFIG_GANYMEDE_API_POLL_TIMEOUT, (ProtobufCMessage**) response);
+}
+
+static size_t ganymede_api_v2_pack_message_element_(const void* elements, size_t index, uint8_t* buffer)
+{
+    const ProtobufCMessage* element = ((ProtobufCMessage* const*) elements)[index];
+
+    if (buffer == NULL) {
+        return protobuf_c_message_get_packed_size(element);
+    }
+
+    return protobuf_c_message_pack(element, buffer);
+}
+
+static size_t ganymede_api_v2_encode_atmosphere_element_(const void* elements, size_t index, uint8_t* buffer)
+{
+    return ganymede_api_v2_encode_atmosphere_measurement((const struct ganymede_api_v2_atmosphere_samples*) elements, index, buffer);
+}
+
+// Samples are read in order, and again from the first one on every attempt
+static esp_err_t ganymede_api_v2_seek_atmosphere_stream_(const void* elements, size_t index)
+{
+    struct ganymede_api_v2_atmosphere_stream* stream = (struct ganymede_api_v2_atmosphere_stream*) elements;
+    const struct ganymede_api_v2_atmosphere_reader* reader = stream->reader;
+
+    if (index == stream->loaded) {
+        return ESP_OK;
+    }
+
+    if (index == 0) {
+        esp_err_t rc = reader->rewind(reader->arg);
+
+        if (rc != ESP_OK) {
+            return rc;
+        }
+    } else if (index != stream->loaded + 1) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    esp_err_t rc = reader->read(reader->arg, &stream->timestamp, &stream->humidity, &stream->temperature);
+    stream->loaded = rc == ESP_OK ? index : SIZE_MAX;
+
+    return rc;
+}
+
+static size_t ganymede_api_v2_encode_atmosphere_stream_(const void* elements, size_t index, uint8_t* buffer)
+{
+    (void) index;
+
+    const struct ganymede_api_v2_atmosphere_stream* stream = (const struct ganymede_api_v2_atmosphere_stream*) elements;
+    return ganymede_api_v2_encode_atmosphere_measurement(&stream->sample, 0, buffer);
+}
+
+// Measurements are streamed, so uploads are not bounded by the payload buffer.
+// `rest` receives the request without them, and only needs to live until the
+// call is queued.
+static struct ganymede_api_v2_streamed_field ganymede_api_v2_measurements_field_(const Ganymede__V2__PushMeasurementsRequest* request, Ganymede__V2__PushMeasurementsRequest* rest)
+{
+    *rest = *request;
+    rest->n_measurements = 0;
+    rest->measurements = NULL;
+
+    return (struct ganymede_api_v2_streamed_field) {
+        .number = 1,
+        .encode = ganymede_api_v2_pack_message_element_,
+        .elements = request->measurements,
+        .count = request->n_measurements,
+        .rest = (const ProtobufCMessage*) rest,
+    };
+}
+
+// Same, with measurements encoded straight from the samples
+static struct ganymede_api_v2_streamed_field ganymede_api_v2_atmosphere_field_(const struct ganymede_api_v2_atmosphere_samples* samples, const char* batch_id, Ganymede__V2__PushMeasurementsRequest* rest)
+{
+    ganymede__v2__push_measurements_request__init(rest);
+    rest->batch_id = (char*) (batch_id != NULL ? batch_id : "");
+
+    return (struct ganymede_api_v2_streamed_field) {
+        .number = 1,
+        .encode = ganymede_api_v2_encode_atmosphere_element_,
+        .elements = samples,
+        .count = samples->count,
+        .rest = (const ProtobufCMessage*) rest,
+    };
 }
 
 grpc_status_t ganymede_api_v2_push_measurements(const Ganymede__V2__PushMeasurementsRequest* request)
 {
-    return ganymede_api_v2_perform_("/ganymede.v2.MeasurementsService/PushMeasurements", (const ProtobufCMessage*) request, NULL, NULL);
+    Ganymede__V2__PushMeasurementsRequest rest;
+    struct ganymede_api_v2_streamed_field streamed = ganymede_api_v2_measurements_field_(request, &rest);
+    return ganymede_api_v2_perform_("/ganymede.v2.MeasurementsService/PushMeasurements", NULL, NULL, &streamed, NULL, NULL, CONFIG_GANYMEDE_API_PUSH_MEASUREMENTS_TIMEOUT, NULL);
+}
+
+grpc_status_t ganymede_api_v2_poll_device_async(const Ganymede__V2__PollRequest* request, struct pb_arena* arena, ganymede_api_v2_callback_t callback, void* arg, ganymede_api_v2_call_id_t* call_id)
+{
+    return ganymede_api_v2_perform_async_("/ganymede.v2.DeviceService/Poll", ganymede_api_v2_pack_message_, request, NULL, &ganymede__v2__poll_response__descriptor, arena, CONFIG_GANYMEDE_API_POLL_TIMEOUT, callback, arg, call_id, 0);
+}
+
+grpc_status_t ganymede_api_v2_push_measurements_async(const Ganymede__V2__PushMeasurementsRequest* request, ganymede_api_v2_callback_t callback, void* arg, ganymede_api_v2_call_id_t* call_id)
+{
+    Ganymede__V2__PushMeasurementsRequest rest;
+    struct ganymede_api_v2_streamed_field streamed = ganymede_api_v2_measurements_field_(request, &rest);
+    return ganymede_api_v2_perform_async_("/ganymede.v2.MeasurementsService/PushMeasurements", NULL, NULL, &streamed, NULL, NULL, CONFIG_GANYMEDE_API_PUSH_MEASUREMENTS_TIMEOUT, callback, arg, call_id, 0);
+}
+
+grpc_status_t ganymede_api_v2_push_atmosphere(const struct ganymede_api_v2_atmosphere_samples* samples, const char* batch_id)
+{
+    Ganymede__V2__PushMeasurementsRequest rest;
+    struct ganymede_api_v2_streamed_field streamed = ganymede_api_v2_atmosphere_field_(samples, batch_id, &rest);
+    return ganymede_api_v2_perform_("/ganymede.v2.MeasurementsService/PushMeasurements", NULL, NULL, &streamed, NULL, NULL, CONFIG_GANYMEDE_API_PUSH_MEASUREMENTS_TIMEOUT, NULL);
+}
+
+grpc_status_t ganymede_api_v2_push_atmosphere_stream(const struct ganymede_api_v2_atmosphere_reader* reader, const char* batch_id)
+{
+    Ganymede__V2__PushMeasurementsRequest rest;
+    ganymede__v2__push_measurements_request__init(&rest);
+    rest.batch_id = (char*) (batch_id != NULL ? batch_id : "");
+
+    struct ganymede_api_v2_atmosphere_stream stream = {
+        .reader = reader,
+        .loaded = SIZE_MAX,
+    };
+
+    stream.sample = (struct ganymede_api_v2_atmosphere_samples) {
+        .device_id = reader->device_id,
+        .timestamps = &stream.timestamp,
+        .humidities = &stream.humidity,
+        .temperatures = &stream.temperature,
+        .count = 1,
+    };
+
+    struct ganymede_api_v2_streamed_field streamed = {
+        .number = 1,
+        .encode = ganymede_api_v2_encode_atmosphere_stream_,
+        .seek = ganymede_api_v2_seek_atmosphere_stream_,
+        .elements = &stream,
+        .count = reader->count,
+        .rest = (const ProtobufCMessage*) &rest,
+    };
+
+    return ganymede_api_v2_perform_("/ganymede.v2.MeasurementsService/PushMeasurements", NULL, NULL, &streamed, NULL, NULL, CONFIG_GANYMEDE_API_PUSH_MEASUREMENTS_TIMEOUT, NULL);
+}
+
+grpc_status_t ganymede_api_v2_push_atmosphere_async(const struct ganymede_api_v2_atmosphere_samples* samples, const char* batch_id, ganymede_api_v2_callback_t callback, void* arg, ganymede_api_v2_call_id_t* call_id)
+{
+    Ganymede__V2__PushMeasurementsRequest rest;
+    struct ganymede_api_v2_streamed_field streamed = ganymede_api_v2_atmosphere_field_(samples, batch_id, &rest);
+    return ganymede_api_v2_perform_async_("/ganymede.v2.MeasurementsService/PushMeasurements", NULL, NULL, &streamed, NULL, NULL, CONFIG_GANYMEDE_API_PUSH_MEASUREMENTS_TIMEOUT, callback, arg, call_id, 0);
+}
+
+// Batches too large for the payload buffer go through PushMeasurements, which is
+// streamed
+static bool ganymede_api_v2_fits_atmosphere_batch_(const struct ganymede_api_v2_atmosphere_batch* batch)
+{
+    return ganymede_api_v2_encode_atmosphere_batch_(batch, NULL) <= CONFIG_GRPC_PAYLOAD_BUFFER_LEN - GRPC_MESSAGE_PREFIX_LEN;
+}
+
+grpc_status_t ganymede_api_v2_push_atmosphere_batch(const struct ganymede_api_v2_atmosphere_samples* samples, const char* batch_id)
+{
+    struct ganymede_api_v2_atmosphere_batch batch = {
+        .samples = samples,
+        .batch_id = batch_id,
+    };
+
+    if (!ganymede_api_v2_fits_atmosphere_batch_(&batch)) {
+        return ganymede_api_v2_push_atmosphere(samples, batch_id);
+    }
+
+    return ganymede_api_v2_perform_("/ganymede.v2.MeasurementsService/PushAtmosphereBatch", ganymede_api_v2_encode_atmosphere_batch_, &batch, NULL, NULL, NULL, CONFIG_GANYMEDE_API_PUSH_MEASUREMENTS_TIMEOUT, NULL);
+}
+
+grpc_status_t ganymede_api_v2_push_atmosphere_batch_async(const struct ganymede_api_v2_atmosphere_samples* samples, const char* batch_id, ganymede_api_v2_callback_t callback, void* arg, ganymede_api_v2_call_id_t* call_id)
+{
+    struct ganymede_api_v2_atmosphere_batch batch = {
+        .samples = samples,
+        .batch_id = batch_id,
+    };
+
+    if (!ganymede_api_v2_fits_atmosphere_batch_(&batch)) {
+        return ganymede_api_v2_push_atmosphere_async(samples, batch_id, callback, arg, call_id);
+    }
+
+    return ganymede_api_v2_perform_async_("/ganymede.v2.MeasurementsService/PushAtmosphereBatch", ganymede_api_v2_encode_atmosphere_batch_, &batch, NULL, NULL, NULL, CONFIG_GANYMEDE_API_PUSH_MEASUREMENTS_TIMEOUT, callback, arg, call_id, 0);
+}
+
+esp_err_t ganymede_api_v2_cancel(ganymede_api_v2_call_id_t call_id)
+{
+    struct ganymede_api_v2_call* backoff = NULL;
+    http2_request_id_t request_id = 0;
+    bool found = false;
+
+    portENTER_CRITICAL(&calls_lock_);
+
+    for (size_t i = 0; i < CONFIG_GANYMEDE_API_MAX_CONCURRENT_CALLS; i++) {
+        struct ganymede_api_v2_call* call = &calls_[i];
+
+        if (call->state != GANYMEDE_API_V2_CALL_IDLE && call->call_id == call_id) {
+            call->cancelled = true;
+            found = true;
+
+            if (call->state == GANYMEDE_API_V2_CALL_BACKOFF) {
+                backoff = call;
+            } else {
+                request_id = call->request_id;
+            }
+
+            break;
+        }
+    }
+
+    portEXIT_CRITICAL(&calls_lock_);
+
+    // Fire the retry timer right away, it finishes the call. If it can't be
+    // stopped, it is already firing and sees the call cancelled.
+    if (backoff != NULL) {
+        if (esp_timer_stop(backoff->retry_timer) == ESP_OK) {
+            esp_timer_start_once(backoff->retry_timer, 0);
+        }
+
+        return ESP_OK;
+    }
+
+    if (!found) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    // An attempt in flight is not retried once cancelled. One still being
+    // queued has no id yet, ganymede_api_v2_attempt_ resets it once it has.
+    if (request_id != 0) {
+        return http2_cancel(request_id, false);
+    }
+
+    return ESP_OK;
 }
\ No newline at end of file
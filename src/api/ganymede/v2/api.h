@@ -1,8 +1,14 @@
 #ifndef API__GANYMEDE__V2__SERVICES_H_
 #define API__GANYMEDE__V2__SERVICES_H_
 
+#include <stdint.h>
+
 #include <esp_err.h>
 
+#include <api/ganymede/v2/encode.h>
+#include <api/ganymede/v2/pb_arena.h>
+#include <net/http2/http2.h>
+
 #include <ganymede/v2/device.pb-c.h>
 #include <ganymede/v2/measurements.pb-c.h>
 
@@ -30,11 +36,74 @@ enum grpc_status {
 
 typedef enum grpc_status grpc_status_t;
 
+// Stays the same across retries of a call
+typedef uint32_t ganymede_api_v2_call_id_t;
+
+// Invoked from the http2 or esp_timer task when an async call completes, after
+// any retries. `response` is NULL unless the call succeeded and the RPC has a
+// response. It is unpacked in the arena passed to the call, and lives until the
+// arena is reset or reused. Must not block.
+typedef void (*ganymede_api_v2_callback_t)(grpc_status_t status, ProtobufCMessage* response, void* arg);
+
 const char* grpc_status_to_str(grpc_status_t status);
 
 esp_err_t ganymede_api_v2_init(void);
 
-grpc_status_t ganymede_api_v2_poll_device(const Ganymede__V2__PollRequest* request, Ganymede__V2__PollResponse** response);
+// Calls that fail with UNAVAILABLE, RESOURCE_EXHAUSTED or DEADLINE_EXCEEDED
+// are retried up to CONFIG_GANYMEDE_API_RETRY_MAX_ATTEMPTS times, each attempt
+// with the full timeout. The delay between attempts backs off exponentially
+// with jitter, unless the server sends grpc-retry-pushback-ms. Retries are
+// throttled across calls by a shared budget, so a failing backend is not
+// hammered. PushMeasurements requests should carry a batch_id so the server
+// can drop retried duplicates.
+
+// Responses are unpacked in `arena`, see pb_arena.h. Its capacity bounds the
+// memory they use.
+grpc_status_t ganymede_api_v2_poll_device(const Ganymede__V2__PollRequest* request, Ganymede__V2__PollResponse** response, struct pb_arena* arena);
 grpc_status_t ganymede_api_v2_push_measurements(const Ganymede__V2__PushMeasurementsRequest* request);
 
+// PushMeasurements, with the measurements encoded straight from `samples` as
+// they are sent. Same request as ganymede_api_v2_push_measurements, without
+// any heap allocation for the measurements. `batch_id` may be NULL.
+grpc_status_t ganymede_api_v2_push_atmosphere(const struct ganymede_api_v2_atmosphere_samples* samples, const char* batch_id);
+
+// Samples read one at a time as a streamed push is sent, so a push can be
+// larger than what fits in memory. `read` loads the next sample, and `rewind`
+// goes back to the first, as every attempt sends the request from the start.
+// Both run on the calling, http2 or esp_timer task, never concurrently, and
+// `read` must yield exactly `count` samples after each rewind.
+struct ganymede_api_v2_atmosphere_reader {
+    const char* device_id;
+    size_t count;
+    esp_err_t (*rewind)(void* arg);
+    esp_err_t (*read)(void* arg, time_t* timestamp, int16_t* humidity, int16_t* temperature);
+    void* arg;
+};
+
+// PushMeasurements, with the measurements encoded from `reader` as they are
+// sent. `batch_id` may be NULL.
+grpc_status_t ganymede_api_v2_push_atmosphere_stream(const struct ganymede_api_v2_atmosphere_reader* reader, const char* batch_id);
+
+// PushAtmosphereBatch, the columnar equivalent of ganymede_api_v2_push_atmosphere,
+// for servers that advertise it. Falls back to the latter for batches too
+// large for CONFIG_GRPC_PAYLOAD_BUFFER_LEN.
+grpc_status_t ganymede_api_v2_push_atmosphere_batch(const struct ganymede_api_v2_atmosphere_samples* samples, const char* batch_id);
+
+// Async variants return once the request is queued. Poll requests are
+// serialized right away and can be freed, but measurements and samples are
+// serialized as they are sent and must stay valid until the callback is invoked. `callback`
+// is invoked only if they return GRPC_STATUS_OK. They fail with GRPC_STATUS_LOCAL_ERROR when
+// CONFIG_GANYMEDE_API_MAX_CONCURRENT_CALLS calls are already in flight.
+// `call_id` may be NULL.
+grpc_status_t ganymede_api_v2_poll_device_async(const Ganymede__V2__PollRequest* request, struct pb_arena* arena, ganymede_api_v2_callback_t callback, void* arg, ganymede_api_v2_call_id_t* call_id);
+grpc_status_t ganymede_api_v2_push_measurements_async(const Ganymede__V2__PushMeasurementsRequest* request, ganymede_api_v2_callback_t callback, void* arg, ganymede_api_v2_call_id_t* call_id);
+grpc_status_t ganymede_api_v2_push_atmosphere_async(const struct ganymede_api_v2_atmosphere_samples* samples, const char* batch_id, ganymede_api_v2_callback_t callback, void* arg, ganymede_api_v2_call_id_t* call_id);
+grpc_status_t ganymede_api_v2_push_atmosphere_batch_async(const struct ganymede_api_v2_atmosphere_samples* samples, const char* batch_id, ganymede_api_v2_callback_t callback, void* arg, ganymede_api_v2_call_id_t* call_id);
+
+// The call's callback is invoked with GRPC_STATUS_CANCELLED unless it already
+// completed. Like any other completion, it runs on the http2 or esp_timer task,
+// never on the cancelling one. Returns ESP_OK once the call is marked
+// cancelled, ESP_ERR_NOT_FOUND if it is already over.
+esp_err_t ganymede_api_v2_cancel(ganymede_api_v2_call_id_t call_id);
+
 #endif // API__GANYMEDE__V2__SERVICES_H_
\ No newline at end of file
@@ -0,0 +1,203 @@
+#include "encode.h"
+
+#include <string.h>
+
+enum {
+    // Protobuf wire types
+    PROTOBUF_WIRE_TYPE_VARINT = 0,
+    PROTOBUF_WIRE_TYPE_LENGTH_DELIMITED = 2,
+    PROTOBUF_WIRE_TYPE_FIXED32 = 5,
+
+    // Field numbers, from measurements.proto and timestamp.proto
+    PUSH_MEASUREMENTS_REQUEST_MEASUREMENTS = 1,
+    PUSH_MEASUREMENTS_REQUEST_BATCH_ID = 2,
+    MEASUREMENT_DEVICE_ID = 1,
+    MEASUREMENT_TIMESTAMP = 2,
+    MEASUREMENT_ATMOSPHERE = 10,
+    TIMESTAMP_SECONDS = 1,
+    ATMOSPHERIC_MEASUREMENTS_TEMPERATURE = 1,
+    ATMOSPHERIC_MEASUREMENTS_RELATIVE_HUMIDITY = 2,
+    ATMOSPHERE_BATCH_DEVICE_ID = 1,
+    ATMOSPHERE_BATCH_BATCH_ID = 2,
+    ATMOSPHERE_BATCH_BASE_TIMESTAMP = 3,
+    ATMOSPHERE_BATCH_TIMESTAMP_DELTAS = 4,
+    ATMOSPHERE_BATCH_RELATIVE_HUMIDITIES = 5,
+    ATMOSPHERE_BATCH_TEMPERATURES = 6,
+};
+
+// Where the next field goes, or NULL when only sizing
+static uint8_t* encode_at_(uint8_t* buffer, size_t length)
+{
+    return buffer == NULL ? NULL : &buffer[length];
+}
+
+static size_t encode_varint_(uint64_t value, uint8_t* buffer)
+{
+    size_t length = 0;
+
+    while (value >= 0x80) {
+        if (buffer != NULL) {
+            buffer[length] = (uint8_t) (value | 0x80);
+        }
+
+        value >>= 7;
+        length++;
+    }
+
+    if (buffer != NULL) {
+        buffer[length] = (uint8_t) value;
+    }
+
+    return length + 1;
+}
+
+static size_t encode_tag_(uint32_t number, uint32_t wire_type, uint8_t* buffer)
+{
+    return encode_varint_((number << 3) | wire_type, buffer);
+}
+
+// Tag and length of an embedded message, which is always packed, even empty
+static size_t encode_message_header_(uint32_t number, size_t message_length, uint8_t* buffer)
+{
+    size_t length = encode_tag_(number, PROTOBUF_WIRE_TYPE_LENGTH_DELIMITED, buffer);
+    return length + encode_varint_(message_length, encode_at_(buffer, length));
+}
+
+// Scalars and strings are left out when they hold their default value, as
+// proto3 wants. protobuf-c compares floats bitwise, so -0.0 is packed.
+
+static size_t encode_int64_(uint32_t number, int64_t value, uint8_t* buffer)
+{
+    if (value == 0) {
+        return 0;
+    }
+
+    size_t length = encode_tag_(number, PROTOBUF_WIRE_TYPE_VARINT, buffer);
+    return length + encode_varint_((uint64_t) value, encode_at_(buffer, length));
+}
+
+static size_t encode_float_(uint32_t number, float value, uint8_t* buffer)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    if (bits == 0) {
+        return 0;
+    }
+
+    size_t length = encode_tag_(number, PROTOBUF_WIRE_TYPE_FIXED32, buffer);
+
+    if (buffer != NULL) {
+        buffer[length + 0] = (uint8_t) bits;
+        buffer[length + 1] = (uint8_t) (bits >> 8);
+        buffer[length + 2] = (uint8_t) (bits >> 16);
+        buffer[length + 3] = (uint8_t) (bits >> 24);
+    }
+
+    return length + 4;
+}
+
+static size_t encode_string_(uint32_t number, const char* value, uint8_t* buffer)
+{
+    if (value == NULL || value[0] == '\0') {
+        return 0;
+    }
+
+    size_t value_length = strlen(value);
+    size_t length = encode_message_header_(number, value_length, buffer);
+
+    if (buffer != NULL) {
+        memcpy(&buffer[length], value, value_length);
+    }
+
+    return length + value_length;
+}
+
+static uint64_t encode_zigzag_(int64_t value)
+{
+    return ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+}
+
+// Zigzag varints of one of the sample columns, or of the timestamps' deltas
+// from the previous one, starting from `base`, when `values` is NULL
+static size_t encode_column_values_(const struct ganymede_api_v2_atmosphere_samples* samples, const int16_t* values, int64_t base, uint8_t* buffer)
+{
+    int64_t previous = base;
+    size_t length = 0;
+
+    for (size_t i = 0; i < samples->count; i++) {
+        int64_t timestamp = (int64_t) samples->timestamps[i];
+        int64_t value = values != NULL ? values[i] : timestamp - previous;
+
+        length += encode_varint_(encode_zigzag_(value), encode_at_(buffer, length));
+        previous = timestamp;
+    }
+
+    return length;
+}
+
+// Packed repeated sint32 or sint64 field. Empty ones are left out.
+static size_t encode_column_(uint32_t number, const struct ganymede_api_v2_atmosphere_samples* samples, const int16_t* values, int64_t base, uint8_t* buffer)
+{
+    if (samples->count == 0) {
+        return 0;
+    }
+
+    size_t values_length = encode_column_values_(samples, values, base, NULL);
+    size_t length = encode_message_header_(number, values_length, buffer);
+
+    return length + encode_column_values_(samples, values, base, encode_at_(buffer, length));
+}
+
+size_t ganymede_api_v2_encode_atmosphere_measurement(const struct ganymede_api_v2_atmosphere_samples* samples, size_t index, uint8_t* buffer)
+{
+    int64_t seconds = (int64_t) samples->timestamps[index];
+    float temperature = ((float) samples->temperatures[index]) / 10.0F;
+    float humidity = ((float) samples->humidities[index]) / 1000.0F;
+
+    size_t timestamp_length = encode_int64_(TIMESTAMP_SECONDS, seconds, NULL);
+    size_t atmosphere_length = encode_float_(ATMOSPHERIC_MEASUREMENTS_TEMPERATURE, temperature, NULL) + encode_float_(ATMOSPHERIC_MEASUREMENTS_RELATIVE_HUMIDITY, humidity, NULL);
+    size_t length = 0;
+
+    length += encode_string_(MEASUREMENT_DEVICE_ID, samples->device_id, encode_at_(buffer, length));
+
+    length += encode_message_header_(MEASUREMENT_TIMESTAMP, timestamp_length, encode_at_(buffer, length));
+    length += encode_int64_(TIMESTAMP_SECONDS, seconds, encode_at_(buffer, length));
+
+    length += encode_message_header_(MEASUREMENT_ATMOSPHERE, atmosphere_length, encode_at_(buffer, length));
+    length += encode_float_(ATMOSPHERIC_MEASUREMENTS_TEMPERATURE, temperature, encode_at_(buffer, length));
+    length += encode_float_(ATMOSPHERIC_MEASUREMENTS_RELATIVE_HUMIDITY, humidity, encode_at_(buffer, length));
+
+    return length;
+}
+
+size_t ganymede_api_v2_encode_push_atmosphere_request(const struct ganymede_api_v2_atmosphere_samples* samples, const char* batch_id, uint8_t* buffer)
+{
+    size_t length = 0;
+
+    for (size_t i = 0; i < samples->count; i++) {
+        size_t measurement_length = ganymede_api_v2_encode_atmosphere_measurement(samples, i, NULL);
+
+        length += encode_message_header_(PUSH_MEASUREMENTS_REQUEST_MEASUREMENTS, measurement_length, encode_at_(buffer, length));
+        length += ganymede_api_v2_encode_atmosphere_measurement(samples, i, encode_at_(buffer, length));
+    }
+
+    length += encode_string_(PUSH_MEASUREMENTS_REQUEST_BATCH_ID, batch_id, encode_at_(buffer, length));
+
+    return length;
+}
+
+size_t ganymede_api_v2_encode_atmosphere_batch(const struct ganymede_api_v2_atmosphere_samples* samples, const char* batch_id, uint8_t* buffer)
+{
+    int64_t base = samples->count > 0 ? (int64_t) samples->timestamps[0] : 0;
+    size_t length = 0;
+
+    length += encode_string_(ATMOSPHERE_BATCH_DEVICE_ID, samples->device_id, encode_at_(buffer, length));
+    length += encode_string_(ATMOSPHERE_BATCH_BATCH_ID, batch_id, encode_at_(buffer, length));
+    length += encode_int64_(ATMOSPHERE_BATCH_BASE_TIMESTAMP, base, encode_at_(buffer, length));
+    length += encode_column_(ATMOSPHERE_BATCH_TIMESTAMP_DELTAS, samples, NULL, base, encode_at_(buffer, length));
+    length += encode_column_(ATMOSPHERE_BATCH_RELATIVE_HUMIDITIES, samples, samples->humidities, 0, encode_at_(buffer, length));
+    length += encode_column_(ATMOSPHERE_BATCH_TEMPERATURES, samples, samples->temperatures, 0, encode_at_(buffer, length));
+
+    return length;
+}
\ No newline at end of file
@@ -0,0 +1,38 @@
+#ifndef API__GANYMEDE__V2__ENCODE_H_
+#define API__GANYMEDE__V2__ENCODE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// Protobuf encoders writing messages straight from the app's sample storage,
+// without building a protobuf-c message for each sample first. Their output is
+// byte for byte what protobuf_c_message_pack produces for the equivalent
+// messages. They never allocate.
+
+// Atmospheric samples from one device, as parallel arrays of `count` items.
+// Values are in the AM2320's native units: tenths of a percent of relative
+// humidity, and tenths of a degree Celsius.
+struct ganymede_api_v2_atmosphere_samples {
+    const char* device_id;
+    const time_t* timestamps;
+    const int16_t* humidities;
+    const int16_t* temperatures;
+    size_t count;
+};
+
+// Pack sample `index` as a Measurement to `buffer`, or only size it when
+// `buffer` is NULL. Values are converted to base units as am2320_readf does.
+// Returns the packed length.
+size_t ganymede_api_v2_encode_atmosphere_measurement(const struct ganymede_api_v2_atmosphere_samples* samples, size_t index, uint8_t* buffer);
+
+// Pack all the samples as a PushMeasurementsRequest to `buffer`, or only size
+// it when `buffer` is NULL. `batch_id` may be NULL. Returns the packed length.
+size_t ganymede_api_v2_encode_push_atmosphere_request(const struct ganymede_api_v2_atmosphere_samples* samples, const char* batch_id, uint8_t* buffer);
+
+// Pack all the samples as a PushAtmosphereBatchRequest to `buffer`, or only
+// size it when `buffer` is NULL. `batch_id` may be NULL. Returns the packed
+// length.
+size_t ganymede_api_v2_encode_atmosphere_batch(const struct ganymede_api_v2_atmosphere_samples* samples, const char* batch_id, uint8_t* buffer);
+
+#endif // API__GANYMEDE__V2__ENCODE_H_
\ No newline at end of file
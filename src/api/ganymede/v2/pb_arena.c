@@ -0,0 +1,153 @@
+#include "pb_arena.h"
+
+#include <esp_log.h>
+
+#include <freertos/FreeRTOS.h>
+
+enum {
+    // Alignment of allocations, enough for any field protobuf-c unpacks
+    PB_ARENA_ALIGNMENT = 8,
+
+    // Message types tracked in stats
+    PB_ARENA_STATS_LEN = 8,
+};
+
+static const char* TAG = "pb_arena";
+
+static struct pb_arena_stats stats_[PB_ARENA_STATS_LEN] = { 0 };
+static const ProtobufCMessageDescriptor* stats_descriptors_[PB_ARENA_STATS_LEN] = { 0 };
+static size_t stats_count_ = 0;
+static portMUX_TYPE stats_lock_ = portMUX_INITIALIZER_UNLOCKED;
+
+static void* pb_arena_alloc_(void* allocator_data, size_t size)
+{
+    struct pb_arena* arena = (struct pb_arena*) allocator_data;
+    size_t offset = (arena->used + PB_ARENA_ALIGNMENT - 1) & ~((size_t) PB_ARENA_ALIGNMENT - 1);
+    size_t limit = arena->capacity - arena->reserved;
+
+    arena->allocations++;
+
+    if (offset > limit || size > limit - offset) {
+        arena->exhausted = true;
+        return NULL;
+    }
+
+    arena->used = offset + size;
+    return &arena->buffer[offset];
+}
+
+// Objects go away with the arena
+static void pb_arena_free_(void* allocator_data, void* pointer)
+{
+    (void) allocator_data;
+    (void) pointer;
+}
+
+static void pb_arena_record_(const ProtobufCMessageDescriptor* descriptor, const struct pb_arena* arena, bool ok)
+{
+    portENTER_CRITICAL(&stats_lock_);
+
+    size_t i = 0;
+
+    while (i < stats_count_ && stats_descriptors_[i] != descriptor) {
+        i++;
+    }
+
+    if (i == stats_count_ && stats_count_ < PB_ARENA_STATS_LEN) {
+        stats_descriptors_[i] = descriptor;
+        stats_[i].message = descriptor->name;
+        stats_count_++;
+    }
+
+    if (i < stats_count_) {
+        struct pb_arena_stats* stats = &stats_[i];
+        stats->allocations += arena->allocations;
+
+        if (ok) {
+            stats->unpacked++;
+            size_t used = arena->used + arena->reserved;
+            stats->peak = used > stats->peak ? used : stats->peak;
+        } else if (arena->exhausted) {
+            stats->exhausted++;
+        } else {
+            stats->invalid++;
+        }
+    }
+
+    portEXIT_CRITICAL(&stats_lock_);
+}
+
+void pb_arena_init(struct pb_arena* arena, uint8_t* buffer, size_t capacity)
+{
+    arena->allocator.alloc = pb_arena_alloc_;
+    arena->allocator.free = pb_arena_free_;
+    arena->allocator.allocator_data = arena;
+    arena->buffer = buffer;
+    arena->capacity = capacity;
+
+    pb_arena_reset(arena);
+}
+
+void pb_arena_reset(struct pb_arena* arena)
+{
+    arena->used = 0;
+    arena->reserved = 0;
+    arena->allocations = 0;
+    arena->exhausted = false;
+}
+
+static ProtobufCMessage* pb_arena_unpack_(struct pb_arena* arena, const ProtobufCMessageDescriptor* descriptor, size_t length, const uint8_t* data)
+{
+    ProtobufCMessage* message = protobuf_c_message_unpack(descriptor, &arena->allocator, length, data);
+    pb_arena_record_(descriptor, arena, message != NULL);
+
+    if (message == NULL && arena->exhausted) {
+        ESP_LOGE(TAG, "%s does not fit in %zu bytes", descriptor->name, arena->capacity);
+    }
+
+    return message;
+}
+
+ProtobufCMessage* pb_arena_unpack(struct pb_arena* arena, const ProtobufCMessageDescriptor* descriptor, size_t length, const uint8_t* data)
+{
+    pb_arena_reset(arena);
+    return pb_arena_unpack_(arena, descriptor, length, data);
+}
+
+uint8_t* pb_arena_reserve(struct pb_arena* arena, size_t length)
+{
+    pb_arena_reset(arena);
+
+    if (length > arena->capacity) {
+        ESP_LOGE(TAG, "%zu byte message does not fit in %zu bytes", length, arena->capacity);
+        return NULL;
+    }
+
+    arena->reserved = length;
+    return &arena->buffer[arena->capacity - length];
+}
+
+ProtobufCMessage* pb_arena_unpack_reserved(struct pb_arena* arena, const ProtobufCMessageDescriptor* descriptor)
+{
+    arena->used = 0;
+    arena->allocations = 0;
+    arena->exhausted = false;
+
+    return pb_arena_unpack_(arena, descriptor, arena->reserved, &arena->buffer[arena->capacity - arena->reserved]);
+}
+
+esp_err_t pb_arena_get_stats(size_t index, struct pb_arena_stats* dest)
+{
+    esp_err_t rc = ESP_ERR_NOT_FOUND;
+
+    portENTER_CRITICAL(&stats_lock_);
+
+    if (index < stats_count_) {
+        *dest = stats_[index];
+        rc = ESP_OK;
+    }
+
+    portEXIT_CRITICAL(&stats_lock_);
+
+    return rc;
+}
\ No newline at end of file
@@ -0,0 +1,73 @@
+#ifndef API__GANYMEDE__V2__PB_ARENA_H_
+#define API__GANYMEDE__V2__PB_ARENA_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <esp_err.h>
+
+#include <protobuf-c/protobuf-c.h>
+
+// Bump-pointer allocator for unpacking protobuf-c messages into a fixed buffer
+// owned by the caller. Each unpack starts from an empty arena, so a message
+// lives until the next unpack into the same arena, or until it is reset. Its
+// objects are never freed one by one: protobuf_c_message_free_unpacked must not
+// be called on it.
+
+struct pb_arena {
+    // Passed to protobuf-c
+    ProtobufCAllocator allocator;
+
+    uint8_t* buffer;
+    size_t capacity;
+    size_t used;
+
+    // Bytes set aside at the end of the buffer for the packed message
+    size_t reserved;
+
+    // Allocations made since the last reset, and whether one did not fit
+    uint32_t allocations;
+    bool exhausted;
+};
+
+// Peak use of arenas by message type
+struct pb_arena_stats {
+    const char* message;
+
+    // Bytes used by the largest message unpacked so far
+    size_t peak;
+
+    uint32_t unpacked;
+
+    // Allocations protobuf-c made unpacking them, those that did not fit
+    // included
+    uint32_t allocations;
+
+    // Unpacks that ran out of room, or failed on invalid data
+    uint32_t exhausted;
+    uint32_t invalid;
+};
+
+void pb_arena_init(struct pb_arena* arena, uint8_t* buffer, size_t capacity);
+
+// Discard everything allocated in the arena. O(1).
+void pb_arena_reset(struct pb_arena* arena);
+
+// Reset the arena and unpack a message into it. Returns NULL if the message is
+// invalid or does not fit.
+ProtobufCMessage* pb_arena_unpack(struct pb_arena* arena, const ProtobufCMessageDescriptor* descriptor, size_t length, const uint8_t* data);
+
+// Reset the arena and set aside its last `length` bytes, for a packed message to
+// be received in. Returns NULL if they don't fit.
+uint8_t* pb_arena_reserve(struct pb_arena* arena, size_t length);
+
+// Unpack the message received in the reserved bytes into the rest of the
+// arena. They stay reserved until the next reset.
+ProtobufCMessage* pb_arena_unpack_reserved(struct pb_arena* arena, const ProtobufCMessageDescriptor* descriptor);
+
+// Stats of the `index`th message type unpacked since boot. Returns
+// ESP_ERR_NOT_FOUND past the last one.
+esp_err_t pb_arena_get_stats(size_t index, struct pb_arena_stats* dest);
+
+#endif // API__GANYMEDE__V2__PB_ARENA_H_
\ No newline at end of file
@@ -0,0 +1,505 @@
+#include "bench.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <api/ganymede/v2/api.h>
+#include <api/ganymede/v2/encode.h>
+#include <app/identity.h>
+#include <ganymede/v2/device.pb-c.h>
+#include <ganymede/v2/measurements.pb-c.h>
+#include <net/http2/arena.h>
+#include <net/http2/http2.h>
+
+#if CONFIG_IDF_TARGET_LINUX
+#include <host/heap.h>
+#endif
+
+enum {
+    // Samples taken by each benchmark
+    BENCH_SAMPLES = 100,
+
+    // Fewer samples for RPCs, each is a round trip to the server
+    BENCH_RPC_SAMPLES = 20,
+};
+
+static const char* TAG = "bench";
+
+#if CONFIG_APP_BENCHMARKS
+
+// Calls to the allocators given to nghttp2 and protobuf-c. Neither takes from
+// the heap, so the heap figures don't show them.
+struct bench_allocations {
+    uint32_t http2_allocations;
+    uint32_t http2_frees;
+    uint32_t protobuf_allocations;
+};
+
+// Timings of a single benchmark (microseconds), and the heap and allocators
+// around it
+struct bench_result {
+    int64_t samples[BENCH_SAMPLES];
+    size_t count;
+    uint32_t failures;
+
+    size_t heap_before;
+    size_t heap_after;
+    size_t heap_lowest;
+    struct bench_allocations allocations_before;
+
+#if CONFIG_IDF_TARGET_LINUX
+    // Process CPU time (microseconds) and malloc calls at the start
+    int64_t cpu_before;
+    struct host_heap_stats heap_calls_before;
+#endif
+};
+
+// An async call of the load benchmark. Its outcome is filled in by the http2
+// task and recorded by the requestor once notified, so that only the requestor
+// touches the result.
+struct bench_call {
+    TaskHandle_t requestor;
+    int64_t start;
+
+    int64_t elapsed;
+    size_t heap;
+    bool ok;
+};
+
+static struct bench_result result_;
+static struct bench_call load_calls_[CONFIG_GANYMEDE_API_MAX_CONCURRENT_CALLS];
+
+// A full bucket of measurements, in static storage so building it does not
+// disturb the heap figures
+static Ganymede__V2__Measurement measurements_[CONFIG_MEASUREMENTS_BUCKET_SIZE];
+static Ganymede__V2__Measurement* measurement_ptrs_[CONFIG_MEASUREMENTS_BUCKET_SIZE];
+static Google__Protobuf__Timestamp timestamps_[CONFIG_MEASUREMENTS_BUCKET_SIZE];
+static Ganymede__V2__AtmosphericMeasurements atmospheres_[CONFIG_MEASUREMENTS_BUCKET_SIZE];
+static uint8_t pack_buffer_[CONFIG_GRPC_PAYLOAD_BUFFER_LEN];
+
+// The same bucket, as the app stores it
+static time_t sample_timestamps_[CONFIG_MEASUREMENTS_BUCKET_SIZE];
+static int16_t sample_humidities_[CONFIG_MEASUREMENTS_BUCKET_SIZE];
+static int16_t sample_temperatures_[CONFIG_MEASUREMENTS_BUCKET_SIZE];
+static uint8_t encode_buffer_[CONFIG_GRPC_PAYLOAD_BUFFER_LEN];
+
+// Poll responses, one arena per concurrent call
+static uint8_t response_buffers_[CONFIG_GANYMEDE_API_MAX_CONCURRENT_CALLS][CONFIG_GANYMEDE_POLL_RESPONSE_ARENA_SIZE] __attribute__((aligned(8)));
+static struct pb_arena response_arenas_[CONFIG_GANYMEDE_API_MAX_CONCURRENT_CALLS];
+
+static int bench_compare_samples_(const void* a, const void* b)
+{
+    int64_t lhs = *(const int64_t*) a;
+    int64_t rhs = *(const int64_t*) b;
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+#if CONFIG_IDF_TARGET_LINUX
+static int64_t bench_cpu_time_(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+
+    return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+#endif
+
+static void bench_get_allocations_(struct bench_allocations* dest)
+{
+    struct arena_stats http2;
+    struct pb_arena_stats protobuf;
+
+    *dest = (struct bench_allocations) { 0 };
+
+    if (arena_get_stats(&http2) == ESP_OK) {
+        dest->http2_allocations = http2.allocations;
+        dest->http2_frees = http2.frees;
+    }
+
+    for (size_t i = 0; pb_arena_get_stats(i, &protobuf) == ESP_OK; i++) {
+        dest->protobuf_allocations += protobuf.allocations;
+    }
+}
+
+static void bench_begin_(struct bench_result* result)
+{
+    memset(result, 0, sizeof(struct bench_result));
+    result->heap_before = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+    result->heap_lowest = result->heap_before;
+    bench_get_allocations_(&result->allocations_before);
+
+#if CONFIG_IDF_TARGET_LINUX
+    host_heap_get_stats(&result->heap_calls_before);
+    result->cpu_before = bench_cpu_time_();
+#endif
+}
+
+static void bench_add_sample_(struct bench_result* result, int64_t elapsed, size_t heap, bool ok)
+{
+    if (heap < result->heap_lowest) {
+        result->heap_lowest = heap;
+    }
+
+    if (!ok) {
+        result->failures++;
+        return;
+    }
+
+    result->samples[result->count++] = elapsed;
+}
+
+static void bench_record_(struct bench_result* result, int64_t start, bool ok)
+{
+    int64_t elapsed = esp_timer_get_time() - start;
+    bench_add_sample_(result, elapsed, heap_caps_get_free_size(MALLOC_CAP_DEFAULT), ok);
+}
+
+static int64_t bench_percentile_(const struct bench_result* result, size_t percent)
+{
+    return result->samples[((result->count - 1) * percent) / 100];
+}
+
+static void bench_report_(const char* name, struct bench_result* result)
+{
+    result->heap_after = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+
+    struct bench_allocations allocations;
+    bench_get_allocations_(&allocations);
+
+    printf("Bench %s allocations: nghttp2 %" PRIu32 " (Frees %" PRIu32 ") protobuf-c %" PRIu32 "\n", name, allocations.http2_allocations - result->allocations_before.http2_allocations, allocations.http2_frees - result->allocations_before.http2_frees, allocations.protobuf_allocations - result->allocations_before.protobuf_allocations);
+
+#if CONFIG_IDF_TARGET_LINUX
+    int64_t cpu = bench_cpu_time_() - result->cpu_before;
+    struct host_heap_stats heap_calls;
+    host_heap_get_stats(&heap_calls);
+
+    // Every task's time, the http2 task's included
+    printf("Bench %s host: CPU %" PRId64 "us Allocations %" PRIu64 " Frees %" PRIu64 "\n", name, cpu, heap_calls.allocations - result->heap_calls_before.allocations, heap_calls.frees - result->heap_calls_before.frees);
+#endif
+
+    if (result->count == 0) {
+        printf("Bench %s: no successful samples (Failed %" PRIu32 ")\n", name, result->failures);
+        return;
+    }
+
+    int64_t total = 0;
+
+    for (size_t i = 0; i < result->count; i++) {
+        total += result->samples[i];
+    }
+
+    qsort(result->samples, result->count, sizeof(int64_t), bench_compare_samples_);
+
+    printf("Bench %s: n=%zu Total %" PRId64 "us p50 %" PRId64 "us p90 %" PRId64 "us p99 %" PRId64 "us Max %" PRId64 "us Failed %" PRIu32 "\n", name, result->count, total, bench_percentile_(result, 50), bench_percentile_(result, 90), bench_percentile_(result, 99), result->samples[result->count - 1], result->failures);
+    printf("Bench %s heap: Held %d (Peak use %zu)\n", name, (int) result->heap_before - (int) result->heap_after, result->heap_before - result->heap_lowest);
+}
+
+static void bench_build_measurements_(Ganymede__V2__PushMeasurementsRequest* request, char* device_id)
+{
+    ganymede__v2__push_measurements_request__init(request);
+
+    for (size_t i = 0; i < CONFIG_MEASUREMENTS_BUCKET_SIZE; i++) {
+        ganymede__v2__measurement__init(&measurements_[i]);
+        google__protobuf__timestamp__init(&timestamps_[i]);
+        ganymede__v2__atmospheric_measurements__init(&atmospheres_[i]);
+
+        // In the AM2320's units, converted as am2320_readf does
+        sample_timestamps_[i] = (time_t) (1700000000 + i * CONFIG_MEASUREMENTS_ACQUISITION_INTERVAL);
+        sample_humidities_[i] = (int16_t) (400 + (i % 200));
+        sample_temperatures_[i] = (int16_t) (200 + (i % 10));
+
+        timestamps_[i].seconds = (int64_t) sample_timestamps_[i];
+        atmospheres_[i].relative_humidity = ((float) sample_humidities_[i]) / 1000.0F;
+        atmospheres_[i].temperature = ((float) sample_temperatures_[i]) / 10.0F;
+
+        measurements_[i].device_id = device_id;
+        measurements_[i].timestamp = &timestamps_[i];
+        measurements_[i].atmosphere = &atmospheres_[i];
+        measurement_ptrs_[i] = &measurements_[i];
+    }
+
+    request->measurements = measurement_ptrs_;
+    request->n_measurements = CONFIG_MEASUREMENTS_BUCKET_SIZE;
+}
+
+// Serialize a full bucket the way PushMeasurements streams it: sized whole for
+// the gRPC prefix, then packed one measurement at a time
+static void bench_serialization_(void)
+{
+    char device_id[DEVICE_ID_LEN] = "00000000-0000-4000-8000-000000000000";
+    Ganymede__V2__PushMeasurementsRequest request;
+
+    bench_build_measurements_(&request, device_id);
+    bench_begin_(&result_);
+
+    for (size_t i = 0; i < BENCH_SAMPLES; i++) {
+        int64_t start = esp_timer_get_time();
+        size_t length = protobuf_c_message_get_packed_size((const ProtobufCMessage*) &request);
+        size_t packed = 0;
+
+        for (size_t j = 0; j < request.n_measurements; j++) {
+            packed += protobuf_c_message_pack((const ProtobufCMessage*) request.measurements[j], pack_buffer_);
+        }
+
+        bench_record_(&result_, start, length > 0 && packed > 0);
+    }
+
+    bench_report_("serialize", &result_);
+}
+
+// Same bucket, encoded straight from the samples as PushMeasurements now sends
+// them. Each measurement is checked against protobuf-c's output first.
+static bool bench_direct_serialization_(void)
+{
+    char device_id[DEVICE_ID_LEN] = "00000000-0000-4000-8000-000000000000";
+    Ganymede__V2__PushMeasurementsRequest request;
+
+    bench_build_measurements_(&request, device_id);
+
+    struct ganymede_api_v2_atmosphere_samples samples = {
+        .device_id = device_id,
+        .timestamps = sample_timestamps_,
+        .humidities = sample_humidities_,
+        .temperatures = sample_temperatures_,
+        .count = CONFIG_MEASUREMENTS_BUCKET_SIZE,
+    };
+
+    size_t mismatches = 0;
+
+    for (size_t i = 0; i < samples.count; i++) {
+        size_t expected = protobuf_c_message_pack((const ProtobufCMessage*) request.measurements[i], pack_buffer_);
+        size_t actual = ganymede_api_v2_encode_atmosphere_measurement(&samples, i, encode_buffer_);
+
+        if (actual != expected || memcmp(pack_buffer_, encode_buffer_, actual) != 0) {
+            mismatches++;
+        }
+    }
+
+    bool match = mismatches == 0 && ganymede_api_v2_encode_push_atmosphere_request(&samples, NULL, NULL) == protobuf_c_message_get_packed_size((const ProtobufCMessage*) &request);
+
+    if (!match) {
+        printf("Bench serialize direct: %zu of %zu measurements differ from protobuf-c\n", mismatches, samples.count);
+    }
+
+    bench_begin_(&result_);
+
+    for (size_t i = 0; i < BENCH_SAMPLES; i++) {
+        int64_t start = esp_timer_get_time();
+        size_t length = ganymede_api_v2_encode_push_atmosphere_request(&samples, NULL, NULL);
+        size_t packed = 0;
+
+        for (size_t j = 0; j < samples.count; j++) {
+            packed += ganymede_api_v2_encode_atmosphere_measurement(&samples, j, encode_buffer_);
+        }
+
+        bench_record_(&result_, start, length > 0 && packed > 0);
+    }
+
+    bench_report_("serialize direct", &result_);
+    return match;
+}
+
+// Same bucket as a PushAtmosphereBatch, the columnar layout used when the
+// server supports it
+static void bench_columnar_serialization_(void)
+{
+    char device_id[DEVICE_ID_LEN] = "00000000-0000-4000-8000-000000000000";
+    char batch_id[] = "0123456789abcdef0123456789abcdef";
+    Ganymede__V2__PushMeasurementsRequest request;
+
+    bench_build_measurements_(&request, device_id);
+    request.batch_id = batch_id;
+
+    struct ganymede_api_v2_atmosphere_samples samples = {
+        .device_id = device_id,
+        .timestamps = sample_timestamps_,
+        .humidities = sample_humidities_,
+        .temperatures = sample_temperatures_,
+        .count = CONFIG_MEASUREMENTS_BUCKET_SIZE,
+    };
+
+    size_t columnar = ganymede_api_v2_encode_atmosphere_batch(&samples, batch_id, NULL);
+    size_t row = protobuf_c_message_get_packed_size((const ProtobufCMessage*) &request);
+
+    printf("Bench serialize columnar: %zu bytes vs %zu for PushMeasurements (%zu samples)\n", columnar, row, samples.count);
+
+    if (columnar > sizeof(encode_buffer_)) {
+        return;
+    }
+
+    bench_begin_(&result_);
+
+    for (size_t i = 0; i < BENCH_SAMPLES; i++) {
+        int64_t start = esp_timer_get_time();
+        size_t packed = ganymede_api_v2_encode_atmosphere_batch(&samples, batch_id, encode_buffer_);
+        bench_record_(&result_, start, packed == columnar);
+    }
+
+    bench_report_("serialize columnar", &result_);
+}
+
+// Wake-up latency of a task sleeping for one tick, as seen by the app tasks
+// sleeping between polls and acquisitions
+static void bench_scheduling_(void)
+{
+    bench_begin_(&result_);
+
+    for (size_t i = 0; i < BENCH_SAMPLES; i++) {
+        int64_t start = esp_timer_get_time();
+        vTaskDelay(1);
+        bench_record_(&result_, start, true);
+    }
+
+    bench_report_("schedule", &result_);
+}
+
+static esp_err_t bench_build_poll_request_(Ganymede__V2__PollRequest* request, Google__Protobuf__Duration* uptime, char* mac_buffer)
+{
+    ganymede__v2__poll_request__init(request);
+    google__protobuf__duration__init(uptime);
+
+    request->device_mac = mac_buffer;
+    request->uptime = uptime;
+
+    if (identity_get_device_mac(request->device_mac) != ESP_OK) {
+        ESP_LOGE(TAG, "failed to retrieve device MAC address");
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+static void bench_rpc_(void)
+{
+    char mac_buffer[DEVICE_MAC_LEN] = { 0 };
+    Ganymede__V2__PollRequest request;
+    Google__Protobuf__Duration uptime;
+
+    if (bench_build_poll_request_(&request, &uptime, mac_buffer) != ESP_OK) {
+        return;
+    }
+
+    bench_begin_(&result_);
+
+    for (size_t i = 0; i < BENCH_RPC_SAMPLES; i++) {
+        Ganymede__V2__PollResponse* response = NULL;
+
+        int64_t start = esp_timer_get_time();
+        grpc_status_t rc = ganymede_api_v2_poll_device(&request, &response, &response_arenas_[0]);
+        bench_record_(&result_, start, rc == GRPC_STATUS_OK);
+    }
+
+    bench_report_("rpc", &result_);
+}
+
+// Runs in the http2 task
+static void bench_load_complete_(grpc_status_t status, ProtobufCMessage* response, void* arg)
+{
+    struct bench_call* call = (struct bench_call*) arg;
+
+    call->elapsed = esp_timer_get_time() - call->start;
+    call->heap = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+    call->ok = status == GRPC_STATUS_OK;
+
+    xTaskNotifyGive(call->requestor);
+}
+
+// Poll RPCs issued in rounds that fill every call slot, so requests are
+// multiplexed on the session the way concurrent app tasks would
+static void bench_load_(void)
+{
+    char mac_buffer[DEVICE_MAC_LEN] = { 0 };
+    Ganymede__V2__PollRequest request;
+    Google__Protobuf__Duration uptime;
+    struct http2_stats before;
+    struct http2_stats after;
+
+    if (bench_build_poll_request_(&request, &uptime, mac_buffer) != ESP_OK) {
+        return;
+    }
+
+    bench_begin_(&result_);
+    http2_get_stats(&before);
+
+    int64_t started = esp_timer_get_time();
+    size_t issued = 0;
+
+    while (issued < BENCH_SAMPLES) {
+        size_t submitted = 0;
+        size_t in_flight = 0;
+
+        for (; submitted < CONFIG_GANYMEDE_API_MAX_CONCURRENT_CALLS && issued < BENCH_SAMPLES; submitted++, issued++) {
+            struct bench_call* call = &load_calls_[submitted];
+
+            call->requestor = xTaskGetCurrentTaskHandle();
+            call->start = esp_timer_get_time();
+            call->ok = false;
+
+            if (ganymede_api_v2_poll_device_async(&request, &response_arenas_[submitted], bench_load_complete_, call, NULL) == GRPC_STATUS_OK) {
+                in_flight++;
+            } else {
+                call->elapsed = esp_timer_get_time() - call->start;
+                call->heap = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+            }
+        }
+
+        while (in_flight > 0) {
+            ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
+            in_flight--;
+        }
+
+        // Every call of the round is complete, and its outcome visible here
+        for (size_t i = 0; i < submitted; i++) {
+            bench_add_sample_(&result_, load_calls_[i].elapsed, load_calls_[i].heap, load_calls_[i].ok);
+        }
+    }
+
+    int64_t elapsed = esp_timer_get_time() - started;
+    http2_get_stats(&after);
+
+    bench_report_("load", &result_);
+
+    printf("Bench load throughput: %" PRId64 " calls/s Sent %" PRIu64 "B/s Received %" PRIu64 "B/s\n", (int64_t) result_.count * 1000000 / elapsed, (after.bytes_sent - before.bytes_sent) * 1000000 / (uint64_t) elapsed, (after.bytes_received - before.bytes_received) * 1000000 / (uint64_t) elapsed);
+    printf("Bench load timing: Handshake %" PRId64 "us First byte %" PRId64 "us\n", after.handshake_time, after.first_byte_time);
+}
+
+esp_err_t app_bench_run(void)
+{
+    printf("Bench: tick %" PRIu32 "ms\n", (uint32_t) portTICK_PERIOD_MS);
+
+    for (size_t i = 0; i < CONFIG_GANYMEDE_API_MAX_CONCURRENT_CALLS; i++) {
+        pb_arena_init(&response_arenas_[i], response_buffers_[i], sizeof(response_buffers_[i]));
+    }
+
+    bench_serialization_();
+    bool encoders_match = bench_direct_serialization_();
+    bench_columnar_serialization_();
+    bench_scheduling_();
+    bench_rpc_();
+    bench_load_();
+
+    // host/checks/encode.c covers the encoders' edge cases
+    return encoders_match ? ESP_OK : ESP_FAIL;
+}
+
+#else
+
+esp_err_t app_bench_run(void)
+{
+    ESP_LOGE(TAG, "built without CONFIG_APP_BENCHMARKS");
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+#endif // CONFIG_APP_BENCHMARKS
\ No newline at end of file
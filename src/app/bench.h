@@ -0,0 +1,13 @@
+#ifndef APP__BENCH_H_
+#define APP__BENCH_H_
+
+#include <esp_err.h>
+
+// Run the serialization, scheduling, RPC and RPC load benchmarks and print
+// their results. Blocks for the whole run; RPCs go to CONFIG_GANYMEDE_HOST and
+// CONFIG_GANYMEDE_PORT, and need a registered device. Fails when the direct
+// encoders differ from protobuf-c, and with ESP_ERR_NOT_SUPPORTED unless built
+// with CONFIG_APP_BENCHMARKS.
+esp_err_t app_bench_run(void);
+
+#endif // APP__BENCH_H_
\ No newline at end of file
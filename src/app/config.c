@@ -0,0 +1,100 @@
+#include "config.h"
+
+#include <stddef.h>
+
+#include <esp_log.h>
+
+#include <freertos/FreeRTOS.h>
+
+enum {
+    // The current snapshot, the one being built and one still held by a
+    // reader that has yet to pick up the current one
+    CONFIG_SNAPSHOTS_LEN = 3,
+};
+
+static const char* TAG = "config";
+
+static uint8_t buffers_[CONFIG_SNAPSHOTS_LEN][CONFIG_GANYMEDE_POLL_RESPONSE_ARENA_SIZE] __attribute__((aligned(8)));
+static struct config_snapshot snapshots_[CONFIG_SNAPSHOTS_LEN];
+
+// Loading current_ and taking a reference on it must happen as one, or the
+// snapshot could be reclaimed in between. Held for a few instructions only,
+// releases don't take it.
+static portMUX_TYPE current_lock_ = portMUX_INITIALIZER_UNLOCKED;
+static struct config_snapshot* current_ = NULL;
+static uint32_t generation_ = 0;
+
+esp_err_t app_config_init(void)
+{
+    for (size_t i = 0; i < CONFIG_SNAPSHOTS_LEN; i++) {
+        pb_arena_init(&snapshots_[i].arena, buffers_[i], sizeof(buffers_[i]));
+        snapshots_[i].response = NULL;
+        atomic_init(&snapshots_[i].references, 0);
+    }
+
+    return ESP_OK;
+}
+
+struct config_snapshot* config_snapshot_create(void)
+{
+    struct config_snapshot* snapshot = NULL;
+
+    portENTER_CRITICAL(&current_lock_);
+
+    for (size_t i = 0; i < CONFIG_SNAPSHOTS_LEN && snapshot == NULL; i++) {
+        if (atomic_load(&snapshots_[i].references) == 0) {
+            snapshot = &snapshots_[i];
+            atomic_store(&snapshot->references, 1);
+        }
+    }
+
+    portEXIT_CRITICAL(&current_lock_);
+
+    if (snapshot == NULL) {
+        ESP_LOGE(TAG, "All config snapshots are in use");
+        return NULL;
+    }
+
+    snapshot->response = NULL;
+    pb_arena_reset(&snapshot->arena);
+
+    return snapshot;
+}
+
+void config_snapshot_publish(struct config_snapshot* snapshot, const Ganymede__V2__PollResponse* response)
+{
+    snapshot->response = response;
+
+    portENTER_CRITICAL(&current_lock_);
+
+    struct config_snapshot* previous = current_;
+    snapshot->generation = ++generation_;
+    current_ = snapshot;
+
+    portEXIT_CRITICAL(&current_lock_);
+
+    if (previous != NULL) {
+        config_snapshot_release(previous);
+    }
+}
+
+struct config_snapshot* config_snapshot_acquire(void)
+{
+    portENTER_CRITICAL(&current_lock_);
+
+    struct config_snapshot* snapshot = current_;
+
+    if (snapshot != NULL) {
+        atomic_fetch_add(&snapshot->references, 1);
+    }
+
+    portEXIT_CRITICAL(&current_lock_);
+
+    return snapshot;
+}
+
+void config_snapshot_release(struct config_snapshot* snapshot)
+{
+    // The slot is free for config_snapshot_create once this drops to 0
+    atomic_fetch_sub(&snapshot->references, 1);
+}
\ No newline at end of file
@@ -0,0 +1,48 @@
+#ifndef APP__CONFIG_H_
+#define APP__CONFIG_H_
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include <esp_err.h>
+
+#include <api/ganymede/v2/pb_arena.h>
+#include <ganymede/v2/device.pb-c.h>
+
+// Device configuration, as last received in a PollResponse, shared between
+// tasks without copies. poll unpacks each response into a snapshot and
+// publishes it; readers take a reference to the current snapshot and keep
+// using it, unchanged, until they release it, even if a newer one is
+// published meanwhile. A snapshot is reclaimed once it is no longer current
+// and its last reference is released.
+
+struct config_snapshot {
+    // Never modified once published
+    const Ganymede__V2__PollResponse* response;
+
+    // Increases with each published snapshot
+    uint32_t generation;
+
+    // Holds the response
+    struct pb_arena arena;
+
+    atomic_uint_fast32_t references;
+};
+
+esp_err_t app_config_init(void);
+
+// A free snapshot to unpack a response into, with one reference held by the
+// caller. Returns NULL if every snapshot is still referenced.
+struct config_snapshot* config_snapshot_create(void);
+
+// Make `snapshot` current, with `response` unpacked in its arena. The caller's
+// reference passes to the configuration, and the one on the previous snapshot
+// is released.
+void config_snapshot_publish(struct config_snapshot* snapshot, const Ganymede__V2__PollResponse* response);
+
+// A reference to the current snapshot, or NULL if none was published yet
+struct config_snapshot* config_snapshot_acquire(void);
+
+void config_snapshot_release(struct config_snapshot* snapshot);
+
+#endif // APP__CONFIG_H_
\ No newline at end of file
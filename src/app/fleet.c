@@ -0,0 +1,178 @@
+#include "fleet.h"
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <esp_log.h>
+
+#include <app/identity.h>
+#include <app/schedule.h>
+
+enum {
+    // Simulated time after the power comes back (seconds)
+    FLEET_WINDOW = 3 * 3600,
+
+    // Requests are counted in buckets of this length (seconds)
+    FLEET_BUCKET = 10,
+    FLEET_BUCKET_COUNT = FLEET_WINDOW / FLEET_BUCKET,
+
+    // Timeline lines printed, each summarizing a span of buckets
+    FLEET_TIMELINE_SPAN = 600 / FLEET_BUCKET,
+
+    // Devices do not all come up at once: WiFi association and DHCP take a
+    // few seconds (milliseconds)
+    FLEET_BOOT_SPREAD = 5000,
+
+    // Crystal tolerance of the simulated clocks (parts per million)
+    FLEET_CLOCK_DRIFT = 20,
+
+    // Requests per second the simulated backend can serve
+    FLEET_SERVER_CAPACITY = 50,
+
+    FLEET_MAX_DEVICES = 0xFFFF,
+};
+
+static const char* TAG = "fleet";
+
+#if CONFIG_APP_BENCHMARKS
+
+static uint16_t arrivals_[FLEET_BUCKET_COUNT];
+static uint16_t job_peaks_[APP_SCHEDULE_JOB_COUNT];
+static uint16_t job_arrivals_[FLEET_BUCKET_COUNT];
+
+// Deterministic per-device randomness, so runs can be compared
+static uint32_t fleet_next_random_(uint32_t* state)
+{
+    *state = *state * 1664525 + 1013904223;
+    return *state >> 8;
+}
+
+static void fleet_virtual_mac_(size_t device, uint8_t mac[DEVICE_MAC_BYTES_LEN])
+{
+    // Locally administered, unicast
+    mac[0] = 0x02;
+    mac[1] = 0x00;
+    mac[2] = 0x00;
+    mac[3] = (uint8_t) (device >> 16);
+    mac[4] = (uint8_t) (device >> 8);
+    mac[5] = (uint8_t) device;
+}
+
+// Add the runs of `job` on one device to the timeline
+static void fleet_simulate_job_(const uint8_t mac[DEVICE_MAC_BYTES_LEN], enum app_schedule_job job, int64_t boot, int32_t drift, uint16_t* timeline)
+{
+    struct app_schedule_timing timing;
+
+    if (app_schedule_get(mac, job, &timing) != ESP_OK || timing.period <= 0) {
+        return;
+    }
+
+    // The device's clock runs slightly fast or slow
+    int64_t period = timing.period + (timing.period / 1000000) * drift;
+    int64_t window = FLEET_WINDOW * 1000LL * 1000LL;
+
+    for (int64_t at = boot + timing.first; at < window; at += period) {
+        size_t bucket = (size_t) (at / (FLEET_BUCKET * 1000LL * 1000LL));
+
+        if (timeline[bucket] < UINT16_MAX) {
+            timeline[bucket]++;
+        }
+    }
+}
+
+static void fleet_report_(size_t devices)
+{
+    uint32_t total = 0;
+    size_t peak_bucket = 0;
+    uint32_t queue = 0;
+    uint32_t max_queue = 0;
+    size_t max_queue_bucket = 0;
+
+    for (size_t i = 0; i < FLEET_BUCKET_COUNT; i++) {
+        total += arrivals_[i];
+
+        if (arrivals_[i] > arrivals_[peak_bucket]) {
+            peak_bucket = i;
+        }
+
+        // The backend serves a fixed number of requests per bucket, the rest
+        // waits for the next one
+        queue += arrivals_[i];
+        queue -= queue < FLEET_SERVER_CAPACITY * FLEET_BUCKET ? queue : FLEET_SERVER_CAPACITY * FLEET_BUCKET;
+
+        if (queue > max_queue) {
+            max_queue = queue;
+            max_queue_bucket = i;
+        }
+    }
+
+    printf("Fleet: %zu devices, %" PRIu32 " requests in %ds (Mean %" PRIu32 ".%02" PRIu32 "/s)\n", devices, total, FLEET_WINDOW, total / FLEET_WINDOW, (total % FLEET_WINDOW) * 100 / FLEET_WINDOW);
+    printf("Fleet peak: %u requests in %ds at t+%zus (%u/s)\n", arrivals_[peak_bucket], FLEET_BUCKET, peak_bucket * FLEET_BUCKET, arrivals_[peak_bucket] / FLEET_BUCKET);
+    printf("Fleet backend at %d/s: Max queue %" PRIu32 " at t+%zus (Max wait ~%" PRIu32 "s)\n", FLEET_SERVER_CAPACITY, max_queue, max_queue_bucket * FLEET_BUCKET, max_queue / FLEET_SERVER_CAPACITY);
+
+    for (size_t job = 0; job < APP_SCHEDULE_JOB_COUNT; job++) {
+        printf("Fleet %s peak: %u requests in %ds\n", app_schedule_job_to_str(job), job_peaks_[job], FLEET_BUCKET);
+    }
+
+    for (size_t start = 0; start < FLEET_BUCKET_COUNT; start += FLEET_TIMELINE_SPAN) {
+        uint32_t span_total = 0;
+        uint16_t span_peak = 0;
+
+        for (size_t i = start; i < start + FLEET_TIMELINE_SPAN && i < FLEET_BUCKET_COUNT; i++) {
+            span_total += arrivals_[i];
+            span_peak = arrivals_[i] > span_peak ? arrivals_[i] : span_peak;
+        }
+
+        printf("  t+%5zus: %5" PRIu32 " requests (Peak %u in %ds)\n", start * FLEET_BUCKET, span_total, span_peak, FLEET_BUCKET);
+    }
+}
+
+esp_err_t app_fleet_simulate(size_t devices)
+{
+    if (devices == 0 || devices > FLEET_MAX_DEVICES) {
+        ESP_LOGE(TAG, "fleet size must be between 1 and %d", FLEET_MAX_DEVICES);
+        return ESP_FAIL;
+    }
+
+    memset(arrivals_, 0, sizeof(arrivals_));
+    memset(job_peaks_, 0, sizeof(job_peaks_));
+
+    // Jobs are simulated one at a time to get their individual peaks
+    for (size_t job = 0; job < APP_SCHEDULE_JOB_COUNT; job++) {
+        memset(job_arrivals_, 0, sizeof(job_arrivals_));
+
+        for (size_t device = 0; device < devices; device++) {
+            uint8_t mac[DEVICE_MAC_BYTES_LEN];
+            uint32_t random = (uint32_t) device + 1;
+
+            fleet_virtual_mac_(device, mac);
+
+            int64_t boot = (int64_t) (fleet_next_random_(&random) % FLEET_BOOT_SPREAD) * 1000LL;
+            int32_t drift = (int32_t) (fleet_next_random_(&random) % (2 * FLEET_CLOCK_DRIFT + 1)) - FLEET_CLOCK_DRIFT;
+
+            fleet_simulate_job_(mac, job, boot, drift, job_arrivals_);
+        }
+
+        for (size_t i = 0; i < FLEET_BUCKET_COUNT; i++) {
+            arrivals_[i] = (uint16_t) (arrivals_[i] + job_arrivals_[i] < UINT16_MAX ? arrivals_[i] + job_arrivals_[i] : UINT16_MAX);
+            job_peaks_[job] = job_arrivals_[i] > job_peaks_[job] ? job_arrivals_[i] : job_peaks_[job];
+        }
+    }
+
+    fleet_report_(devices);
+    return ESP_OK;
+}
+
+#else
+
+esp_err_t app_fleet_simulate(size_t devices)
+{
+    (void) devices;
+
+    ESP_LOGE(TAG, "built without CONFIG_APP_BENCHMARKS");
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+#endif // CONFIG_APP_BENCHMARKS
\ No newline at end of file
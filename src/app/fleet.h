@@ -0,0 +1,17 @@
+#ifndef APP__FLEET_H_
+#define APP__FLEET_H_
+
+#include <stdlib.h>
+
+#include <esp_err.h>
+
+// Simulate `devices` devices booting together after a site-wide power cut,
+// each running the schedule in app/schedule.h under its own virtual MAC and
+// clock, and print the load they put on the backend. Nothing is sent: this
+// is the schedule's arithmetic, quick enough for the device console.
+// host/fleet.py runs the firmware itself, one runner per device, against the
+// stand-in server. Fails with ESP_ERR_NOT_SUPPORTED unless built with
+// CONFIG_APP_BENCHMARKS.
+esp_err_t app_fleet_simulate(size_t devices);
+
+#endif // APP__FLEET_H_
\ No newline at end of file
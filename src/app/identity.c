@@ -26,7 +26,7 @@ esp_err_t app_identity_init()
     return ESP_OK;
 }
 
-esp_err_t identity_get_device_mac(char dest[DEVICE_MAC_LEN])
+esp_err_t identity_get_device_mac_bytes(uint8_t dest[DEVICE_MAC_BYTES_LEN])
 {
     // We expect 6 bytes, but read_mac could return 8 in some cases. Better to
     // not crash.
@@ -37,6 +37,18 @@ esp_err_t identity_get_device_mac(char dest[DEVICE_MAC_LEN])
         return ESP_FAIL;
     }
 
+    memcpy(dest, mac, DEVICE_MAC_BYTES_LEN);
+    return ESP_OK;
+}
+
+esp_err_t identity_get_device_mac(char dest[DEVICE_MAC_LEN])
+{
+    uint8_t mac[DEVICE_MAC_BYTES_LEN] = { 0 };
+
+    if (identity_get_device_mac_bytes(mac) != ESP_OK) {
+        return ESP_FAIL;
+    }
+
     snprintf(dest, 18, "%02x:%02x:%02x:%02x:%02x:%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
     ESP_LOGD(TAG, "MAC %s", dest);
     return ESP_OK;
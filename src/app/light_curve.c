@@ -0,0 +1,90 @@
+#include "light_curve.h"
+
+static uint32_t light_curve_get_length_(const struct light_curve_period* period)
+{
+    return (period->stop + LIGHT_CURVE_SECONDS_PER_DAY - period->start) % LIGHT_CURVE_SECONDS_PER_DAY;
+}
+
+// The ramp in must end by stop, and the ramp out by the next start
+static uint32_t light_curve_get_ramp_(const struct light_curve_period* period, uint32_t length)
+{
+    uint32_t ramp = period->ramp;
+
+    if (ramp > length) {
+        ramp = length;
+    }
+
+    if (ramp > LIGHT_CURVE_SECONDS_PER_DAY - length) {
+        ramp = LIGHT_CURVE_SECONDS_PER_DAY - length;
+    }
+
+    return ramp;
+}
+
+uint8_t light_curve_intensity(const struct light_curve_period* period, uint32_t second)
+{
+    uint32_t length = light_curve_get_length_(period);
+    uint32_t ramp = light_curve_get_ramp_(period, length);
+    uint32_t elapsed = (second + LIGHT_CURVE_SECONDS_PER_DAY - period->start) % LIGHT_CURVE_SECONDS_PER_DAY;
+
+    if (elapsed < length) {
+        if (elapsed < ramp) {
+            return (uint8_t) ((period->intensity * elapsed) / ramp);
+        }
+
+        return period->intensity;
+    }
+
+    if (elapsed - length < ramp) {
+        return (uint8_t) ((period->intensity * (ramp - (elapsed - length))) / ramp);
+    }
+
+    return 0;
+}
+
+size_t light_curve_breakpoints(const struct light_curve_period* period, uint32_t* dest)
+{
+    uint32_t length = light_curve_get_length_(period);
+    uint32_t ramp = light_curve_get_ramp_(period, length);
+    size_t count = 0;
+
+    if (length == 0) {
+        return 0;
+    }
+
+    dest[count++] = period->start;
+    dest[count++] = period->stop;
+
+    if (ramp > 0) {
+        dest[count++] = (period->start + ramp) % LIGHT_CURVE_SECONDS_PER_DAY;
+        dest[count++] = (period->stop + ramp) % LIGHT_CURVE_SECONDS_PER_DAY;
+    }
+
+    return count;
+}
+
+uint32_t light_curve_duty(uint8_t intensity)
+{
+    return ((uint32_t) intensity * LIGHT_CURVE_DUTY_MAX + 127) / 255;
+}
+
+uint32_t light_curve_duty_at(uint32_t from, uint32_t to, uint32_t elapsed, uint32_t duration)
+{
+    if (elapsed >= duration) {
+        return to;
+    }
+
+    if (to >= from) {
+        return from + (uint32_t) (((uint64_t) (to - from) * elapsed) / duration);
+    }
+
+    return from - (uint32_t) (((uint64_t) (from - to) * elapsed) / duration);
+}
+
+uint32_t light_curve_max_fade_time(uint32_t from, uint32_t to, uint32_t frequency)
+{
+    uint64_t steps = to > from ? to - from : from - to;
+    uint64_t max = (steps * LIGHT_CURVE_FADE_CYCLES_MAX * 1000) / frequency;
+
+    return max > UINT32_MAX ? UINT32_MAX : (uint32_t) max;
+}
\ No newline at end of file
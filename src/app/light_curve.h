@@ -0,0 +1,56 @@
+#ifndef APP__LIGHT_CURVE_H_
+#define APP__LIGHT_CURVE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Model of a dimmed luminaire's output over a day, free of ESP-IDF so that it
+// can be run on a host. Each photo period is a trapezoid: the intensity rises
+// linearly from 0 over `ramp` seconds after `start`, holds, and falls back to
+// 0 over `ramp` seconds after `stop`. A luminaire's intensity at the curve's
+// breakpoints is the highest among its periods; in between, the LEDC fade
+// engine moves the duty linearly.
+
+enum {
+    LIGHT_CURVE_SECONDS_PER_DAY = 24 * 3600,
+
+    // PWM duty resolution (bits)
+    LIGHT_CURVE_DUTY_RESOLUTION = 13,
+    LIGHT_CURVE_DUTY_MAX = (1 << LIGHT_CURVE_DUTY_RESOLUTION) - 1,
+
+    // Most PWM periods the fade engine spends on one duty step. Slower fades
+    // finish early, so they are cut into pieces it can keep up with.
+    LIGHT_CURVE_FADE_CYCLES_MAX = 1023,
+
+    LIGHT_CURVE_BREAKPOINTS_LEN = 4,
+};
+
+struct light_curve_period {
+    // Seconds since local midnight. A period that stops before it starts
+    // wraps past midnight.
+    uint32_t start;
+    uint32_t stop;
+
+    // Shortened to fit the period and the gap before it comes around again
+    uint32_t ramp;
+
+    uint8_t intensity;
+};
+
+// Intensity of the period at `second` since local midnight
+uint8_t light_curve_intensity(const struct light_curve_period* period, uint32_t second);
+
+// Seconds of day where the period's slope changes. Returns how many were
+// written to `dest`, at most LIGHT_CURVE_BREAKPOINTS_LEN.
+size_t light_curve_breakpoints(const struct light_curve_period* period, uint32_t* dest);
+
+uint32_t light_curve_duty(uint8_t intensity);
+
+// Duty `elapsed` into a linear fade from `from` to `to` lasting `duration`
+uint32_t light_curve_duty_at(uint32_t from, uint32_t to, uint32_t elapsed, uint32_t duration);
+
+// Longest the fade engine can stretch a fade from `from` to `to` at
+// `frequency` Hz (milliseconds)
+uint32_t light_curve_max_fade_time(uint32_t from, uint32_t to, uint32_t frequency);
+
+#endif // APP__LIGHT_CURVE_H_
\ No newline at end of file
@@ -1,164 +1,604 @@
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
 #include <time.h>
 
 #include <esp_log.h>
 
 #include <driver/gpio.h>
+#include <driver/ledc.h>
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 
 #include <api/error.h>
+#include <app/config.h>
+#include <app/light_curve.h>
+#include <drivers/output_bank.h>
 
 #include "lights.h"
 
 enum {
     LIGHTS_TASK_STACK_DEPTH = 1024 * 4,
+
+    // LEDC channels of the ESP32-S2, all on the low speed timer
+    LIGHTS_PWM_CHANNELS_LEN = 8,
+
+    // Longest the task sleeps between transitions, so that it catches up with
+    // a clock stepped without notice (seconds)
+    LIGHTS_MAX_SLEEP = 3600,
+};
+
+// From `second` (since local midnight) until the next transition, the
+// switched pins in `levels` are driven high and the others low, while each
+// PWM channel fades from its intensity here to its intensity at the next
+// transition
+struct lights_transition {
+    uint32_t second;
+    uint64_t levels;
+    uint8_t intensities[LIGHTS_PWM_CHANNELS_LEN];
+};
+
+// The light config compiled for the lights task: a day of transitions sorted
+// by time, the first one at midnight
+struct lights_timeline {
+    // Pins of luminaires switched on and off
+    uint64_t pins;
+
+    // Pins of dimmed luminaires, by LEDC channel
+    uint32_t pwm_ports[LIGHTS_PWM_CHANNELS_LEN];
+    bool pwm_inverted[LIGHTS_PWM_CHANNELS_LEN];
+    size_t pwm_count;
+
+    // Local time minus UTC, as of the last wake of the lights task (seconds)
+    int32_t utc_offset;
+
+    // Allocated for the boundaries of the largest configuration so far, up to
+    // four per photo period and midnight
+    size_t count;
+    size_t capacity;
+    struct lights_transition* transitions;
 };
 
 const char* TAG = "lights";
 
-static Ganymede__V2__LightConfig* incoming_light_config = NULL;
-static uint8_t buffer[CONFIG_GANYMEDE_LIGHT_CONFIG_MAX_SIZE];
+static TaskHandle_t lights_task_handle_ = NULL;
 
-static bool lights_is_in_schedule_(struct tm* timeinfo, Ganymede__V2__Luminaire__DailySchedule* schedule)
+// Only used by the lights task. The timeline in use and the one compiled
+// from a new configuration, which are compared to reconfigure the outputs.
+static struct lights_timeline timelines_[2] = { 0 };
+static struct lights_timeline* timeline_ = NULL;
+static uint64_t applied_levels_ = 0;
+static bool applied_ = false;
+
+static uint32_t lights_get_second_of_day_(const Ganymede__V2__Time* time)
 {
-    uint32_t now_sec = timeinfo->tm_hour * 3600 + timeinfo->tm_min * 60 + timeinfo->tm_sec;
-    uint32_t start_sec = schedule->start->hour * 3600 + schedule->start->minute * 60 + schedule->start->second;
-    uint32_t stop_sec = schedule->stop->hour * 3600 + schedule->stop->minute * 60 + schedule->stop->second;
+    return time->hour * 3600 + time->minute * 60 + time->second;
+}
 
-    return (start_sec <= now_sec && now_sec < stop_sec);
+// Switched luminaires are fully on during their photo periods, whatever their
+// intensity
+static void lights_get_period_(const Ganymede__V2__Luminaire__DailySchedule* schedule, bool pwm, struct light_curve_period* dest)
+{
+    dest->start = lights_get_second_of_day_(schedule->start);
+    dest->stop = lights_get_second_of_day_(schedule->stop);
+    dest->ramp = pwm ? schedule->ramp_seconds : 0;
+    dest->intensity = pwm ? (uint8_t) (schedule->intensity > UINT8_MAX ? UINT8_MAX : schedule->intensity) : UINT8_MAX;
 }
 
-static void lights_recompute_(struct tm* timeinfo, Ganymede__V2__LightConfig* light_config)
+// Highest intensity of the luminaire's photo periods at `now_sec`
+static uint8_t lights_compute_intensity_(uint32_t now_sec, const Ganymede__V2__Luminaire* luminaire, bool pwm)
 {
-    for (size_t lum_idx = 0; lum_idx < light_config->n_luminaires; lum_idx++) {
-        Ganymede__V2__Luminaire* luminaire = light_config->luminaires[lum_idx];
-        bool active = false;
+    uint8_t intensity = 0;
 
-        size_t pp_idx = 0;
-        for (; pp_idx < luminaire->n_photo_period; pp_idx++) {
+    for (size_t pp_idx = 0; pp_idx < luminaire->n_photo_period; pp_idx++) {
+        struct light_curve_period period;
+        lights_get_period_(luminaire->photo_period[pp_idx], pwm, &period);
 
-            if (lights_is_in_schedule_(timeinfo, luminaire->photo_period[pp_idx])) {
-                active = true;
-                break;
-            }
+        uint8_t value = light_curve_intensity(&period, now_sec);
+        intensity = value > intensity ? value : intensity;
+    }
+
+    return intensity;
+}
+
+static bool lights_is_valid_port_(const Ganymede__V2__Luminaire* luminaire)
+{
+    return luminaire->port < GPIO_NUM_MAX && GPIO_IS_VALID_OUTPUT_GPIO(luminaire->port);
+}
+
+// Levels of switched pins and intensities of PWM channels at `dest->second`.
+// Luminaires take channels in order, as assigned by lights_compile_.
+static void lights_evaluate_(const struct lights_timeline* timeline, const Ganymede__V2__LightConfig* light_config, struct lights_transition* dest)
+{
+    size_t channel = 0;
+
+    dest->levels = 0;
+    memset(dest->intensities, 0, sizeof(dest->intensities));
+
+    for (size_t lum_idx = 0; light_config != NULL && lum_idx < light_config->n_luminaires; lum_idx++) {
+        const Ganymede__V2__Luminaire* luminaire = light_config->luminaires[lum_idx];
+
+        if (!lights_is_valid_port_(luminaire)) {
+            continue;
+        }
+
+        if (luminaire->use_pwm && channel < timeline->pwm_count) {
+            dest->intensities[channel++] = lights_compute_intensity_(dest->second, luminaire, true);
+            continue;
         }
 
+        bool active = lights_compute_intensity_(dest->second, luminaire, false) > 0;
+
         if (luminaire->active_high == 0) {
             active = !active;
         }
 
-        gpio_set_level(luminaire->port, active);
-        ESP_LOGD(
-            TAG,
-            "%02d:%02d:%02d port=%" PRIu32 " signal=%s (%s)",
-            timeinfo->tm_hour,
-            timeinfo->tm_min,
-            timeinfo->tm_sec,
-            luminaire->port,
-            active ? "high" : "low",
-            luminaire->active_high ? "active_high" : "active_low"
-        );
+        if (active) {
+            dest->levels |= (1ULL << luminaire->port);
+        }
+    }
+}
+
+static void lights_add_boundary_(struct lights_timeline* timeline, uint32_t second)
+{
+    size_t i = 0;
+
+    while (i < timeline->count && timeline->transitions[i].second < second) {
+        i++;
+    }
+
+    if (i < timeline->count && timeline->transitions[i].second == second) {
+        return;
+    }
+
+    for (size_t j = timeline->count; j > i; j--) {
+        timeline->transitions[j] = timeline->transitions[j - 1];
     }
+
+    timeline->transitions[i].second = second;
+    timeline->count++;
 }
 
-static uint64_t lights_compute_pin_mask_(Ganymede__V2__LightConfig* config)
+// Local time minus UTC at `now`, following the TZ rules in effect (seconds)
+static int32_t lights_compute_utc_offset_(time_t now)
 {
-    uint64_t pin_mask = 0;
+    struct tm local;
+    struct tm utc;
+
+    localtime_r(&now, &local);
+    gmtime_r(&now, &utc);
+
+    int32_t days = local.tm_yday - utc.tm_yday;
+
+    if (local.tm_year != utc.tm_year) {
+        days = local.tm_year > utc.tm_year ? 1 : -1;
+    }
+
+    return days * LIGHT_CURVE_SECONDS_PER_DAY + (local.tm_hour - utc.tm_hour) * 3600 + (local.tm_min - utc.tm_min) * 60 + (local.tm_sec - utc.tm_sec);
+}
+
+// Seconds after `now` at which the UTC offset first differs from
+// `utc_offset`, such as when daylight saving time starts or ends, or 0 if it
+// doesn't change within `within` seconds
+static uint32_t lights_find_offset_change_(time_t now, int32_t utc_offset, uint32_t within)
+{
+    if (lights_compute_utc_offset_(now + within) == utc_offset) {
+        return 0;
+    }
 
-    if (config) {
-        for (size_t lum_idx = 0; lum_idx < config->n_luminaires; lum_idx++) {
-            pin_mask |= (1 << config->luminaires[lum_idx]->port);
+    // The offset is `utc_offset` at `low` and differs at `high`
+    uint32_t low = 0;
+    uint32_t high = within;
+
+    while (high - low > 1) {
+        uint32_t middle = low + (high - low) / 2;
+
+        if (lights_compute_utc_offset_(now + middle) == utc_offset) {
+            low = middle;
+        } else {
+            high = middle;
         }
     }
 
-    return pin_mask;
+    return high;
 }
 
-static esp_err_t lights_reconfigure_gpio_(Ganymede__V2__LightConfig* old_config, Ganymede__V2__LightConfig* new_config)
+// Room for every boundary of `light_config`, so that none is dropped
+static esp_err_t lights_reserve_(struct lights_timeline* timeline, const Ganymede__V2__LightConfig* light_config)
 {
-    uint64_t old_pins = lights_compute_pin_mask_(old_config);
-    uint64_t new_pins = lights_compute_pin_mask_(new_config);
-    uint64_t pins_to_disable = old_pins & (~new_pins);
+    size_t capacity = 1;
 
-    if (pins_to_disable != 0) {
-        gpio_config_t pin_config = {
-            .intr_type = GPIO_INTR_DISABLE,
-            .mode = GPIO_MODE_DISABLE,
-            .pin_bit_mask = old_pins & (~new_pins)
-        };
+    for (size_t lum_idx = 0; light_config != NULL && lum_idx < light_config->n_luminaires; lum_idx++) {
+        capacity += light_config->luminaires[lum_idx]->n_photo_period * LIGHT_CURVE_BREAKPOINTS_LEN;
+    }
+
+    if (capacity <= timeline->capacity) {
+        return ESP_OK;
+    }
+
+    struct lights_transition* transitions = realloc(timeline->transitions, capacity * sizeof(struct lights_transition));
+
+    if (transitions == NULL) {
+        ESP_LOGE(TAG, "Out of memory for %zu light transitions", capacity);
+        return ESP_ERR_NO_MEM;
+    }
+
+    timeline->transitions = transitions;
+    timeline->capacity = capacity;
+    return ESP_OK;
+}
+
+static bool lights_is_same_intensities_(const struct lights_transition* a, const struct lights_transition* b)
+{
+    return memcmp(a->intensities, b->intensities, sizeof(a->intensities)) == 0;
+}
+
+// Assign LEDC channels, then evaluate the schedules once per boundary, so that
+// the task only looks up levels and starts fades afterwards
+static esp_err_t lights_compile_(struct lights_timeline* timeline, const Ganymede__V2__LightConfig* light_config)
+{
+    RETURN_IF_FAIL(lights_reserve_(timeline, light_config), ESP_ERR_NO_MEM);
+
+    timeline->pins = 0;
+    timeline->pwm_count = 0;
+    timeline->utc_offset = lights_compute_utc_offset_(time(NULL));
+    timeline->count = 0;
+
+    lights_add_boundary_(timeline, 0);
+
+    for (size_t lum_idx = 0; light_config != NULL && lum_idx < light_config->n_luminaires; lum_idx++) {
+        const Ganymede__V2__Luminaire* luminaire = light_config->luminaires[lum_idx];
+        bool pwm = luminaire->use_pwm && timeline->pwm_count < LIGHTS_PWM_CHANNELS_LEN;
+
+        if (!lights_is_valid_port_(luminaire)) {
+            ESP_LOGE(TAG, "Port %" PRIu32 " is not a valid output, ignoring its luminaire", luminaire->port);
+            continue;
+        }
+
+        if (pwm) {
+            timeline->pwm_ports[timeline->pwm_count] = luminaire->port;
+            timeline->pwm_inverted[timeline->pwm_count] = luminaire->active_high == 0;
+            timeline->pwm_count++;
+        } else {
+            if (luminaire->use_pwm) {
+                ESP_LOGE(TAG, "Out of PWM channels, switching port %" PRIu32 " on and off", luminaire->port);
+            }
+
+            timeline->pins |= (1ULL << luminaire->port);
+        }
+
+        for (size_t pp_idx = 0; pp_idx < luminaire->n_photo_period; pp_idx++) {
+            struct light_curve_period period;
+            uint32_t breakpoints[LIGHT_CURVE_BREAKPOINTS_LEN];
+
+            lights_get_period_(luminaire->photo_period[pp_idx], pwm, &period);
+            size_t n_breakpoints = light_curve_breakpoints(&period, breakpoints);
+
+            for (size_t i = 0; i < n_breakpoints; i++) {
+                lights_add_boundary_(timeline, breakpoints[i]);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < timeline->count; i++) {
+        lights_evaluate_(timeline, light_config, &timeline->transitions[i]);
+    }
+
+    // A boundary is dropped when nothing changes across it, such as a photo
+    // period starting as another one stops: same levels as the transition
+    // before, and the same intensities on both sides, so that no fade
+    // stretches over it
+    size_t count = 1;
+
+    for (size_t i = 1; i < timeline->count; i++) {
+        const struct lights_transition* next = &timeline->transitions[(i + 1) % timeline->count];
+        const struct lights_transition* previous = &timeline->transitions[count - 1];
+        const struct lights_transition* transition = &timeline->transitions[i];
+
+        if (transition->levels != previous->levels || !lights_is_same_intensities_(transition, previous) || !lights_is_same_intensities_(transition, next)) {
+            timeline->transitions[count++] = timeline->transitions[i];
+        }
+    }
+
+    timeline->count = count;
+
+    ESP_LOGD(TAG, "compiled %zu transitions, %zu pwm channels, utc_offset=%" PRId32 "s", timeline->count, timeline->pwm_count, timeline->utc_offset);
+    return ESP_OK;
+}
 
-        ERROR_CHECK(gpio_config(&pin_config));
+// Seconds since local midnight
+static uint32_t lights_get_local_second_(const struct lights_timeline* timeline, const struct timeval* now)
+{
+    int64_t local = (int64_t) now->tv_sec + timeline->utc_offset;
+
+    return (uint32_t) (((local % LIGHT_CURVE_SECONDS_PER_DAY) + LIGHT_CURVE_SECONDS_PER_DAY) % LIGHT_CURVE_SECONDS_PER_DAY);
+}
+
+// Index of the transition in effect at `now_sec`
+static size_t lights_find_transition_(const struct lights_timeline* timeline, uint32_t now_sec)
+{
+    size_t i = 0;
+
+    while (i + 1 < timeline->count && timeline->transitions[i + 1].second <= now_sec) {
+        i++;
+    }
+
+    return i;
+}
+
+// Drive the switched pins whose level changed since the last call, all at once
+static void lights_apply_levels_(uint64_t pins, uint64_t levels, uint32_t now_sec)
+{
+    uint64_t changed = applied_ ? (levels ^ applied_levels_) & pins : pins;
+
+    if (changed != 0) {
+        output_bank_write(changed, levels);
+    }
+
+    for (uint32_t port = 0; changed != 0; port++, changed >>= 1) {
+        if (changed & 1) {
+            bool level = (levels >> port) & 1;
+
+            ESP_LOGD(TAG, "%02" PRIu32 ":%02" PRIu32 ":%02" PRIu32 " port=%" PRIu32 " signal=%s", now_sec / 3600, (now_sec / 60) % 60, now_sec % 60, port, level ? "high" : "low");
+        }
+    }
+
+    applied_levels_ = levels;
+    applied_ = true;
+}
+
+// Set each PWM channel to its duty at `now_ms` into the transition, and hand
+// the fade toward the next transition to the LEDC. Returns how long the fades
+// run on their own, when the fade engine cannot stretch one that far (ms).
+static uint32_t lights_apply_intensities_(const struct lights_timeline* timeline, size_t index, uint32_t now_ms)
+{
+    const struct lights_transition* transition = &timeline->transitions[index];
+    const struct lights_transition* next = &timeline->transitions[(index + 1) % timeline->count];
+    uint32_t start_ms = transition->second * 1000;
+    uint32_t end_ms = (index + 1 < timeline->count ? next->second : LIGHT_CURVE_SECONDS_PER_DAY) * 1000;
+    uint32_t wake_ms = UINT32_MAX;
+
+    for (size_t channel = 0; channel < timeline->pwm_count; channel++) {
+        uint32_t from = light_curve_duty(transition->intensities[channel]);
+        uint32_t to = light_curve_duty(next->intensities[channel]);
+        uint32_t duty = light_curve_duty_at(from, to, now_ms - start_ms, end_ms - start_ms);
+        uint32_t remaining_ms = end_ms - now_ms;
+
+        ledc_fade_stop(LEDC_LOW_SPEED_MODE, (ledc_channel_t) channel);
+        ledc_set_duty(LEDC_LOW_SPEED_MODE, (ledc_channel_t) channel, duty);
+        ledc_update_duty(LEDC_LOW_SPEED_MODE, (ledc_channel_t) channel);
+
+        if (duty == to) {
+            continue;
+        }
+
+        uint32_t fade_ms = light_curve_max_fade_time(duty, to, CONFIG_LIGHTS_PWM_FREQUENCY);
+
+        if (fade_ms >= remaining_ms) {
+            fade_ms = remaining_ms;
+        } else if (fade_ms < wake_ms) {
+            wake_ms = fade_ms;
+        }
+
+        uint32_t target = light_curve_duty_at(duty, to, fade_ms, remaining_ms);
+
+        ledc_set_fade_with_time(LEDC_LOW_SPEED_MODE, (ledc_channel_t) channel, target, (int) fade_ms);
+        ledc_fade_start(LEDC_LOW_SPEED_MODE, (ledc_channel_t) channel, LEDC_FADE_NO_WAIT);
+
+        ESP_LOGD(TAG, "port=%" PRIu32 " duty=%" PRIu32 " fading to %" PRIu32 " in %" PRIu32 "ms", timeline->pwm_ports[channel], duty, target, fade_ms);
     }
 
-    for (size_t lum_idx = 0; lum_idx < new_config->n_luminaires; lum_idx++) {
-        uint32_t port = new_config->luminaires[lum_idx]->port;
+    return wake_ms;
+}
+
+static uint64_t lights_get_pwm_pins_(const struct lights_timeline* timeline)
+{
+    uint64_t pins = 0;
+
+    for (size_t channel = 0; channel < timeline->pwm_count; channel++) {
+        pins |= (1ULL << timeline->pwm_ports[channel]);
+    }
 
-        if (((1 << port) & old_pins) == 0) {
-            gpio_config_t pin_config = {
-                .intr_type = GPIO_INTR_DISABLE,
-                .mode = GPIO_MODE_OUTPUT,
-                .pin_bit_mask = 1 << port,
-                .pull_up_en = GPIO_PULLUP_ENABLE,
-                .pull_down_en = GPIO_PULLDOWN_DISABLE
-            };
+    return pins;
+}
 
-            ERROR_CHECK(gpio_set_level(port, false));
-            ERROR_CHECK(gpio_config(&pin_config));
+// Whether `channel` drives the same pin the same way in both timelines
+static bool lights_is_same_channel_(const struct lights_timeline* old_timeline, const struct lights_timeline* new_timeline, size_t channel)
+{
+    return old_timeline != NULL
+        && channel < old_timeline->pwm_count
+        && channel < new_timeline->pwm_count
+        && old_timeline->pwm_ports[channel] == new_timeline->pwm_ports[channel]
+        && old_timeline->pwm_inverted[channel] == new_timeline->pwm_inverted[channel];
+}
 
-            ESP_LOGD(TAG, "enabled gpio port %" PRIu32, port);
+// Only pins and channels whose mode changed are reconfigured. Switched pins
+// are driven to `levels` all at once, so that luminaires kept across the
+// change don't go through a transient state.
+static esp_err_t lights_reconfigure_outputs_(const struct lights_timeline* old_timeline, const struct lights_timeline* new_timeline, uint64_t levels)
+{
+    uint64_t old_switched = old_timeline != NULL ? old_timeline->pins : 0;
+    uint64_t old_pins = old_timeline != NULL ? old_switched | lights_get_pwm_pins_(old_timeline) : 0;
+    uint64_t new_pins = new_timeline->pins | lights_get_pwm_pins_(new_timeline);
+
+    for (size_t channel = 0; old_timeline != NULL && channel < old_timeline->pwm_count; channel++) {
+        if (!lights_is_same_channel_(old_timeline, new_timeline, channel)) {
+            ledc_fade_stop(LEDC_LOW_SPEED_MODE, (ledc_channel_t) channel);
+            ERROR_CHECK(ledc_stop(LEDC_LOW_SPEED_MODE, (ledc_channel_t) channel, old_timeline->pwm_inverted[channel] ? 1 : 0));
         }
     }
 
+    ERROR_CHECK(output_bank_disable(old_pins & (~new_pins)));
+
+    // Pins becoming outputs, including those previously driven by the LEDC,
+    // latch their level here and come up at it once enabled
+    output_bank_write(new_timeline->pins, levels);
+    ERROR_CHECK(output_bank_enable(new_timeline->pins & (~old_switched)));
+
+    for (size_t channel = 0; channel < new_timeline->pwm_count; channel++) {
+        if (lights_is_same_channel_(old_timeline, new_timeline, channel)) {
+            continue;
+        }
+
+        ledc_channel_config_t channel_config = {
+            .gpio_num = (int) new_timeline->pwm_ports[channel],
+            .speed_mode = LEDC_LOW_SPEED_MODE,
+            .channel = (ledc_channel_t) channel,
+            .intr_type = LEDC_INTR_DISABLE,
+            .timer_sel = LEDC_TIMER_0,
+            .duty = 0,
+            .hpoint = 0,
+            .flags.output_invert = new_timeline->pwm_inverted[channel],
+        };
+
+        ERROR_CHECK(ledc_channel_config(&channel_config));
+
+        ESP_LOGD(TAG, "enabled pwm port %" PRIu32 " on channel %zu", new_timeline->pwm_ports[channel], channel);
+    }
+
+    return ESP_OK;
+}
+
+static const Ganymede__V2__LightConfig* lights_get_config_(const struct config_snapshot* snapshot)
+{
+    return snapshot != NULL ? snapshot->response->light_config : NULL;
+}
+
+// Compile the configuration into the spare timeline and switch the outputs
+// over to it. The outputs are left as they are if it doesn't compile.
+static esp_err_t lights_load_(const struct config_snapshot* snapshot)
+{
+    struct lights_timeline* timeline = timeline_ == &timelines_[0] ? &timelines_[1] : &timelines_[0];
+
+    if (lights_compile_(timeline, lights_get_config_(snapshot)) != ESP_OK) {
+        ESP_LOGE(TAG, "Light config rejected, keeping the previous one");
+        return ESP_FAIL;
+    }
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    uint64_t levels = timeline->transitions[lights_find_transition_(timeline, lights_get_local_second_(timeline, &now))].levels;
+    lights_reconfigure_outputs_(timeline_, timeline, levels);
+
+    timeline_ = timeline;
+    applied_levels_ = levels;
+    applied_ = true;
     return ESP_OK;
 }
 
+// Move to the current configuration snapshot if it changed, releasing the
+// previous one
+static struct config_snapshot* lights_update_snapshot_(struct config_snapshot* snapshot)
+{
+    struct config_snapshot* latest = config_snapshot_acquire();
+
+    if (latest == snapshot) {
+        if (latest != NULL) {
+            config_snapshot_release(latest);
+        }
+
+        return snapshot;
+    }
+
+    if (snapshot != NULL) {
+        config_snapshot_release(snapshot);
+    }
+
+    return latest;
+}
+
 static void lights_task_(void* args)
 {
     (void) args;
-    Ganymede__V2__LightConfig* light_config = NULL;
+    struct config_snapshot* snapshot = NULL;
 
-    while (incoming_light_config == NULL) {
-        ESP_LOGD(TAG, "incoming_light_config=%p, waiting 10s", incoming_light_config);
-        vTaskDelay(10000 / portTICK_PERIOD_MS);
-    }
+    while (true) {
+        snapshot = lights_update_snapshot_(snapshot);
 
-    light_config = incoming_light_config;
-    lights_reconfigure_gpio_(NULL, light_config);
+        if (snapshot == NULL) {
+            ESP_LOGD(TAG, "no configuration yet, waiting for one");
+        } else if (lights_load_(snapshot) == ESP_OK) {
+            break;
+        }
+
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
 
     while (true) {
-        time_t now = time(NULL);
+        struct timeval now;
+        gettimeofday(&now, NULL);
+
+        // Daylight saving time starts and ends without notice
+        timeline_->utc_offset = lights_compute_utc_offset_(now.tv_sec);
+
+        uint32_t now_sec = lights_get_local_second_(timeline_, &now);
+        uint32_t now_ms = now_sec * 1000 + (uint32_t) (now.tv_usec / 1000);
+        size_t index = lights_find_transition_(timeline_, now_sec);
+
+        lights_apply_levels_(timeline_->pins, timeline_->transitions[index].levels, now_sec);
+        uint32_t sleep_ms = lights_apply_intensities_(timeline_, index, now_ms);
 
-        struct tm timeinfo;
-        localtime_r(&now, &timeinfo);
-        lights_recompute_(&timeinfo, light_config);
+        // The timeline repeats daily, so the last transition of the day is
+        // followed by the first one, at midnight
+        uint32_t next_sec = index + 1 < timeline_->count ? timeline_->transitions[index + 1].second : LIGHT_CURVE_SECONDS_PER_DAY;
+        uint32_t next_ms = next_sec * 1000 - now_ms;
 
-        if (light_config != incoming_light_config) {
-            lights_reconfigure_gpio_(light_config, incoming_light_config);
-            protobuf_c_message_free_unpacked((ProtobufCMessage*) light_config, NULL);
-            light_config = incoming_light_config;
-            lights_recompute_(&timeinfo, light_config);
+        sleep_ms = next_ms < sleep_ms ? next_ms : sleep_ms;
+        sleep_ms = sleep_ms > LIGHTS_MAX_SLEEP * 1000 ? LIGHTS_MAX_SLEEP * 1000 : sleep_ms;
+
+        // Wake up as the UTC offset changes, which moves the transitions
+        uint32_t offset_change_sec = lights_find_offset_change_(now.tv_sec, timeline_->utc_offset, sleep_ms / 1000 + 1);
+
+        if (offset_change_sec > 0) {
+            uint32_t offset_change_ms = offset_change_sec * 1000 - (uint32_t) (now.tv_usec / 1000);
+            sleep_ms = offset_change_ms < sleep_ms ? offset_change_ms : sleep_ms;
         }
 
-        vTaskDelay(10000 / portTICK_PERIOD_MS);
+        // One tick late rather than early, to land past the transition
+        if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(sleep_ms) + 1) > 0) {
+            struct config_snapshot* latest = lights_update_snapshot_(snapshot);
+
+            // Otherwise the clock was set, leave the outputs be
+            if (latest != snapshot) {
+                snapshot = latest;
+                lights_load_(snapshot);
+            }
+        }
     }
 }
 
 esp_err_t app_lights_init(void)
 {
-    if (xTaskCreate(&lights_task_, "lights_task", LIGHTS_TASK_STACK_DEPTH, NULL, 3, NULL) != pdPASS) {
+    ledc_timer_config_t timer_config = {
+        .speed_mode = LEDC_LOW_SPEED_MODE,
+        .duty_resolution = (ledc_timer_bit_t) LIGHT_CURVE_DUTY_RESOLUTION,
+        .timer_num = LEDC_TIMER_0,
+        .freq_hz = CONFIG_LIGHTS_PWM_FREQUENCY,
+        .clk_cfg = LEDC_AUTO_CLK,
+    };
+
+    if (ledc_timer_config(&timer_config) != ESP_OK || ledc_fade_func_install(0) != ESP_OK) {
+        ESP_LOGE(TAG, "PWM setup failed");
+        return ESP_FAIL;
+    }
+
+    if (xTaskCreate(&lights_task_, "lights_task", LIGHTS_TASK_STACK_DEPTH, NULL, 3, &lights_task_handle_) != pdPASS) {
         ESP_LOGE(TAG, "Task creation failed");
         return ESP_FAIL;
     }
     return ESP_OK;
 }
 
-esp_err_t lights_update_config(const Ganymede__V2__LightConfig* config)
+esp_err_t lights_request_refresh(void)
 {
-    // FIXME: This is a hack to quickly deep-clone, but it is not performance efficient
-    size_t size = protobuf_c_message_pack((ProtobufCMessage*) config, buffer);
-    incoming_light_config = (Ganymede__V2__LightConfig*) protobuf_c_message_unpack(&ganymede__v2__light_config__descriptor, NULL, size, buffer);
+    if (lights_task_handle_ == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xTaskNotifyGive(lights_task_handle_);
     return ESP_OK;
 }
\ No newline at end of file
@@ -3,10 +3,12 @@
 
 #include <esp_err.h>
 
-#include <ganymede/v2/device.pb-c.h>
-
+// Drives the luminaires from the light_config of the current configuration
+// snapshot. The task sleeps until the next transition of the schedule.
 esp_err_t app_lights_init(void);
 
-esp_err_t lights_update_config(const Ganymede__V2__LightConfig* config);
+// Wake the lights task to pick up a new configuration snapshot, timezone or
+// wall clock
+esp_err_t lights_request_refresh(void);
 
 #endif // APP__LIGHTS__H_
\ No newline at end of file
@@ -1,3 +1,4 @@
+#include <stdio.h>
 #include <string.h>
 #include <time.h>
 
@@ -13,12 +14,19 @@
 #include <esp32s2/rom/uart.h>
 
 #include <api/error.h>
+#include <api/ganymede/v2/api.h>
+#include <app/bench.h>
+#include <app/config.h>
+#include <app/fleet.h>
 #include <app/identity.h>
 #include <app/lights.h>
 #include <app/measurements.h>
 #include <app/poll.h>
+#include <app/schedule.h>
 #include <net/auth/auth.h>
+#include <net/http2/arena.h>
 #include <net/http2/http2.h>
+#include <net/http2/tls_cache.h>
 #include <net/wifi/wifi.h>
 
 static int nvs_try_init_(void)
@@ -40,6 +48,54 @@ static void report_memory(void)
     uint32_t largest_block = heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT);
 
     printf("Memory: Available %" PRIu32 "/%" PRIu32 " (Largest %" PRIu32 ")\n", available, total, largest_block);
+
+    struct pb_arena_stats stats;
+
+    for (size_t i = 0; pb_arena_get_stats(i, &stats) == ESP_OK; i++) {
+        printf("Protobuf %s: Peak %u Unpacked %" PRIu32 " Allocations %" PRIu32 " Exhausted %" PRIu32 " Invalid %" PRIu32 "\n", stats.message, stats.peak, stats.unpacked, stats.allocations, stats.exhausted, stats.invalid);
+    }
+}
+
+static void report_tls(void)
+{
+    struct tls_cache_stats stats;
+
+    if (tls_cache_get_stats(&stats) == ESP_OK) {
+        printf("TLS: Full %" PRIu32 " Resumed %" PRIu32 " Fallback %" PRIu32 "\n", stats.full_handshakes, stats.resumed_handshakes, stats.resumption_fallbacks);
+    }
+}
+
+static void report_http2(void)
+{
+    struct http2_stats stats;
+
+    if (http2_get_stats(&stats) == ESP_OK) {
+        printf("HTTP2: RTT %" PRId64 "us (Smoothed %" PRId64 "us) Pings %" PRIu32 " Lost %" PRIu32 " GOAWAY %" PRIu32 " Predials %" PRIu32 "\n", stats.ping_rtt, stats.ping_srtt, stats.pings_sent, stats.pings_lost, stats.goaways, stats.predials);
+        printf("HTTP2 Timing: Handshake %" PRId64 "us First byte %" PRId64 "us Sent %" PRIu64 " Received %" PRIu64 "\n", stats.handshake_time, stats.first_byte_time, stats.bytes_sent, stats.bytes_received);
+    }
+
+    struct arena_stats arena;
+
+    if (arena_get_stats(&arena) == ESP_OK) {
+        printf("HTTP2 Memory: Used %u/%u (Peak %u, Carved %u) Allocations %" PRIu32 " Frees %" PRIu32 " Failed %" PRIu32 "\n", arena.used, arena.capacity, arena.high_water, arena.carved, arena.allocations, arena.frees, arena.failed_allocations);
+    }
+}
+
+static void report_measurements(void)
+{
+    struct app_measurements_stats stats;
+
+    if (app_measurements_get_stats(&stats) == ESP_OK) {
+        printf("Measurements: Acquired %" PRIu32 " Read failures %" PRIu32 " Dropped %" PRIu32 " (Queue peak %" PRIu32 ", Log sectors %" PRIu32 ")\n", stats.acquired, stats.read_failures, stats.dropped, stats.queue_high_water, stats.log_dropped);
+        printf("Measurements Timing: Jitter %" PRId64 "us (Max %" PRId64 "us)\n", stats.jitter, stats.max_jitter);
+    }
+}
+
+// The clock jumps when first set, and lights sleep until a transition
+static void main_on_time_sync_(struct timeval* tv)
+{
+    (void) tv;
+    lights_request_refresh();
 }
 
 static void main_run_console_loop_(void)
@@ -63,6 +119,18 @@ static void main_run_console_loop_(void)
                     report_memory();
                 } else if (strcmp(linebuf, "poll") == 0) {
                     poll_request_refresh();
+                } else if (strcmp(linebuf, "tls") == 0) {
+                    report_tls();
+                } else if (strcmp(linebuf, "http2") == 0) {
+                    report_http2();
+                } else if (strcmp(linebuf, "measurements") == 0) {
+                    report_measurements();
+                } else if (strcmp(linebuf, "bench") == 0) {
+                    app_bench_run();
+                } else if (strncmp(linebuf, "fleet", 5) == 0) {
+                    unsigned int devices = 500;
+                    sscanf(linebuf, "fleet %u", &devices);
+                    app_fleet_simulate(devices);
                 }
             } else {
                 linebuf[cursor++] = (char) c;
@@ -90,7 +158,10 @@ void app_main(void)
     ERROR_CHECK(wifi_init());
     ERROR_CHECK(http2_init());
     ERROR_CHECK(auth_init());
+    ERROR_CHECK(ganymede_api_v2_init());
     ERROR_CHECK(app_identity_init());
+    ERROR_CHECK(app_schedule_init());
+    ERROR_CHECK(app_config_init());
     ERROR_CHECK(app_poll_init());
     ERROR_CHECK(app_lights_init());
     ERROR_CHECK(app_measurements_init());
@@ -98,6 +169,7 @@ void app_main(void)
     // SNTP
     {
         esp_sntp_setoperatingmode(SNTP_OPMODE_POLL);
+        sntp_set_time_sync_notification_cb(main_on_time_sync_);
         esp_sntp_setservername(0, "pool.ntp.org");
         esp_sntp_init();
     }
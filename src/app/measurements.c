@@ -1,34 +1,100 @@
 #include "measurements.h"
 
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 #include <time.h>
 
 #include <esp_log.h>
+#include <esp_timer.h>
 
 #include <driver/i2c_master.h>
 
 #include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 
 #include <api/ganymede/v2/api.h>
+#include <app/config.h>
 #include <app/identity.h>
+#include <app/schedule.h>
 #include <drivers/am2320.h>
-#include <ganymede/v2/measurements.pb-c.h>
 #include <net/auth/auth.h>
 #include <net/http2/http2.h>
+#include <storage/ringlog.h>
+
+// A full bucket goes out in a single PushMeasurements request
+#if CONFIG_MEASUREMENTS_PUSH_MAX_LEN < CONFIG_MEASUREMENTS_BUCKET_SIZE
+#error "MEASUREMENTS_PUSH_MAX_LEN must be at least MEASUREMENTS_BUCKET_SIZE"
+#endif
 
 enum {
-    MEASUREMENTS_TASK_STACK_DEPTH = 6 * 1024,
+    MEASUREMENTS_ACQUISITION_TASK_STACK_DEPTH = 3 * 1024,
+    MEASUREMENTS_UPLOAD_TASK_STACK_DEPTH = 6 * 1024,
+
+    // Log epoch, position of the batch's first sample and batch length in
+    // hex, NULL-terminated
+    MEASUREMENTS_BATCH_ID_LEN = 33,
+
+    // Longest wait for a fresh auth token before pushing with the stored one
+    // (milliseconds)
+    MEASUREMENTS_TOKEN_TIMEOUT = 30 * 1000,
+
+    // Leads every record in the log
+    MEASUREMENTS_RECORD_VERSION = 2,
+
+    // Records written before they were versioned: the same fields, padded by
+    // the compiler to the timestamp's alignment
+    MEASUREMENTS_LEGACY_RECORD_LEN = 16,
+};
+
+// Samples as stored in the log, in the AM2320's native units. Packed, so the
+// layout is the same whatever the target's alignment rules.
+struct measurements_record {
+    uint8_t version;
+    int64_t timestamp;
+    int16_t humidity;
+    int16_t temperature;
+} __attribute__((packed));
+
+// Records passed over while reading the log
+struct measurements_skipped {
+    size_t legacy;
+    size_t malformed;
 };
 
 static const char* TAG = "measurements";
 
 static time_t timestamps_[CONFIG_MEASUREMENTS_BUCKET_SIZE] = { 0 };
-static float humidities_[CONFIG_MEASUREMENTS_BUCKET_SIZE] = { 0 };
-static float temperatures_[CONFIG_MEASUREMENTS_BUCKET_SIZE] = { 0 };
+static int16_t humidities_[CONFIG_MEASUREMENTS_BUCKET_SIZE] = { 0 };
+static int16_t temperatures_[CONFIG_MEASUREMENTS_BUCKET_SIZE] = { 0 };
 
 static i2c_master_bus_handle_t i2c_bus_;
 static am2320_handle_t am2320_handle_;
+static ringlog_t* samples_;
+
+// Samples on their way from the acquisition task to the upload task. Only the
+// acquisition task moves `queue_head_` and only the upload task moves
+// `queue_tail_`, so neither waits on the other.
+static struct measurements_record queue_[CONFIG_MEASUREMENTS_QUEUE_LEN];
+static atomic_uint_fast32_t queue_head_ = 0;
+static atomic_uint_fast32_t queue_tail_ = 0;
+
+static TaskHandle_t upload_task_;
+
+// Configuration generation whose claim to support PushAtmosphereBatch the
+// server contradicted. Only used by the upload task.
+static uint32_t batch_rejected_generation_ = 0;
+
+static struct app_measurements_stats stats_ = { 0 };
+static portMUX_TYPE stats_lock_ = portMUX_INITIALIZER_UNLOCKED;
+
+// Samples in the first bucket, and delay before the first acquisition interval
+// starts (ticks)
+static size_t first_flush_at_ = CONFIG_MEASUREMENTS_BUCKET_SIZE;
+static TickType_t first_delay_ = 0;
 
 static i2c_master_bus_handle_t measurements_init_i2c_(i2c_port_num_t port, gpio_num_t sda_pin, gpio_num_t scl_pin)
 {
@@ -50,52 +116,68 @@ static i2c_master_bus_handle_t measurements_init_i2c_(i2c_port_num_t port, gpio_
     return bus;
 }
 
-static esp_err_t measurements_build_atmosphere_measurement_(Ganymede__V2__Measurement** dest, char* device_id, time_t observed_on, float relative_humidity, float temperature)
+// Acquisition task side. Returns false if the queue is full.
+static bool measurements_enqueue_(const struct measurements_record* record)
 {
-    esp_err_t rc = ESP_OK;
+    uint32_t head = atomic_load_explicit(&queue_head_, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&queue_tail_, memory_order_acquire);
 
-    *dest = (Ganymede__V2__Measurement*) malloc(sizeof(Ganymede__V2__Measurement));
-    if (*dest == NULL) {
-        ESP_LOGE(TAG, "failed to allocate memory for measurement");
-        rc = ESP_FAIL;
-        goto exit;
+    if (head - tail == CONFIG_MEASUREMENTS_QUEUE_LEN) {
+        return false;
     }
-    ganymede__v2__measurement__init(*dest);
 
-    (*dest)->timestamp = (Google__Protobuf__Timestamp*) malloc(sizeof(Google__Protobuf__Timestamp));
-    if ((*dest)->timestamp == NULL) {
-        ESP_LOGE(TAG, "failed to allocate memory for timestamp");
-        rc = ESP_FAIL;
-        goto cleanup_measurement;
+    queue_[head % CONFIG_MEASUREMENTS_QUEUE_LEN] = *record;
+    atomic_store_explicit(&queue_head_, head + 1, memory_order_release);
+
+    portENTER_CRITICAL(&stats_lock_);
+    if (head + 1 - tail > stats_.queue_high_water) {
+        stats_.queue_high_water = head + 1 - tail;
     }
-    google__protobuf__timestamp__init((*dest)->timestamp);
+    portEXIT_CRITICAL(&stats_lock_);
 
-    (*dest)->atmosphere = (Ganymede__V2__AtmosphericMeasurements*) malloc(sizeof(Ganymede__V2__AtmosphericMeasurements));
-    if ((*dest)->atmosphere == NULL) {
-        ESP_LOGE(TAG, "failed to allocate memory for atmosphere measurement");
-        rc = ESP_FAIL;
-        goto cleanup_timestamp;
+    return true;
+}
+
+// Upload task side. Returns false if the queue is empty.
+static bool measurements_dequeue_(struct measurements_record* dest)
+{
+    uint32_t tail = atomic_load_explicit(&queue_tail_, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&queue_head_, memory_order_acquire);
+
+    if (head == tail) {
+        return false;
     }
-    ganymede__v2__atmospheric_measurements__init((*dest)->atmosphere);
 
-    (*dest)->device_id = device_id;
-    (*dest)->timestamp->seconds = observed_on;
-    (*dest)->atmosphere->relative_humidity = relative_humidity;
-    (*dest)->atmosphere->temperature = temperature;
+    *dest = queue_[tail % CONFIG_MEASUREMENTS_QUEUE_LEN];
+    atomic_store_explicit(&queue_tail_, tail + 1, memory_order_release);
 
-    goto exit; // Don't free! // FIXME: Very weird function flow, refactor this
+    return true;
+}
 
-cleanup_timestamp:
-    free((*dest)->timestamp);
+// Move queued samples to the log. Returns how many were stored.
+static size_t measurements_store_queued_(void)
+{
+    struct measurements_record record;
+    size_t stored = 0;
 
-cleanup_measurement:
-    free(*dest);
+    while (measurements_dequeue_(&record)) {
+        if (ringlog_append(samples_, &record, sizeof(record)) == ESP_OK) {
+            stored++;
+        }
+    }
 
-exit:
-    return rc;
+    return stored;
 }
 
-static esp_err_t measurements_push_(time_t timestamps[], float humidities[], float temperatures[], ssize_t len)
+static void measurements_batch_id_(char dest[MEASUREMENTS_BATCH_ID_LEN], uint32_t epoch, const struct ringlog_cursor* start, size_t len)
+{
+    snprintf(dest, MEASUREMENTS_BATCH_ID_LEN, "%08" PRIx32 "%08" PRIx32 "%08" PRIx32 "%08" PRIx32, epoch, start->sequence, start->offset, (uint32_t) len);
+}
+
+// Measurements are encoded straight from the bucket as they are sent, without
+// touching the heap. The columnar PushAtmosphereBatch is used when the server
+// supports it.
+static esp_err_t measurements_push_(time_t timestamps[], int16_t humidities[], int16_t temperatures[], size_t len, char* batch_id)
 {
     char device_id[DEVICE_ID_LEN] = { 0 };
 
@@ -104,59 +186,332 @@ static esp_err_t measurements_push_(time_t timestamps[], float humidities[], flo
         return ESP_FAIL;
     }
 
-    esp_err_t rc = ESP_OK;
-    ssize_t allocated = 0;
+    struct ganymede_api_v2_atmosphere_samples samples = {
+        .device_id = device_id,
+        .timestamps = timestamps,
+        .humidities = humidities,
+        .temperatures = temperatures,
+        .count = len,
+    };
 
-    Ganymede__V2__PushMeasurementsRequest request;
-    ganymede__v2__push_measurements_request__init(&request);
+    grpc_status_t rc = GRPC_STATUS_UNIMPLEMENTED;
+    struct config_snapshot* config = config_snapshot_acquire();
 
-    Ganymede__V2__Measurement** measurements = (Ganymede__V2__Measurement**) malloc(len * sizeof(Ganymede__V2__Measurement*));
+    if (config != NULL && config->response->atmosphere_batch_supported && config->generation != batch_rejected_generation_) {
+        rc = ganymede_api_v2_push_atmosphere_batch(&samples, batch_id);
 
-    for (ssize_t i = 0; i < len; i++, allocated++) {
-        if (measurements_build_atmosphere_measurement_(&measurements[i], device_id, timestamps[i], humidities[i], temperatures[i]) != ESP_OK) {
-            goto cleanup;
+        // Server rolled back since it last advertised it
+        if (rc == GRPC_STATUS_UNIMPLEMENTED) {
+            ESP_LOGW(TAG, "PushAtmosphereBatch not implemented, falling back to PushMeasurements");
+            batch_rejected_generation_ = config->generation;
         }
     }
 
-    request.measurements = measurements;
-    request.n_measurements = len;
+    if (config != NULL) {
+        config_snapshot_release(config);
+    }
 
-    if (ganymede_api_v2_push_measurements(&request) != GRPC_STATUS_OK) {
+    if (rc == GRPC_STATUS_UNIMPLEMENTED) {
+        rc = ganymede_api_v2_push_atmosphere(&samples, batch_id);
+    }
+
+    if (rc != GRPC_STATUS_OK) {
         ESP_LOGE(TAG, "failed to push measurements");
-        rc = ESP_FAIL;
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+// Next sample at `cursor` in the current format. Returns ESP_ERR_NOT_FOUND at
+// the end of the log. Legacy records are rejected rather than guessed at, as
+// their layout depends on the compiler that wrote them. `skipped` counts the
+// records passed over, and may be NULL.
+static esp_err_t measurements_read_(struct ringlog_cursor* cursor, struct measurements_record* dest, struct measurements_skipped* skipped)
+{
+    struct measurements_skipped ignored;
+
+    if (skipped == NULL) {
+        skipped = &ignored;
+    }
+
+    while (true) {
+        uint8_t buffer[MEASUREMENTS_LEGACY_RECORD_LEN];
+        size_t length = sizeof(buffer);
+        esp_err_t rc = ringlog_read(samples_, cursor, buffer, &length);
+
+        if (rc == ESP_ERR_INVALID_SIZE) {
+            skipped->malformed++;
+            continue;
+        }
+
+        if (rc != ESP_OK) {
+            return rc;
+        }
+
+        if (length == sizeof(*dest) && buffer[0] == MEASUREMENTS_RECORD_VERSION) {
+            memcpy(dest, buffer, sizeof(*dest));
+            return ESP_OK;
+        }
+
+        if (length == MEASUREMENTS_LEGACY_RECORD_LEN) {
+            skipped->legacy++;
+        } else {
+            skipped->malformed++;
+        }
+    }
+}
+
+// Reads a push's samples back from the log, from its first one
+struct measurements_log_reader {
+    struct ringlog_cursor start;
+    struct ringlog_cursor cursor;
+};
+
+static esp_err_t measurements_log_rewind_(void* arg)
+{
+    struct measurements_log_reader* reader = (struct measurements_log_reader*) arg;
+
+    reader->cursor = reader->start;
+    return ESP_OK;
+}
+
+static esp_err_t measurements_log_read_(void* arg, time_t* timestamp, int16_t* humidity, int16_t* temperature)
+{
+    struct measurements_log_reader* reader = (struct measurements_log_reader*) arg;
+    struct measurements_record record;
+    esp_err_t rc = measurements_read_(&reader->cursor, &record, NULL);
+
+    if (rc != ESP_OK) {
+        return rc;
+    }
+
+    *timestamp = (time_t) record.timestamp;
+    *humidity = record.humidity;
+    *temperature = record.temperature;
+    return ESP_OK;
+}
+
+// A backlog larger than a bucket goes over a single PushMeasurements request,
+// read from the log as it is sent
+static esp_err_t measurements_push_log_(const struct ringlog_cursor* start, size_t len, char* batch_id)
+{
+    char device_id[DEVICE_ID_LEN] = { 0 };
+
+    if (identity_get_device_id(device_id) != ESP_OK) {
+        ESP_LOGE(TAG, "failed to retrieve device_id");
+        return ESP_FAIL;
     }
 
-cleanup:
-    for (ssize_t i = allocated - 1; i >= 0; i--) {
-        free(measurements[i]->atmosphere);
-        free(measurements[i]->timestamp);
-        free(measurements[i]);
+    struct measurements_log_reader log_reader = {
+        .start = *start,
+        .cursor = *start,
+    };
+
+    struct ganymede_api_v2_atmosphere_reader reader = {
+        .device_id = device_id,
+        .count = len,
+        .rewind = measurements_log_rewind_,
+        .read = measurements_log_read_,
+        .arg = &log_reader,
+    };
+
+    if (ganymede_api_v2_push_atmosphere_stream(&reader, batch_id) != GRPC_STATUS_OK) {
+        ESP_LOGE(TAG, "failed to push %zu measurements", len);
+        return ESP_FAIL;
     }
-    free(measurements);
 
-    return rc;
+    return ESP_OK;
 }
 
-static void measurements_task_(void* args)
+// Push the samples not acknowledged yet. A bucket's worth is sent from memory,
+// the columnar way when the server supports it. A backlog built up while
+// offline is streamed from the log over one request per
+// CONFIG_MEASUREMENTS_PUSH_MAX_LEN samples, so it drains in a few round trips
+// without holding more than a sample in memory. The log's read cursor only
+// moves once the server acknowledged a push.
+static esp_err_t measurements_drain_(size_t* retry_len)
 {
-    size_t cursor = 0;
+    struct ringlog_stats stats;
+    struct ringlog_cursor cursor;
+
+    if (ringlog_get_stats(samples_, &stats) != ESP_OK || ringlog_get_cursor(samples_, &cursor) != ESP_OK) {
+        return ESP_FAIL;
+    }
+
+    if (auth_wait_for_token(pdMS_TO_TICKS(MEASUREMENTS_TOKEN_TIMEOUT)) != ESP_OK) {
+        ESP_LOGW(TAG, "no auth token obtained since boot, pushing with the stored one");
+    }
 
     while (true) {
-        vTaskDelay((CONFIG_MEASUREMENTS_ACQUISITION_INTERVAL * 1000) / portTICK_PERIOD_MS);
+        // Keep the queue flowing while a backlog drains
+        measurements_store_queued_();
+
+        struct ringlog_cursor start = cursor;
+        size_t max = *retry_len > 0 ? *retry_len : CONFIG_MEASUREMENTS_PUSH_MAX_LEN;
+        size_t len = 0;
+        struct measurements_skipped skipped = { 0 };
+
+        while (len < max) {
+            struct measurements_record record;
+            esp_err_t rc = measurements_read_(&cursor, &record, &skipped);
+
+            if (rc == ESP_ERR_NOT_FOUND) {
+                break;
+            }
+
+            if (rc != ESP_OK) {
+                ESP_LOGE(TAG, "failed to read samples: %s", esp_err_to_name(rc));
+                return rc;
+            }
+
+            // Kept in case the push fits a bucket
+            if (len < CONFIG_MEASUREMENTS_BUCKET_SIZE) {
+                timestamps_[len] = (time_t) record.timestamp;
+                humidities_[len] = record.humidity;
+                temperatures_[len] = record.temperature;
+            }
+
+            len++;
+        }
 
-        if (am2320_readf(am2320_handle_, &humidities_[cursor], &temperatures_[cursor]) == ESP_OK) {
-            ESP_LOGI(TAG, "%0.2frh %0.2f°C", humidities_[cursor], temperatures_[cursor]);
-            timestamps_[cursor] = time(NULL);
-            cursor++;
+        if (skipped.legacy > 0) {
+            ESP_LOGW(TAG, "rejecting %zu samples in the unversioned format", skipped.legacy);
         }
 
-        if (cursor >= CONFIG_MEASUREMENTS_BUCKET_SIZE) {
-            measurements_push_(timestamps_, humidities_, temperatures_, CONFIG_MEASUREMENTS_BUCKET_SIZE);
-            cursor = 0;
+        if (skipped.malformed > 0) {
+            ESP_LOGW(TAG, "skipping %zu malformed samples", skipped.malformed);
+        }
+
+        if (len == 0) {
+            return ESP_OK;
+        }
+
+        char batch_id[MEASUREMENTS_BATCH_ID_LEN] = { 0 };
+        measurements_batch_id_(batch_id, stats.epoch, &start, len);
+
+        // A push that failed is sent again as is, so the server can
+        // deduplicate it by batch_id
+        esp_err_t rc = len <= CONFIG_MEASUREMENTS_BUCKET_SIZE
+            ? measurements_push_(timestamps_, humidities_, temperatures_, len, batch_id)
+            : measurements_push_log_(&start, len, batch_id);
+
+        if (rc != ESP_OK) {
+            *retry_len = len;
+            return ESP_FAIL;
+        }
+
+        *retry_len = 0;
+
+        if (ringlog_commit(samples_, &cursor) != ESP_OK) {
+            return ESP_FAIL;
+        }
+
+        if (len < max) {
+            return ESP_OK;
         }
     }
 }
 
+// Samples on a fixed period, whatever each read takes, and hands samples over
+// to the upload task without waiting on it. Timestamps stay evenly spaced
+// while uploads stall.
+static void measurements_acquisition_task_(void* args)
+{
+    (void) args;
+
+    const TickType_t period = (CONFIG_MEASUREMENTS_ACQUISITION_INTERVAL * 1000) / portTICK_PERIOD_MS;
+    const int64_t period_us = (int64_t) period * portTICK_PERIOD_MS * 1000LL;
+
+    vTaskDelay(first_delay_);
+
+    TickType_t last_wake = xTaskGetTickCount();
+    int64_t scheduled = esp_timer_get_time();
+
+    while (true) {
+        vTaskDelayUntil(&last_wake, period);
+        scheduled += period_us;
+
+        int64_t jitter = esp_timer_get_time() - scheduled;
+        int16_t humidity = 0;
+        int16_t temperature = 0;
+        bool read = am2320_read(am2320_handle_, &humidity, &temperature) == ESP_OK;
+        bool queued = false;
+
+        if (read) {
+            ESP_LOGI(TAG, "%0.2frh %0.2f°C", humidity / 1000.0F, temperature / 10.0F);
+
+            struct measurements_record record = {
+                .version = MEASUREMENTS_RECORD_VERSION,
+                .timestamp = (int64_t) time(NULL),
+                .humidity = humidity,
+                .temperature = temperature,
+            };
+
+            queued = measurements_enqueue_(&record);
+        }
+
+        portENTER_CRITICAL(&stats_lock_);
+        stats_.jitter = jitter;
+        if (jitter > stats_.max_jitter) {
+            stats_.max_jitter = jitter;
+        }
+
+        if (!read) {
+            stats_.read_failures++;
+        } else if (!queued) {
+            stats_.dropped++;
+        } else {
+            stats_.acquired++;
+        }
+        portEXIT_CRITICAL(&stats_lock_);
+
+        if (queued) {
+            xTaskNotifyGive(upload_task_);
+        } else if (read) {
+            ESP_LOGW(TAG, "upload queue full, dropping sample");
+        }
+    }
+}
+
+// Stores samples in the log as they come in, and pushes them in buckets
+static void measurements_upload_task_(void* args)
+{
+    (void) args;
+
+    size_t acquired = 0;
+    size_t flush_at = first_flush_at_;
+    size_t retry_len = 0;
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        acquired += measurements_store_queued_();
+
+        // The first bucket may be cut short to offset this device's pushes
+        // from the rest of the fleet. Samples stay in the log until they go
+        // through, and are tried again with the next sample otherwise.
+        if (acquired >= flush_at && measurements_drain_(&retry_len) == ESP_OK) {
+            acquired = 0;
+            flush_at = CONFIG_MEASUREMENTS_BUCKET_SIZE;
+        }
+    }
+}
+
+esp_err_t app_measurements_get_stats(struct app_measurements_stats* dest)
+{
+    portENTER_CRITICAL(&stats_lock_);
+    *dest = stats_;
+    portEXIT_CRITICAL(&stats_lock_);
+
+    struct ringlog_stats log_stats;
+
+    if (samples_ != NULL && ringlog_get_stats(samples_, &log_stats) == ESP_OK) {
+        dest->log_dropped = log_stats.dropped;
+    }
+
+    return ESP_OK;
+}
+
 esp_err_t app_measurements_init()
 {
     i2c_bus_ = measurements_init_i2c_(1, 5, 6);
@@ -173,7 +528,32 @@ esp_err_t app_measurements_init()
         return ESP_FAIL;
     }
 
-    if (xTaskCreate(&measurements_task_, "measurements_task", MEASUREMENTS_TASK_STACK_DEPTH, NULL, 4, NULL) != pdPASS) {
+    samples_ = ringlog_open("measurements", "measurements");
+
+    if (samples_ == NULL) {
+        ESP_LOGE(TAG, "failed to open measurements log");
+        return ESP_FAIL;
+    }
+
+    uint8_t mac[DEVICE_MAC_BYTES_LEN] = { 0 };
+    struct app_schedule_timing timing;
+
+    if (identity_get_device_mac_bytes(mac) != ESP_OK || app_schedule_get(mac, APP_SCHEDULE_MEASUREMENTS_PUSH, &timing) != ESP_OK) {
+        ESP_LOGE(TAG, "failed to compute push schedule");
+        return ESP_FAIL;
+    }
+
+    int64_t interval = (int64_t) CONFIG_MEASUREMENTS_ACQUISITION_INTERVAL * 1000LL * 1000LL;
+    first_flush_at_ = (size_t) (timing.first / interval);
+    first_delay_ = (TickType_t) ((timing.first % interval) / 1000 / portTICK_PERIOD_MS);
+
+    if (xTaskCreate(&measurements_upload_task_, "measurements_upload", MEASUREMENTS_UPLOAD_TASK_STACK_DEPTH, NULL, 4, &upload_task_) != pdPASS) {
+        ESP_LOGE(TAG, "Task creation failed");
+        return ESP_FAIL;
+    }
+
+    // Ahead of the upload task, so a stalled upload never delays a sample
+    if (xTaskCreate(&measurements_acquisition_task_, "measurements_acquisition", MEASUREMENTS_ACQUISITION_TASK_STACK_DEPTH, NULL, 5, NULL) != pdPASS) {
         ESP_LOGE(TAG, "Task creation failed");
         return ESP_FAIL;
     }
@@ -1,8 +1,33 @@
 #ifndef APP_MEASUREMENTS_H_
 #define APP_MEASUREMENTS_H_
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include <esp_err.h>
 
+struct app_measurements_stats {
+    // Samples handed over to the upload task, and acquisitions that failed to
+    // read the sensor
+    uint32_t acquired;
+    uint32_t read_failures;
+
+    // Samples lost because the upload task fell CONFIG_MEASUREMENTS_QUEUE_LEN
+    // samples behind, and the most it has been behind
+    uint32_t dropped;
+    uint32_t queue_high_water;
+
+    // How late the last acquisition woke up compared to its schedule, and the
+    // worst so far (microseconds)
+    int64_t jitter;
+    int64_t max_jitter;
+
+    // Log sectors erased before their samples were uploaded
+    uint32_t log_dropped;
+};
+
 esp_err_t app_measurements_init();
 
+esp_err_t app_measurements_get_stats(struct app_measurements_stats* dest);
+
 #endif // APP_MEASUREMENTS_H_
\ No newline at end of file
@@ -18,9 +18,12 @@
 
 #include <api/error.h>
 #include <api/ganymede/v2/api.h>
+#include <app/config.h>
 #include <app/identity.h>
 #include <app/lights.h>
+#include <app/schedule.h>
 #include <ganymede/v2/device.pb-c.h>
+#include <net/auth/auth.h>
 
 enum {
     POLLER_TASK_STACK_DEPTH = 1024 * 4,
@@ -30,6 +33,10 @@ enum {
 
     // EventBiT: a Poll was requested (manually, or the timer elapsed)
     POLL_REFRESH_REQUEST_BIT = BIT1,
+
+    // Longest wait for a fresh auth token before polling with the stored one
+    // (milliseconds)
+    POLL_TOKEN_TIMEOUT = 30 * 1000,
 };
 
 static const char* TAG = "poll";
@@ -38,6 +45,8 @@ static uint8_t serialization_buffer_[CONFIG_GANYMEDE_POLL_RESPONSE_MAX_SIZE] = {
 
 static EventGroupHandle_t poll_event_group_ = NULL;
 static esp_timer_handle_t poll_refresh_timer_ = NULL;
+static int64_t poll_period_ = 0;
+static uint8_t mac_[DEVICE_MAC_BYTES_LEN] = { 0 };
 
 static void poll_event_handler_(void* arg, esp_event_base_t event_source, int32_t event_id, void* data)
 {
@@ -54,10 +63,13 @@ static void poll_event_handler_(void* arg, esp_event_base_t event_source, int32_
     }
 }
 
+// The timer is one-shot and re-armed here, so the first poll can come at a
+// different delay than the following ones
 static void poll_timer_callback_(void* args)
 {
     (void) args;
     xEventGroupSetBits(poll_event_group_, POLL_REFRESH_REQUEST_BIT);
+    esp_timer_start_once(poll_refresh_timer_, poll_period_);
 }
 
 static esp_err_t poll_set_timezone_(const int timezone_offset_minutes)
@@ -78,7 +90,7 @@ static esp_err_t poll_set_timezone_(const int timezone_offset_minutes)
     return ESP_OK;
 }
 
-static esp_err_t poll_read_response_from_storage_(Ganymede__V2__PollResponse** dest)
+static esp_err_t poll_read_response_from_storage_(struct pb_arena* arena, Ganymede__V2__PollResponse** dest)
 {
     esp_err_t rc = ESP_OK;
 
@@ -103,7 +115,7 @@ static esp_err_t poll_read_response_from_storage_(Ganymede__V2__PollResponse** d
         goto exit;
     }
 
-    *dest = (Ganymede__V2__PollResponse*) protobuf_c_message_unpack(&ganymede__v2__poll_response__descriptor, NULL, length, serialization_buffer_);
+    *dest = (Ganymede__V2__PollResponse*) pb_arena_unpack(arena, &ganymede__v2__poll_response__descriptor, length, serialization_buffer_);
 
     if (*dest == NULL) {
         ESP_LOGE(TAG, "Failed to unpack poll_response");
@@ -126,6 +138,13 @@ static esp_err_t poll_write_response_to_storage_(Ganymede__V2__PollResponse* res
         return ESP_FAIL;
     }
 
+    // Responses longer than this buffer are rejected as they come in, but one
+    // may still pack longer than it was sent.
+    if (protobuf_c_message_get_packed_size((ProtobufCMessage*) response) > sizeof(serialization_buffer_)) {
+        ESP_LOGW(TAG, "Poll response too large to persist");
+        return ESP_FAIL;
+    }
+
     length = protobuf_c_message_pack((ProtobufCMessage*) response, serialization_buffer_);
 
     if (length == 0) {
@@ -163,13 +182,18 @@ static void poll_handle_response_(Ganymede__V2__PollResponse* response)
 
     identity_set_device_id(response->device_uid);
     poll_set_timezone_((int) response->timezone_offset_minutes);
-    lights_update_config(response->light_config);
+
+    if (response->poll_spread != NULL) {
+        app_schedule_set_spread((response->poll_spread->seconds * 1000 * 1000) + (response->poll_spread->nanos / 1000));
+    }
 
     int64_t poll_period_us = (response->poll_period->seconds * 1000 * 1000) + (response->poll_period->nanos / 1000);
 
+    // Takes effect when the timer is next armed, so a response read back
+    // from storage at boot doesn't push back the first poll
     if (poll_period_us >= 600LL * 1000LL * 1000LL) {
-        esp_timer_restart(poll_refresh_timer_, poll_period_us);
-        ESP_LOGD(TAG, "set refresh_timer to %lldus", poll_period_us);
+        poll_period_ = app_schedule_jitter_period(mac_, APP_SCHEDULE_POLL, poll_period_us);
+        ESP_LOGD(TAG, "set refresh_timer to %" PRId64 "us", poll_period_);
     }
 }
 
@@ -190,6 +214,7 @@ static void poll_refresh_()
     Ganymede__V2__PollRequest request;
     Google__Protobuf__Duration uptime;
     Ganymede__V2__PollResponse* response = NULL;
+    struct config_snapshot* snapshot = NULL;
 
     ganymede__v2__poll_request__init(&request);
 
@@ -202,10 +227,19 @@ static void poll_refresh_()
         return;
     }
 
-    if (ganymede_api_v2_poll_device(&request, &response) == GRPC_STATUS_OK) {
+    snapshot = config_snapshot_create();
+
+    if (snapshot == NULL) {
+        return;
+    }
+
+    if (ganymede_api_v2_poll_device(&request, &response, &snapshot->arena) == GRPC_STATUS_OK) {
         poll_write_response_to_storage_(response);
         poll_handle_response_(response);
-        protobuf_c_message_free_unpacked((ProtobufCMessage*) response, NULL);
+        config_snapshot_publish(snapshot, response);
+        lights_request_refresh();
+    } else {
+        config_snapshot_release(snapshot);
     }
 }
 
@@ -216,12 +250,15 @@ static void poll_task_(void* args)
     {
         ESP_LOGD(TAG, "Reading latest poll response from non-volatile storage");
         Ganymede__V2__PollResponse* response = NULL;
+        struct config_snapshot* snapshot = config_snapshot_create();
 
-        if (poll_read_response_from_storage_(&response) == ESP_OK) {
+        if (snapshot != NULL && poll_read_response_from_storage_(&snapshot->arena, &response) == ESP_OK) {
             ESP_LOGI(TAG, "Read latest poll response from non-volatile storage");
             poll_handle_response_(response);
-            protobuf_c_message_free_unpacked((ProtobufCMessage*) response, NULL);
-            response = NULL;
+            config_snapshot_publish(snapshot, response);
+            lights_request_refresh();
+        } else if (snapshot != NULL) {
+            config_snapshot_release(snapshot);
         }
     }
 
@@ -233,6 +270,11 @@ static void poll_task_(void* args)
 
     while (1) {
         xEventGroupWaitBits(poll_event_group_, POLL_CONNECTED_BIT | POLL_REFRESH_REQUEST_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
+
+        if (auth_wait_for_token(pdMS_TO_TICKS(POLL_TOKEN_TIMEOUT)) != ESP_OK) {
+            ESP_LOGW(TAG, "no auth token obtained since boot, polling with the stored one");
+        }
+
         poll_refresh_();
         xEventGroupClearBits(poll_event_group_, POLL_REFRESH_REQUEST_BIT);
     }
@@ -256,13 +298,28 @@ esp_err_t app_poll_init()
         return ESP_FAIL;
     }
 
+    struct app_schedule_timing timing;
+
+    if (identity_get_device_mac_bytes(mac_) != ESP_OK || app_schedule_get(mac_, APP_SCHEDULE_POLL, &timing) != ESP_OK) {
+        ESP_LOGE(TAG, "failed to compute poll schedule");
+        return ESP_FAIL;
+    }
+
+    poll_period_ = timing.period;
+
     if (xTaskCreate(&poll_task_, "poll_task", POLLER_TASK_STACK_DEPTH, NULL, 4, NULL) != pdPASS) {
         ESP_LOGE(TAG, "Task creation failed");
         return ESP_FAIL;
     }
 
-    xEventGroupSetBits(poll_event_group_, POLL_REFRESH_REQUEST_BIT);
-    return esp_timer_start_periodic(poll_refresh_timer_, 3600LL * 1000LL * 1000LL);
+    ESP_LOGI(TAG, "first poll in %" PRId64 "ms", timing.first / 1000);
+
+    if (timing.first == 0) {
+        xEventGroupSetBits(poll_event_group_, POLL_REFRESH_REQUEST_BIT);
+        return esp_timer_start_once(poll_refresh_timer_, poll_period_);
+    }
+
+    return esp_timer_start_once(poll_refresh_timer_, timing.first);
 }
 
 esp_err_t poll_request_refresh()
@@ -0,0 +1,220 @@
+#include "schedule.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <esp_log.h>
+
+#include <nvs_flash.h>
+
+#include <freertos/FreeRTOS.h>
+
+#include <net/auth/auth.h>
+
+enum {
+    // Default time between polls, until the server sends its own (seconds)
+    SCHEDULE_POLL_PERIOD = 3600,
+};
+
+static const char* TAG = "schedule";
+
+// Spread sent by the server, in NVS so that it applies from boot: first runs
+// are placed before the first poll
+static const char* SCHEDULE_SPREAD_KEY = "schedule-spread";
+
+// Window over which the fleet's runs are spread (microseconds). Written by the
+// poll task, read by every job.
+static int64_t schedule_spread_ = (int64_t) CONFIG_SCHEDULE_SPREAD * 1000LL * 1000LL;
+static portMUX_TYPE schedule_lock_ = portMUX_INITIALIZER_UNLOCKED;
+
+// FNV-1a of the MAC and job, so each job of each device gets its own stable
+// offset
+static uint32_t schedule_hash_(const uint8_t mac[DEVICE_MAC_BYTES_LEN], enum app_schedule_job job)
+{
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < DEVICE_MAC_BYTES_LEN; i++) {
+        hash = (hash ^ mac[i]) * 16777619u;
+    }
+
+    return (hash ^ (uint32_t) job) * 16777619u;
+}
+
+static int64_t schedule_get_spread_(void)
+{
+    portENTER_CRITICAL(&schedule_lock_);
+    int64_t spread = schedule_spread_;
+    portEXIT_CRITICAL(&schedule_lock_);
+
+    return spread;
+}
+
+// Offset within the spread window, at millisecond granularity
+static int64_t schedule_offset_(uint32_t hash, int64_t period)
+{
+    int64_t spread = schedule_get_spread_();
+
+    if (spread > period) {
+        spread = period;
+    }
+
+    if (spread < 1000) {
+        return 0;
+    }
+
+    return (int64_t) (hash % (uint32_t) (spread / 1000)) * 1000LL;
+}
+
+// Stretch or shrink the period by up to CONFIG_SCHEDULE_PERIOD_JITTER percent,
+// so devices that start together drift apart
+static int64_t schedule_jitter_(uint32_t hash, int64_t period)
+{
+    int32_t percent = (int32_t) ((hash >> 16) % (2 * CONFIG_SCHEDULE_PERIOD_JITTER + 1)) - CONFIG_SCHEDULE_PERIOD_JITTER;
+    return period + (period / 100) * percent;
+}
+
+const char* app_schedule_job_to_str(enum app_schedule_job job)
+{
+    static const char* job_names[] = {
+        "auth",
+        "poll",
+        "push",
+    };
+
+    if (job >= APP_SCHEDULE_JOB_COUNT) {
+        return "unknown";
+    }
+
+    return job_names[job];
+}
+
+esp_err_t app_schedule_get(const uint8_t mac[DEVICE_MAC_BYTES_LEN], enum app_schedule_job job, struct app_schedule_timing* dest)
+{
+    if (mac == NULL || dest == NULL) {
+        return ESP_FAIL;
+    }
+
+    uint32_t hash = schedule_hash_(mac, job);
+
+    switch (job) {
+    case APP_SCHEDULE_AUTH_REFRESH:
+        dest->period = schedule_jitter_(hash, (int64_t) CONFIG_AUTH_REFRESH_INTERVAL * 1000LL * 1000LL);
+        dest->first = schedule_offset_(hash, dest->period);
+        break;
+    case APP_SCHEDULE_POLL:
+        dest->period = schedule_jitter_(hash, SCHEDULE_POLL_PERIOD * 1000LL * 1000LL);
+        dest->first = schedule_offset_(hash, dest->period);
+        break;
+    case APP_SCHEDULE_MEASUREMENTS_PUSH: {
+        // Buckets fill at the acquisition rate and are pushed once full, so
+        // the period can't stretch. Only the first bucket is cut short, and
+        // acquisitions shifted within their interval.
+        int64_t interval = (int64_t) CONFIG_MEASUREMENTS_ACQUISITION_INTERVAL * 1000LL * 1000LL;
+
+        dest->period = (int64_t) CONFIG_MEASUREMENTS_BUCKET_SIZE * interval;
+        dest->first = dest->period - schedule_offset_(hash, dest->period);
+
+        if (dest->first < interval) {
+            dest->first = interval;
+        }
+        break;
+    }
+    default:
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+int64_t app_schedule_jitter_period(const uint8_t mac[DEVICE_MAC_BYTES_LEN], enum app_schedule_job job, int64_t period)
+{
+    if (mac == NULL || job == APP_SCHEDULE_MEASUREMENTS_PUSH) {
+        return period;
+    }
+
+    return schedule_jitter_(schedule_hash_(mac, job), period);
+}
+
+static void schedule_load_spread_(void)
+{
+    nvs_handle_t nvs;
+    uint64_t spread = 0;
+
+    // Nothing stored until the server sends a spread
+    if (nvs_open("nvs", NVS_READONLY, &nvs) != ESP_OK) {
+        return;
+    }
+
+    if (nvs_get_u64(nvs, SCHEDULE_SPREAD_KEY, &spread) == ESP_OK && spread > 0 && spread <= INT64_MAX) {
+        schedule_spread_ = (int64_t) spread;
+    }
+
+    nvs_close(nvs);
+}
+
+static esp_err_t schedule_store_spread_(int64_t spread)
+{
+    nvs_handle_t nvs;
+    esp_err_t rc = nvs_open("nvs", NVS_READWRITE, &nvs);
+
+    if (rc != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to open non-volatile storage rc=%d", rc);
+        return rc;
+    }
+
+    rc = nvs_set_u64(nvs, SCHEDULE_SPREAD_KEY, (uint64_t) spread);
+
+    if (rc == ESP_OK) {
+        rc = nvs_commit(nvs);
+    }
+
+    if (rc != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to write spread to non-volatile storage rc=%d", rc);
+    }
+
+    nvs_close(nvs);
+    return rc;
+}
+
+esp_err_t app_schedule_set_spread(int64_t spread)
+{
+    if (spread < 0) {
+        return ESP_FAIL;
+    }
+
+    if (spread == 0) {
+        spread = (int64_t) CONFIG_SCHEDULE_SPREAD * 1000LL * 1000LL;
+    }
+
+    portENTER_CRITICAL(&schedule_lock_);
+    bool changed = schedule_spread_ != spread;
+    schedule_spread_ = spread;
+    portEXIT_CRITICAL(&schedule_lock_);
+
+    // Every poll sends it, only a new value is written to flash
+    if (!changed) {
+        return ESP_OK;
+    }
+
+    ESP_LOGI(TAG, "spread set to %" PRId64 "s, from the next boot", spread / (1000 * 1000));
+    return schedule_store_spread_(spread);
+}
+
+esp_err_t app_schedule_init(void)
+{
+    uint8_t mac[DEVICE_MAC_BYTES_LEN] = { 0 };
+    struct app_schedule_timing timing;
+
+    // Before any job is placed, poll and measurements included
+    schedule_load_spread_();
+
+    if (identity_get_device_mac_bytes(mac) != ESP_OK || app_schedule_get(mac, APP_SCHEDULE_AUTH_REFRESH, &timing) != ESP_OK) {
+        ESP_LOGE(TAG, "failed to compute auth refresh schedule");
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "auth refresh in %" PRId64 "ms, then every %" PRId64 "s", timing.first / 1000, timing.period / (1000 * 1000));
+    return auth_set_refresh_schedule(timing.first, timing.period);
+}
\ No newline at end of file
@@ -0,0 +1,46 @@
+#ifndef APP__SCHEDULE_H_
+#define APP__SCHEDULE_H_
+
+#include <stdint.h>
+
+#include <esp_err.h>
+
+#include <app/identity.h>
+
+// Periodic jobs that reach the backend
+enum app_schedule_job {
+    APP_SCHEDULE_AUTH_REFRESH,
+    APP_SCHEDULE_POLL,
+    APP_SCHEDULE_MEASUREMENTS_PUSH,
+    APP_SCHEDULE_JOB_COUNT,
+};
+
+struct app_schedule_timing {
+    // Delay from boot to the first run, and between runs (microseconds)
+    int64_t first;
+    int64_t period;
+};
+
+// Jobs run on a per-device schedule derived from the MAC address, so a fleet
+// that boots together after an outage does not reach the backend all at once.
+// First runs are offset within a spread window, and periods are stretched or
+// shrunk by a few percent so devices keep drifting apart.
+
+// Apply this device's schedule to the auth refresh timer
+esp_err_t app_schedule_init(void);
+
+const char* app_schedule_job_to_str(enum app_schedule_job job);
+
+// Timing of `job` on the device with the given MAC address. Used both by the
+// jobs themselves and by the fleet simulator, which passes virtual MACs.
+esp_err_t app_schedule_get(const uint8_t mac[DEVICE_MAC_BYTES_LEN], enum app_schedule_job job, struct app_schedule_timing* dest);
+
+// Apply the device's jitter to a period sent by the server (microseconds)
+int64_t app_schedule_jitter_period(const uint8_t mac[DEVICE_MAC_BYTES_LEN], enum app_schedule_job job, int64_t period);
+
+// Window over which first runs are spread, as sent by the server
+// (microseconds). 0 restores CONFIG_SCHEDULE_SPREAD. Kept in NVS and applied
+// from the next boot, when app_schedule_init places the first runs.
+esp_err_t app_schedule_set_spread(int64_t spread);
+
+#endif // APP__SCHEDULE_H_
\ No newline at end of file
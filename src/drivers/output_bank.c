@@ -0,0 +1,57 @@
+#include "output_bank.h"
+
+#include <driver/gpio.h>
+#include <soc/gpio_reg.h>
+#include <soc/soc.h>
+
+void output_bank_write(uint64_t pins, uint64_t levels)
+{
+    uint32_t low_pins = (uint32_t) pins;
+    uint32_t low_levels = (uint32_t) levels;
+    uint32_t high_pins = (uint32_t) (pins >> 32);
+    uint32_t high_levels = (uint32_t) (levels >> 32);
+
+    // GPIO 0-31
+    if (low_pins != 0) {
+        REG_WRITE(GPIO_OUT_W1TS_REG, low_pins & low_levels);
+        REG_WRITE(GPIO_OUT_W1TC_REG, low_pins & ~low_levels);
+    }
+
+    // GPIO 32 and up
+    if (high_pins != 0) {
+        REG_WRITE(GPIO_OUT1_W1TS_REG, high_pins & high_levels);
+        REG_WRITE(GPIO_OUT1_W1TC_REG, high_pins & ~high_levels);
+    }
+}
+
+esp_err_t output_bank_enable(uint64_t pins)
+{
+    if (pins == 0) {
+        return ESP_OK;
+    }
+
+    gpio_config_t pin_config = {
+        .intr_type = GPIO_INTR_DISABLE,
+        .mode = GPIO_MODE_OUTPUT,
+        .pin_bit_mask = pins,
+        .pull_up_en = GPIO_PULLUP_ENABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE
+    };
+
+    return gpio_config(&pin_config);
+}
+
+esp_err_t output_bank_disable(uint64_t pins)
+{
+    if (pins == 0) {
+        return ESP_OK;
+    }
+
+    gpio_config_t pin_config = {
+        .intr_type = GPIO_INTR_DISABLE,
+        .mode = GPIO_MODE_DISABLE,
+        .pin_bit_mask = pins
+    };
+
+    return gpio_config(&pin_config);
+}
\ No newline at end of file
@@ -0,0 +1,23 @@
+#ifndef DRIVERS_OUTPUT_BANK_H_
+#define DRIVERS_OUTPUT_BANK_H_
+
+#include <stdint.h>
+
+#include <esp_err.h>
+
+// GPIO outputs driven together. Pins are given as 64-bit masks indexed by GPIO
+// number, and their levels are written with one write-set and one write-clear
+// register access per bank of 32 pins, so they all switch in the same cycle
+// instead of one after another.
+
+// Drive `pins` to `levels`. Pins that are not outputs yet latch the level and
+// take it once enabled.
+void output_bank_write(uint64_t pins, uint64_t levels);
+
+// Make `pins` outputs. Their levels should be written first, so that they come
+// up at them rather than low.
+esp_err_t output_bank_enable(uint64_t pins);
+
+esp_err_t output_bank_disable(uint64_t pins);
+
+#endif // DRIVERS_OUTPUT_BANK_H_
\ No newline at end of file
@@ -49,6 +49,9 @@ enum {
 
     // EventBit: the user requested to register the device with Auth0
     AUTH_REGISTER_REQUEST_BIT = BIT2,
+
+    // EventBit: an access token was obtained since boot
+    AUTH_TOKEN_FRESH_BIT = BIT3,
 };
 
 static const char* TAG = "auth";
@@ -59,6 +62,7 @@ static const char* REFRESH_TOKEN_REQUEST_PAYLOAD_TEMPLATE = "{\"client_id\":\""
 
 static EventGroupHandle_t auth_event_group_ = NULL;
 static esp_timer_handle_t auth_refresh_timer_ = NULL;
+static int64_t auth_refresh_period_ = (int64_t) CONFIG_AUTH_REFRESH_INTERVAL * 1000 * 1000;
 
 static char payload_buffer_[CONFIG_AUTH_RESPONSE_BUFFER_LEN] = { 0 };
 static char response_buffer_[CONFIG_AUTH_RESPONSE_BUFFER_LEN] = { 0 };
@@ -168,9 +172,13 @@ static esp_err_t auth_perform_wait_for_token_(http2_session_t* session, double i
 
     int64_t end = esp_timer_get_time() + (int64_t) (expiry * 1000LL * 1000LL);
 
+    // No point in waiting for a response once the device code has expired
+    struct http_perform_options options = http_perform_options_;
+    options.deadline = end;
+
     while (esp_timer_get_time() < end) {
         vTaskDelay(((TickType_t) interval * 1000LL) / portTICK_PERIOD_MS);
-        status = http2_perform(session, "POST", CONFIG_AUTH_AUTH0_HOSTNAME, "/oauth/token", payload_buffer_, strlen(payload_buffer_), (char*) response_buffer_, sizeof(response_buffer_), http_perform_options_);
+        status = http2_perform(session, "POST", CONFIG_AUTH_AUTH0_HOSTNAME, "/oauth/token", payload_buffer_, strlen(payload_buffer_), (char*) response_buffer_, sizeof(response_buffer_), options);
 
         if (status / 100 == 2) {
             break;
@@ -187,7 +195,9 @@ static esp_err_t auth_perform_wait_for_token_(http2_session_t* session, double i
             goto exit;
         }
 
-        auth_write_credentials_to_storage_(access_token, refresh_token);
+        if (auth_write_credentials_to_storage_(access_token, refresh_token) == ESP_OK) {
+            xEventGroupSetBits(auth_event_group_, AUTH_TOKEN_FRESH_BIT);
+        }
     }
 
 exit:
@@ -199,22 +209,16 @@ static esp_err_t auth_perform_interactive_register_(void)
     esp_err_t rc = ESP_OK;
     int status = -1;
 
-    http2_session_t* session = http2_session_acquire(portMAX_DELAY);
+    http2_session_t* session = http2_session_acquire(CONFIG_AUTH_AUTH0_HOSTNAME, CONFIG_AUTH_AUTH0_PORT, NULL, portMAX_DELAY);
 
     if (session == NULL) {
-        ESP_LOGE(TAG, "failed to create http2 session");
+        ESP_LOGE(TAG, "failed connect to %s:%d", CONFIG_AUTH_AUTH0_HOSTNAME, CONFIG_AUTH_AUTH0_PORT);
         rc = ESP_FAIL;
         goto exit;
     }
 
     // Perform HTTP call
     {
-        if (http2_session_connect(session, CONFIG_AUTH_AUTH0_HOSTNAME, CONFIG_AUTH_AUTH0_PORT, NULL) != ESP_OK) {
-            ESP_LOGE(TAG, "failed connect to %s:%d", CONFIG_AUTH_AUTH0_HOSTNAME, CONFIG_AUTH_AUTH0_PORT);
-            rc = ESP_FAIL;
-            goto exit;
-        }
-
         status = http2_perform(session, "POST", CONFIG_AUTH_AUTH0_HOSTNAME, "/oauth/device/code", DEVICE_TOKEN_REQUEST_PAYLOAD, strlen(DEVICE_TOKEN_REQUEST_PAYLOAD), (char*) response_buffer_, sizeof(response_buffer_), http_perform_options_);
 
         if (status / 100 != 2) {
@@ -256,10 +260,10 @@ static esp_err_t auth_perform_refresh_(void)
     size_t refresh_token_len = CONFIG_AUTH_REFRESH_TOKEN_LEN;
 
     int status = -1;
-    http2_session_t* session = http2_session_acquire(portMAX_DELAY);
+    http2_session_t* session = http2_session_acquire(CONFIG_AUTH_AUTH0_HOSTNAME, CONFIG_AUTH_AUTH0_PORT, NULL, portMAX_DELAY);
 
     if (session == NULL) {
-        ESP_LOGE(TAG, "failed to acquire http2 session");
+        ESP_LOGE(TAG, "failed connect to %s:%d", CONFIG_AUTH_AUTH0_HOSTNAME, CONFIG_AUTH_AUTH0_PORT);
         rc = ESP_FAIL;
         goto exit;
     }
@@ -277,15 +281,10 @@ static esp_err_t auth_perform_refresh_(void)
 
     // Perform HTTP call
     {
-        if (http2_session_connect(session, CONFIG_AUTH_AUTH0_HOSTNAME, CONFIG_AUTH_AUTH0_PORT, NULL) != ESP_OK) {
-            ESP_LOGE(TAG, "failed connect to %s:%d", CONFIG_AUTH_AUTH0_HOSTNAME, CONFIG_AUTH_AUTH0_PORT);
-            rc = ESP_FAIL;
-            goto exit;
-        }
-
         status = http2_perform(session, "POST", CONFIG_AUTH_AUTH0_HOSTNAME, "/oauth/token", payload_buffer_, strlen(payload_buffer_), (char*) response_buffer_, sizeof(response_buffer_), http_perform_options_);
 
-        if (status == HTTP_STATUS_OK) {
+        if (status != HTTP_STATUS_OK) {
+            ESP_LOGE(TAG, "auth0 returned status %d to refresh", status);
             rc = ESP_FAIL;
             goto exit;
         }
@@ -301,7 +300,9 @@ static esp_err_t auth_perform_refresh_(void)
             goto exit;
         }
 
-        auth_write_credentials_to_storage_(access_token, NULL);
+        if (auth_write_credentials_to_storage_(access_token, NULL) == ESP_OK) {
+            xEventGroupSetBits(auth_event_group_, AUTH_TOKEN_FRESH_BIT);
+        }
     }
 
 exit:
@@ -337,10 +338,13 @@ static void auth_task_(void* args)
     vTaskDelete(NULL);
 }
 
+// The timer is one-shot and re-armed here, so the first refresh can come at a
+// different delay than the following ones
 static void auth_timer_callback_(void* args)
 {
     (void) args;
     xEventGroupSetBits(auth_event_group_, AUTH_REFRESH_REQUEST_BIT);
+    esp_timer_start_once(auth_refresh_timer_, auth_refresh_period_);
 }
 
 esp_err_t auth_init(void)
@@ -364,7 +368,37 @@ esp_err_t auth_init(void)
     ERROR_CHECK(xTaskCreate(&auth_task_, "auth_task", AUTH_TASK_STACK_DEPTH, NULL, 6, NULL), pdPASS);
     xEventGroupSetBits(auth_event_group_, AUTH_REFRESH_REQUEST_BIT);
 
-    return esp_timer_start_periodic(auth_refresh_timer_, ((int64_t) CONFIG_AUTH_REFRESH_INTERVAL * 1000 * 1000));
+    return esp_timer_start_once(auth_refresh_timer_, auth_refresh_period_);
+}
+
+esp_err_t auth_set_refresh_schedule(int64_t first, int64_t period)
+{
+    if (first < 0 || period <= 0) {
+        return ESP_FAIL;
+    }
+
+    esp_timer_stop(auth_refresh_timer_);
+    auth_refresh_period_ = period;
+
+    if (first == 0) {
+        xEventGroupSetBits(auth_event_group_, AUTH_REFRESH_REQUEST_BIT);
+        return esp_timer_start_once(auth_refresh_timer_, period);
+    }
+
+    // Drop the refresh requested at boot unless it is already underway. Jobs
+    // that need a token before then get one with auth_wait_for_token.
+    xEventGroupClearBits(auth_event_group_, AUTH_REFRESH_REQUEST_BIT);
+    return esp_timer_start_once(auth_refresh_timer_, first);
+}
+
+esp_err_t auth_wait_for_token(TickType_t ticks_to_wait)
+{
+    if ((xEventGroupGetBits(auth_event_group_) & AUTH_TOKEN_FRESH_BIT) == 0) {
+        xEventGroupSetBits(auth_event_group_, AUTH_REFRESH_REQUEST_BIT);
+    }
+
+    EventBits_t bits = xEventGroupWaitBits(auth_event_group_, AUTH_TOKEN_FRESH_BIT, pdFALSE, pdFALSE, ticks_to_wait);
+    return (bits & AUTH_TOKEN_FRESH_BIT) != 0 ? ESP_OK : ESP_ERR_TIMEOUT;
 }
 
 esp_err_t auth_request_register(void)
@@ -1,11 +1,25 @@
 #ifndef NET__AUTH__AUTH_H_
 #define NET__AUTH__AUTH_H_
 
+#include <stdint.h>
 #include <stdlib.h>
 
 #include <esp_err.h>
 
+#include <freertos/FreeRTOS.h>
+
 esp_err_t auth_init(void);
+
+// Refresh the access token after `first`, then every `period` (microseconds),
+// instead of at boot and every CONFIG_AUTH_REFRESH_INTERVAL
+esp_err_t auth_set_refresh_schedule(int64_t first, int64_t period);
+
+// Block until an access token was obtained since boot, refreshing it right
+// away if none was. The scheduled first refresh may come long after boot, and
+// the stored token may have expired during an outage; jobs call this before
+// their first request reaches the backend.
+esp_err_t auth_wait_for_token(TickType_t ticks_to_wait);
+
 esp_err_t auth_request_register(void);
 esp_err_t auth_get_token(char* dest, size_t* len);
 
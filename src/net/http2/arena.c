@@ -0,0 +1,313 @@
+#include "arena.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#include <freertos/FreeRTOS.h>
+
+enum {
+    // nghttp2 allocates its outbound frame buffer in chunks of this size: a
+    // full 16K frame payload, the 9 byte frame header and a padding byte. It
+    // gets a size class of its own rather than rounding up to 32K.
+    ARENA_FRAMEBUF_LEN = 16394,
+
+    // Alignment of every block handed out
+    ARENA_ALIGNMENT = 8,
+};
+
+// Precedes every block. Stays in place while the block is on a free list, so
+// the arena can be walked block by block to coalesce free neighbours.
+struct arena_block {
+    struct arena_block* next;
+
+    // Length of the block, header included. The low bit flags free blocks.
+    uint32_t length;
+} __attribute__((aligned(ARENA_ALIGNMENT)));
+
+enum {
+    ARENA_BLOCK_FREE = 1,
+};
+
+static const size_t arena_classes_[] = { 16, 32, 64, 128, 256, 512, 1024, 2048, 4096, ARENA_FRAMEBUF_LEN };
+
+enum {
+    ARENA_CLASS_COUNT = sizeof(arena_classes_) / sizeof(arena_classes_[0]),
+};
+
+static uint8_t arena_memory_[CONFIG_HTTP2_ARENA_SIZE] __attribute__((aligned(ARENA_ALIGNMENT)));
+static size_t arena_carved_ = 0;
+
+// A free block is kept on the list of the largest class it can serve, so it
+// may be longer than the class needs
+static struct arena_block* arena_free_lists_[ARENA_CLASS_COUNT] = { 0 };
+static struct arena_stats arena_stats_ = { .capacity = CONFIG_HTTP2_ARENA_SIZE };
+
+// Connections are only opened and closed by the http2 task, but the stats are
+// read from other tasks.
+static portMUX_TYPE arena_lock_ = portMUX_INITIALIZER_UNLOCKED;
+
+static size_t arena_block_len_(size_t size_class)
+{
+    size_t length = sizeof(struct arena_block) + arena_classes_[size_class];
+    return (length + ARENA_ALIGNMENT - 1) & ~((size_t) ARENA_ALIGNMENT - 1);
+}
+
+static size_t arena_length_of_(const struct arena_block* block)
+{
+    return block->length & ~(uint32_t) ARENA_BLOCK_FREE;
+}
+
+static bool arena_find_class_(size_t size, size_t* size_class)
+{
+    for (size_t i = 0; i < ARENA_CLASS_COUNT; i++) {
+        if (size <= arena_classes_[i]) {
+            *size_class = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static struct arena_block* arena_block_of_(void* ptr)
+{
+    return (struct arena_block*) ((uint8_t*) ptr - sizeof(struct arena_block));
+}
+
+// Must be called with the lock
+static void arena_push_free_(struct arena_block* block, size_t length)
+{
+    size_t size_class = 0;
+
+    while (size_class + 1 < ARENA_CLASS_COUNT && arena_block_len_(size_class + 1) <= length) {
+        size_class++;
+    }
+
+    block->length = length | ARENA_BLOCK_FREE;
+    block->next = arena_free_lists_[size_class];
+    arena_free_lists_[size_class] = block;
+}
+
+// Take a free block of at least `length` bytes from the lists of classes
+// [first, last], splitting off what's left over when it can hold a block of
+// its own. Must be called with the lock.
+static struct arena_block* arena_pop_free_(size_t first, size_t last, size_t length)
+{
+    for (size_t i = first; i <= last; i++) {
+        struct arena_block* block = arena_free_lists_[i];
+
+        if (block == NULL) {
+            continue;
+        }
+
+        arena_free_lists_[i] = block->next;
+
+        size_t remainder = arena_length_of_(block) - length;
+
+        if (remainder >= arena_block_len_(0)) {
+            arena_push_free_((struct arena_block*) ((uint8_t*) block + length), remainder);
+            block->length = length;
+        } else {
+            block->length = arena_length_of_(block);
+        }
+
+        return block;
+    }
+
+    return NULL;
+}
+
+// Must be called with the lock
+static struct arena_block* arena_carve_(size_t length)
+{
+    if (arena_carved_ + length > sizeof(arena_memory_)) {
+        return NULL;
+    }
+
+    struct arena_block* block = (struct arena_block*) &arena_memory_[arena_carved_];
+    block->length = length;
+    arena_carved_ += length;
+    arena_stats_.carved = arena_carved_;
+
+    return block;
+}
+
+// Merge runs of adjacent free blocks, and give a run at the end of the carved
+// memory back to be carved again. Must be called with the lock.
+static void arena_coalesce_(void)
+{
+    size_t offset = 0;
+
+    memset(arena_free_lists_, 0, sizeof(arena_free_lists_));
+
+    while (offset < arena_carved_) {
+        struct arena_block* block = (struct arena_block*) &arena_memory_[offset];
+        size_t length = arena_length_of_(block);
+
+        if ((block->length & ARENA_BLOCK_FREE) == 0) {
+            offset += length;
+            continue;
+        }
+
+        while (offset + length < arena_carved_) {
+            struct arena_block* next = (struct arena_block*) &arena_memory_[offset + length];
+
+            if ((next->length & ARENA_BLOCK_FREE) == 0) {
+                break;
+            }
+
+            length += arena_length_of_(next);
+        }
+
+        if (offset + length == arena_carved_) {
+            arena_carved_ = offset;
+            break;
+        }
+
+        arena_push_free_(block, length);
+        offset += length;
+    }
+
+    arena_stats_.carved = arena_carved_;
+}
+
+// A free block of the class, then fresh memory, then part of a larger free
+// block. Must be called with the lock.
+static struct arena_block* arena_take_(size_t size_class)
+{
+    size_t length = arena_block_len_(size_class);
+    struct arena_block* block = arena_pop_free_(size_class, size_class, length);
+
+    if (block == NULL) {
+        block = arena_carve_(length);
+    }
+
+    if (block == NULL) {
+        block = arena_pop_free_(size_class, ARENA_CLASS_COUNT - 1, length);
+    }
+
+    // Neighbouring blocks freed from other classes may add up to one
+    if (block == NULL) {
+        arena_coalesce_();
+        block = arena_carve_(length);
+    }
+
+    if (block == NULL) {
+        block = arena_pop_free_(size_class, ARENA_CLASS_COUNT - 1, length);
+    }
+
+    return block;
+}
+
+void* arena_malloc(size_t size)
+{
+    size_t size_class = 0;
+    struct arena_block* block = NULL;
+
+    if (size == 0) {
+        return NULL;
+    }
+
+    bool found = arena_find_class_(size, &size_class);
+
+    portENTER_CRITICAL(&arena_lock_);
+
+    if (found) {
+        block = arena_take_(size_class);
+    }
+
+    if (block == NULL) {
+        arena_stats_.failed_allocations++;
+        portEXIT_CRITICAL(&arena_lock_);
+        return NULL;
+    }
+
+    block->next = NULL;
+
+    arena_stats_.allocations++;
+    arena_stats_.used += block->length;
+    if (arena_stats_.used > arena_stats_.high_water) {
+        arena_stats_.high_water = arena_stats_.used;
+    }
+
+    portEXIT_CRITICAL(&arena_lock_);
+    return (uint8_t*) block + sizeof(struct arena_block);
+}
+
+void* arena_calloc(size_t nmemb, size_t size)
+{
+    if (size != 0 && nmemb > SIZE_MAX / size) {
+        portENTER_CRITICAL(&arena_lock_);
+        arena_stats_.failed_allocations++;
+        portEXIT_CRITICAL(&arena_lock_);
+        return NULL;
+    }
+
+    void* ptr = arena_malloc(nmemb * size);
+
+    if (ptr != NULL) {
+        memset(ptr, 0, nmemb * size);
+    }
+
+    return ptr;
+}
+
+void* arena_realloc(void* ptr, size_t size)
+{
+    if (ptr == NULL) {
+        return arena_malloc(size);
+    }
+
+    if (size == 0) {
+        arena_free(ptr);
+        return NULL;
+    }
+
+    size_t current = arena_length_of_(arena_block_of_(ptr)) - sizeof(struct arena_block);
+
+    // Still fits in its block
+    if (size <= current) {
+        return ptr;
+    }
+
+    void* moved = arena_malloc(size);
+
+    if (moved != NULL) {
+        memcpy(moved, ptr, current);
+        arena_free(ptr);
+    }
+
+    return moved;
+}
+
+void arena_free(void* ptr)
+{
+    if (ptr == NULL) {
+        return;
+    }
+
+    struct arena_block* block = arena_block_of_(ptr);
+    size_t length = arena_length_of_(block);
+
+    portENTER_CRITICAL(&arena_lock_);
+
+    arena_push_free_(block, length);
+
+    arena_stats_.frees++;
+    arena_stats_.used -= length;
+
+    portEXIT_CRITICAL(&arena_lock_);
+}
+
+esp_err_t arena_get_stats(struct arena_stats* dest)
+{
+    if (dest == NULL) {
+        return ESP_FAIL;
+    }
+
+    portENTER_CRITICAL(&arena_lock_);
+    *dest = arena_stats_;
+    portEXIT_CRITICAL(&arena_lock_);
+
+    return ESP_OK;
+}
\ No newline at end of file
@@ -0,0 +1,40 @@
+#ifndef NET__HTTP2__ARENA_H_
+#define NET__HTTP2__ARENA_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <esp_err.h>
+
+// Fixed-budget allocator backing nghttp2. Memory is carved out of a static
+// arena of CONFIG_HTTP2_ARENA_SIZE bytes into size classes, and freed blocks
+// are kept on per-class free lists for reuse. Larger free blocks are split
+// for smaller classes, and when nothing fits, adjacent free blocks are merged.
+// Nothing is ever returned to, or taken from, the system heap.
+
+struct arena_stats {
+    // Size of the arena, and bytes carved out of it so far (bytes)
+    size_t capacity;
+    size_t carved;
+
+    // Bytes held by live allocations, including block headers and rounding
+    // to the size class, and the highest it has been (bytes)
+    size_t used;
+    size_t high_water;
+
+    // Allocations served and blocks freed since boot
+    uint32_t allocations;
+    uint32_t frees;
+
+    // Allocations that could not be served
+    uint32_t failed_allocations;
+};
+
+void* arena_malloc(size_t size);
+void* arena_calloc(size_t nmemb, size_t size);
+void* arena_realloc(void* ptr, size_t size);
+void arena_free(void* ptr);
+
+esp_err_t arena_get_stats(struct arena_stats* dest);
+
+#endif // NET__HTTP2__ARENA_H_
\ No newline at end of file
@@ -1,138 +1,299 @@
 #include "http2.h"
 
+#include <stdatomic.h>
 #include <string.h>
+#include <sys/select.h>
+#include <unistd.h>
 
-#include <esp_crt_bundle.h>
+#include <esp_heap_caps.h>
 #include <esp_log.h>
 #include <esp_timer.h>
 #include <esp_tls.h>
+#include <esp_vfs_eventfd.h>
 
 #include <freertos/semphr.h>
 
 #include <nghttp2/nghttp2.h>
 
+#include "arena.h"
+#include "tls_cache.h"
+
 enum {
     // Stack size for http2 task. NGHTTP2 & mbedtls require considerable memory.
     HTTP2_TASK_STACK_DEPTH = 1024 * 24,
 
-    // NGHTTP2 does not allow us to provide a static pointer for the rx buffer.
-    // This can cause issue as our very limited memory gets fragemented, and we
-    // will often not have a free block of 16K.
-    // To work around this we implement wrappers around malloc and use this
-    // magic value to detect when the rx buffer is created. This allows us to
-    // return a static buffer.
-    NGHTTP2_RECV_BUFFER_SIZE = 16394,
+    // Largest plaintext mbedtls puts in a single TLS record. Every record
+    // costs a header and a MAC, so we write in chunks of this size and
+    // coalesce smaller frames up to it.
+    HTTP2_TLS_RECORD_LEN = CONFIG_MBEDTLS_SSL_OUT_CONTENT_LEN,
 
-    // How many bytes to send to esp_tls_write per call. We need to balance
-    // blocking time with efficiency.
-    HTTP2_WRITE_CHUNK_LEN = 1000,
+    // Length of the header preceding every HTTP2 frame
+    HTTP2_FRAME_HEADER_LEN = 9,
 
-    // Timeout for HTTP2 calls. This is not an idle timeout, but a hard limit on
-    // rx/tx duration.
+    // Timeout for HTTP2 calls that don't set a deadline. This is not an idle
+    // timeout, but a hard limit on rx/tx duration.
     HTTP2_PERFORM_TIMEOUT = 5 * 1000 * 1000,
+
+    // Largest value allowed in the grpc-timeout header, which is limited to
+    // 8 digits.
+    HTTP2_GRPC_TIMEOUT_MAX = 99999999,
+
+    // Hard limit on the duration of the TCP connection and TLS handshake. DNS
+    // resolution happens when the connection is started, and blocks.
+    HTTP2_CONNECT_TIMEOUT = 10 * 1000 * 1000,
+
+    // Longest a connection waits on its socket between two steps of the TLS
+    // handshake. We can't tell whether mbedtls is waiting to read or to write,
+    // so we wait for input and recheck periodically.
+    HTTP2_HANDSHAKE_POLL_INTERVAL = 100 * 1000,
+
+    // Maximum length of the hostname and common name used as pool keys,
+    // including the NULL terminator.
+    HTTP2_POOL_HOSTNAME_LEN = 64,
+
+    // Longest other tasks wait for room in the event queue, unless they ask
+    // not to wait at all
+    HTTP2_EVENT_POST_TIMEOUT = 1000,
+
+    // Weight of the latest sample in the smoothed PING RTT, as a shift
+    // (1/8, as TCP does).
+    HTTP2_RTT_SMOOTHING_SHIFT = 3,
+
+    // Arena memory taken by an open connection: the outbound frame buffer,
+    // session state, HPACK tables and a few streams, rounded to size classes.
+    HTTP2_CONN_ARENA_LEN = 28 * 1024,
+
+    // Connections the arena can hold at once
+    HTTP2_ARENA_CONNECTIONS = CONFIG_HTTP2_ARENA_SIZE / HTTP2_CONN_ARENA_LEN,
 };
 
 static const char* TAG = "http2";
 
-struct http2_session {
+// A TLS connection and the HTTP2 session running over it. Only accessed from
+// the http2 task.
+struct http2_conn {
+    http2_session_t* session;
+
+    // Generation of the session key this connection was dialed for
+    uint32_t generation;
+
     esp_tls_t* tls;
     nghttp2_session* ng;
 
-    char* payload;
+    // Set from the start of the TCP connection until the TLS handshake is
+    // done. Each step runs from the http2 task's loop once the socket is
+    // ready, so other connections are served meanwhile. Streams submitted in
+    // the meantime are opened once it is done.
+    bool connecting;
+    int64_t connect_started;
+    int64_t connect_deadline;
+
+    // Key the connection was dialed for, and the configuration every step of
+    // the handshake is given
+    char hostname[HTTP2_POOL_HOSTNAME_LEN];
+    char common_name[HTTP2_POOL_HOSTNAME_LEN];
+    uint16_t port;
+    esp_tls_cfg_t tls_config;
+
+    // Last time anything was received, and when the outstanding keepalive
+    // PING was submitted (0 if none). It times out from then.
+    int64_t last_activity;
+    int64_t ping_submitted;
+
+    // The PING was serialized into the staged record, and when that record
+    // was written out (0 until then). The RTT is measured from the latter,
+    // so it doesn't include time spent queued behind other frames.
+    bool ping_staged;
+    int64_t ping_sent;
+
+    // The server sent a GOAWAY. No new streams may be opened on this
+    // connection, the ones in flight are left to complete.
+    bool goaway;
+
+    // Bytes of the DATA frame being transmitted that were already written,
+    // including its header. nghttp2 retries the whole frame after
+    // NGHTTP2_ERR_WOULDBLOCK.
+    size_t tx_frame_sent;
+
+    // Record mbedtls was interrupted in. It was already encrypted, and the
+    // exact same write must be repeated before any other.
+    const uint8_t* tx_retry;
+    size_t tx_retry_length;
+};
+
+// The key, users, last_used and generation are protected by the pool mutex,
+// and may be changed by any task. The connections belong to the http2 task,
+// which is the only one to open or close them.
+struct http2_session {
+    // Pool key
+    char hostname[HTTP2_POOL_HOSTNAME_LEN];
+    char common_name[HTTP2_POOL_HOSTNAME_LEN];
+    uint16_t port;
+
+    // Number of callers currently holding this session
+    uint32_t users;
+    int64_t last_used;
+
+    // Bumped when the slot is recycled for another key. The http2 task then
+    // closes the connections dialed for the previous one.
+    uint32_t generation;
+
+    // New streams are opened on conns[active]. After a GOAWAY, the other
+    // connection drains the streams still in flight while a replacement is
+    // dialed.
+    struct http2_conn conns[2];
+    size_t active;
+};
+
+// Context of a single request. Several streams can be in flight on the same
+// session; nghttp2 hands this back to us as the stream's user data.
+struct http2_stream {
+    bool in_use;
+    http2_request_id_t request_id;
+
+    // 0 until the stream is opened, which waits for the connection to be
+    // established
+    struct http2_conn* conn;
+    int32_t stream_id;
+
+    // Request line and headers, sent when the stream is opened
+    const char* method;
+    const char* authority;
+    const char* path;
+    const char* content_type;
+    const char* authorization;
+
+    http2_perform_callback_t callback;
+    void* arg;
+
+    const char* payload;
     size_t payload_cursor;
     size_t payload_length;
+    http2_request_source_t source;
+    void* source_arg;
 
     char* dest;
     size_t dest_cursor;
     size_t dest_length;
+    http2_response_sink_t sink;
+    void* sink_arg;
 
     bool use_grpc_status;
+    int32_t* retry_pushback;
 
     int32_t status;
-    bool complete;
-};
+    int64_t deadline;
 
-enum http2_event_type {
-    HTTP2_EVENT_CONNECT,
-    HTTP2_EVENT_PERFORM
+    // When the stream was opened, cleared once its response starts
+    int64_t submitted;
 };
 
-struct http2_event_connect {
-    enum http2_event_type type;
-    struct http2_session* session;
-    TaskHandle_t requestor;
-
-    const char* hostname;
-    const char* common_name;
-    uint16_t port;
+enum http2_event_type {
+    HTTP2_EVENT_PERFORM,
+    HTTP2_EVENT_CANCEL,
 };
 
 struct http2_event_perform {
     enum http2_event_type type;
-    struct http2_session* session;
-    TaskHandle_t requestor;
+    http2_request_id_t request_id;
 
+    struct http2_session* session;
     const char* method;
     const char* authority;
     const char* path;
+
     const char* payload;
-    size_t payload_len;
+    size_t payload_length;
     char* dest;
-    size_t dest_len;
+    size_t dest_length;
+
     struct http_perform_options options;
+
+    http2_perform_callback_t callback;
+    void* arg;
+};
+
+struct http2_event_cancel {
+    enum http2_event_type type;
+    http2_request_id_t request_id;
 };
 
 union http2_event {
     struct {
         enum http2_event_type type;
-        struct http2_session* session;
-        TaskHandle_t requestor;
+        http2_request_id_t request_id;
     };
-    struct http2_event_connect connect;
     struct http2_event_perform perform;
+    struct http2_event_cancel cancel;
 };
 
-static SemaphoreHandle_t http2_mutex_;
+// Recursive, as completion callbacks run by the http2 task while it holds the
+// mutex may release their session.
+static SemaphoreHandle_t http2_pool_mutex_;
 static QueueHandle_t http2_event_queue_;
 
-static char http2_rx_buffer_[NGHTTP2_RECV_BUFFER_SIZE] = { 0 };
+// Written to after every event posted to the queue, so the http2 task can
+// sleep in select() on both the sockets and the queue.
+static int http2_wakeup_fd_ = -1;
+static esp_timer_handle_t http2_sweep_timer_;
+static TaskHandle_t http2_task_handle_;
+
+// Events posted by the http2 task itself, from completion callbacks. Waiting
+// for room in its own queue would never end, so they are kept here and
+// handled on its next iteration.
+static union http2_event http2_deferred_[CONFIG_HTTP2_MAX_CONCURRENT_STREAMS];
+static size_t http2_deferred_count_ = 0;
 
+// Sweeps are requested with a flag rather than an event, so they never take
+// room in the queue
+static atomic_bool http2_sweep_requested_ = false;
+
+static http2_session_t http2_pool_[CONFIG_HTTP2_POOL_SIZE] = { 0 };
+
+// Streams in flight, across all sessions. Only accessed from the http2 task.
+static struct http2_stream http2_streams_[CONFIG_HTTP2_MAX_CONCURRENT_STREAMS] = { 0 };
+
+// Request ids are handed out by the callers, 0 is never used.
+static atomic_uint_least32_t http2_next_request_id_ = 1;
+
+static struct http2_stats http2_stats_ = { 0 };
+
+// Plaintext of the next TLS record. Frames are staged here until a full record
+// is available or nghttp2 has nothing more to send. Only one connection may
+// have data staged at a time.
+static uint8_t http2_tx_buffer_[HTTP2_TLS_RECORD_LEN] = { 0 };
+static struct http2_conn* http2_tx_owner_ = NULL;
+static size_t http2_tx_length_ = 0;
+static size_t http2_tx_cursor_ = 0;
+
+// Sent in place of the payload of a stream cancelled halfway through a frame
+static const uint8_t http2_tx_padding_[64] = { 0 };
+
+// nghttp2 allocates from a fixed arena rather than the heap. Our memory is
+// very limited, and connection setup used to fragment it to the point where
+// mbedtls could not find the blocks it needs.
 static void* http2_nghttp2_malloc_(size_t size, void* user_data)
 {
     (void) user_data;
-    return malloc(size);
+    return arena_malloc(size);
 }
 
 static void* http2_nghttp2_calloc_(size_t nmemb, size_t size, void* user_data)
 {
     (void) user_data;
-    return calloc(nmemb, size);
+    return arena_calloc(nmemb, size);
 }
 
 static void* http2_nghttp2_realloc_(void* ptr, size_t size, void* user_data)
 {
     (void) user_data;
-
-    void* alloc = NULL;
-
-    // Hack to reduce heap fragmentation when creating many HTTP2 sessions.
-    if (size == NGHTTP2_RECV_BUFFER_SIZE) {
-        free(ptr);
-        alloc = (void*) http2_rx_buffer_;
-    } else {
-        alloc = realloc(ptr, size);
-    }
-
-    return alloc;
+    return arena_realloc(ptr, size);
 }
 
 static void http2_nghttp2_free_(void* ptr, void* user_data)
 {
     (void) user_data;
-
-    if (ptr != http2_rx_buffer_) {
-        return free(ptr);
-    }
+    arena_free(ptr);
 }
 
 static nghttp2_mem nghttp2_mem_ = {
@@ -142,35 +303,167 @@ static nghttp2_mem nghttp2_mem_ = {
     .free = http2_nghttp2_free_,
 };
 
-static ssize_t http2_tls_send_(nghttp2_session* ng, const uint8_t* data, size_t length, int flags, void* user_data)
+static bool http2_tls_would_block_(ssize_t rc)
 {
-    (void) ng;
-    (void) flags;
+    return rc == ESP_TLS_ERR_SSL_WANT_READ || rc == ESP_TLS_ERR_SSL_WANT_WRITE;
+}
 
-    http2_session_t* session = (http2_session_t*) user_data;
+// Write `length` bytes in full records. Returns how many were written, which is
+// less than `length` when the socket would block. The record mbedtls is
+// interrupted in counts as written, as it holds on to it; the interrupted write
+// is repeated first on the next call.
+static ssize_t http2_tls_write_(struct http2_conn* conn, const uint8_t* data, size_t length)
+{
+    if (conn->tx_retry_length > 0) {
+        ssize_t sent = esp_tls_conn_write(conn->tls, conn->tx_retry, conn->tx_retry_length);
 
-    ssize_t rc = 0;
-    int cursor = 0;
+        if (sent < 0) {
+            return http2_tls_would_block_(sent) ? 0 : NGHTTP2_ERR_CALLBACK_FAILURE;
+        }
+
+        conn->tx_retry = NULL;
+        conn->tx_retry_length = 0;
+    }
 
-    while (cursor != length) {
+    size_t cursor = 0;
+
+    while (cursor < length) {
         size_t left = length - cursor;
-        size_t chunklen = left > HTTP2_WRITE_CHUNK_LEN ? HTTP2_WRITE_CHUNK_LEN : left;
+        size_t chunklen = left > HTTP2_TLS_RECORD_LEN ? HTTP2_TLS_RECORD_LEN : left;
 
-        int sent = esp_tls_conn_write(session->tls, data, chunklen);
-        cursor += sent;
+        ssize_t sent = esp_tls_conn_write(conn->tls, &data[cursor], chunklen);
 
         if (sent < 0) {
-            if (sent == ESP_TLS_ERR_SSL_WANT_READ || sent == ESP_TLS_ERR_SSL_WANT_WRITE) {
-                return NGHTTP2_ERR_WOULDBLOCK;
+            if (http2_tls_would_block_(sent)) {
+                conn->tx_retry = &data[cursor];
+                conn->tx_retry_length = chunklen;
+                cursor += chunklen;
+                break;
             }
 
             return NGHTTP2_ERR_CALLBACK_FAILURE;
         }
 
-        rc += sent;
+        cursor += sent;
     }
 
-    return rc;
+    http2_stats_.bytes_sent += cursor;
+    return (ssize_t) cursor;
+}
+
+static bool http2_tx_pending_(struct http2_conn* conn)
+{
+    return http2_tx_owner_ == conn || conn->tx_retry_length > 0;
+}
+
+static void http2_tx_discard_(struct http2_conn* conn)
+{
+    if (http2_tx_owner_ == conn) {
+        http2_tx_owner_ = NULL;
+        http2_tx_length_ = 0;
+        http2_tx_cursor_ = 0;
+    }
+}
+
+// Write out the staged record, and the interrupted one if any. Returns
+// ESP_ERR_NOT_FINISHED when the socket would block.
+static esp_err_t http2_tx_flush_(struct http2_conn* conn)
+{
+    if (!http2_tx_pending_(conn)) {
+        return ESP_OK;
+    }
+
+    if (http2_tx_owner_ == conn) {
+        ssize_t sent = http2_tls_write_(conn, &http2_tx_buffer_[http2_tx_cursor_], http2_tx_length_ - http2_tx_cursor_);
+
+        if (sent < 0) {
+            return ESP_FAIL;
+        }
+
+        http2_tx_cursor_ += sent;
+
+        if (http2_tx_cursor_ < http2_tx_length_) {
+            return ESP_ERR_NOT_FINISHED;
+        }
+
+        http2_tx_discard_(conn);
+    } else if (http2_tls_write_(conn, NULL, 0) < 0) {
+        return ESP_FAIL;
+    }
+
+    return conn->tx_retry_length > 0 ? ESP_ERR_NOT_FINISHED : ESP_OK;
+}
+
+// Copy up to `length` bytes into the staged record, flushing it first if it
+// is full. Returns how many bytes were taken.
+static ssize_t http2_tx_stage_(struct http2_conn* conn, const uint8_t* data, size_t length)
+{
+    if (http2_tx_owner_ != NULL && http2_tx_owner_ != conn) {
+        // Another connection is waiting for its socket
+        return NGHTTP2_ERR_WOULDBLOCK;
+    }
+
+    if (http2_tx_length_ == sizeof(http2_tx_buffer_)) {
+        esp_err_t rc = http2_tx_flush_(conn);
+
+        if (rc != ESP_OK) {
+            return rc == ESP_ERR_NOT_FINISHED ? NGHTTP2_ERR_WOULDBLOCK : NGHTTP2_ERR_CALLBACK_FAILURE;
+        }
+    }
+
+    size_t taken = sizeof(http2_tx_buffer_) - http2_tx_length_;
+    if (taken > length) {
+        taken = length;
+    }
+
+    memcpy(&http2_tx_buffer_[http2_tx_length_], data, taken);
+    http2_tx_length_ += taken;
+    http2_tx_owner_ = conn;
+
+    return (ssize_t) taken;
+}
+
+// Stage small writes, and write large ones straight from the caller's buffer
+// once whatever is staged went out.
+static ssize_t http2_tx_write_(struct http2_conn* conn, const uint8_t* data, size_t length)
+{
+    if (length <= sizeof(http2_tx_buffer_) - http2_tx_length_) {
+        return http2_tx_stage_(conn, data, length);
+    }
+
+    esp_err_t rc = http2_tx_flush_(conn);
+
+    if (rc != ESP_OK) {
+        return rc == ESP_ERR_NOT_FINISHED ? NGHTTP2_ERR_WOULDBLOCK : NGHTTP2_ERR_CALLBACK_FAILURE;
+    }
+
+    // Nothing is pending after the flush, so a record is always taken
+    return http2_tls_write_(conn, data, length);
+}
+
+// Frames other than DATA are serialized by nghttp2 and usually small. They are
+// coalesced into as few records as possible.
+static ssize_t http2_tls_send_(nghttp2_session* ng, const uint8_t* data, size_t length, int flags, void* user_data)
+{
+    (void) ng;
+    (void) flags;
+
+    struct http2_conn* conn = (struct http2_conn*) user_data;
+
+    ssize_t rc = 0;
+    size_t cursor = 0;
+
+    while (cursor < length) {
+        rc = http2_tx_stage_(conn, &data[cursor], length - cursor);
+
+        if (rc < 0) {
+            break;
+        }
+
+        cursor += rc;
+    }
+
+    return cursor > 0 ? (ssize_t) cursor : rc;
 }
 
 static ssize_t http2_tls_recv_(nghttp2_session* ng, uint8_t* buf, size_t length, int flags, void* user_data)
@@ -178,9 +471,9 @@ static ssize_t http2_tls_recv_(nghttp2_session* ng, uint8_t* buf, size_t length,
     (void) ng;
     (void) flags;
 
-    http2_session_t* session = (http2_session_t*) user_data;
+    struct http2_conn* conn = (struct http2_conn*) user_data;
 
-    ssize_t rc = esp_tls_conn_read(session->tls, buf, length);
+    ssize_t rc = esp_tls_conn_read(conn->tls, buf, length);
 
     if (rc < 0) {
         if (rc == ESP_TLS_ERR_SSL_WANT_READ || rc == ESP_TLS_ERR_SSL_WANT_WRITE) {
@@ -194,6 +487,8 @@ static ssize_t http2_tls_recv_(nghttp2_session* ng, uint8_t* buf, size_t length,
         return NGHTTP2_ERR_EOF;
     }
 
+    conn->last_activity = esp_timer_get_time();
+    http2_stats_.bytes_received += rc;
     return rc;
 }
 
@@ -213,98 +508,286 @@ static nghttp2_nv http2_make_header_static_(const char* name, const char* value)
     return http2_make_header_with_flag_(name, value, NGHTTP2_NV_FLAG_NO_COPY_NAME | NGHTTP2_NV_FLAG_NO_COPY_VALUE);
 }
 
-ssize_t http2_data_provider_(nghttp2_session* ng, int32_t stream_id, uint8_t* buf, size_t length, uint32_t* data_flags, nghttp2_data_source* source, void* user_data)
+// Free the stream's slot and hand its status to the requestor. The callback
+// may start a new request, so the slot is released first.
+static void http2_stream_complete_(struct http2_stream* stream, int32_t status)
+{
+    http2_perform_callback_t callback = stream->callback;
+    void* arg = stream->arg;
+
+    if (stream->conn != NULL && stream->conn->ng != NULL && stream->stream_id > 0) {
+        nghttp2_session_set_stream_user_data(stream->conn->ng, stream->stream_id, NULL);
+    }
+
+    memset(stream, 0, sizeof(struct http2_stream));
+
+    if (callback != NULL) {
+        callback(status, arg);
+    }
+}
+
+static struct http2_stream* http2_stream_find_(http2_request_id_t request_id)
+{
+    for (size_t i = 0; i < CONFIG_HTTP2_MAX_CONCURRENT_STREAMS; i++) {
+        if (http2_streams_[i].in_use && http2_streams_[i].request_id == request_id) {
+            return &http2_streams_[i];
+        }
+    }
+
+    return NULL;
+}
+
+static size_t http2_conn_count_streams_(struct http2_conn* conn)
+{
+    size_t count = 0;
+
+    for (size_t i = 0; i < CONFIG_HTTP2_MAX_CONCURRENT_STREAMS; i++) {
+        if (http2_streams_[i].in_use && http2_streams_[i].conn == conn) {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+// A flat payload is not copied into nghttp2's buffers: we only tell it how
+// much goes in the next DATA frame, and http2_send_data_ writes it to TLS. A
+// request source is serialized straight into nghttp2's frame buffer.
+static ssize_t http2_data_provider_(nghttp2_session* ng, int32_t stream_id, uint8_t* buf, size_t length, uint32_t* data_flags, nghttp2_data_source* source, void* user_data)
 {
-    (void) stream_id;
-    (void) ng;
     (void) source;
+    (void) user_data;
+
+    // The request may have been cancelled, and its slot reused, since the
+    // data was submitted.
+    struct http2_stream* stream = nghttp2_session_get_stream_user_data(ng, stream_id);
 
-    http2_session_t* session = (http2_session_t*) user_data;
+    if (stream == NULL) {
+        return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+    }
 
-    size_t to_write = session->payload_length - session->payload_cursor;
+    size_t to_write = stream->payload_length - stream->payload_cursor;
     if (to_write > length) {
         to_write = length;
     }
 
-    memcpy(buf, &session->payload[session->payload_cursor], to_write);
-    session->payload_cursor += to_write;
+    if (stream->source != NULL && to_write > 0) {
+        ssize_t produced = stream->source(buf, to_write, stream->source_arg);
+
+        // The source must produce exactly payload_length bytes
+        if (produced <= 0 || (size_t) produced > to_write) {
+            ESP_LOGE(TAG, "request source failed on stream %" PRId32, stream_id);
+            return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+        }
+
+        to_write = (size_t) produced;
+        stream->payload_cursor += to_write;
+
+        if (stream->payload_cursor == stream->payload_length) {
+            (*data_flags |= NGHTTP2_DATA_FLAG_EOF);
+        }
+
+        return (ssize_t) to_write;
+    }
+
+    (*data_flags |= NGHTTP2_DATA_FLAG_NO_COPY);
 
-    if (to_write <= length) {
+    if (stream->payload_cursor + to_write == stream->payload_length) {
         (*data_flags |= NGHTTP2_DATA_FLAG_EOF);
     }
 
     return (ssize_t) to_write;
 }
 
+static esp_err_t http2_send_data_(nghttp2_session* ng, nghttp2_frame* frame, const uint8_t* framehd, size_t length, nghttp2_data_source* source, void* user_data)
+{
+    (void) source;
+
+    struct http2_conn* conn = (struct http2_conn*) user_data;
+    struct http2_stream* stream = nghttp2_session_get_stream_user_data(ng, frame->hd.stream_id);
+
+    size_t total = HTTP2_FRAME_HEADER_LEN + length;
+
+    if (stream == NULL && conn->tx_frame_sent == 0) {
+        // Cancelled before anything went out, nghttp2 resets the stream
+        return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+    }
+
+    while (conn->tx_frame_sent < total) {
+        size_t offset = conn->tx_frame_sent;
+        ssize_t rc = 0;
+
+        if (offset < HTTP2_FRAME_HEADER_LEN) {
+            rc = http2_tx_stage_(conn, &framehd[offset], HTTP2_FRAME_HEADER_LEN - offset);
+        } else if (stream != NULL) {
+            rc = http2_tx_write_(conn, (const uint8_t*) &stream->payload[stream->payload_cursor + offset - HTTP2_FRAME_HEADER_LEN], total - offset);
+        } else {
+            // The frame was partly written when its stream was cancelled, and
+            // the payload may be gone. Its length is fixed, so fill it in.
+            size_t left = total - offset;
+            rc = http2_tx_write_(conn, http2_tx_padding_, left > sizeof(http2_tx_padding_) ? sizeof(http2_tx_padding_) : left);
+        }
+
+        if (rc < 0) {
+            return (esp_err_t) rc;
+        }
+
+        conn->tx_frame_sent += rc;
+    }
+
+    conn->tx_frame_sent = 0;
+
+    if (stream != NULL) {
+        stream->payload_cursor += length;
+    }
+
+    return 0;
+}
+
 static esp_err_t http2_on_data_(nghttp2_session* ng, uint8_t flags, int32_t stream_id, const uint8_t* data, size_t len, void* user_data)
 {
-    (void) ng;
     (void) flags;
-    (void) stream_id;
+    (void) user_data;
+
+    struct http2_stream* stream = nghttp2_session_get_stream_user_data(ng, stream_id);
+
+    if (stream == NULL) {
+        return ESP_OK;
+    }
 
-    http2_session_t* session = (http2_session_t*) user_data;
+    esp_err_t rc = ESP_OK;
 
-    if (len > (session->dest_length - session->dest_cursor - 1)) {
+    if (stream->sink != NULL) {
+        rc = stream->sink(data, len, stream->sink_arg);
+    } else if (len < stream->dest_length - stream->dest_cursor) {
+        // Always leaves room for the NULL terminator
+        memcpy(&stream->dest[stream->dest_cursor], data, len);
+        stream->dest_cursor += len;
+        stream->dest[stream->dest_cursor] = 0;
+        ESP_LOGD(TAG, "received: %.*s", (int) len, (char*) data);
+    } else {
         ESP_LOGE(TAG, "destination buffer to small for response");
-        return NGHTTP2_ERR_CALLBACK_FAILURE;
+        rc = ESP_FAIL;
     }
 
-    memcpy(&session->dest[session->dest_cursor], data, len);
-    session->dest_cursor += len;
-    session->dest[session->dest_cursor + 1] = 0;
-    ESP_LOGD(TAG, "received: %.*s", len, (char*) data);
+    // Only this stream is affected, the connection carries on
+    if (rc != ESP_OK) {
+        nghttp2_submit_rst_stream(ng, NGHTTP2_FLAG_NONE, stream_id, NGHTTP2_INTERNAL_ERROR);
+        http2_stream_complete_(stream, HTTP2_STATUS_LOCAL_ERROR);
+    }
 
     return ESP_OK;
 }
 
 static esp_err_t http2_on_header_(nghttp2_session* ng, const nghttp2_frame* frame, const uint8_t* name, size_t namelen, const uint8_t* value, size_t valuelen, uint8_t flags, void* user_data)
 {
-    (void) ng;
-    (void) frame;
     (void) flags;
     (void) user_data;
 
-    http2_session_t* session = (http2_session_t*) user_data;
+    struct http2_stream* stream = nghttp2_session_get_stream_user_data(ng, frame->hd.stream_id);
+
+    if (stream == NULL) {
+        return ESP_OK;
+    }
+
+    if (stream->submitted != 0) {
+        http2_stats_.first_byte_time = esp_timer_get_time() - stream->submitted;
+        stream->submitted = 0;
+    }
 
-    const char* status_header = session->use_grpc_status ? "grpc-status" : ":status";
+    const char* status_header = stream->use_grpc_status ? "grpc-status" : ":status";
 
-    if (strncmp((const char*) name, status_header, namelen) == 0) {
-        int status = (int) strtol((const char*) value, NULL, 10);
+    // Whole values only: a prefix of the name, or an empty or partly numeric
+    // value, is not a status
+    if (namelen == strlen(status_header) && strncmp((const char*) name, status_header, namelen) == 0) {
+        char* end = NULL;
+        long status = strtol((const char*) value, &end, 10);
 
-        if (status != 0 || (session->use_grpc_status && strncmp((const char*) value, "0", valuelen) == 0)) {
-            session->status = status;
+        if (end == (const char*) value + valuelen && valuelen > 0 && status >= 0 && status <= INT32_MAX && (status != 0 || stream->use_grpc_status)) {
+            stream->status = (int) status;
         }
     }
 
+    if (stream->retry_pushback != NULL && namelen == strlen("grpc-retry-pushback-ms") && strncmp((const char*) name, "grpc-retry-pushback-ms", namelen) == 0) {
+        char* end = NULL;
+        long pushback = strtol((const char*) value, &end, 10);
+
+        *stream->retry_pushback = (end == (const char*) value + valuelen && valuelen > 0 && pushback >= 0 && pushback <= INT32_MAX) ? (int32_t) pushback : -1;
+    }
+
     ESP_LOGD(TAG, "%s: %s", name, value);
     return ESP_OK;
 }
 
 static esp_err_t http2_on_stream_close_(nghttp2_session* ng, int32_t stream_id, uint32_t error_code, void* user_data)
 {
-    (void) ng;
-    (void) stream_id;
     (void) error_code;
+    (void) user_data;
+
+    struct http2_stream* stream = nghttp2_session_get_stream_user_data(ng, stream_id);
 
-    http2_session_t* session = (http2_session_t*) user_data;
-    session->complete = true;
+    if (stream != NULL) {
+        http2_stream_complete_(stream, stream->status);
+    }
 
-    ESP_LOGD(TAG, "stream closed");
+    ESP_LOGD(TAG, "stream %" PRId32 " closed", stream_id);
     return ESP_OK;
 }
 
-static esp_err_t http2_tls_init_(http2_session_t* session)
+static esp_err_t http2_on_frame_recv_(nghttp2_session* ng, const nghttp2_frame* frame, void* user_data)
+{
+    (void) ng;
+
+    struct http2_conn* conn = (struct http2_conn*) user_data;
+
+    if (frame->hd.type == NGHTTP2_PING && (frame->hd.flags & NGHTTP2_FLAG_ACK) && conn->ping_sent != 0) {
+        int64_t rtt = esp_timer_get_time() - conn->ping_sent;
+        conn->ping_submitted = 0;
+        conn->ping_sent = 0;
+
+        if (http2_stats_.ping_srtt == 0) {
+            http2_stats_.ping_srtt = rtt;
+        } else {
+            http2_stats_.ping_srtt += (rtt - http2_stats_.ping_srtt) >> HTTP2_RTT_SMOOTHING_SHIFT;
+        }
+
+        http2_stats_.ping_rtt = rtt;
+        ESP_LOGD(TAG, "PING rtt=%" PRId64 "us", rtt);
+    } else if (frame->hd.type == NGHTTP2_GOAWAY) {
+        ESP_LOGI(TAG, "GOAWAY from %s (last stream %" PRId32 ", error %" PRIu32 ")", conn->session->hostname, frame->goaway.last_stream_id, frame->goaway.error_code);
+        conn->goaway = true;
+        http2_stats_.goaways++;
+    }
+
+    return 0;
+}
+
+// Called once a frame is handed to http2_tls_send_, which stages it
+static esp_err_t http2_on_frame_send_(nghttp2_session* ng, const nghttp2_frame* frame, void* user_data)
+{
+    (void) ng;
+
+    struct http2_conn* conn = (struct http2_conn*) user_data;
+
+    if (frame->hd.type == NGHTTP2_PING && !(frame->hd.flags & NGHTTP2_FLAG_ACK)) {
+        conn->ping_staged = true;
+    }
+
+    return 0;
+}
+
+static esp_err_t http2_tls_init_(struct http2_conn* conn)
 {
-    session->tls = esp_tls_init();
+    conn->tls = esp_tls_init();
 
-    if (session->tls == NULL) {
+    if (conn->tls == NULL) {
         return ESP_FAIL;
     }
 
     return ESP_OK;
 }
 
-static esp_err_t http2_ng_init_(http2_session_t* session)
+static esp_err_t http2_ng_init_(struct http2_conn* conn)
 {
     esp_err_t rc = ESP_OK;
     nghttp2_session_callbacks* callbacks;
@@ -318,13 +801,16 @@ static esp_err_t http2_ng_init_(http2_session_t* session)
     }
 
     nghttp2_session_callbacks_set_send_callback(callbacks, http2_tls_send_);
+    nghttp2_session_callbacks_set_send_data_callback(callbacks, http2_send_data_);
     nghttp2_session_callbacks_set_recv_callback(callbacks, http2_tls_recv_);
 
     nghttp2_session_callbacks_set_on_header_callback(callbacks, http2_on_header_);
     nghttp2_session_callbacks_set_on_data_chunk_recv_callback(callbacks, http2_on_data_);
     nghttp2_session_callbacks_set_on_stream_close_callback(callbacks, http2_on_stream_close_);
+    nghttp2_session_callbacks_set_on_frame_recv_callback(callbacks, http2_on_frame_recv_);
+    nghttp2_session_callbacks_set_on_frame_send_callback(callbacks, http2_on_frame_send_);
 
-    rc = nghttp2_session_client_new3(&session->ng, callbacks, session, NULL, &nghttp2_mem_);
+    rc = nghttp2_session_client_new3(&conn->ng, callbacks, conn, NULL, &nghttp2_mem_);
 
     if (rc != NGHTTP2_NO_ERROR) {
         ESP_LOGE(TAG, "nghttp2_session_client_new rc=%d", rc);
@@ -337,129 +823,810 @@ exit:
     return rc;
 }
 
-static esp_err_t http2_session_connect_internal_(http2_session_t* session, const char* hostname, uint16_t port, const char* common_name)
+// Submit the stream's headers on its connection, which must be established
+static esp_err_t http2_stream_open_(struct http2_stream* stream, int64_t now)
 {
-    size_t hostname_length = strlen(hostname);
-
-    static const char* alpn_protos[] = { "h2", NULL };
+    char content_length[10] = { 0 };
+    snprintf(content_length, 10, "%zu", stream->payload_length);
 
-    esp_tls_cfg_t config = {
-        .alpn_protos = alpn_protos,
-        .non_block = true,
-        .timeout_ms = INT32_MAX,
-        .common_name = common_name,
-        .crt_bundle_attach = esp_crt_bundle_attach,
+    nghttp2_nv headers[10] = {
+        http2_make_header_(":method", stream->method),
+        http2_make_header_static_(":scheme", "https"),
+        http2_make_header_(":path", stream->path),
+        http2_make_header_static_(":authority", stream->authority),
+        http2_make_header_("content-length", content_length),
+        http2_make_header_("content-type", stream->content_type),
+        http2_make_header_("authorization", stream->authorization),
+        http2_make_header_static_("user-agent", "esp32s2; nghttp2; ganymede"),
+        http2_make_header_static_("te", "trailers")
     };
+    size_t header_count = 9;
 
-    ESP_LOGD(TAG, "Trying connection to %s (common_name: %s)", hostname, common_name ? common_name : hostname);
+    // Let the server give up on the call when we do
+    char grpc_timeout[12] = { 0 };
 
-    int state = 0;
-    while (state == 0) {
-        // The _sync version of this function uses gettimeofday to check the connection timeout. This breaks
-        // when you set the correct time as int32 is too small for the current unix time (in ms).
-        state = esp_tls_conn_new_async(hostname, (int) hostname_length, port, &config, session->tls);
+    if (stream->use_grpc_status) {
+        int64_t timeout_ms = (stream->deadline - now + 999) / 1000;
+        snprintf(grpc_timeout, sizeof(grpc_timeout), "%" PRId32 "m", (int32_t) (timeout_ms > HTTP2_GRPC_TIMEOUT_MAX ? HTTP2_GRPC_TIMEOUT_MAX : timeout_ms));
+        headers[header_count++] = http2_make_header_("grpc-timeout", grpc_timeout);
     }
 
-    if (state == -1) {
-        return ESP_FAIL;
-    }
-
-    ESP_LOGD(TAG, "connected");
-    return nghttp2_submit_settings(session->ng, NGHTTP2_FLAG_NONE, NULL, 0);
-}
-
-static esp_err_t http2_session_check_tls_conn_(http2_session_t* session)
-{
-    esp_tls_conn_state_t state;
+    nghttp2_data_provider provider = {
+        .read_callback = http2_data_provider_
+    };
 
-    if (esp_tls_get_conn_state(session->tls, &state) != ESP_OK || state != ESP_TLS_DONE) {
+    int32_t stream_id = nghttp2_submit_request(stream->conn->ng, NULL, headers, header_count, &provider, stream);
+    if (stream_id < 0) {
+        ESP_LOGE(TAG, "submit_request failed: %s", nghttp2_strerror(stream_id));
         return ESP_FAIL;
     }
 
+    stream->stream_id = stream_id;
+    stream->submitted = now;
+
+    ESP_LOGD(TAG, "%s %s%s (stream %" PRId32 ")", stream->method, stream->authority, stream->path, stream_id);
     return ESP_OK;
 }
 
-static esp_err_t http2_session_perform_internal_(http2_session_t* session, const char* method, const char* authority, const char* path, const char* payload, size_t payload_len, char* dest, size_t dest_len, const struct http_perform_options options)
+// Take the connection one step further: TCP connection, then TLS handshake.
+// Returns ESP_ERR_NOT_FINISHED until the handshake is done, and opens the
+// streams waiting for it then.
+static esp_err_t http2_conn_connect_step_(struct http2_conn* conn)
 {
-    if (session == NULL) {
-        return ESP_FAIL;
+    // Looked up again every step, as another connection to the host may have
+    // replaced the cached session meanwhile
+    conn->tls_config.client_session = tls_cache_get(conn->hostname, conn->port);
+
+    // The _sync version of this function uses gettimeofday to check the connection timeout. This breaks
+    // when you set the correct time as int32 is too small for the current unix time (in ms).
+    int state = esp_tls_conn_new_async(conn->hostname, (int) strlen(conn->hostname), conn->port, &conn->tls_config, conn->tls);
+    int64_t now = esp_timer_get_time();
+
+    if (state == 0 && now >= conn->connect_deadline) {
+        ESP_LOGE(TAG, "connection to %s timed out", conn->hostname);
+        state = -1;
     }
 
-    if (http2_session_check_tls_conn_(session) != ESP_OK) {
-        ESP_LOGE(TAG, "TLS connection not ok");
-        return ESP_FAIL;
+    if (state == 0) {
+        return ESP_ERR_NOT_FINISHED;
     }
 
-    session->payload = (char*) payload;
-    session->payload_length = payload_len;
-    session->payload_cursor = 0;
-
-    session->dest = dest;
-    session->dest_length = dest_len;
-    session->dest_cursor = 0;
+    if (state == -1) {
+        // The server may have rejected our cached session, start from scratch
+        // next time.
+        tls_cache_invalidate(conn->hostname, conn->port);
+        ESP_LOGE(TAG, "failed to connect to %s:%u", conn->hostname, conn->port);
+        return ESP_FAIL;
+    }
 
-    session->use_grpc_status = options.use_grpc_status;
+    tls_cache_update(conn->hostname, conn->port, conn->tls);
+    conn->connecting = false;
+    conn->last_activity = now;
+    http2_stats_.handshake_time = now - conn->connect_started;
 
-    session->status = -1;
-    session->complete = false;
+    ESP_LOGD(TAG, "connected to %s:%u", conn->hostname, conn->port);
 
-    char content_length[10] = { 0 };
-    snprintf(content_length, 10, "%u", session->payload_length);
+    if (nghttp2_submit_settings(conn->ng, NGHTTP2_FLAG_NONE, NULL, 0) != 0) {
+        return ESP_FAIL;
+    }
 
-    nghttp2_nv headers[] = {
-        http2_make_header_(":method", method),
-        http2_make_header_static_(":scheme", "https"),
-        http2_make_header_(":path", path),
-        http2_make_header_static_(":authority", authority),
-        http2_make_header_("content-length", content_length),
-        http2_make_header_("content-type", options.content_type),
-        http2_make_header_("authorization", options.authorization),
-        http2_make_header_static_("user-agent", "esp32s2; nghttp2; ganymede"),
-        http2_make_header_static_("te", "trailers")
+    for (size_t i = 0; i < CONFIG_HTTP2_MAX_CONCURRENT_STREAMS; i++) {
+        struct http2_stream* stream = &http2_streams_[i];
+
+        if (stream->in_use && stream->conn == conn && stream->stream_id == 0 && http2_stream_open_(stream, now) != ESP_OK) {
+            http2_stream_complete_(stream, HTTP2_STATUS_LOCAL_ERROR);
+        }
+    }
+
+    return ESP_OK;
+}
+
+// Start dialing. The rest of the connection is driven by the http2 task's
+// loop, see http2_conn_connect_step_.
+static esp_err_t http2_conn_start_connect_(struct http2_conn* conn, const char* hostname, const char* common_name, uint16_t port)
+{
+    static const char* alpn_protos[] = { "h2", NULL };
+
+    memcpy(conn->hostname, hostname, sizeof(conn->hostname));
+    memcpy(conn->common_name, common_name, sizeof(conn->common_name));
+    conn->port = port;
+
+    conn->tls_config = (esp_tls_cfg_t) {
+        .alpn_protos = alpn_protos,
+        .non_block = true,
+        .timeout_ms = INT32_MAX,
+        .common_name = conn->common_name[0] != '\0' ? conn->common_name : NULL,
+        .crt_bundle_attach = tls_cache_crt_bundle_attach,
     };
 
-    nghttp2_data_provider provider = {
-        .read_callback = http2_data_provider_
+    ESP_LOGD(TAG, "Trying connection to %s (common_name: %s)", hostname, conn->common_name[0] != '\0' ? conn->common_name : hostname);
+
+    conn->connecting = true;
+    conn->connect_started = esp_timer_get_time();
+    conn->connect_deadline = conn->connect_started + HTTP2_CONNECT_TIMEOUT;
+
+    return http2_conn_connect_step_(conn) == ESP_FAIL ? ESP_FAIL : ESP_OK;
+}
+
+static esp_err_t http2_conn_check_tls_(struct http2_conn* conn)
+{
+    esp_tls_conn_state_t state;
+
+    if (esp_tls_get_conn_state(conn->tls, &state) != ESP_OK || state != ESP_TLS_DONE) {
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+static void http2_conn_close_(struct http2_conn* conn)
+{
+    // Whatever is still in flight on this connection is lost
+    for (size_t i = 0; i < CONFIG_HTTP2_MAX_CONCURRENT_STREAMS; i++) {
+        if (http2_streams_[i].in_use && http2_streams_[i].conn == conn) {
+            http2_stream_complete_(&http2_streams_[i], HTTP2_STATUS_LOCAL_ERROR);
+        }
+    }
+
+    if (conn->ng != NULL) {
+        nghttp2_session_del(conn->ng);
+        conn->ng = NULL;
+    }
+
+    if (conn->tls != NULL) {
+        esp_tls_conn_destroy(conn->tls);
+        conn->tls = NULL;
+    }
+
+    http2_tx_discard_(conn);
+
+    conn->connecting = false;
+    conn->ping_submitted = 0;
+    conn->ping_staged = false;
+    conn->ping_sent = 0;
+    conn->goaway = false;
+    conn->tx_frame_sent = 0;
+    conn->tx_retry = NULL;
+    conn->tx_retry_length = 0;
+}
+
+static bool http2_conn_is_alive_(struct http2_conn* conn)
+{
+    if (conn->tls == NULL || conn->ng == NULL || conn->goaway) {
+        return false;
+    }
+
+    if (http2_conn_check_tls_(conn) != ESP_OK) {
+        return false;
+    }
+
+    // Consume whatever the server sent since the connection was last driven.
+    // The socket is non-blocking, so this returns immediately when there is
+    // nothing to read. A GOAWAY or a closed socket shows up here.
+    if (nghttp2_session_recv(conn->ng) != NGHTTP2_NO_ERROR || conn->goaway) {
+        return false;
+    }
+
+    return nghttp2_session_want_read(conn->ng) || nghttp2_session_want_write(conn->ng);
+}
+
+static struct http2_conn* http2_session_active_(http2_session_t* session)
+{
+    return &session->conns[session->active];
+}
+
+static void http2_session_close_(http2_session_t* session)
+{
+    http2_conn_close_(&session->conns[0]);
+    http2_conn_close_(&session->conns[1]);
+}
+
+static size_t http2_pool_count_conns_(void)
+{
+    size_t count = 0;
+
+    for (size_t i = 0; i < CONFIG_HTTP2_POOL_SIZE; i++) {
+        count += (http2_pool_[i].conns[0].ng != NULL) + (http2_pool_[i].conns[1].ng != NULL);
+    }
+
+    return count;
+}
+
+// Stop opening streams on the active connection. If it still has streams in
+// flight, they are left to drain while the other connection becomes active,
+// provided the arena can hold the replacement alongside.
+static void http2_session_retire_active_(http2_session_t* session)
+{
+    struct http2_conn* conn = http2_session_active_(session);
+
+    if (conn->ng == NULL || http2_conn_count_streams_(conn) == 0) {
+        http2_conn_close_(conn);
+        return;
+    }
+
+    // The draining connection is about to be replaced, so it doesn't count
+    size_t open = http2_pool_count_conns_() - (session->conns[session->active ^ 1].ng != NULL);
+
+    if (open >= HTTP2_ARENA_CONNECTIONS) {
+        ESP_LOGW(TAG, "no room in the arena to drain connection, closing it");
+        http2_conn_close_(conn);
+        return;
+    }
+
+    // Only one connection drains at a time
+    session->active ^= 1;
+    http2_conn_close_(http2_session_active_(session));
+}
+
+// Close the connections dialed for the previous key of a recycled session.
+// Must be called with the pool mutex.
+static void http2_session_close_stale_(http2_session_t* session)
+{
+    for (size_t i = 0; i < 2; i++) {
+        if (session->conns[i].tls != NULL && session->conns[i].generation != session->generation) {
+            http2_conn_close_(&session->conns[i]);
+        }
+    }
+}
+
+// Returns ESP_OK when the session's active connection is up, and
+// ESP_ERR_NOT_FINISHED while it is being established. Works on a copy of the
+// key, as DNS resolution blocks and callers acquiring sessions would otherwise
+// wait on it. A connection dialed for a key the slot has since been recycled
+// from is closed by http2_session_close_stale_.
+static esp_err_t http2_session_ensure_connected_(http2_session_t* session)
+{
+    char hostname[HTTP2_POOL_HOSTNAME_LEN];
+    char common_name[HTTP2_POOL_HOSTNAME_LEN];
+
+    xSemaphoreTakeRecursive(http2_pool_mutex_, portMAX_DELAY);
+
+    http2_session_close_stale_(session);
+
+    memcpy(hostname, session->hostname, sizeof(hostname));
+    memcpy(common_name, session->common_name, sizeof(common_name));
+    uint16_t port = session->port;
+    uint32_t generation = session->generation;
+
+    xSemaphoreGiveRecursive(http2_pool_mutex_);
+
+    struct http2_conn* conn = http2_session_active_(session);
+
+    if (conn->connecting) {
+        return ESP_ERR_NOT_FINISHED;
+    }
+
+    if (http2_conn_is_alive_(conn)) {
+        ESP_LOGD(TAG, "reusing session to %s:%u", hostname, port);
+        return ESP_OK;
+    }
+
+    http2_session_retire_active_(session);
+    conn = http2_session_active_(session);
+    conn->session = session;
+    conn->generation = generation;
+
+    if (http2_tls_init_(conn) != ESP_OK) {
+        ESP_LOGE(TAG, "tls initialization failed");
+        return ESP_FAIL;
+    }
+
+    if (http2_ng_init_(conn) != ESP_OK) {
+        ESP_LOGE(TAG, "http2 library initialization failed");
+        http2_conn_close_(conn);
+        return ESP_FAIL;
+    }
+
+    if (http2_conn_start_connect_(conn, hostname, common_name, port) != ESP_OK) {
+        http2_conn_close_(conn);
+        return ESP_FAIL;
+    }
+
+    return conn->connecting ? ESP_ERR_NOT_FINISHED : ESP_OK;
+}
+
+// Close idle sessions that have not been used for too long, or all idle
+// sessions when the heap is running low. Must be called from the http2 task,
+// with the pool mutex.
+static void http2_pool_sweep_(void)
+{
+    int64_t now = esp_timer_get_time();
+    bool low_memory = heap_caps_get_free_size(MALLOC_CAP_DEFAULT) < CONFIG_HTTP2_POOL_MIN_FREE_HEAP;
+
+    for (size_t i = 0; i < CONFIG_HTTP2_POOL_SIZE; i++) {
+        http2_session_t* session = &http2_pool_[i];
+
+        http2_session_close_stale_(session);
+
+        if (session->users > 0 || (session->conns[0].tls == NULL && session->conns[1].tls == NULL)) {
+            continue;
+        }
+
+        if (low_memory || now - session->last_used > (int64_t) CONFIG_HTTP2_POOL_IDLE_TIMEOUT * 1000 * 1000) {
+            ESP_LOGD(TAG, "evicting idle session to %s:%u", session->hostname, session->port);
+            http2_session_close_(session);
+        }
+    }
+}
+
+static http2_session_t* http2_pool_find_(const char* hostname, uint16_t port, const char* common_name)
+{
+    http2_session_t* lru = NULL;
+
+    for (size_t i = 0; i < CONFIG_HTTP2_POOL_SIZE; i++) {
+        http2_session_t* session = &http2_pool_[i];
+
+        if (session->port == port && strcmp(session->hostname, hostname) == 0 && strcmp(session->common_name, common_name) == 0) {
+            return session;
+        }
+
+        if (session->users == 0 && (lru == NULL || session->last_used < lru->last_used)) {
+            lru = session;
+        }
+    }
+
+    // No session for this key, recycle the least recently used slot. Its
+    // connections are closed by the http2 task.
+    if (lru != NULL) {
+        lru->generation++;
+        strncpy(lru->hostname, hostname, sizeof(lru->hostname) - 1);
+        strncpy(lru->common_name, common_name, sizeof(lru->common_name) - 1);
+        lru->port = port;
+    }
+
+    return lru;
+}
+
+static esp_err_t http2_session_submit_(struct http2_event_perform* event)
+{
+    http2_session_t* session = event->session;
+
+    int64_t now = esp_timer_get_time();
+    int64_t deadline = event->options.deadline != 0 ? event->options.deadline : now + HTTP2_PERFORM_TIMEOUT;
+
+    if (deadline <= now) {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    size_t slot = 0;
+    while (slot < CONFIG_HTTP2_MAX_CONCURRENT_STREAMS && http2_streams_[slot].in_use) {
+        slot++;
+    }
+
+    if (slot == CONFIG_HTTP2_MAX_CONCURRENT_STREAMS) {
+        ESP_LOGE(TAG, "too many concurrent streams");
+        return ESP_FAIL;
+    }
+
+    // Connections are established lazily, by the first request to use them
+    esp_err_t rc = http2_session_ensure_connected_(session);
+
+    if (rc != ESP_OK && rc != ESP_ERR_NOT_FINISHED) {
+        return ESP_FAIL;
+    }
+
+    struct http2_stream* stream = &http2_streams_[slot];
+
+    *stream = (struct http2_stream) {
+        .in_use = true,
+        .request_id = event->request_id,
+
+        .conn = http2_session_active_(session),
+
+        .method = event->method,
+        .authority = event->authority,
+        .path = event->path,
+        .content_type = event->options.content_type,
+        .authorization = event->options.authorization,
+
+        .callback = event->callback,
+        .arg = event->arg,
+
+        .payload = event->payload,
+        .payload_length = event->payload_length,
+        .source = event->options.source,
+        .source_arg = event->options.source_arg,
+        .dest = event->dest,
+        .dest_length = event->dest_length,
+        .sink = event->options.sink,
+        .sink_arg = event->options.sink_arg,
+
+        .use_grpc_status = event->options.use_grpc_status,
+        .retry_pushback = event->options.retry_pushback,
+        .status = HTTP2_STATUS_LOCAL_ERROR,
+        .deadline = deadline,
     };
 
-    int rc = nghttp2_submit_request(session->ng, NULL, headers, sizeof(headers) / sizeof(nghttp2_nv), &provider, &session);
-    if (rc < 0) {
-        ESP_LOGE(TAG, "submit_request failed: %s", nghttp2_strerror(rc));
-        return -1;
+    // Opened once the handshake is done
+    if (stream->conn->connecting) {
+        ESP_LOGD(TAG, "%s %s%s waiting for connection", event->method, event->authority, event->path);
+        return ESP_OK;
     }
 
-    ESP_LOGD(TAG, "%s %s%s", method, authority, path);
+    if (http2_stream_open_(stream, now) != ESP_OK) {
+        memset(stream, 0, sizeof(struct http2_stream));
+        return ESP_FAIL;
+    }
 
-    int64_t end = esp_timer_get_time() + HTTP2_PERFORM_TIMEOUT;
-    do {
-        rc = nghttp2_session_send(session->ng);
+    return ESP_OK;
+}
 
-        if (rc != NGHTTP2_NO_ERROR) {
-            ESP_LOGE(TAG, "send failed: %s", nghttp2_strerror(rc));
-            break;
+// Reset the streams whose deadline has passed. The connection itself is fine,
+// and stays up for the other streams.
+static void http2_conn_expire_streams_(struct http2_conn* conn, int64_t now)
+{
+    for (size_t i = 0; i < CONFIG_HTTP2_MAX_CONCURRENT_STREAMS; i++) {
+        struct http2_stream* stream = &http2_streams_[i];
+
+        if (stream->in_use && stream->conn == conn && now > stream->deadline) {
+            ESP_LOGW(TAG, "stream %" PRId32 " exceeded its deadline", stream->stream_id);
+
+            // Not opened yet if the connection is still being established
+            if (stream->stream_id > 0) {
+                nghttp2_submit_rst_stream(conn->ng, NGHTTP2_FLAG_NONE, stream->stream_id, NGHTTP2_CANCEL);
+            }
+
+            http2_stream_complete_(stream, HTTP2_STATUS_DEADLINE_EXCEEDED);
         }
+    }
+}
+
+// When the next keepalive PING is due, or when the outstanding one times out
+static int64_t http2_conn_next_keepalive_(struct http2_conn* conn)
+{
+    if (CONFIG_HTTP2_KEEPALIVE_INTERVAL == 0) {
+        return INT64_MAX;
+    }
 
-        rc = nghttp2_session_recv(session->ng);
+    if (conn->ping_submitted != 0) {
+        return conn->ping_submitted + (int64_t) CONFIG_HTTP2_KEEPALIVE_TIMEOUT * 1000 * 1000;
+    }
 
-        if (rc != NGHTTP2_NO_ERROR) {
-            ESP_LOGE(TAG, "recv failed: %s", nghttp2_strerror(rc));
-            break;
+    return conn->last_activity + (int64_t) CONFIG_HTTP2_KEEPALIVE_INTERVAL * 1000 * 1000;
+}
+
+// Send a PING once the connection has been quiet for a while. A connection
+// that doesn't answer in time was dropped along the way, e.g. by a NAT.
+static esp_err_t http2_conn_keepalive_(struct http2_conn* conn, int64_t now)
+{
+    if (now < http2_conn_next_keepalive_(conn)) {
+        return ESP_OK;
+    }
+
+    if (conn->ping_submitted != 0) {
+        ESP_LOGW(TAG, "PING to %s unanswered, closing connection", conn->session->hostname);
+        http2_stats_.pings_lost++;
+        return ESP_FAIL;
+    }
+
+    if (nghttp2_submit_ping(conn->ng, NGHTTP2_FLAG_NONE, NULL) != 0) {
+        return ESP_FAIL;
+    }
+
+    conn->ping_submitted = now;
+    http2_stats_.pings_sent++;
+    return ESP_OK;
+}
+
+static esp_err_t http2_conn_drive_(struct http2_conn* conn, bool active, int64_t now)
+{
+    http2_conn_expire_streams_(conn, now);
+
+    if (conn->connecting) {
+        esp_err_t rc = http2_conn_connect_step_(conn);
+
+        if (rc != ESP_OK) {
+            return rc == ESP_ERR_NOT_FINISHED ? ESP_OK : ESP_FAIL;
+        }
+    }
+
+    // Only the active connection needs to be kept warm, the other one is
+    // closed once drained.
+    if (active && http2_conn_keepalive_(conn, now) != ESP_OK) {
+        return ESP_FAIL;
+    }
+
+    // Whatever nghttp2 sends is staged, then written out once it has nothing
+    // left to add to the record.
+    esp_err_t flushed = http2_tx_flush_(conn);
+    int rc = NGHTTP2_NO_ERROR;
+
+    if (flushed == ESP_OK) {
+        rc = nghttp2_session_send(conn->ng);
+        flushed = http2_tx_flush_(conn);
+    }
+
+    if (rc != NGHTTP2_NO_ERROR || flushed == ESP_FAIL) {
+        ESP_LOGE(TAG, "send failed: %s", nghttp2_strerror(rc));
+        return ESP_FAIL;
+    }
+
+    // The record carrying the PING is out
+    if (conn->ping_staged && !http2_tx_pending_(conn)) {
+        conn->ping_staged = false;
+        conn->ping_sent = esp_timer_get_time();
+    }
+
+    rc = nghttp2_session_recv(conn->ng);
+
+    if (rc != NGHTTP2_NO_ERROR) {
+        ESP_LOGE(TAG, "recv failed: %s", nghttp2_strerror(rc));
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+// A connection lost while the session is in use, or recently used, is
+// replaced so the next request doesn't wait on the handshake. Must be called
+// with the pool mutex.
+static bool http2_session_wants_predial_(http2_session_t* session, int64_t now)
+{
+    return session->users > 0 || now - session->last_used <= (int64_t) CONFIG_HTTP2_POOL_IDLE_TIMEOUT * 1000 * 1000;
+}
+
+static void http2_session_predial_(http2_session_t* session)
+{
+    ESP_LOGD(TAG, "dialing replacement connection");
+
+    if (http2_session_ensure_connected_(session) == ESP_ERR_NOT_FINISHED) {
+        http2_stats_.predials++;
+    }
+}
+
+// Send and receive on every open connection, keep the active ones alive and
+// replace those the server is going away from.
+static void http2_drive_sessions_(void)
+{
+    int64_t now = esp_timer_get_time();
+    bool predial[CONFIG_HTTP2_POOL_SIZE] = { false };
+
+    // Keeps the keys stable for the GOAWAY and keepalive logs, and the
+    // generations for finding stale connections.
+    xSemaphoreTakeRecursive(http2_pool_mutex_, portMAX_DELAY);
+
+    for (size_t i = 0; i < CONFIG_HTTP2_POOL_SIZE; i++) {
+        http2_session_t* session = &http2_pool_[i];
+
+        http2_session_close_stale_(session);
+
+        for (size_t j = 0; j < 2; j++) {
+            struct http2_conn* conn = &session->conns[j];
+            bool active = j == session->active;
+
+            if (conn->ng == NULL) {
+                continue;
+            }
+
+            // A connection that could not be established is not dialed again
+            // until a request needs it
+            bool connecting = conn->connecting;
+            bool failed = http2_conn_drive_(conn, active, now) != ESP_OK;
+
+            if (!failed && !conn->goaway) {
+                continue;
+            }
+
+            if (failed || http2_conn_count_streams_(conn) == 0) {
+                http2_conn_close_(conn);
+            } else if (active) {
+                http2_session_retire_active_(session);
+            }
+
+            if (active && !connecting) {
+                predial[i] = http2_session_wants_predial_(session, now);
+            }
+        }
+    }
+
+    xSemaphoreGiveRecursive(http2_pool_mutex_);
+
+    // Dialed without the pool mutex, callers acquiring sessions meanwhile
+    // would otherwise wait on DNS resolution.
+    for (size_t i = 0; i < CONFIG_HTTP2_POOL_SIZE; i++) {
+        if (predial[i]) {
+            http2_session_predial_(&http2_pool_[i]);
+        }
+    }
+}
+
+// The socket becomes writable once the TCP connection is established. During
+// the handshake, mbedtls mostly waits for input; it is stepped again
+// periodically in case it is waiting to write.
+static void http2_conn_wait_for_handshake_(struct http2_conn* conn, fd_set* readset, fd_set* writeset, int* maxfd, int64_t* deadline)
+{
+    esp_tls_conn_state_t state;
+    int fd = -1;
+    int64_t wake = conn->connect_deadline;
+
+    if (esp_tls_get_conn_state(conn->tls, &state) != ESP_OK || esp_tls_get_conn_sockfd(conn->tls, &fd) != ESP_OK || fd < 0) {
+        // No socket yet, try again right away
+        wake = 0;
+    } else if (state == ESP_TLS_CONNECTING) {
+        FD_SET(fd, writeset);
+    } else {
+        FD_SET(fd, readset);
+
+        int64_t poll = esp_timer_get_time() + HTTP2_HANDSHAKE_POLL_INTERVAL;
+        wake = poll < wake ? poll : wake;
+    }
+
+    if (fd > *maxfd) {
+        *maxfd = fd;
+    }
+
+    if (wake < *deadline) {
+        *deadline = wake;
+    }
+}
+
+// Sleep until an open connection can make progress, a connection being
+// established can take its next step, an event is posted, the earliest stream
+// deadline passes or a keepalive PING is due.
+static void http2_wait_for_activity_(void)
+{
+    fd_set readset;
+    fd_set writeset;
+    FD_ZERO(&readset);
+    FD_ZERO(&writeset);
+
+    FD_SET(http2_wakeup_fd_, &readset);
+    int maxfd = http2_wakeup_fd_;
+    int64_t deadline = INT64_MAX;
+
+    for (size_t i = 0; i < CONFIG_HTTP2_MAX_CONCURRENT_STREAMS; i++) {
+        if (http2_streams_[i].in_use && http2_streams_[i].deadline < deadline) {
+            deadline = http2_streams_[i].deadline;
+        }
+    }
+
+    for (size_t i = 0; i < CONFIG_HTTP2_POOL_SIZE; i++) {
+        http2_session_t* session = &http2_pool_[i];
+
+        for (size_t j = 0; j < 2; j++) {
+            struct http2_conn* conn = &session->conns[j];
+            int fd = -1;
+
+            if (conn->ng == NULL) {
+                continue;
+            }
+
+            if (conn->connecting) {
+                http2_conn_wait_for_handshake_(conn, &readset, &writeset, &maxfd, &deadline);
+                continue;
+            }
+
+            if (j == session->active && http2_conn_next_keepalive_(conn) < deadline) {
+                deadline = http2_conn_next_keepalive_(conn);
+            }
+
+            if (esp_tls_get_conn_sockfd(conn->tls, &fd) != ESP_OK || fd < 0) {
+                continue;
+            }
+
+            if (nghttp2_session_want_read(conn->ng)) {
+                FD_SET(fd, &readset);
+            }
+
+            if (nghttp2_session_want_write(conn->ng) || http2_tx_pending_(conn)) {
+                FD_SET(fd, &writeset);
+            }
+
+            if (fd > maxfd) {
+                maxfd = fd;
+            }
+        }
+    }
+
+    struct timeval timeout;
+    struct timeval* ptimeout = NULL;
+
+    if (deadline != INT64_MAX) {
+        int64_t remaining = deadline - esp_timer_get_time();
+
+        if (remaining < 0) {
+            remaining = 0;
         }
-    } while (session->complete == false && esp_timer_get_time() < end);
 
-    return session->status;
+        timeout.tv_sec = (time_t) (remaining / (1000 * 1000));
+        timeout.tv_usec = (suseconds_t) (remaining % (1000 * 1000));
+        ptimeout = &timeout;
+    }
+
+    if (select(maxfd + 1, &readset, &writeset, NULL, ptimeout) > 0 && FD_ISSET(http2_wakeup_fd_, &readset)) {
+        uint64_t count = 0;
+        read(http2_wakeup_fd_, &count, sizeof(count));
+    }
 }
 
-static void http2_handle_connect_event_(struct http2_event_connect event)
+static void http2_wake_up_(void)
 {
-    int32_t rc = http2_session_connect_internal_(event.session, event.hostname, event.port, event.common_name);
-    xTaskNotify(event.requestor, (uint32_t) rc, eSetValueWithOverwrite);
+    static const uint64_t one = 1;
+    write(http2_wakeup_fd_, &one, sizeof(one));
+}
+
+// Hand an event to the http2 task. Posted from the http2 task itself, it is
+// deferred without waiting. Other tasks wait up to HTTP2_EVENT_POST_TIMEOUT
+// for room in the queue, or not at all with `no_wait`.
+static esp_err_t http2_post_event_(const union http2_event* event, bool no_wait)
+{
+    if (xTaskGetCurrentTaskHandle() == http2_task_handle_) {
+        if (http2_deferred_count_ == CONFIG_HTTP2_MAX_CONCURRENT_STREAMS) {
+            ESP_LOGE(TAG, "too many events deferred");
+            return ESP_ERR_NO_MEM;
+        }
+
+        http2_deferred_[http2_deferred_count_++] = *event;
+        return ESP_OK;
+    }
+
+    if (xQueueSend(http2_event_queue_, event, no_wait ? 0 : pdMS_TO_TICKS(HTTP2_EVENT_POST_TIMEOUT)) != pdTRUE) {
+        ESP_LOGE(TAG, "event queue full");
+        return ESP_ERR_TIMEOUT;
+    }
+
+    http2_wake_up_();
+    return ESP_OK;
+}
+
+static void http2_request_sweep_(void)
+{
+    atomic_store(&http2_sweep_requested_, true);
+    http2_wake_up_();
+}
+
+static void http2_handle_sweep_(void)
+{
+    if (!atomic_exchange(&http2_sweep_requested_, false)) {
+        return;
+    }
+
+    if (xSemaphoreTakeRecursive(http2_pool_mutex_, portMAX_DELAY) == pdTRUE) {
+        http2_pool_sweep_();
+        xSemaphoreGiveRecursive(http2_pool_mutex_);
+    }
 }
 
 static void http2_handle_perform_event_(struct http2_event_perform event)
 {
-    int32_t rc = http2_session_perform_internal_(event.session, event.method, event.authority, event.path, event.payload, event.payload_len, event.dest, event.dest_len, event.options);
-    xTaskNotify(event.requestor, (uint32_t) rc, eSetValueWithOverwrite);
+    // On success, the callback is invoked once the stream closes
+    esp_err_t rc = http2_session_submit_(&event);
+
+    if (rc == ESP_ERR_TIMEOUT) {
+        event.callback(HTTP2_STATUS_DEADLINE_EXCEEDED, event.arg);
+    } else if (rc != ESP_OK) {
+        event.callback(HTTP2_STATUS_LOCAL_ERROR, event.arg);
+    }
+}
+
+static void http2_handle_cancel_event_(struct http2_event_cancel event)
+{
+    struct http2_stream* stream = http2_stream_find_(event.request_id);
+
+    // Already completed
+    if (stream == NULL) {
+        return;
+    }
+
+    ESP_LOGD(TAG, "cancelling stream %" PRId32, stream->stream_id);
+
+    if (stream->stream_id > 0) {
+        nghttp2_submit_rst_stream(stream->conn->ng, NGHTTP2_FLAG_NONE, stream->stream_id, NGHTTP2_CANCEL);
+    }
+
+    http2_stream_complete_(stream, HTTP2_STATUS_CANCELLED);
+}
+
+static void http2_handle_event_(const union http2_event* event)
+{
+    switch (event->type) {
+    case HTTP2_EVENT_PERFORM:
+        http2_handle_perform_event_(event->perform);
+        break;
+    case HTTP2_EVENT_CANCEL:
+        http2_handle_cancel_event_(event->cancel);
+        break;
+    }
 }
 
 static void http2_task_(void* args)
@@ -469,140 +1636,220 @@ static void http2_task_(void* args)
     while (true) {
         union http2_event event;
 
-        if (xQueueReceive(http2_event_queue_, &event, portMAX_DELAY) == pdTRUE) {
-            switch (event.type) {
-            case HTTP2_EVENT_CONNECT:
-                http2_handle_connect_event_(event.connect);
-                break;
-            case HTTP2_EVENT_PERFORM:
-                http2_handle_perform_event_(event.perform);
-                break;
-            }
+        // Idle sessions are evicted before a new connection is dialed
+        http2_handle_sweep_();
+
+        // Handlers may defer more events, which are handled in turn
+        for (size_t i = 0; i < http2_deferred_count_; i++) {
+            event = http2_deferred_[i];
+            http2_handle_event_(&event);
+        }
+
+        http2_deferred_count_ = 0;
+
+        while (xQueueReceive(http2_event_queue_, &event, 0) == pdTRUE) {
+            http2_handle_event_(&event);
+        }
+
+        http2_drive_sessions_();
+
+        // Events deferred while driving the sessions are handled right away
+        if (http2_deferred_count_ == 0) {
+            http2_wait_for_activity_();
         }
     }
 }
 
+static void http2_sweep_timer_callback_(void* args)
+{
+    (void) args;
+    http2_request_sweep_();
+}
+
 esp_err_t http2_init(void)
 {
-    http2_mutex_ = xSemaphoreCreateMutex();
+    if (tls_cache_init() != ESP_OK) {
+        ESP_LOGE(TAG, "TLS session cache initialization failed");
+        return ESP_FAIL;
+    }
 
-    if (http2_mutex_ == NULL) {
+    http2_pool_mutex_ = xSemaphoreCreateRecursiveMutex();
+
+    if (http2_pool_mutex_ == NULL) {
         ESP_LOGE(TAG, "Mutex initialization failed");
         return ESP_FAIL;
     }
 
-    http2_event_queue_ = xQueueCreate(2, sizeof(union http2_event));
+    http2_event_queue_ = xQueueCreate(CONFIG_HTTP2_MAX_CONCURRENT_STREAMS, sizeof(union http2_event));
 
     if (http2_event_queue_ == NULL) {
         ESP_LOGE(TAG, "Event queue initialization failed");
         return ESP_FAIL;
     }
 
-    if (xTaskCreate(http2_task_, "http2_task", HTTP2_TASK_STACK_DEPTH, NULL, 4, NULL) != pdPASS) {
+    esp_vfs_eventfd_config_t eventfd_config = ESP_VFS_EVENTD_CONFIG_DEFAULT();
+
+    if (esp_vfs_eventfd_register(&eventfd_config) != ESP_OK) {
+        ESP_LOGE(TAG, "eventfd registration failed");
+        return ESP_FAIL;
+    }
+
+    http2_wakeup_fd_ = eventfd(0, 0);
+
+    if (http2_wakeup_fd_ < 0) {
+        ESP_LOGE(TAG, "eventfd creation failed");
+        return ESP_FAIL;
+    }
+
+    if (xTaskCreate(http2_task_, "http2_task", HTTP2_TASK_STACK_DEPTH, NULL, 4, &http2_task_handle_) != pdPASS) {
         ESP_LOGE(TAG, "Task creation failed");
         return ESP_FAIL;
     }
 
-    return ESP_OK;
+    esp_timer_create_args_t args = {
+        .dispatch_method = ESP_TIMER_TASK,
+        .callback = http2_sweep_timer_callback_,
+        .arg = NULL
+    };
+
+    if (esp_timer_create(&args, &http2_sweep_timer_) != ESP_OK) {
+        ESP_LOGE(TAG, "Sweep timer creation failed");
+        return ESP_FAIL;
+    }
+
+    return esp_timer_start_periodic(http2_sweep_timer_, (int64_t) CONFIG_HTTP2_POOL_IDLE_TIMEOUT * 1000 * 1000);
 }
 
-http2_session_t* http2_session_acquire(const TickType_t ticks_to_wait)
+http2_session_t* http2_session_acquire(const char* hostname, uint16_t port, const char* common_name, const TickType_t ticks_to_wait)
 {
-    if (xSemaphoreTake(http2_mutex_, ticks_to_wait) == pdFALSE) {
+    if (hostname == NULL || strlen(hostname) >= HTTP2_POOL_HOSTNAME_LEN) {
         return NULL;
     }
 
-    http2_session_t* session = malloc(sizeof(http2_session_t));
-    session->tls = NULL;
-    session->ng = NULL;
-
-    if (http2_tls_init_(session) != ESP_OK) {
-        ESP_LOGE(TAG, "tls initialization failed");
-        http2_session_release(session);
+    if (common_name == NULL) {
+        common_name = "";
+    } else if (strlen(common_name) >= HTTP2_POOL_HOSTNAME_LEN) {
         return NULL;
     }
 
-    if (http2_ng_init_(session) != ESP_OK) {
-        ESP_LOGE(TAG, "http2 library initialization failed");
-        http2_session_release(session);
+    if (xSemaphoreTakeRecursive(http2_pool_mutex_, ticks_to_wait) == pdFALSE) {
         return NULL;
     }
 
-    return session;
-}
+    http2_session_t* session = http2_pool_find_(hostname, port, common_name);
 
-esp_err_t http2_session_connect(http2_session_t* session, const char* hostname, uint16_t port, const char* common_name)
-{
-    esp_err_t rc = ESP_FAIL;
-
-    if (session == NULL || hostname == NULL) {
-        return rc;
+    if (session == NULL) {
+        ESP_LOGE(TAG, "no free session in pool");
+        xSemaphoreGiveRecursive(http2_pool_mutex_);
+        return NULL;
     }
 
-    struct http2_event_connect event = {
-        .type = HTTP2_EVENT_CONNECT,
-        .session = session,
-        .requestor = xTaskGetCurrentTaskHandle(),
+    session->users++;
 
-        .hostname = hostname,
-        .common_name = common_name,
-        .port = port
-    };
+    xSemaphoreGiveRecursive(http2_pool_mutex_);
 
-    if (xQueueSend(http2_event_queue_, (void*) &event, portMAX_DELAY) == pdTRUE) {
-        xTaskNotifyWait(0xFFFFFFFF, 0xFFFFFFFF, (uint32_t*) &rc, portMAX_DELAY);
-    }
+    // Connections are only closed on the http2 task. The sweep is handled
+    // ahead of the caller's first request, so idle sessions are evicted
+    // before a new connection is dialed.
+    http2_request_sweep_();
 
-    return rc;
+    return session;
 }
 
 // NOLINTNEXTLINE(readability-non-const-parameter) // clang-tidy doesn't understand how the dest pointer is used
-esp_err_t http2_perform(http2_session_t* session, const char* method, const char* authority, const char* path, const char* payload, size_t payload_len, char* dest, size_t dest_len, struct http_perform_options options)
+esp_err_t http2_perform_async(http2_session_t* session, const char* method, const char* authority, const char* path, const char* payload, size_t payload_len, char* dest, size_t dest_len, struct http_perform_options options, http2_perform_callback_t callback, void* arg, http2_request_id_t* request_id)
 {
-    esp_err_t rc = ESP_FAIL;
+    if (session == NULL || method == NULL || authority == NULL || path == NULL || (payload == NULL && options.source == NULL) || (dest == NULL && options.sink == NULL) || callback == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
 
-    if (session == NULL || method == NULL || authority == NULL || path == NULL || payload == NULL || dest == NULL) {
-        return rc;
+    http2_request_id_t id = atomic_fetch_add(&http2_next_request_id_, 1);
+
+    if (id == 0) {
+        id = atomic_fetch_add(&http2_next_request_id_, 1);
     }
 
-    struct http2_event_perform event = {
+    union http2_event event;
+    event.perform = (struct http2_event_perform) {
         .type = HTTP2_EVENT_PERFORM,
-        .session = session,
-        .requestor = xTaskGetCurrentTaskHandle(),
+        .request_id = id,
 
+        .session = session,
         .method = method,
         .authority = authority,
         .path = path,
+
         .payload = payload,
-        .payload_len = payload_len,
+        .payload_length = payload_len,
         .dest = dest,
-        .dest_len = dest_len,
-        .options = options
+        .dest_length = dest_len,
+
+        .options = options,
+
+        .callback = callback,
+        .arg = arg,
     };
 
-    if (xQueueSend(http2_event_queue_, (void*) &event, portMAX_DELAY) == pdTRUE) {
+    // Set before posting, the request may complete before this returns
+    if (request_id != NULL) {
+        *request_id = id;
+    }
+
+    return http2_post_event_(&event, options.no_wait);
+}
+
+esp_err_t http2_cancel(http2_request_id_t request_id, bool no_wait)
+{
+    union http2_event event;
+    event.cancel = (struct http2_event_cancel) {
+        .type = HTTP2_EVENT_CANCEL,
+        .request_id = request_id,
+    };
+
+    return http2_post_event_(&event, no_wait);
+}
+
+static void http2_perform_notify_(int32_t status, void* arg)
+{
+    xTaskNotify((TaskHandle_t) arg, (uint32_t) status, eSetValueWithOverwrite);
+}
+
+// NOLINTNEXTLINE(readability-non-const-parameter) // clang-tidy doesn't understand how the dest pointer is used
+esp_err_t http2_perform(http2_session_t* session, const char* method, const char* authority, const char* path, const char* payload, size_t payload_len, char* dest, size_t dest_len, struct http_perform_options options)
+{
+    esp_err_t rc = ESP_FAIL;
+
+    if (http2_perform_async(session, method, authority, path, payload, payload_len, dest, dest_len, options, http2_perform_notify_, xTaskGetCurrentTaskHandle(), NULL) == ESP_OK) {
         xTaskNotifyWait(0xFFFFFFFF, 0xFFFFFFFF, (uint32_t*) &rc, portMAX_DELAY);
     }
 
     return rc;
 }
 
+esp_err_t http2_get_stats(struct http2_stats* dest)
+{
+    if (dest == NULL) {
+        return ESP_FAIL;
+    }
+
+    *dest = http2_stats_;
+    return ESP_OK;
+}
+
 esp_err_t http2_session_release(http2_session_t* session)
 {
     if (session == NULL) {
         return ESP_OK;
     }
 
-    if (session->ng != NULL) {
-        nghttp2_session_del(session->ng);
-    }
-
-    if (session->tls != NULL) {
-        esp_tls_conn_destroy(session->tls);
+    if (xSemaphoreTakeRecursive(http2_pool_mutex_, portMAX_DELAY) == pdFALSE) {
+        return ESP_FAIL;
     }
 
-    free(session);
+    // Keep the connection warm for the next caller
+    session->users--;
+    session->last_used = esp_timer_get_time();
 
-    xSemaphoreGive(http2_mutex_);
+    xSemaphoreGiveRecursive(http2_pool_mutex_);
     return ESP_OK;
 }
\ No newline at end of file
@@ -3,27 +3,129 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <sys/types.h>
 
 #include <freertos/FreeRTOS.h>
 
 typedef struct http2_session http2_session_t;
 
+// Receives the response body chunk by chunk, as it arrives. Returning anything
+// but ESP_OK resets the stream, and the request fails with
+// HTTP2_STATUS_LOCAL_ERROR. Runs in the http2 task, must not block.
+typedef esp_err_t (*http2_response_sink_t)(const uint8_t* data, size_t length, void* arg);
+
+// Writes up to `length` bytes of the request body to `buf` and returns how many
+// were written, or -1 on failure, which resets the stream. Called as flow
+// control allows, from the http2 task; must not block.
+typedef ssize_t (*http2_request_source_t)(uint8_t* buf, size_t length, void* arg);
+
 struct http_perform_options {
     const char* content_type;
     const char* authorization;
 
     bool use_grpc_status;
+
+    // Absolute time, as returned by esp_timer_get_time, after which the
+    // request is reset and fails with HTTP2_STATUS_DEADLINE_EXCEEDED. Sent to
+    // gRPC servers as grpc-timeout. 0 picks a default of 5 seconds.
+    int64_t deadline;
+
+    // When set, the response body is streamed to `sink` instead of being
+    // copied to `dest`, which may then be NULL.
+    http2_response_sink_t sink;
+    void* sink_arg;
+
+    // When set, the request body is pulled from `source` as it is sent,
+    // instead of from `payload`, which may then be NULL. `payload_len` is the
+    // total length the source will produce.
+    http2_request_source_t source;
+    void* source_arg;
+
+    // When set, receives the grpc-retry-pushback-ms trailer if the server
+    // sends one, or -1 if it is malformed or negative, meaning the server asks
+    // not to retry. Left untouched otherwise.
+    int32_t* retry_pushback;
+
+    // Fail with ESP_ERR_TIMEOUT rather than wait when the http2 task's event
+    // queue is full. For callers on the esp_timer task, which every timer
+    // shares.
+    bool no_wait;
 };
 
 typedef enum {
     HTTP_STATUS_OK = 200,
 } http_status_t;
 
+// Statuses reported for requests that did not complete with a response from
+// the server.
+enum {
+    HTTP2_STATUS_LOCAL_ERROR = -1,
+    HTTP2_STATUS_DEADLINE_EXCEEDED = -2,
+    HTTP2_STATUS_CANCELLED = -3,
+};
+
+typedef uint32_t http2_request_id_t;
+
+struct http2_stats {
+    // Round-trip time of the last keepalive PING, and its smoothed average
+    // (microseconds). 0 until a PING is answered.
+    int64_t ping_rtt;
+    int64_t ping_srtt;
+
+    uint32_t pings_sent;
+    uint32_t pings_lost;
+
+    // GOAWAY frames received, and connections dialed ahead of a request to
+    // replace a lost one
+    uint32_t goaways;
+    uint32_t predials;
+
+    // Duration of the last connection setup, TCP and TLS handshake included,
+    // and time from submitting the last request to its response headers
+    // (microseconds)
+    int64_t handshake_time;
+    int64_t first_byte_time;
+
+    // Bytes written to and read from TLS, frame overhead included
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+};
+
+// Invoked from the http2 task once a request completes, with either the HTTP
+// (or gRPC) status from the server or one of the HTTP2_STATUS_* values above.
+// Must not block.
+typedef void (*http2_perform_callback_t)(int32_t status, void* arg);
+
 esp_err_t http2_init(void);
 
-http2_session_t* http2_session_acquire(TickType_t ticks_to_wait);
-esp_err_t http2_session_connect(http2_session_t* session, const char* hostname, uint16_t port, const char* common_name);
+// Acquire a session to `hostname`. Sessions are pooled by (hostname, port,
+// common_name) and kept open after release, so consecutive calls to the same
+// host reuse the same TLS connection. The connection is established by the
+// first request performed on the session.
+http2_session_t* http2_session_acquire(const char* hostname, uint16_t port, const char* common_name, TickType_t ticks_to_wait);
+
+// Queue a request and return. `callback` is invoked exactly once if this
+// returns ESP_OK. Waits up to a second for room in the http2 task's queue,
+// unless options.no_wait is set, and never when called from the http2 task,
+// e.g. from a completion callback. `payload`, `dest` and the strings passed
+// in must stay valid until then. The body is NULL-terminated in `dest`, and fails the
+// request if it doesn't fit. `request_id` may be NULL.
+esp_err_t http2_perform_async(http2_session_t* session, const char* method, const char* authority, const char* path, const char* payload, size_t payload_len, char* dest, size_t dest_len, struct http_perform_options options, http2_perform_callback_t callback, void* arg, http2_request_id_t* request_id);
+
+// Reset the request's stream. Its callback is invoked with
+// HTTP2_STATUS_CANCELLED unless it already completed. Waits for room in the
+// queue as http2_perform_async does, `no_wait` as options.no_wait there.
+esp_err_t http2_cancel(http2_request_id_t request_id, bool no_wait);
+
+// Perform a request and block until its response is received. Several tasks
+// may perform requests concurrently on the same session, each runs on its own
+// HTTP2 stream. Must not be called from the http2 task.
 esp_err_t http2_perform(http2_session_t* session, const char* method, const char* authority, const char* path, const char* payload, size_t payload_len, char* dest, size_t dest_len, struct http_perform_options options);
+
+esp_err_t http2_get_stats(struct http2_stats* dest);
+
+// Return the session to the pool. The connection stays open until it is idle
+// for CONFIG_HTTP2_POOL_IDLE_TIMEOUT seconds or memory runs low.
 esp_err_t http2_session_release(http2_session_t* session);
 
 #endif // NET__HTTP2__HTTP2_H_
\ No newline at end of file
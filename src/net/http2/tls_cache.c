@@ -0,0 +1,305 @@
+#include "tls_cache.h"
+
+#include <inttypes.h>
+#include <string.h>
+
+#include <esp_crt_bundle.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include <nvs_flash.h>
+
+#include <mbedtls/ssl.h>
+
+enum {
+    // Maximum length of cached hostnames, including the NULL terminator.
+    TLS_CACHE_HOSTNAME_LEN = 64,
+
+    // Length of the NVS key derived from the host, including the NULL
+    // terminator. NVS keys are limited to 15 characters.
+    TLS_CACHE_NVS_KEY_LEN = 13,
+};
+
+static const char* TAG = "tls_cache";
+
+struct tls_cache_entry {
+    char hostname[TLS_CACHE_HOSTNAME_LEN];
+    uint16_t port;
+
+    esp_tls_client_session_t* session;
+    int64_t last_used;
+};
+
+static struct tls_cache_entry tls_cache_[CONFIG_HTTP2_TLS_SESSION_CACHE_SIZE] = { 0 };
+static struct tls_cache_stats tls_cache_stats_ = { 0 };
+
+// Certificate verification callback installed by esp_crt_bundle_attach. We
+// wrap it to learn whether the server sent its certificate chain, which only
+// happens on full handshakes.
+static int (*tls_cache_crt_verify_)(void*, mbedtls_x509_crt*, int, uint32_t*) = NULL;
+static bool tls_cache_crt_verified_ = false;
+
+static int tls_cache_crt_verify_wrapper_(void* ctx, mbedtls_x509_crt* crt, int depth, uint32_t* flags)
+{
+    tls_cache_crt_verified_ = true;
+    return tls_cache_crt_verify_(ctx, crt, depth, flags);
+}
+
+#if CONFIG_HTTP2_TLS_SESSION_PERSIST
+static void tls_cache_make_nvs_key_(const char* hostname, uint16_t port, char dest[TLS_CACHE_NVS_KEY_LEN])
+{
+    // FNV-1a
+    uint32_t hash = 2166136261U;
+
+    for (const char* c = hostname; *c != '\0'; c++) {
+        hash = (hash ^ (uint8_t) *c) * 16777619U;
+    }
+
+    hash = (hash ^ (port & 0xFF)) * 16777619U;
+    hash = (hash ^ (port >> 8)) * 16777619U;
+
+    snprintf(dest, TLS_CACHE_NVS_KEY_LEN, "tls-%08" PRIx32, hash);
+}
+
+static esp_tls_client_session_t* tls_cache_read_from_storage_(const char* hostname, uint16_t port)
+{
+    esp_tls_client_session_t* session = NULL;
+    uint8_t* buffer = NULL;
+    size_t length = 0;
+    nvs_handle_t nvs;
+
+    char key[TLS_CACHE_NVS_KEY_LEN] = { 0 };
+    tls_cache_make_nvs_key_(hostname, port, key);
+
+    if (nvs_open("nvs", NVS_READONLY, &nvs) != ESP_OK) {
+        return NULL;
+    }
+
+    if (nvs_get_blob(nvs, key, NULL, &length) != ESP_OK || length == 0) {
+        goto exit;
+    }
+
+    buffer = malloc(length);
+    session = calloc(1, sizeof(esp_tls_client_session_t));
+
+    if (buffer == NULL || session == NULL) {
+        ESP_LOGE(TAG, "failed to allocate memory for stored session");
+        goto cleanup;
+    }
+
+    if (nvs_get_blob(nvs, key, buffer, &length) != ESP_OK) {
+        goto cleanup;
+    }
+
+    mbedtls_ssl_session_init(&session->saved_session);
+
+    if (mbedtls_ssl_session_load(&session->saved_session, buffer, length) != 0) {
+        ESP_LOGW(TAG, "stored session for %s is invalid", hostname);
+        mbedtls_ssl_session_free(&session->saved_session);
+        goto cleanup;
+    }
+
+    ESP_LOGD(TAG, "loaded stored session for %s:%u", hostname, port);
+    goto exit;
+
+cleanup:
+    free(session);
+    session = NULL;
+
+exit:
+    free(buffer);
+    nvs_close(nvs);
+    return session;
+}
+
+static void tls_cache_write_to_storage_(const char* hostname, uint16_t port, const esp_tls_client_session_t* session)
+{
+    uint8_t* buffer = NULL;
+    size_t length = 0;
+    nvs_handle_t nvs;
+
+    char key[TLS_CACHE_NVS_KEY_LEN] = { 0 };
+    tls_cache_make_nvs_key_(hostname, port, key);
+
+    if (nvs_open("nvs", NVS_READWRITE, &nvs) != ESP_OK) {
+        return;
+    }
+
+    if (session == NULL) {
+        nvs_erase_key(nvs, key);
+        goto exit;
+    }
+
+    // First call only computes the serialized length
+    if (mbedtls_ssl_session_save(&session->saved_session, NULL, 0, &length) != MBEDTLS_ERR_SSL_BUFFER_TOO_SMALL) {
+        goto exit;
+    }
+
+    buffer = malloc(length);
+
+    if (buffer == NULL) {
+        ESP_LOGE(TAG, "failed to allocate memory to store session");
+        goto exit;
+    }
+
+    if (mbedtls_ssl_session_save(&session->saved_session, buffer, length, &length) != 0) {
+        goto exit;
+    }
+
+    if (nvs_set_blob(nvs, key, buffer, length) != ESP_OK) {
+        ESP_LOGW(TAG, "failed to store session for %s", hostname);
+    }
+
+exit:
+    free(buffer);
+    nvs_close(nvs);
+}
+#else
+static esp_tls_client_session_t* tls_cache_read_from_storage_(const char* hostname, uint16_t port)
+{
+    (void) hostname;
+    (void) port;
+    return NULL;
+}
+
+static void tls_cache_write_to_storage_(const char* hostname, uint16_t port, const esp_tls_client_session_t* session)
+{
+    (void) hostname;
+    (void) port;
+    (void) session;
+}
+#endif
+
+static struct tls_cache_entry* tls_cache_find_(const char* hostname, uint16_t port)
+{
+    for (size_t i = 0; i < CONFIG_HTTP2_TLS_SESSION_CACHE_SIZE; i++) {
+        if (tls_cache_[i].port == port && strcmp(tls_cache_[i].hostname, hostname) == 0) {
+            return &tls_cache_[i];
+        }
+    }
+
+    return NULL;
+}
+
+static struct tls_cache_entry* tls_cache_find_or_create_(const char* hostname, uint16_t port)
+{
+    struct tls_cache_entry* entry = tls_cache_find_(hostname, port);
+
+    if (entry != NULL || strlen(hostname) >= TLS_CACHE_HOSTNAME_LEN) {
+        return entry;
+    }
+
+    // Recycle the least recently used entry
+    entry = &tls_cache_[0];
+    for (size_t i = 1; i < CONFIG_HTTP2_TLS_SESSION_CACHE_SIZE; i++) {
+        if (tls_cache_[i].last_used < entry->last_used) {
+            entry = &tls_cache_[i];
+        }
+    }
+
+    if (entry->session != NULL) {
+        esp_tls_free_client_session(entry->session);
+    }
+
+    memset(entry, 0, sizeof(struct tls_cache_entry));
+    strncpy(entry->hostname, hostname, sizeof(entry->hostname) - 1);
+    entry->port = port;
+    entry->session = tls_cache_read_from_storage_(hostname, port);
+
+    return entry;
+}
+
+esp_err_t tls_cache_init(void)
+{
+    memset(&tls_cache_stats_, 0, sizeof(tls_cache_stats_));
+    return ESP_OK;
+}
+
+esp_err_t tls_cache_crt_bundle_attach(void* conf)
+{
+    mbedtls_ssl_config* ssl_conf = (mbedtls_ssl_config*) conf;
+    esp_err_t rc = esp_crt_bundle_attach(conf);
+
+    // This is called once per connection, before the handshake starts
+    tls_cache_crt_verified_ = false;
+
+    if (rc == ESP_OK && ssl_conf->MBEDTLS_PRIVATE(f_vrfy) != NULL) {
+        tls_cache_crt_verify_ = ssl_conf->MBEDTLS_PRIVATE(f_vrfy);
+        mbedtls_ssl_conf_verify(ssl_conf, tls_cache_crt_verify_wrapper_, ssl_conf->MBEDTLS_PRIVATE(p_vrfy));
+    }
+
+    return rc;
+}
+
+esp_tls_client_session_t* tls_cache_get(const char* hostname, uint16_t port)
+{
+    struct tls_cache_entry* entry = tls_cache_find_or_create_(hostname, port);
+
+    if (entry == NULL) {
+        return NULL;
+    }
+
+    entry->last_used = esp_timer_get_time();
+    return entry->session;
+}
+
+void tls_cache_update(const char* hostname, uint16_t port, esp_tls_t* tls)
+{
+    struct tls_cache_entry* entry = tls_cache_find_or_create_(hostname, port);
+
+    if (entry == NULL) {
+        return;
+    }
+
+    if (entry->session == NULL) {
+        tls_cache_stats_.full_handshakes++;
+    } else if (!tls_cache_crt_verified_) {
+        tls_cache_stats_.resumed_handshakes++;
+        ESP_LOGD(TAG, "resumed session with %s:%u", hostname, port);
+    } else {
+        tls_cache_stats_.resumption_fallbacks++;
+        ESP_LOGD(TAG, "%s:%u refused session resumption", hostname, port);
+    }
+
+    esp_tls_client_session_t* session = esp_tls_get_client_session(tls);
+
+    if (session == NULL) {
+        return;
+    }
+
+    if (entry->session != NULL) {
+        esp_tls_free_client_session(entry->session);
+    }
+
+    entry->session = session;
+    entry->last_used = esp_timer_get_time();
+
+    // Resumed handshakes reuse the stored master secret, no need to wear the
+    // flash out rewriting it.
+    if (tls_cache_crt_verified_) {
+        tls_cache_write_to_storage_(hostname, port, session);
+    }
+}
+
+void tls_cache_invalidate(const char* hostname, uint16_t port)
+{
+    struct tls_cache_entry* entry = tls_cache_find_(hostname, port);
+
+    if (entry == NULL || entry->session == NULL) {
+        return;
+    }
+
+    esp_tls_free_client_session(entry->session);
+    entry->session = NULL;
+    tls_cache_write_to_storage_(hostname, port, NULL);
+}
+
+esp_err_t tls_cache_get_stats(struct tls_cache_stats* dest)
+{
+    if (dest == NULL) {
+        return ESP_FAIL;
+    }
+
+    *dest = tls_cache_stats_;
+    return ESP_OK;
+}
\ No newline at end of file
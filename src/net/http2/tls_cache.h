@@ -0,0 +1,40 @@
+#ifndef NET__HTTP2__TLS_CACHE_H_
+#define NET__HTTP2__TLS_CACHE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <esp_err.h>
+#include <esp_tls.h>
+
+struct tls_cache_stats {
+    // Handshakes done without a cached session to offer
+    uint32_t full_handshakes;
+
+    // Handshakes where the server accepted the cached session
+    uint32_t resumed_handshakes;
+
+    // Handshakes where a cached session was offered but the server fell back
+    // to a full handshake
+    uint32_t resumption_fallbacks;
+};
+
+esp_err_t tls_cache_init(void);
+
+// Drop-in replacement for esp_crt_bundle_attach that also lets the cache tell
+// full handshakes (which verify the certificate chain) from resumed ones.
+esp_err_t tls_cache_crt_bundle_attach(void* conf);
+
+// Session to offer when connecting to `hostname`, or NULL if none is cached.
+esp_tls_client_session_t* tls_cache_get(const char* hostname, uint16_t port);
+
+// Record the outcome of a successful handshake and save its session for the
+// next connection to the same host.
+void tls_cache_update(const char* hostname, uint16_t port, esp_tls_t* tls);
+
+// Forget the session cached for `hostname`, e.g. after a failed handshake.
+void tls_cache_invalidate(const char* hostname, uint16_t port);
+
+esp_err_t tls_cache_get_stats(struct tls_cache_stats* dest);
+
+#endif // NET__HTTP2__TLS_CACHE_H_
\ No newline at end of file
@@ -0,0 +1,532 @@
+#include "ringlog.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_log.h>
+#include <esp_partition.h>
+#include <esp_random.h>
+#include <esp_rom_crc.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include <nvs_flash.h>
+
+enum {
+    // "RLOG", marks sectors holding a log
+    RINGLOG_MAGIC = 0x474F4C52,
+
+    // Largest record payload (bytes)
+    RINGLOG_RECORD_MAX_LEN = 256,
+
+    // Length of records past the end of a sector's data. Flash reads 0xFF once
+    // erased.
+    RINGLOG_RECORD_END = 0xFFFF,
+
+    // Records are padded to a multiple of this (bytes)
+    RINGLOG_ALIGNMENT = 4,
+
+    // Chunk size used to check that the free space of a sector is erased
+    RINGLOG_SCAN_CHUNK_LEN = 256,
+
+    // Length of the NVS key holding the read cursor, including the NULL
+    // terminator
+    RINGLOG_NVS_KEY_LEN = 16,
+};
+
+static const char* TAG = "ringlog";
+
+// Written at the start of each sector after it is erased. Sectors are used in
+// order, and each gets the next sequence number.
+struct ringlog_sector_header {
+    uint32_t magic;
+    uint32_t epoch;
+    uint32_t sequence;
+    uint32_t crc;
+};
+
+// Precedes each record's payload. The CRC covers the length and the payload,
+// so a record torn by a reset is detected.
+struct ringlog_record_header {
+    uint16_t length;
+    uint16_t reserved;
+    uint32_t crc;
+};
+
+// Read cursor as persisted in NVS. The epoch tells whether it belongs to the
+// log currently on flash.
+struct ringlog_persisted_cursor {
+    uint32_t epoch;
+    uint32_t sequence;
+    uint32_t offset;
+};
+
+struct ringlog {
+    const esp_partition_t* partition;
+    char key[RINGLOG_NVS_KEY_LEN];
+
+    SemaphoreHandle_t mutex;
+
+    uint32_t sector_size;
+    uint32_t sectors;
+    uint32_t epoch;
+
+    // Sector being written to, and where the next record goes in it
+    uint32_t head_index;
+    uint32_t head_sequence;
+    uint32_t write_offset;
+
+    // Oldest sector still holding records
+    uint32_t tail_sequence;
+
+    struct ringlog_cursor committed;
+
+    uint32_t appended;
+    uint32_t dropped;
+};
+
+static uint32_t ringlog_align_(uint32_t length)
+{
+    return (length + RINGLOG_ALIGNMENT - 1) & ~(RINGLOG_ALIGNMENT - 1);
+}
+
+static uint32_t ringlog_sector_address_(const ringlog_t* log, uint32_t index)
+{
+    return index * log->sector_size;
+}
+
+static uint32_t ringlog_sector_index_(const ringlog_t* log, uint32_t sequence)
+{
+    return (log->head_index + log->sectors - (log->head_sequence - sequence) % log->sectors) % log->sectors;
+}
+
+static uint32_t ringlog_header_crc_(const struct ringlog_sector_header* header)
+{
+    return esp_rom_crc32_le(0, (const uint8_t*) header, offsetof(struct ringlog_sector_header, crc));
+}
+
+static uint32_t ringlog_record_crc_(uint16_t length, const uint8_t* payload)
+{
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t*) &length, sizeof(length));
+    return esp_rom_crc32_le(crc, payload, length);
+}
+
+static bool ringlog_read_sector_header_(ringlog_t* log, uint32_t index, struct ringlog_sector_header* dest)
+{
+    if (esp_partition_read(log->partition, ringlog_sector_address_(log, index), dest, sizeof(*dest)) != ESP_OK) {
+        return false;
+    }
+
+    return dest->magic == RINGLOG_MAGIC && dest->crc == ringlog_header_crc_(dest);
+}
+
+static esp_err_t ringlog_start_sector_(ringlog_t* log, uint32_t index, uint32_t sequence)
+{
+    struct ringlog_sector_header header = {
+        .magic = RINGLOG_MAGIC,
+        .epoch = log->epoch,
+        .sequence = sequence,
+    };
+    header.crc = ringlog_header_crc_(&header);
+
+    uint32_t address = ringlog_sector_address_(log, index);
+    esp_err_t rc = esp_partition_erase_range(log->partition, address, log->sector_size);
+
+    if (rc == ESP_OK) {
+        rc = esp_partition_write(log->partition, address, &header, sizeof(header));
+    }
+
+    if (rc != ESP_OK) {
+        ESP_LOGE(TAG, "failed to start sector %lu: %s", (unsigned long) index, esp_err_to_name(rc));
+        return rc;
+    }
+
+    log->head_index = index;
+    log->head_sequence = sequence;
+    log->write_offset = sizeof(struct ringlog_sector_header);
+
+    return ESP_OK;
+}
+
+static esp_err_t ringlog_format_(ringlog_t* log)
+{
+    ESP_LOGW(TAG, "formatting partition %s", log->partition->label);
+
+    esp_err_t rc = esp_partition_erase_range(log->partition, 0, log->sectors * log->sector_size);
+
+    if (rc != ESP_OK) {
+        ESP_LOGE(TAG, "failed to erase partition %s: %s", log->partition->label, esp_err_to_name(rc));
+        return rc;
+    }
+
+    log->epoch = esp_random();
+    log->tail_sequence = 0;
+
+    return ringlog_start_sector_(log, 0, 0);
+}
+
+// Check that the sector is erased from `offset` on, so records can be written
+// there
+static bool ringlog_is_erased_(ringlog_t* log, uint32_t index, uint32_t offset)
+{
+    uint8_t chunk[RINGLOG_SCAN_CHUNK_LEN];
+
+    while (offset < log->sector_size) {
+        uint32_t length = log->sector_size - offset;
+        length = length < sizeof(chunk) ? length : sizeof(chunk);
+
+        if (esp_partition_read(log->partition, ringlog_sector_address_(log, index) + offset, chunk, length) != ESP_OK) {
+            return false;
+        }
+
+        for (uint32_t i = 0; i < length; i++) {
+            if (chunk[i] != 0xFF) {
+                return false;
+            }
+        }
+
+        offset += length;
+    }
+
+    return true;
+}
+
+// Read the record at `offset` into `payload`, which holds at least
+// RINGLOG_RECORD_MAX_LEN bytes. Returns the offset past it, or 0 if there is no
+// valid record there.
+static uint32_t ringlog_read_record_(ringlog_t* log, uint32_t index, uint32_t offset, uint8_t* payload, uint16_t* length)
+{
+    struct ringlog_record_header header;
+    uint32_t address = ringlog_sector_address_(log, index) + offset;
+
+    if (offset + sizeof(header) > log->sector_size || esp_partition_read(log->partition, address, &header, sizeof(header)) != ESP_OK) {
+        return 0;
+    }
+
+    uint32_t end = offset + ringlog_align_(sizeof(header) + header.length);
+
+    if (header.length == RINGLOG_RECORD_END || header.length == 0 || header.length > RINGLOG_RECORD_MAX_LEN || end > log->sector_size) {
+        return 0;
+    }
+
+    if (esp_partition_read(log->partition, address + sizeof(header), payload, header.length) != ESP_OK) {
+        return 0;
+    }
+
+    if (header.crc != ringlog_record_crc_(header.length, payload)) {
+        return 0;
+    }
+
+    *length = header.length;
+    return end;
+}
+
+static esp_err_t ringlog_mount_(ringlog_t* log)
+{
+    struct ringlog_sector_header header;
+    bool found = false;
+
+    for (uint32_t i = 0; i < log->sectors; i++) {
+        if (!ringlog_read_sector_header_(log, i, &header)) {
+            continue;
+        }
+
+        if (!found || (int32_t) (header.sequence - log->head_sequence) > 0) {
+            found = true;
+            log->epoch = header.epoch;
+            log->head_index = i;
+            log->head_sequence = header.sequence;
+        }
+    }
+
+    if (!found) {
+        return ringlog_format_(log);
+    }
+
+    // Walk back from the head for as long as sectors follow each other
+    log->tail_sequence = log->head_sequence;
+
+    for (uint32_t n = 1; n < log->sectors; n++) {
+        uint32_t index = (log->head_index + log->sectors - n) % log->sectors;
+
+        if (!ringlog_read_sector_header_(log, index, &header) || header.epoch != log->epoch || header.sequence != log->head_sequence - n) {
+            break;
+        }
+
+        log->tail_sequence = header.sequence;
+    }
+
+    // Find the end of the head sector's data
+    uint8_t payload[RINGLOG_RECORD_MAX_LEN];
+    uint16_t length;
+    uint32_t offset = sizeof(struct ringlog_sector_header);
+    uint32_t next;
+
+    while ((next = ringlog_read_record_(log, log->head_index, offset, payload, &length)) != 0) {
+        offset = next;
+    }
+
+    // A write torn by a reset leaves bytes that can't be written over until
+    // the sector is erased. Records resume in the next sector.
+    if (!ringlog_is_erased_(log, log->head_index, offset)) {
+        ESP_LOGW(TAG, "sector %lu damaged at offset %lu, sealing it", (unsigned long) log->head_index, (unsigned long) offset);
+        offset = log->sector_size;
+    }
+
+    log->write_offset = offset;
+
+    return ESP_OK;
+}
+
+static void ringlog_load_cursor_(ringlog_t* log)
+{
+    struct ringlog_persisted_cursor persisted = { 0 };
+    size_t length = sizeof(persisted);
+    nvs_handle_t nvs;
+
+    log->committed.sequence = log->tail_sequence;
+    log->committed.offset = sizeof(struct ringlog_sector_header);
+
+    if (nvs_open("nvs", NVS_READONLY, &nvs) != ESP_OK) {
+        return;
+    }
+
+    if (nvs_get_blob(nvs, log->key, &persisted, &length) == ESP_OK && length == sizeof(persisted) && persisted.epoch == log->epoch) {
+        log->committed.sequence = persisted.sequence;
+        log->committed.offset = persisted.offset;
+    }
+
+    nvs_close(nvs);
+}
+
+// Move writes to the next sector, erasing the oldest one if the log is full
+static esp_err_t ringlog_advance_(ringlog_t* log)
+{
+    uint32_t used = log->head_sequence - log->tail_sequence + 1;
+
+    if (used == log->sectors) {
+        if ((int32_t) (log->committed.sequence - log->tail_sequence) <= 0) {
+            log->dropped++;
+            ESP_LOGW(TAG, "log full, dropping unread sector %lu", (unsigned long) log->tail_sequence);
+        }
+
+        log->tail_sequence++;
+    }
+
+    return ringlog_start_sector_(log, (log->head_index + 1) % log->sectors, log->head_sequence + 1);
+}
+
+ringlog_t* ringlog_open(const char* partition_label, const char* name)
+{
+    const esp_partition_t* partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, partition_label);
+
+    if (partition == NULL) {
+        ESP_LOGE(TAG, "partition %s not found", partition_label);
+        return NULL;
+    }
+
+    if (partition->size / partition->erase_size < 2) {
+        ESP_LOGE(TAG, "partition %s needs at least 2 sectors", partition_label);
+        return NULL;
+    }
+
+    ringlog_t* log = calloc(1, sizeof(ringlog_t));
+
+    if (log == NULL) {
+        ESP_LOGE(TAG, "failed to allocate memory for log");
+        return NULL;
+    }
+
+    log->partition = partition;
+    log->sector_size = partition->erase_size;
+    log->sectors = partition->size / partition->erase_size;
+    strncpy(log->key, name, sizeof(log->key) - 1);
+
+    log->mutex = xSemaphoreCreateMutex();
+
+    if (log->mutex == NULL) {
+        ESP_LOGE(TAG, "failed to create mutex");
+        goto cleanup;
+    }
+
+    if (ringlog_mount_(log) != ESP_OK) {
+        goto cleanup_mutex;
+    }
+
+    ringlog_load_cursor_(log);
+
+    ESP_LOGI(TAG, "%s: %lu sectors in use out of %lu", partition_label, (unsigned long) (log->head_sequence - log->tail_sequence + 1), (unsigned long) log->sectors);
+
+    return log;
+
+cleanup_mutex:
+    vSemaphoreDelete(log->mutex);
+
+cleanup:
+    free(log);
+    return NULL;
+}
+
+esp_err_t ringlog_append(ringlog_t* log, const void* data, size_t length)
+{
+    if (length == 0 || length > RINGLOG_RECORD_MAX_LEN) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // Header and payload go in a single write. Padding is left erased.
+    uint8_t record[sizeof(struct ringlog_record_header) + RINGLOG_RECORD_MAX_LEN];
+    uint32_t size = ringlog_align_(sizeof(struct ringlog_record_header) + length);
+
+    struct ringlog_record_header header = {
+        .length = (uint16_t) length,
+        .reserved = 0xFFFF,
+        .crc = ringlog_record_crc_((uint16_t) length, data),
+    };
+
+    memset(record, 0xFF, size);
+    memcpy(record, &header, sizeof(header));
+    memcpy(record + sizeof(header), data, length);
+
+    esp_err_t rc = ESP_OK;
+    xSemaphoreTake(log->mutex, portMAX_DELAY);
+
+    if (log->write_offset + size > log->sector_size) {
+        rc = ringlog_advance_(log);
+
+        if (rc != ESP_OK) {
+            goto exit;
+        }
+    }
+
+    rc = esp_partition_write(log->partition, ringlog_sector_address_(log, log->head_index) + log->write_offset, record, size);
+
+    if (rc != ESP_OK) {
+        ESP_LOGE(TAG, "failed to write record: %s", esp_err_to_name(rc));
+
+        // What made it to flash is unknown, don't write after it
+        log->write_offset = log->sector_size;
+        goto exit;
+    }
+
+    log->write_offset += size;
+    log->appended++;
+
+exit:
+    xSemaphoreGive(log->mutex);
+    return rc;
+}
+
+esp_err_t ringlog_get_cursor(ringlog_t* log, struct ringlog_cursor* dest)
+{
+    xSemaphoreTake(log->mutex, portMAX_DELAY);
+    *dest = log->committed;
+    xSemaphoreGive(log->mutex);
+
+    return ESP_OK;
+}
+
+esp_err_t ringlog_read(ringlog_t* log, struct ringlog_cursor* cursor, void* dest, size_t* length)
+{
+    uint8_t payload[RINGLOG_RECORD_MAX_LEN];
+    uint16_t payload_length = 0;
+    esp_err_t rc = ESP_ERR_NOT_FOUND;
+
+    xSemaphoreTake(log->mutex, portMAX_DELAY);
+
+    if ((int32_t) (cursor->sequence - log->head_sequence) > 0) {
+        rc = ESP_ERR_INVALID_ARG;
+        goto exit;
+    }
+
+    while (true) {
+        // Records behind the tail were erased to make room, resume at the
+        // oldest remaining one
+        if ((int32_t) (cursor->sequence - log->tail_sequence) < 0) {
+            cursor->sequence = log->tail_sequence;
+            cursor->offset = sizeof(struct ringlog_sector_header);
+        }
+
+        bool is_head = cursor->sequence == log->head_sequence;
+
+        if (is_head && cursor->offset >= log->write_offset) {
+            goto exit;
+        }
+
+        uint32_t next = ringlog_read_record_(log, ringlog_sector_index_(log, cursor->sequence), cursor->offset, payload, &payload_length);
+
+        if (next != 0) {
+            cursor->offset = next;
+            break;
+        }
+
+        // End of the sector's data, or a damaged record. Nothing can be
+        // trusted past it in this sector.
+        if (is_head) {
+            goto exit;
+        }
+
+        cursor->sequence++;
+        cursor->offset = sizeof(struct ringlog_sector_header);
+    }
+
+    if (payload_length > *length) {
+        rc = ESP_ERR_INVALID_SIZE;
+        goto exit;
+    }
+
+    memcpy(dest, payload, payload_length);
+    *length = payload_length;
+    rc = ESP_OK;
+
+exit:
+    xSemaphoreGive(log->mutex);
+    return rc;
+}
+
+esp_err_t ringlog_commit(ringlog_t* log, const struct ringlog_cursor* cursor)
+{
+    xSemaphoreTake(log->mutex, portMAX_DELAY);
+
+    struct ringlog_persisted_cursor persisted = {
+        .epoch = log->epoch,
+        .sequence = cursor->sequence,
+        .offset = cursor->offset,
+    };
+
+    nvs_handle_t nvs;
+    esp_err_t rc = nvs_open("nvs", NVS_READWRITE, &nvs);
+
+    if (rc == ESP_OK) {
+        rc = nvs_set_blob(nvs, log->key, &persisted, sizeof(persisted));
+
+        if (rc == ESP_OK) {
+            rc = nvs_commit(nvs);
+        }
+
+        nvs_close(nvs);
+    }
+
+    if (rc == ESP_OK) {
+        log->committed = *cursor;
+    } else {
+        ESP_LOGE(TAG, "failed to persist cursor: %s", esp_err_to_name(rc));
+    }
+
+    xSemaphoreGive(log->mutex);
+    return rc;
+}
+
+esp_err_t ringlog_get_stats(ringlog_t* log, struct ringlog_stats* dest)
+{
+    xSemaphoreTake(log->mutex, portMAX_DELAY);
+
+    dest->epoch = log->epoch;
+    dest->sectors = log->sectors;
+    dest->appended = log->appended;
+    dest->dropped = log->dropped;
+
+    xSemaphoreGive(log->mutex);
+    return ESP_OK;
+}
\ No newline at end of file
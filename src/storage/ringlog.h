@@ -0,0 +1,57 @@
+#ifndef STORAGE__RINGLOG_H_
+#define STORAGE__RINGLOG_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <esp_err.h>
+
+// Append-only log of small records on a dedicated flash partition, used as a
+// ring: once full, the oldest sector is erased to make room. Sectors are
+// written in turn, so wear is spread evenly over the partition. Records are
+// CRC-framed, and a record torn by a reset is dropped when the log is opened.
+//
+// Readers consume records from a read cursor, which is persisted in NVS only
+// once they commit it, so records read but not committed are read again after
+// a reboot.
+
+typedef struct ringlog ringlog_t;
+
+// Position in the log
+struct ringlog_cursor {
+    uint32_t sequence;
+    uint32_t offset;
+};
+
+struct ringlog_stats {
+    // Random value picked when the log was formatted. Together with a cursor,
+    // identifies a record across reboots.
+    uint32_t epoch;
+
+    uint32_t sectors;
+    uint32_t appended;
+
+    // Sectors erased to make room before all their records were committed
+    uint32_t dropped;
+};
+
+// Open the log on the partition labeled `partition_label`, formatting it if
+// it holds no log. `name` keys the read cursor in NVS, at most 15 characters.
+ringlog_t* ringlog_open(const char* partition_label, const char* name);
+
+esp_err_t ringlog_append(ringlog_t* log, const void* data, size_t length);
+
+// The committed read cursor
+esp_err_t ringlog_get_cursor(ringlog_t* log, struct ringlog_cursor* dest);
+
+// Read the record at `cursor` and advance it past. `length` holds the size of
+// `dest` and receives the record's length. Returns ESP_ERR_NOT_FOUND at the end
+// of the log.
+esp_err_t ringlog_read(ringlog_t* log, struct ringlog_cursor* cursor, void* dest, size_t* length);
+
+// Persist `cursor` as the read cursor, once the records before it are safe
+esp_err_t ringlog_commit(ringlog_t* log, const struct ringlog_cursor* cursor);
+
+esp_err_t ringlog_get_stats(ringlog_t* log, struct ringlog_stats* dest);
+
+#endif // STORAGE__RINGLOG_H_
\ No newline at end of file